@@ -0,0 +1,291 @@
+/**
+ * @file accesslog.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the asynchronous access log defined in accesslog.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Records consist of a fixed header followed by the method and the path,
+ * padded to a multiple of 8 bytes. A record never wraps around the end of a ring:
+ * the remaining bytes are skipped instead, marked by a padding record if the
+ * header fits. The ring positions are accessed with the __atomic builtins of GCC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "accesslog.h"
+
+/**
+ * @brief Interval in which the background thread writes the log, in nanoseconds.
+ */
+#define ACCESS_LOG_FLUSH_INTERVAL (20 * 1000 * 1000)
+
+/**
+ * @brief Time a worker waits for room in its ring before checking again, in nanoseconds.
+ */
+#define ACCESS_LOG_WAIT (100 * 1000)
+
+/**
+ * @brief Size of the buffer the lines are formatted in.
+ */
+#define ACCESS_LOG_OUT_SIZE (256 * 1024)
+
+/**
+ * @brief Maximum length of a formatted line.
+ * @details A path may grow to twice its length by escaping.
+ */
+#define ACCESS_LOG_LINE_MAX (2 * ACCESS_LOG_MAX_PATH + 256)
+
+/**
+ * @brief Header of a record.
+ * @details len is the length of the record including the header and padding.
+ * Padding records have a negative status.
+ */
+typedef struct access_record {
+    uint32_t len;
+    uint16_t method_len;
+    uint16_t path_len;
+    int32_t status;
+    int64_t time;
+    uint64_t bytes;
+    uint64_t duration;
+} access_record_t;
+
+/**
+ * @brief Contains the loop of the background thread.
+ *
+ * @param arg The log.
+ * @return void* NULL.
+ */
+static void *run_flusher(void *arg);
+
+/**
+ * @brief Format all records of all rings and write them.
+ *
+ * @param log Log.
+ */
+static void drain(access_log_t *log);
+
+/**
+ * @brief Format a record as a line in the output buffer.
+ *
+ * @param log Log with at least ACCESS_LOG_LINE_MAX free bytes in its output buffer.
+ * @param rec Header of the record.
+ * @param data Method and path following the header.
+ */
+static void format_record(access_log_t *log, const access_record_t *rec, const char *data);
+
+/**
+ * @brief Format a timestamp as in the log lines.
+ *
+ * @param t Timestamp.
+ * @return const char* Timestamp in ISO 8601 format (UTC), valid until the next call.
+ */
+static const char *format_time(time_t t);
+
+/**
+ * @brief Write the output buffer to the log file and empty it.
+ *
+ * @param log Log.
+ *
+ * @details Write errors cannot be reported anywhere, the lines are discarded.
+ */
+static void flush_out(access_log_t *log);
+
+int access_log_open(access_log_t *log, const char *path, int rings, size_t ring_size, access_log_policy_t policy) {
+    memset(log, 0, sizeof(*log));
+    log->policy = policy;
+    log->fd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(log->fd < 0) {
+        return -1;
+    }
+    int err = 0;
+    if((err = posix_memalign((void **)&log->rings, 64, rings * sizeof(access_ring_t))) != 0) {
+        log->rings = NULL;
+    } else if((log->out = malloc(ACCESS_LOG_OUT_SIZE)) == NULL) {
+        err = errno;
+    } else {
+        memset(log->rings, 0, rings * sizeof(access_ring_t));
+        log->ring_cnt = rings;
+        for(int i = 0; i < rings && err == 0; i++) {
+            log->rings[i].size = ring_size;
+            if((log->rings[i].data = malloc(ring_size)) == NULL) {
+                err = errno;
+            }
+        }
+    }
+    if(err == 0) {
+        err = pthread_create(&log->thread, NULL, run_flusher, log);
+    }
+    if(err != 0) {
+        for(int i = 0; i < log->ring_cnt; i++) {
+            free(log->rings[i].data);
+        }
+        free(log->rings);
+        free(log->out);
+        if(log->fd != STDOUT_FILENO) {
+            close(log->fd);
+        }
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void access_log_write(access_log_t *log, int ring, const char *method, size_t method_len, const char *path,
+        size_t path_len, int status, uint64_t bytes, uint64_t duration) {
+    access_ring_t *r = &log->rings[ring];
+    if(method_len > ACCESS_LOG_MAX_METHOD) {
+        method_len = ACCESS_LOG_MAX_METHOD;
+    }
+    if(path_len > ACCESS_LOG_MAX_PATH) {
+        path_len = ACCESS_LOG_MAX_PATH;
+    }
+    size_t len = (sizeof(access_record_t) + method_len + path_len + 7) & ~(size_t)7;
+    uint64_t tail = r->tail;
+    size_t off = tail & (r->size - 1);
+    size_t skip = r->size - off < len ? r->size - off : 0;
+
+    while(r->size - (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) < skip + len) {
+        if(log->policy == ACCESS_LOG_DROP) {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        struct timespec ts = {0, ACCESS_LOG_WAIT};
+        nanosleep(&ts, NULL);
+    }
+
+    if(skip > 0) {
+        if(skip >= sizeof(access_record_t)) {
+            access_record_t pad = {skip, 0, 0, -1, 0, 0, 0};
+            memcpy(r->data + off, &pad, sizeof(pad));
+        }
+        tail += skip;
+        off = 0;
+    }
+    access_record_t rec = {len, method_len, path_len, status, time(NULL), bytes, duration};
+    memcpy(r->data + off, &rec, sizeof(rec));
+    memcpy(r->data + off + sizeof(rec), method, method_len);
+    memcpy(r->data + off + sizeof(rec) + method_len, path, path_len);
+
+    // Publish the record to the background thread
+    __atomic_store_n(&r->tail, tail + len, __ATOMIC_RELEASE);
+}
+
+void access_log_close(access_log_t *log) {
+    log->stop = 1;
+    pthread_join(log->thread, NULL);
+    for(int i = 0; i < log->ring_cnt; i++) {
+        free(log->rings[i].data);
+    }
+    free(log->rings);
+    free(log->out);
+    if(log->fd != STDOUT_FILENO) {
+        close(log->fd);
+    }
+}
+
+static void *run_flusher(void *arg) {
+    access_log_t *log = arg;
+    while(!log->stop) {
+        struct timespec ts = {0, ACCESS_LOG_FLUSH_INTERVAL};
+        nanosleep(&ts, NULL);
+        drain(log);
+    }
+    // Records written before the workers stopped
+    drain(log);
+    return NULL;
+}
+
+static void drain(access_log_t *log) {
+    for(int i = 0; i < log->ring_cnt; i++) {
+        access_ring_t *r = &log->rings[i];
+        uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        uint64_t head = r->head;
+        while(head < tail) {
+            size_t off = head & (r->size - 1);
+            if(r->size - off < sizeof(access_record_t)) {
+                head += r->size - off;
+                continue;
+            }
+            access_record_t rec;
+            memcpy(&rec, r->data + off, sizeof(rec));
+            if(rec.status >= 0) {
+                if(ACCESS_LOG_OUT_SIZE - log->out_len < ACCESS_LOG_LINE_MAX) {
+                    flush_out(log);
+                }
+                format_record(log, &rec, r->data + off + sizeof(rec));
+            }
+            head += rec.len;
+        }
+        // The records were copied, the worker may overwrite them
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if(dropped != r->reported) {
+            if(ACCESS_LOG_OUT_SIZE - log->out_len < ACCESS_LOG_LINE_MAX) {
+                flush_out(log);
+            }
+            log->out_len += snprintf(log->out + log->out_len, ACCESS_LOG_LINE_MAX,
+                "time=%s msg=\"records dropped\" worker=%d count=%llu\n", format_time(time(NULL)), i,
+                (unsigned long long)(dropped - r->reported));
+            r->reported = dropped;
+        }
+    }
+    flush_out(log);
+}
+
+static void format_record(access_log_t *log, const access_record_t *rec, const char *data) {
+    char *out = log->out + log->out_len;
+    // Requests rejected before their head was parsed have no method
+    int len = snprintf(out, ACCESS_LOG_LINE_MAX, "time=%s method=%.*s path=\"", format_time(rec->time),
+        rec->method_len > 0 ? (int)rec->method_len : 1, rec->method_len > 0 ? data : "-");
+
+    // Escape the path as a logfmt string
+    const char *path = data + rec->method_len;
+    for(size_t i = 0; i < rec->path_len; i++) {
+        char c = path[i];
+        if(c == '"' || c == '\\') {
+            out[len++] = '\\';
+        } else if((unsigned char)c < 0x20 || c == 0x7f) {
+            c = '?';
+        }
+        out[len++] = c;
+    }
+    len += snprintf(out + len, ACCESS_LOG_LINE_MAX - len, "\" status=%d bytes=%llu duration_us=%llu\n",
+        rec->status, (unsigned long long)rec->bytes, (unsigned long long)(rec->duration / 1000));
+    log->out_len += len;
+}
+
+static const char *format_time(time_t t) {
+    // Only used by the background thread
+    static time_t cached = -1;
+    static char buf[32];
+    if(t != cached) {
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        cached = t;
+    }
+    return buf;
+}
+
+static void flush_out(access_log_t *log) {
+    size_t done = 0;
+    while(done < log->out_len) {
+        ssize_t n = write(log->fd, log->out + done, log->out_len - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    log->out_len = 0;
+}
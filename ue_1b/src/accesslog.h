@@ -0,0 +1,117 @@
+/**
+ * @file accesslog.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Asynchronous access log.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Every worker appends binary records (method, path, status, sent bytes
+ * and duration of a request) to a ring buffer of its own. A background thread
+ * periodically takes the records of all rings, formats them as logfmt lines
+ * ("time=... method=GET path=/ status=200 bytes=123 duration_us=45") and writes
+ * them in large batches. Each ring has a single writer and a single reader, which
+ * synchronize through the acquire and release ordering of the ring positions, so
+ * appending takes neither locks nor system calls. If a ring is full, the record is
+ * either dropped and counted or the worker waits until the background thread made
+ * room, depending on the overflow policy. Dropped records are reported by a line
+ * in the log.
+ */
+
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * @brief Maximum number of bytes of a logged request path.
+ * @details Longer paths are truncated.
+ */
+#define ACCESS_LOG_MAX_PATH 1024
+
+/**
+ * @brief Maximum number of bytes of a logged request method.
+ */
+#define ACCESS_LOG_MAX_METHOD 16
+
+/**
+ * @brief Behavior if a ring buffer is full.
+ */
+typedef enum access_log_policy {
+    // Drop the record and count it
+    ACCESS_LOG_DROP = 0,
+
+    // Wait until the record fits
+    ACCESS_LOG_BLOCK
+} access_log_policy_t;
+
+/**
+ * @brief Ring buffer of a worker.
+ * @details head and tail are the total numbers of bytes consumed and appended;
+ * the byte at position pos is stored at data[pos & (size - 1)]. tail and dropped
+ * are only written by the worker, head only by the background thread; they are
+ * placed on separate cache lines.
+ */
+typedef struct access_ring {
+    uint64_t tail;
+    uint64_t dropped;
+    char *data;
+    size_t size;
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t reported;
+} __attribute__((aligned(64))) access_ring_t;
+
+/**
+ * @brief An access log.
+ * @details fd is the file the log is written to, out the buffer the lines are
+ * formatted in. stop is set to terminate the background thread.
+ */
+typedef struct access_log {
+    int fd;
+    access_log_policy_t policy;
+    access_ring_t *rings;
+    int ring_cnt;
+    char *out;
+    size_t out_len;
+    pthread_t thread;
+    volatile int stop;
+} access_log_t;
+
+/**
+ * @brief Open an access log and start its background thread.
+ *
+ * @param log Log which should be initialized.
+ * @param path File the log is appended to, "-" for stdout.
+ * @param rings Number of ring buffers (one per worker).
+ * @param ring_size Size of each ring buffer in bytes, a power of two.
+ * @param policy Behavior if a ring buffer is full.
+ * @return int 0 on success, -1 on errors (errno is set).
+ */
+int access_log_open(access_log_t *log, const char *path, int rings, size_t ring_size, access_log_policy_t policy);
+
+/**
+ * @brief Append a request to the log.
+ *
+ * @param log Log.
+ * @param ring Ring buffer of the calling worker.
+ * @param method Request method.
+ * @param method_len Length of method.
+ * @param path Request path.
+ * @param path_len Length of path.
+ * @param status Status of the response.
+ * @param bytes Number of sent bytes.
+ * @param duration Duration of the request in nanoseconds.
+ *
+ * @details Must only be called by the worker owning the ring.
+ */
+void access_log_write(access_log_t *log, int ring, const char *method, size_t method_len, const char *path,
+        size_t path_len, int status, uint64_t bytes, uint64_t duration);
+
+/**
+ * @brief Stop the background thread, write all remaining records and close the log.
+ *
+ * @param log Log whose workers do not write anymore.
+ */
+void access_log_close(access_log_t *log);
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file archive.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the archive reader defined in archive.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The whole archive is mapped read-only and shared, so all processes
+ * serving it share the page cache. The index is prefetched when the archive is
+ * opened; file contents are only read by the kernel when they are sent.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+
+/**
+ * @brief Check whether a span lies within an archive.
+ *
+ * @param span Span.
+ * @param size Size of the archive.
+ * @return int 1 if the span is valid, 0 otherwise.
+ */
+static int span_valid(const archive_span_t *span, uint64_t size);
+
+/**
+ * @brief Check the header and the index of a mapped archive.
+ *
+ * @param archive Archive with data and size set.
+ * @return int 0 if the archive is valid, -1 otherwise.
+ *
+ * @details Sets entries and entry_cnt.
+ */
+static int check_archive(archive_t *archive);
+
+int archive_open(archive_t *archive, const char *path) {
+    memset(archive, 0, sizeof(*archive));
+    if((archive->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    struct stat st;
+    if(fstat(archive->fd, &st) != 0) {
+        int err = errno;
+        close(archive->fd);
+        errno = err;
+        return -1;
+    }
+    if(!S_ISREG(st.st_mode) || (uint64_t)st.st_size < sizeof(archive_header_t)) {
+        close(archive->fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    archive->size = st.st_size;
+    void *data = mmap(NULL, archive->size, PROT_READ, MAP_SHARED, archive->fd, 0);
+    if(data == MAP_FAILED) {
+        int err = errno;
+        close(archive->fd);
+        errno = err;
+        return -1;
+    }
+    archive->data = data;
+    if(check_archive(archive) != 0) {
+        archive_close(archive);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Lookups jump around in the index, the contents are read by sendfile
+    madvise(data, archive->size, MADV_RANDOM);
+    const archive_header_t *header = data;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = header->index.offset / page * page;
+    madvise((char *)data + start, header->index.offset + header->index.len - start, MADV_WILLNEED);
+    return 0;
+}
+
+void archive_close(archive_t *archive) {
+    if(archive->data != NULL) {
+        munmap((void *)archive->data, archive->size);
+    }
+    if(archive->fd >= 0) {
+        close(archive->fd);
+    }
+    memset(archive, 0, sizeof(*archive));
+    archive->fd = -1;
+}
+
+const archive_entry_t *archive_find(const archive_t *archive, const char *path, size_t len) {
+    size_t low = 0, high = archive->entry_cnt;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        const archive_entry_t *entry = &archive->entries[mid];
+        int cmp = archive_path_cmp(archive->data + entry->path.offset, entry->path.len, path, len);
+        if(cmp == 0) {
+            return entry;
+        }
+        if(cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+int archive_path_cmp(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if(cmp != 0) {
+        return cmp;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int span_valid(const archive_span_t *span, uint64_t size) {
+    return span->offset <= size && span->len <= size - span->offset;
+}
+
+static int check_archive(archive_t *archive) {
+    const archive_header_t *header = (const archive_header_t *)archive->data;
+    if(memcmp(header->magic, ARCHIVE_MAGIC, sizeof(header->magic)) != 0 || header->version != ARCHIVE_VERSION
+            || header->order != 0x01020304 || header->size != archive->size
+            || !span_valid(&header->index, archive->size) || header->index.offset % 8 != 0
+            || header->index.len / sizeof(archive_entry_t) != header->entry_cnt
+            || header->index.len % sizeof(archive_entry_t) != 0) {
+        return -1;
+    }
+    archive->entries = (const archive_entry_t *)(archive->data + header->index.offset);
+    archive->entry_cnt = header->entry_cnt;
+
+    for(size_t i = 0; i < archive->entry_cnt; i++) {
+        const archive_entry_t *entry = &archive->entries[i];
+        if(!span_valid(&entry->path, archive->size) || !span_valid(&entry->mime, archive->size)
+                || !span_valid(&entry->etag, archive->size) || entry->mime.len > ARCHIVE_FIELD_MAX
+                || entry->etag.len > ARCHIVE_FIELD_MAX || !(entry->variant_mask & (1 << ARCHIVE_IDENTITY))) {
+            return -1;
+        }
+        for(int j = 0; j < ARCHIVE_VARIANTS; j++) {
+            if(!span_valid(&entry->variants[j], archive->size)) {
+                return -1;
+            }
+        }
+        // Binary search relies on strictly ascending paths
+        if(i > 0 && archive_path_cmp(archive->data + archive->entries[i - 1].path.offset,
+                archive->entries[i - 1].path.len, archive->data + entry->path.offset, entry->path.len) >= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
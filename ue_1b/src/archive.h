@@ -0,0 +1,145 @@
+/**
+ * @file archive.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Packed document root archives.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details An archive holds the files of a document root in a single file: a
+ * header, the contents of the files and their precompressed variants, the strings
+ * of the index and the index itself, an array of entries sorted by path. Each
+ * entry records the media type, the entity tag and the modification time of its
+ * file and the location of each stored variant, so serving a file needs neither
+ * a stat nor an open. Archives are created by the pack program and mapped into
+ * memory by the server; all locations are checked when an archive is opened, so
+ * a damaged archive is rejected instead of being read out of bounds. Numbers are
+ * stored in host byte order, an archive is only valid on machines with the byte
+ * order it was created on.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Magic number at the start of an archive.
+ */
+#define ARCHIVE_MAGIC "OSUEPACK"
+
+/**
+ * @brief Version of the archive format.
+ */
+#define ARCHIVE_VERSION 1
+
+/**
+ * @brief Maximum length of the media type and of the entity tag of an entry.
+ */
+#define ARCHIVE_FIELD_MAX 72
+
+/**
+ * @brief Variants of a file.
+ * @details Index into the variants of an entry.
+ */
+typedef enum archive_variant {
+    ARCHIVE_IDENTITY, // The file itself
+    ARCHIVE_GZIP,     // Compressed with gzip
+    ARCHIVE_BR,       // Compressed with brotli
+    ARCHIVE_ZSTD,     // Compressed with zstd
+    ARCHIVE_VARIANTS
+} archive_variant_t;
+
+/**
+ * @brief Location of data in an archive.
+ * @details offset is relative to the start of the archive.
+ */
+typedef struct archive_span {
+    uint64_t offset;
+    uint64_t len;
+} archive_span_t;
+
+/**
+ * @brief Header at the start of an archive.
+ * @details order holds 0x01020304 in the byte order of the machine which created
+ * the archive. size is the size of the whole archive, index the location of the
+ * entries (entry_cnt * sizeof(archive_entry_t) bytes, aligned to 8 bytes).
+ */
+typedef struct archive_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint64_t size;
+    archive_span_t index;
+    uint64_t entry_cnt;
+} archive_header_t;
+
+/**
+ * @brief An entry of the index.
+ * @details path is relative to the document root, without a leading slash. etag
+ * is the quoted entity tag of the file. Bit i of variant_mask is set if variant i
+ * is stored; its Content-Length is the length of its span. Variants may share
+ * their data with other entries (e.g. the gzip variant of a.css with the entry of
+ * a.css.gz).
+ */
+typedef struct archive_entry {
+    archive_span_t path;
+    archive_span_t mime;
+    archive_span_t etag;
+    archive_span_t variants[ARCHIVE_VARIANTS];
+    int64_t mtime;
+    uint32_t variant_mask;
+    uint32_t reserved;
+} archive_entry_t;
+
+/**
+ * @brief An opened archive.
+ * @details fd is the archive file, data its mapping of size bytes and entries
+ * the index inside the mapping.
+ */
+typedef struct archive {
+    int fd;
+    const char *data;
+    size_t size;
+    const archive_entry_t *entries;
+    size_t entry_cnt;
+} archive_t;
+
+/**
+ * @brief Open and map an archive.
+ *
+ * @param archive Archive which should be initialized.
+ * @param path Path of the archive file.
+ * @return int 0 on success, -1 on errors (errno is set, EINVAL if the file is not
+ * a valid archive).
+ */
+int archive_open(archive_t *archive, const char *path);
+
+/**
+ * @brief Unmap and close an archive.
+ *
+ * @param archive Archive.
+ */
+void archive_close(archive_t *archive);
+
+/**
+ * @brief Find the entry of a path.
+ *
+ * @param archive Archive.
+ * @param path Path relative to the document root.
+ * @param len Length of path.
+ * @return const archive_entry_t* Entry, or NULL if the archive has none for path.
+ */
+const archive_entry_t *archive_find(const archive_t *archive, const char *path, size_t len);
+
+/**
+ * @brief Compare two paths in the order of the index.
+ *
+ * @param a First path.
+ * @param a_len Length of a.
+ * @param b Second path.
+ * @param b_len Length of b.
+ * @return int Negative, zero or positive if a sorts before, equal to or after b.
+ */
+int archive_path_cmp(const char *a, size_t a_len, const char *b, size_t b_len);
+
+#endif
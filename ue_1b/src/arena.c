@@ -0,0 +1,162 @@
+/**
+ * @file arena.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the arena allocator defined in arena.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The arena struct itself is stored at the start of the first chunk, so
+ * getting a new arena from the system costs a single malloc call. Further chunks
+ * are allocated on demand with at least twice the size of the previous chunk.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "arena.h"
+
+/**
+ * @brief Round a size up to the arena alignment.
+ */
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+/**
+ * @brief Offset of the first allocation within the first chunk.
+ * @details The first chunk starts with the arena struct.
+ */
+#define ARENA_HEADER ALIGN_UP(sizeof(arena_t))
+
+/**
+ * @brief Allocate a new chunk.
+ *
+ * @param size Number of usable bytes of the chunk.
+ * @return arena_chunk_t* The chunk or NULL if malloc failed.
+ */
+static arena_chunk_t *new_chunk(size_t size);
+
+void arena_pool_init(arena_pool_t *pool, size_t chunk_size, size_t limit, size_t max_free) {
+    pool->free = NULL;
+    pool->free_len = 0;
+    pool->max_free = max_free;
+    pool->chunk_size = ALIGN_UP(chunk_size);
+    pool->limit = limit < pool->chunk_size ? pool->chunk_size : limit;
+}
+
+void arena_pool_destroy(arena_pool_t *pool) {
+    while(pool->free != NULL) {
+        arena_t *arena = pool->free;
+        pool->free = arena->next_free;
+        // The arena struct lives in its first chunk, free it last
+        arena_chunk_t *chunk = arena->first->next;
+        while(chunk != NULL) {
+            arena_chunk_t *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        free(arena->first);
+    }
+    pool->free_len = 0;
+}
+
+arena_t *arena_get(arena_pool_t *pool) {
+    if(pool->free != NULL) {
+        arena_t *arena = pool->free;
+        pool->free = arena->next_free;
+        pool->free_len--;
+        arena->next_free = NULL;
+        return arena;
+    }
+
+    arena_chunk_t *chunk = new_chunk(pool->chunk_size);
+    if(chunk == NULL) {
+        return NULL;
+    }
+    arena_t *arena = (arena_t *)chunk->data;
+    arena->first = arena->cur = chunk;
+    arena->used = ARENA_HEADER;
+    arena->capacity = chunk->size;
+    arena->limit = pool->limit;
+    arena->next_free = NULL;
+    return arena;
+}
+
+void arena_put(arena_pool_t *pool, arena_t *arena) {
+    if(arena == NULL) {
+        return;
+    }
+
+    arena_chunk_t *chunk = arena->first->next;
+    while(chunk != NULL) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->first->next = NULL;
+    arena->capacity = arena->first->size;
+    arena_reset(arena);
+
+    if(pool->free_len >= pool->max_free) {
+        free(arena->first);
+        return;
+    }
+    arena->next_free = pool->free;
+    pool->free = arena;
+    pool->free_len++;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = ALIGN_UP(size);
+    while(arena->cur->size - arena->used < size) {
+        if(arena->cur->next == NULL) {
+            size_t chunk_size = arena->cur->size * 2;
+            if(chunk_size < size) {
+                chunk_size = ALIGN_UP(size);
+            }
+            if(arena->capacity + chunk_size > arena->limit) {
+                chunk_size = arena->limit - arena->capacity;
+                if(chunk_size < size || arena->capacity >= arena->limit) {
+                    errno = ENOMEM;
+                    return NULL;
+                }
+            }
+            arena_chunk_t *chunk = new_chunk(chunk_size);
+            if(chunk == NULL) {
+                return NULL;
+            }
+            arena->cur->next = chunk;
+            arena->capacity += chunk->size;
+        }
+        arena->cur = arena->cur->next;
+        arena->used = 0;
+    }
+
+    void *ptr = arena->cur->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if(copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    arena->cur = arena->first;
+    arena->used = ARENA_HEADER;
+}
+
+static arena_chunk_t *new_chunk(size_t size) {
+    // Chunk data starts after the chunk header, keep it aligned
+    arena_chunk_t *chunk = malloc(ALIGN_UP(sizeof(arena_chunk_t)) + size);
+    if(chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file arena.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Bump allocator for request scoped memory.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details An arena hands out memory by advancing a pointer through a list of
+ * chunks. Individual allocations are never freed; instead the whole arena is
+ * reset in constant time once the request they belong to is finished. The chunks
+ * are kept across resets, so a connection which serves several requests only
+ * allocates memory from the system for its first request. Arenas are handed out
+ * by a pool, which keeps released arenas for reuse by following connections.
+ * The total capacity of an arena is limited, allocations beyond that limit fail.
+ * Arenas and pools are not thread safe; each thread should use its own pool.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Alignment of all arena allocations.
+ */
+#define ARENA_ALIGN 16
+
+/**
+ * @brief A chunk of arena memory.
+ * @details Chunks form a singly linked list, data contains size bytes.
+ */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    char data[];
+} arena_chunk_t;
+
+/**
+ * @brief A bump allocator.
+ * @details Allocations are served from cur, starting at offset used. Chunks
+ * following cur are unused (either new or retained from before the last reset).
+ * capacity is the sum of the sizes of all chunks and never exceeds limit.
+ */
+typedef struct arena {
+    arena_chunk_t *first;
+    arena_chunk_t *cur;
+    size_t used;
+    size_t capacity;
+    size_t limit;
+    struct arena *next_free;
+} arena_t;
+
+/**
+ * @brief A pool of arenas.
+ * @details Released arenas are kept on a free list (up to max_free arenas) and
+ * handed out again by arena_get. chunk_size is the size of the first chunk of
+ * each arena and the minimum size of further chunks, limit the maximum capacity
+ * of an arena.
+ */
+typedef struct arena_pool {
+    arena_t *free;
+    size_t free_len;
+    size_t max_free;
+    size_t chunk_size;
+    size_t limit;
+} arena_pool_t;
+
+/**
+ * @brief Initialize an arena pool.
+ *
+ * @param pool Pool which should be initialized.
+ * @param chunk_size Size of the first chunk of each arena.
+ * @param limit Maximum capacity of each arena.
+ * @param max_free Maximum number of released arenas kept for reuse.
+ */
+void arena_pool_init(arena_pool_t *pool, size_t chunk_size, size_t limit, size_t max_free);
+
+/**
+ * @brief Free all arenas kept by a pool.
+ *
+ * @param pool Pool which should be destroyed.
+ *
+ * @details Arenas which are still in use are not affected and must be freed
+ * with arena_put before the pool is destroyed.
+ */
+void arena_pool_destroy(arena_pool_t *pool);
+
+/**
+ * @brief Get an empty arena from a pool.
+ *
+ * @param pool Pool the arena should be taken from.
+ * @return arena_t* An empty arena, or NULL if memory allocation failed (errno is set).
+ */
+arena_t *arena_get(arena_pool_t *pool);
+
+/**
+ * @brief Return an arena to its pool.
+ *
+ * @param pool Pool the arena was taken from.
+ * @param arena Arena which should be released, may be NULL.
+ *
+ * @details The arena is reset and shrunk to its first chunk, so memory of
+ * unusually large requests is not retained. If the pool already holds max_free
+ * arenas, the arena is freed.
+ */
+void arena_put(arena_pool_t *pool, arena_t *arena);
+
+/**
+ * @brief Allocate memory from an arena.
+ *
+ * @param arena Arena the memory should be allocated from.
+ * @param size Number of bytes.
+ * @return void* Pointer to ARENA_ALIGN aligned memory, or NULL if the limit of the
+ * arena would be exceeded or memory allocation failed.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Copy a string to an arena.
+ *
+ * @param arena Arena the copy should be allocated from.
+ * @param str String which should be copied.
+ * @param len Number of characters to copy.
+ * @return char* Null terminated copy of the first len characters of str, or NULL
+ * if the allocation failed.
+ */
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/**
+ * @brief Release all allocations of an arena.
+ *
+ * @param arena Arena which should be reset.
+ *
+ * @details Runs in constant time, all chunks are retained for future allocations.
+ */
+void arena_reset(arena_t *arena);
+
+#endif
@@ -0,0 +1,658 @@
+/**
+ * @file bench.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Http load generator for measuring the throughput and latency of the server.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Opens a number of concurrent connections to a server and keeps each of
+ * them busy with GET requests for a single URL, optionally pipelining several
+ * requests per connection. Connections are reused as long as the server keeps them
+ * alive and reopened otherwise. The program runs for a fixed duration or number
+ * of requests and reports the request and byte rates together with the latency
+ * percentiles, measured from queueing a request until its response was received
+ * completely. URLs are parsed with the fetch module, response heads with the
+ * incremental parser and response bodies are discarded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utils.h"
+#include "fetch.h"
+#include "http.h"
+#include "hist.h"
+
+/**
+ * @brief Default number of concurrent connections.
+ */
+#define BENCH_CONNECTIONS 1
+
+/**
+ * @brief Default duration of a run in seconds.
+ */
+#define BENCH_DURATION 10
+
+/**
+ * @brief Maximum number of pipelined requests per connection.
+ */
+#define BENCH_MAX_DEPTH 64
+
+/**
+ * @brief Size of the receive buffer of a connection.
+ */
+#define BENCH_BUF_SIZE (64 * 1024)
+
+/**
+ * @brief Number of times a connection may be reopened without receiving a response.
+ */
+#define BENCH_MAX_FAILURES 3
+
+/**
+ * @brief A benchmark connection.
+ * @details in_flight is the number of issued requests whose response was not
+ * received completely yet, queued the number of those which were not sent
+ * completely (the last ones), with sent bytes of the first of them already sent.
+ * start holds the times the in-flight requests were issued as a ring starting at
+ * head. After a response head was parsed, in_body is set and remaining is the
+ * number of body bytes still to be received (-1 for bodies delimited by the end of
+ * the connection) unless the body is chunked. failures counts the times the
+ * connection was reopened since the last response.
+ */
+typedef struct bench_conn {
+    int fd;
+    int connecting;
+    int in_flight;
+    int queued;
+    size_t sent;
+    int head;
+    uint64_t start[BENCH_MAX_DEPTH];
+    int failures;
+
+    char buf[BENCH_BUF_SIZE];
+    size_t len;
+    http_parser_t parser;
+    int in_body;
+    int64_t remaining;
+    int chunked;
+    http_chunked_t dec;
+    int keep_alive;
+} bench_conn_t;
+
+/**
+ * @brief Results of a run.
+ * @details status counts the responses by status class (index status / 100),
+ * errors the connections lost while receiving a response or with an invalid
+ * response and reconnects all reopened connections. bytes is the number of
+ * received bytes, including response heads.
+ */
+typedef struct bench_stats {
+    uint64_t responses;
+    uint64_t status[6];
+    uint64_t errors;
+    uint64_t reconnects;
+    uint64_t bytes;
+    hist_t latency;
+} bench_stats_t;
+
+/**
+ * @brief Program name.
+ * @details Name of the executable used for usage and error messages.
+ */
+static char *progname;
+
+/**
+ * @brief Server port.
+ * Port number of the server for URLs without port (-p cli argument)
+ */
+static char *port = "http";
+
+/**
+ * @brief Number of concurrent connections (-c cli argument).
+ */
+static int connections_opt = BENCH_CONNECTIONS;
+
+/**
+ * @brief Number of pipelined requests per connection (-d cli argument).
+ */
+static int depth_opt = 1;
+
+/**
+ * @brief Duration of the run in seconds (-t cli argument), -1 if not given.
+ */
+static long duration_opt = -1;
+
+/**
+ * @brief Number of requests of the run (-n cli argument), -1 if not given.
+ */
+static long long requests_opt = -1;
+
+/**
+ * @brief Address of the server.
+ */
+static struct addrinfo *server_addr;
+
+/**
+ * @brief depth_opt copies of the serialized request.
+ * @details Consecutive pipelined requests are sent in one piece from this buffer.
+ */
+static char *pipeline;
+
+/**
+ * @brief Length of a single serialized request.
+ */
+static size_t request_len;
+
+/**
+ * @brief Epoll instance of all connections.
+ */
+static int epoll_fd;
+
+/**
+ * @brief Number of issued requests.
+ */
+static long long issued;
+
+/**
+ * @brief Print the usage message and exit with EXIT_FAILURE.
+ */
+static void usage(void);
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return uint64_t Current time in nanoseconds.
+ */
+static uint64_t now_ns(void);
+
+/**
+ * @brief Format a duration for the report.
+ *
+ * @param buf Buffer of at least 32 characters.
+ * @param ns Duration in nanoseconds.
+ * @return char* buf.
+ */
+static char *format_ns(char *buf, uint64_t ns);
+
+/**
+ * @brief Connect a connection to the server.
+ *
+ * @param conn Connection without socket.
+ * @return int 0 if connecting started, -1 otherwise (errno is set).
+ */
+static int conn_open(bench_conn_t *conn);
+
+/**
+ * @brief Replace the socket of a connection with a new one.
+ *
+ * @param conn Connection.
+ * @param stats Results.
+ * @return int 0 on success, -1 if the server cannot be reached (an error
+ * message was printed).
+ *
+ * @details All requests without complete response are sent again on the new
+ * socket.
+ */
+static int conn_reopen(bench_conn_t *conn, bench_stats_t *stats);
+
+/**
+ * @brief Issue new requests up to the pipelining depth and send the queued ones.
+ *
+ * @param conn Connected connection.
+ * @return int 0 on success, -1 if the connection failed.
+ */
+static int conn_send(bench_conn_t *conn);
+
+/**
+ * @brief Receive and process responses.
+ *
+ * @param conn Connected connection.
+ * @param stats Results.
+ * @return int 0 if the connection can be used further, 1 if it must be reopened
+ * and -1 if it failed.
+ */
+static int conn_recv(bench_conn_t *conn, bench_stats_t *stats);
+
+/**
+ * @brief Process the buffered bytes of a connection.
+ *
+ * @param conn Connection.
+ * @param stats Results.
+ * @param eof Whether the server closed the connection.
+ * @return int 0 if more data is needed, 1 if the connection must be reopened
+ * and -1 if the response is invalid.
+ */
+static int conn_process(bench_conn_t *conn, bench_stats_t *stats, int eof);
+
+/**
+ * @brief Prepare the body of the response whose head was parsed.
+ *
+ * @param conn Connection.
+ * @return int 0 on success, -1 if the head is invalid.
+ */
+static int conn_head(bench_conn_t *conn);
+
+/**
+ * @brief Check whether the budget of the run allows another request.
+ *
+ * @return int 1 if another request may be issued, 0 otherwise.
+ */
+static int may_issue(void);
+
+/**
+ * @brief Print the results of a run.
+ *
+ * @param stats Results.
+ * @param elapsed Duration of the run in nanoseconds.
+ */
+static void report(const bench_stats_t *stats, uint64_t elapsed);
+
+/**
+ * @brief Program entry point.
+ * @details Parses the arguments, prepares the request, opens the connections and
+ * drives them with epoll until the run is over.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return int Exit code of the program.
+ */
+int main(int argc, char **argv) {
+    progname = argv[0];
+
+    int c;
+    while((c = getopt(argc, argv, "p:c:d:t:n:")) != -1) {
+        switch(c) {
+        case 'p':
+            port = optarg;
+            break;
+        case 'c':
+            connections_opt = strtol(optarg, NULL, 10);
+            if(connections_opt <= 0) {
+                usage();
+            }
+            break;
+        case 'd':
+            depth_opt = strtol(optarg, NULL, 10);
+            if(depth_opt <= 0 || depth_opt > BENCH_MAX_DEPTH) {
+                usage();
+            }
+            break;
+        case 't':
+            duration_opt = strtol(optarg, NULL, 10);
+            if(duration_opt <= 0) {
+                usage();
+            }
+            break;
+        case 'n':
+            requests_opt = strtoll(optarg, NULL, 10);
+            if(requests_opt <= 0) {
+                usage();
+            }
+            break;
+        case '?':
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if(argc != 1 || (duration_opt > 0 && requests_opt > 0)) {
+        usage();
+    }
+    if(requests_opt < 0 && duration_opt < 0) {
+        duration_opt = BENCH_DURATION;
+    }
+
+    fetch_req_t req;
+    int ret = fetch_req_init(&req, argv[0]);
+    if(ret != FETCH_SUCCESS) {
+        if(ret == FETCH_ERR_URL) {
+            ERRPRINTF("'%s' is not a valid url\n", argv[0]);
+        } else {
+            ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        }
+        fetch_req_free(&req);
+        exit(EXIT_FAILURE);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if((ret = getaddrinfo(req.host, req.port != NULL ? req.port : port, &hints, &server_addr)) != 0) {
+        ERRPRINTF("getaddrinfo failed: %s\n", gai_strerror(ret));
+        fetch_req_free(&req);
+        exit(EXIT_FAILURE);
+    }
+
+    // Serialize the request once, ports other than the default belong into the Host field
+    char request[HTTP_MAX_HEAD];
+    int len = snprintf(request, sizeof(request), "GET %s " HTTP_VERSION "\r\nHost: %s%s%s\r\n\r\n", req.path,
+        req.host, req.port != NULL ? ":" : "", req.port != NULL ? req.port : "");
+    fetch_req_free(&req);
+    if(len < 0 || (size_t)len >= sizeof(request)) {
+        ERRPRINTF("'%s' is not a valid url\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    request_len = len;
+    if((pipeline = malloc(request_len * depth_opt)) == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < depth_opt; i++) {
+        memcpy(pipeline + i * request_len, request, request_len);
+    }
+
+    bench_stats_t *stats = malloc(sizeof(bench_stats_t));
+    bench_conn_t *conns = calloc(connections_opt, sizeof(bench_conn_t));
+    struct epoll_event *events = calloc(connections_opt, sizeof(struct epoll_event));
+    if(stats == NULL || conns == NULL || events == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset(stats, 0, sizeof(*stats));
+    hist_init(&stats->latency);
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        ERRPRINTF("epoll_create1 failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = now_ns();
+    uint64_t deadline = duration_opt > 0 ? start + duration_opt * (uint64_t)1000000000 : 0;
+    for(int i = 0; i < connections_opt; i++) {
+        conns[i].fd = -1;
+        if(conn_open(&conns[i]) != 0) {
+            ERRPRINTF("connecting failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint64_t now = start;
+    while(requests_opt > 0 ? stats->responses < (uint64_t)requests_opt : now < deadline) {
+        int timeout = 100;
+        if(deadline > 0 && (deadline - now) / 1000000 < (uint64_t)timeout) {
+            timeout = (deadline - now) / 1000000 + 1;
+        }
+        int ready = epoll_wait(epoll_fd, events, connections_opt, timeout);
+        if(ready < 0 && errno != EINTR) {
+            ERRPRINTF("epoll_wait failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for(int i = 0; i < ready; i++) {
+            bench_conn_t *conn = events[i].data.ptr;
+            if(conn->connecting) {
+                int err = 0;
+                socklen_t err_len = sizeof(err);
+                if(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0) {
+                    err = errno;
+                }
+                if(err == EINPROGRESS) {
+                    continue;
+                }
+                if(err != 0) {
+                    ERRPRINTF("connecting failed: %s\n", strerror(err));
+                    exit(EXIT_FAILURE);
+                }
+                conn->connecting = 0;
+            }
+
+            // Receive first, answered requests make room for new ones
+            ret = 0;
+            if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                ret = conn_recv(conn, stats);
+            }
+            if(ret == 0) {
+                ret = conn_send(conn) == 0 ? 0 : -1;
+            }
+            if(ret != 0) {
+                if(ret < 0 && conn->in_flight > conn->queued) {
+                    stats->errors++;
+                }
+                if(conn_reopen(conn, stats) != 0) {
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        now = now_ns();
+    }
+
+    report(stats, now_ns() - start);
+    exit(EXIT_SUCCESS);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [-p PORT] [-c CONNECTIONS] [-d DEPTH] [-t SECONDS | -n REQUESTS] URL\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+static char *format_ns(char *buf, uint64_t ns) {
+    if(ns < 1000) {
+        snprintf(buf, 32, "%llu ns", (unsigned long long)ns);
+    } else if(ns < 1000000) {
+        snprintf(buf, 32, "%.1f us", ns / 1e3);
+    } else if(ns < 1000000000) {
+        snprintf(buf, 32, "%.2f ms", ns / 1e6);
+    } else {
+        snprintf(buf, 32, "%.2f s", ns / 1e9);
+    }
+    return buf;
+}
+
+static int conn_open(bench_conn_t *conn) {
+    conn->fd = socket(server_addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(conn->fd < 0) {
+        return -1;
+    }
+    // Pipelined requests are small, they should not wait for each other
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->connecting = 0;
+    if(connect(conn->fd, server_addr->ai_addr, server_addr->ai_addrlen) != 0) {
+        if(errno != EINPROGRESS) {
+            return -1;
+        }
+        conn->connecting = 1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = conn;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) != 0) {
+        return -1;
+    }
+    conn->len = 0;
+    conn->in_body = 0;
+    http_parser_init(&conn->parser, HTTP_PARSE_RESPONSE);
+    conn->queued = conn->in_flight;
+    conn->sent = 0;
+    return 0;
+}
+
+static int conn_reopen(bench_conn_t *conn, bench_stats_t *stats) {
+    close(conn->fd);
+    conn->fd = -1;
+    stats->reconnects++;
+    if(++conn->failures > BENCH_MAX_FAILURES) {
+        ERRPUTS("the server keeps closing connections without responding\n");
+        return -1;
+    }
+    if(conn_open(conn) != 0) {
+        ERRPRINTF("connecting failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int conn_send(bench_conn_t *conn) {
+    if(conn->connecting) {
+        return 0;
+    }
+    uint64_t now = now_ns();
+    while(conn->in_flight < depth_opt && may_issue()) {
+        conn->start[(conn->head + conn->in_flight) % BENCH_MAX_DEPTH] = now;
+        conn->in_flight++;
+        conn->queued++;
+        issued++;
+    }
+
+    // The queued requests are contiguous in the pipeline buffer
+    while(conn->queued > 0) {
+        ssize_t n = send(conn->fd, pipeline + conn->sent, conn->queued * request_len - conn->sent, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        size_t total = conn->sent + n;
+        conn->queued -= total / request_len;
+        conn->sent = total % request_len;
+    }
+    return 0;
+}
+
+static int conn_recv(bench_conn_t *conn, bench_stats_t *stats) {
+    while(1) {
+        ssize_t n = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        conn->len += n;
+        stats->bytes += n;
+        int ret = conn_process(conn, stats, n == 0);
+        if(ret != 0) {
+            return ret;
+        }
+        if(n == 0) {
+            // Closed between responses (e.g. the keep-alive timeout expired)
+            return conn->len > 0 || conn->in_body ? -1 : 1;
+        }
+    }
+}
+
+static int conn_process(bench_conn_t *conn, bench_stats_t *stats, int eof) {
+    while(1) {
+        if(!conn->in_body) {
+            if(conn->len == 0) {
+                return 0;
+            }
+            // Only requests which were sent completely can be answered
+            if(conn->in_flight == conn->queued) {
+                return -1;
+            }
+            int ret = http_parse(&conn->parser, conn->buf, conn->len);
+            if(ret == HTTP_PARSE_AGAIN) {
+                return eof ? -1 : 0;
+            }
+            if(ret != HTTP_PARSE_DONE || conn_head(conn) != 0) {
+                return -1;
+            }
+        }
+
+        size_t data_len = conn->len, used = conn->len;
+        int done = 0;
+        if(conn->chunked) {
+            int ret = http_chunked_decode(&conn->dec, conn->buf, conn->len, &data_len, &used);
+            if(ret == HTTP_PARSE_ERROR) {
+                return -1;
+            }
+            done = ret == HTTP_PARSE_DONE;
+        } else if(conn->remaining >= 0) {
+            if((int64_t)used > conn->remaining) {
+                used = conn->remaining;
+            }
+            conn->remaining -= used;
+            done = conn->remaining == 0;
+        } else {
+            done = eof;
+        }
+        conn->len -= used;
+        memmove(conn->buf, conn->buf + used, conn->len);
+        if(!done) {
+            return eof ? -1 : 0;
+        }
+
+        // Response complete
+        stats->responses++;
+        stats->status[conn->parser.status / 100 <= 5 ? conn->parser.status / 100 : 0]++;
+        hist_record(&stats->latency, now_ns() - conn->start[conn->head]);
+        conn->head = (conn->head + 1) % BENCH_MAX_DEPTH;
+        conn->in_flight--;
+        conn->in_body = 0;
+        conn->failures = 0;
+        http_parser_init(&conn->parser, HTTP_PARSE_RESPONSE);
+        if(!conn->keep_alive) {
+            return 1;
+        }
+    }
+}
+
+static int conn_head(bench_conn_t *conn) {
+    http_parser_t *res = &conn->parser;
+    conn->chunked = http_is_chunked(res->headers.known[HTTP_HDR_TRANSFER_ENCODING]);
+    conn->remaining = -1;
+    http_slice_t content_len = res->headers.known[HTTP_HDR_CONTENT_LENGTH];
+    if(res->status / 100 == 1 || res->status == 204 || res->status == 304) {
+        conn->remaining = 0;
+    } else if(conn->chunked) {
+        http_chunked_init(&conn->dec);
+    } else if(content_len.ptr != NULL) {
+        char *end;
+        conn->remaining = strtoll(content_len.ptr, &end, 10);
+        if(conn->remaining < 0 || end != content_len.ptr + content_len.len) {
+            return -1;
+        }
+    }
+    http_slice_t conn_hdr = res->headers.known[HTTP_HDR_CONNECTION];
+    conn->keep_alive = (conn->chunked || conn->remaining >= 0)
+        && !(conn_hdr.ptr != NULL && http_slice_eq(conn_hdr, "close"));
+
+    conn->len -= res->head_len;
+    memmove(conn->buf, conn->buf + res->head_len, conn->len);
+    conn->in_body = 1;
+    return 0;
+}
+
+static int may_issue(void) {
+    return requests_opt < 0 || issued < requests_opt;
+}
+
+static void report(const bench_stats_t *stats, uint64_t elapsed) {
+    double secs = elapsed / 1e9;
+    char mean[32], p50[32], p99[32], p999[32], max[32];
+    printf("%d connections, pipelining depth %d\n", connections_opt, depth_opt);
+    printf("%llu requests in %.2f s, %.2f MiB read\n", (unsigned long long)stats->responses, secs,
+        stats->bytes / (1024.0 * 1024.0));
+    printf("Requests/s: %.1f\n", stats->responses / secs);
+    printf("Transfer/s: %.2f MiB\n", stats->bytes / (1024.0 * 1024.0) / secs);
+    printf("Status:     2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+        (unsigned long long)stats->status[2], (unsigned long long)stats->status[3],
+        (unsigned long long)stats->status[4], (unsigned long long)stats->status[5],
+        (unsigned long long)(stats->status[0] + stats->status[1]));
+    printf("Errors:     %llu (%llu reconnects)\n", (unsigned long long)stats->errors,
+        (unsigned long long)stats->reconnects);
+    printf("Latency:    mean %s, p50 %s, p99 %s, p99.9 %s, max %s\n",
+        format_ns(mean, stats->latency.count > 0 ? stats->latency.sum / stats->latency.count : 0),
+        format_ns(p50, hist_percentile(&stats->latency, 50.0)),
+        format_ns(p99, hist_percentile(&stats->latency, 99.0)),
+        format_ns(p999, hist_percentile(&stats->latency, 99.9)),
+        format_ns(max, stats->latency.max));
+}
@@ -6,8 +6,10 @@
  * @date 2018-11-07
  * @details Implementation of a very simplified http client which
  * is able to perform GET requests. The code in this module consists
- * mostly of setup code resource management while the specifics on the
- * http protocol are provided by the http module. 
+ * mostly of option handling and output file management, while the requests
+ * are performed by the client library of the fetch module. In batch mode, a list
+ * of URLs is fetched over several concurrent keep-alive connections per host. In
+ * segmented mode, a single large file is fetched as several byte ranges in parallel.
  */
 
 #include <stdio.h>
@@ -16,12 +18,12 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "utils.h"
-#include "http.h"
+#include "fetch.h"
 
 /**
  * @brief Status code for protocol errors.
@@ -37,6 +39,74 @@
  */
 #define EXIT_STATUS_ERR 3
 
+/**
+ * @brief Default number of concurrent connections per host in batch mode.
+ */
+#define BATCH_CONNECTIONS 4
+
+/**
+ * @brief Number of downloaded bytes of a segment after which its progress is saved.
+ */
+#define SEGMENT_SAVE_INTERVAL (1024 * 1024)
+
+/**
+ * @brief Suffix of the file recording the progress of a segmented download.
+ */
+#define SEGMENT_STATE_SUFFIX ".seg"
+
+/**
+ * @brief Counters of fetched URLs.
+ */
+typedef struct batch_stats {
+    int total;
+    int ok;
+    int status_err;
+    int protocol_err;
+    int other_err;
+    int64_t bytes;
+} batch_stats_t;
+
+/**
+ * @brief A URL whose body is stored to a file.
+ * @details The output file is opened once a response with status 200 arrives
+ * (fd is -1 until then and after it was closed, 1 for stdout; opened is set once
+ * it was opened). status_text holds the status text of the response for error
+ * messages. Jobs without counters are not freed when they are done.
+ */
+typedef struct job {
+    fetch_req_t req;
+    char *outfile_path;
+    int fd;
+    int opened;
+    char status_text[64];
+    batch_stats_t *stats;
+} job_t;
+
+/**
+ * @brief A byte range of a segmented download.
+ * @details done is the number of bytes of the range written to the output file,
+ * saved the value of done last recorded in the state file. index is the position
+ * of the segment in the state file.
+ */
+typedef struct segment {
+    fetch_req_t req;
+    int64_t first;
+    int64_t last;
+    int64_t done;
+    int64_t saved;
+    int index;
+} segment_t;
+
+/**
+ * @brief Result of the probing request of a segmented download.
+ * @details size is the size of the file (-1 if unknown), validator its ETag or
+ * Last-Modified value (empty if there is none).
+ */
+typedef struct probe {
+    int64_t size;
+    char validator[128];
+} probe_t;
+
 /**
  * @brief Program name.
  * @details Name of the executable used for usage and error messages.
@@ -63,142 +133,192 @@ static char *outdir_opt = NULL;
  */
 static char *outfile_opt = NULL;
 
-// These are all pointers to allocated memory space -> free needed.
-/**
- * @brief Hostname part of the URL
- * @details Hostname part of the request URL (e.g. "localhost" in 
- * http://localhost/somedir/index.html). 
- * Dynamically allocated memory, needs to be freed!
- */
-static char *hostname = NULL;
-            
 /**
- * @brief File path part of the URL
- * @details File path  part of the request URL (e.g. "/somedir/index.html" in 
- * http://localhost/somedir/index.html).
- * Dynamically allocated memory, needs to be freed!
+ * @brief URL list option argument.
+ * @details File containing the URLs fetched in batch mode, "-" for stdin (the -b
+ * cli argument). NULL if a single URL is fetched.
  */
-static char *file_path = NULL;
+static char *batch_opt = NULL;
 
 /**
- * @brief Server connection.
- * @details Server connection stram.
+ * @brief Number of concurrent connections per host in batch mode (-c cli argument).
  */
-static FILE *sock = NULL;
+static int batch_connections = BATCH_CONNECTIONS;
 
 /**
- * @brief Indicates whether outfile_path needs to be freed.
- * @details if == 1 outfile_path points to dynamically memory which needs to be cleared
- * on program termination.
+ * @brief Number of parallel segments of a single download (-s cli argument).
+ * @details 0 if the file is fetched with a single request.
  */
-static int outfile_path_alloc = 0;
+static int segments_opt = 0;
 
 /**
- * @brief Path to outfile.
- * @details Path where the reponse body should be written to.
+ * @brief State file of a segmented download.
+ * @details -1 if not open.
  */
-static char *outfile_path = NULL;
+static int segment_state_fd = -1;
 
 /**
- * @brief Output stream.
- * Stream for the output file.
+ * @brief Length of the header line of the state file.
  */
-static FILE *out = NULL;
+static size_t segment_state_header;
 
 /**
- * Print usage. 
+ * Print usage.
  * @brief Prints synopsis of the http client program.
- * 
- * @details Prints the usage message of the client on sterr and 
+ *
+ * @details Prints the usage message of the client on sterr and
  * terminates the program with EXIT_FAILURE.
  * Global variables: progname.
  */
 static void usage(void);
 
 /**
- * @brief Establish connection to server.
- * @details Opens a socket connection to the server using the hostname and 
- * port stored in the variables "hostname" and "port". The resulting stdio 
- * stream is stored to the "sock" variable. 
- * Global variables: hostname, port, sock.
+ * @brief Fetch a single URL.
+ *
+ * @param url URL.
+ * @return int Exit status.
+ *
+ * @details The request is sent with "Connection: close". The body is written to
+ * the output file (or stdout if neither -o nor -d is present), which is only
+ * created if the server responds with status 200. If the server responds with an
+ * malformed response, the status is EXIT_PROTOCOL_ERR, for reponse status codes
+ * != 200 it is EXIT_STATUS_ERR.
+ * Global variables: port, outfile_opt, outdir_opt.
+ */
+static int run_single(const char *url);
+
+/**
+ * @brief Compute the output path of a file in an output directory.
+ *
+ * @param dir Output directory.
+ * @param path File path of the URL.
+ * @return char* Dynamically allocated path of the output file, or NULL if malloc failed.
+ *
+ * @details The file name is the last component of path, or "index.html" if path
+ * ends with a slash.
+ */
+static char *dir_out_path(const char *dir, char *path);
+
+/**
+ * @brief Fetch a list of URLs.
+ *
+ * @param urls Stream containing one URL per line.
+ * @return int Exit status: EXIT_SUCCESS if all URLs were fetched with status 200.
+ *
+ * @details Reads all URLs and fetches them with a connection pool of up to
+ * batch_connections connections per host. The body of each URL is written to its
+ * path in the output directory; one line with the status, the body size and the
+ * URL is printed per URL, followed by the aggregate throughput.
+ * Global variables: outdir_opt, port, batch_connections.
+ */
+static int run_batch(FILE *urls);
+
+/**
+ * @brief Create a job for a URL.
+ *
+ * @param url URL.
+ * @param stats Counters updated when the job is done, or NULL.
+ * @param job Pointer where the dynamically allocated job will be stored.
+ * @return fetch_err_t Result of fetch_req_init. The job is created in any case,
+ * writing to stdout until outfile_path is set.
+ */
+static fetch_err_t job_new(const char *url, batch_stats_t *stats, job_t **job);
+
+/**
+ * @brief Free a job, closing its output file.
+ */
+static void job_free(job_t *job);
+
+/**
+ * @brief Head callback of jobs: opens the output file for responses with status 200.
+ */
+static int job_head(fetch_req_t *req, const http_parser_t *res);
+
+/**
+ * @brief Completion callback of jobs.
+ *
+ * @details Closes the output file (removing it if the body is incomplete). Jobs
+ * with counters update them, print their result line and are freed.
  */
-static void connect_to_server(void);
+static void job_done(fetch_req_t *req);
 
 /**
- * @brief Handle error codes returned by functions of the http module.
- * 
- * @param err Error code returned by the function (a values defined in http_err_t).
- * @param cause Description during which operation the error occured, used 
- * for the error message printed to stdout.
- * 
- * @details Handles the given error by printing an appropriate error message and 
- * initiating a sane shutdown of the program with the correponding exit status. 
+ * @brief Download a single URL in parallel segments.
+ *
+ * @param url URL.
+ * @param outfile_path Output file.
+ * @return int Exit status.
+ *
+ * @details Probes the server with a request for the first byte of the file, which
+ * yields the size and validator of the file (or the whole file if the server does
+ * not support ranges). The output file is preallocated and segments_opt byte ranges
+ * are fetched concurrently, each written at its offset. The progress is recorded in
+ * a state file next to the output file; if it exists and matches the size and ETag
+ * (or Last-Modified date) of the file, only the missing bytes are fetched. The
+ * state file is removed once the download is complete.
+ * Global variables: port, segments_opt.
  */
-static void handle_http_err(int err, char *cause);
+static int run_segmented(const char *url, const char *outfile_path);
 
 /**
- * @brief Removes the located at outfile_path.
- * @details Removes the located at outfile_path if != NULL, ignoring a possible ENOENT
- * error (other errors are handled by printing an error message).
- * Global variables: outfile_path.
+ * @brief Head callback of the probing request: records size and validator.
  */
-static void clear_outfile(void);
+static int probe_head(fetch_req_t *req, const http_parser_t *res);
 
 /**
- * Cleanup and terminate.
- * @brief Free allocated memory, close open streams and terminate program with the
- * given status code.
- * 
- * @param status Returns status of the program.
- * 
- * @details Closes open file streams (pointers != NULL) and exits the program using 
- * exit(), returning the given status.
- * Global variables: hostname, file_path, outfile_path, outfile_path_alloc, sock, out.
+ * @brief Load the state file of an interrupted segmented download.
+ *
+ * @param path Path of the state file.
+ * @param size Size of the file.
+ * @param validator ETag or Last-Modified value of the file.
+ * @param cnt Pointer where the number of segments will be stored.
+ * @return segment_t* Dynamically allocated segments, or NULL if there is no state
+ * file or it belongs to a different version of the file.
  */
-static void cleanup_exit(int status);
+static segment_t *load_segments(const char *path, int64_t size, const char *validator, int *cnt);
 
 /**
- * @brief Sends a GET request to the server and handles the response.
- * @details Uses the functions of the http module to send a http GET request
- * to the server and receive the corresponding reply. As required by the exercise
- * description the Host and Connection headers are set in the request. The request 
- * body is written either to a file or to stdout. If the server responds with an 
- * malformed response, the programs exists with EXIT_PROTOCOL_ERR. If a reponse
- * status code != 200 is encountered, the exit code will be EXIT_STATUS_ERR.
- * Global variables: hostname, file_path, sock, outfile_path, out.
+ * @brief Record the progress of a segment in the state file.
+ *
+ * @param seg Segment.
+ * Global variables: segment_state_fd, segment_state_header.
  */
-static void perform_request(void);
+static void save_segment(segment_t *seg);
 
 /**
- * @brief Computes the output file where the request body should be stored.
- * @details Depending on the argument passed to the program, this function either
- * sets outfile_path to NULL (if neither the -o nor the -d option were present) or 
- * to the output file path. outfile_path_alloc is set to 1 if outfile_path points to
- * dynamically allocated memory.
- * Global variables: hostname, file_path, outfile_path, outfile_path_alloc.
+ * @brief Progress callback of segment requests.
+ *
+ * @param req Request of the segment.
+ * @param len Number of bytes written.
+ *
+ * @details Saves the progress every SEGMENT_SAVE_INTERVAL bytes and once the
+ * segment is complete.
  */
-static void extract_out_file(void);
+static void segment_progress(fetch_req_t *req, int64_t len);
 
 /**
- * @brief Main method for the http server. Parses the command line arguments and
- * calls the functions which perform the actual http request.
- * 
+ * @brief Map the result of a request to the exit status of the client.
+ */
+static int exit_status(const fetch_req_t *req);
+
+/**
+ * @brief Main method for the http client. Parses the command line arguments and
+ * calls the functions which perform the actual http requests.
+ *
  * @param argc Argument counter.
  * @param argv Argument vector.
  * @return int Program exit code (EXIT_SUCCESS)
- * 
- * @details Reads the command line arguments via getopt and checks for the correct 
- * number of arguments. If the argument count and provided options are correct, the 
- * subroutines for connecting to the server, performing the request, handling the
- * response and shutting down the program are called. 
+ *
+ * @details Reads the command line arguments via getopt and checks for the correct
+ * number of arguments. If the argument count and provided options are correct, the
+ * function of the selected mode is called and its result is returned as exit status.
  * Global variables: progname, outfile_opt, outdir_opt.
  */
 int main(int argc, char **argv) {
     progname = argv[0];
-    char *url = NULL;
 
     int c;
-    while((c = getopt(argc, argv, "p:o:d:")) != -1) {
+    while((c = getopt(argc, argv, "p:o:d:b:c:s:")) != -1) {
         switch(c) {
         case 'p':
             port = optarg;
@@ -209,6 +329,21 @@ int main(int argc, char **argv) {
         case 'd':
             outdir_opt = optarg;
             break;
+        case 'b':
+            batch_opt = optarg;
+            break;
+        case 'c':
+            batch_connections = strtol(optarg, NULL, 10);
+            if(batch_connections <= 0) {
+                usage();
+            }
+            break;
+        case 's':
+            segments_opt = strtol(optarg, NULL, 10);
+            if(segments_opt <= 0) {
+                usage();
+            }
+            break;
         case '?':
         default:
             usage();
@@ -217,7 +352,21 @@ int main(int argc, char **argv) {
     argc -= optind;
     argv += optind;
 
-    if(argc != 1) { 
+    if(batch_opt != NULL) {
+        if(argc != 0 || outdir_opt == NULL || outfile_opt != NULL) {
+            usage();
+        }
+        FILE *urls = stdin;
+        if(strcmp(batch_opt, "-") != 0 && (urls = fopen(batch_opt, "r")) == NULL) {
+            ERRPRINTF("fopen on %s failed: %s\n", batch_opt, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        int status = run_batch(urls);
+        fclose(urls);
+        exit(status);
+    }
+
+    if(argc != 1) {
         usage();
     }
 
@@ -225,186 +374,521 @@ int main(int argc, char **argv) {
         ERRPUTS("Either the -d or -o argument may be present, but not both them.\n");
         usage();
     }
-
-    url = argv[0];
-    int ret = parse_url(url, &hostname, &file_path);
-    if(ret != 0) {
-        handle_http_err(ret, url);
-        exit(EXIT_FAILURE);
+    if(segments_opt > 0 && outdir_opt == NULL && outfile_opt == NULL) {
+        ERRPUTS("Segmented downloads require the -o or -d argument.\n");
+        usage();
     }
-
-    extract_out_file();
-    
-    connect_to_server();
-    perform_request();
-    
-    cleanup_exit(EXIT_SUCCESS);
+    exit(run_single(argv[0]));
 }
 
 static void usage(void) {
-    fprintf(stderr, "Usage: %s [-p PORT] [ -o FILE | -d DIR ] URL\n", progname);
+    fprintf(stderr, "Usage: %s [-p PORT] [-s SEGMENTS] [ -o FILE | -d DIR ] URL\n"
+        "       %s [-p PORT] [-c CONNECTIONS] -d DIR -b URL_FILE\n", progname, progname);
     exit(EXIT_FAILURE);
 }
 
-static void connect_to_server(void) {
-    struct addrinfo hints, *ai;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    int res = getaddrinfo(hostname, port, &hints, &ai);
-    if(res != 0) {
-        ERRPRINTF("getaddrinfo failed: %s\n", gai_strerror(res));
-        cleanup_exit(EXIT_FAILURE);
+static int run_single(const char *url) {
+    job_t *job;
+    int ret = job_new(url, NULL, &job);
+    if(ret != FETCH_SUCCESS) {
+        if(ret == FETCH_ERR_URL) {
+            ERRPRINTF("'%s' is not a valid url\n", url);
+        } else {
+            ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        }
+        job_free(job);
+        return EXIT_FAILURE;
+    }
+
+    if(outfile_opt != NULL) {
+        job->outfile_path = strdup(outfile_opt);
+    } else if(outdir_opt != NULL) {
+        job->outfile_path = dir_out_path(outdir_opt, job->req.path);
+    }
+    if((outfile_opt != NULL || outdir_opt != NULL) && job->outfile_path == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        job_free(job);
+        return EXIT_FAILURE;
+    }
+    if(segments_opt > 0) {
+        int status = run_segmented(url, job->outfile_path);
+        job_free(job);
+        return status;
+    }
+
+    fetch_pool_t pool;
+    if(fetch_pool_init(&pool, port, 1) != FETCH_SUCCESS) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        job_free(job);
+        return EXIT_FAILURE;
+    }
+    job->req.close = 1;
+    if(fetch_submit(&pool, &job->req) != FETCH_SUCCESS || fetch_run(&pool) != FETCH_SUCCESS) {
+        ERRPRINTF("fetching %s failed: %s\n", url, strerror(errno));
+        fetch_pool_destroy(&pool);
+        job_free(job);
+        return EXIT_FAILURE;
+    }
+    fetch_pool_destroy(&pool);
+
+    int status = exit_status(&job->req);
+    switch(job->req.err) {
+    case FETCH_SUCCESS:
+        break;
+    case FETCH_ERR_STATUS:
+        ERRPRINTF("server returned with status: %d %s\n", job->req.status, job->status_text);
+        break;
+    case FETCH_ERR_PROTOCOL:
+        ERRPUTS("Protocol error!\n");
+        break;
+    case FETCH_ERR_SINK:
+        // Failing to open the file was reported by job_head
+        if(job->opened) {
+            ERRPRINTF("write on %s failed: %s\n", job->outfile_path != NULL ? job->outfile_path : "stdout",
+                strerror(job->req.sys_errno));
+        }
+        break;
+    default:
+        ERRPRINTF("error while receiving response: %s\n", fetch_strerror(&job->req));
     }
+    job_free(job);
+    return status;
+}
 
-    int sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-    if(sockfd < 0) {
-        ERRPRINTF("socket failed: %s\n", strerror(errno));
-        freeaddrinfo(ai);
-        cleanup_exit(EXIT_FAILURE);
+static char *dir_out_path(const char *dir, char *path) {
+    char *filename;
+    if(path[strlen(path)-1] == '/') {
+        filename = "index.html";
+    } else {
+        filename = basename(path);
     }
 
-    if(connect(sockfd, ai->ai_addr, ai->ai_addrlen) < 0) {
-        ERRPRINTF("connect failed: %s\n", strerror(errno));
-        freeaddrinfo(ai);
-        cleanup_exit(EXIT_FAILURE);
+    int trailing_slash = dir[strlen(dir)-1] == '/';
+    // Add 1 additional character for null byte
+    int path_len = strlen(dir) + strlen(filename) + (trailing_slash == 1 ? 0 : 1) + 1;
+
+    char *out_path = malloc(path_len * sizeof(*out_path));
+    if(out_path == NULL) {
+        return NULL;
     }
-    freeaddrinfo(ai);
 
-    if((sock = fdopen(sockfd, "w+")) == NULL) {
-        ERRPRINTF("fdopen failed: %s\n", strerror(errno));
-        cleanup_exit(EXIT_FAILURE);
+    if(trailing_slash == 0) {
+        snprintf(out_path, path_len, "%s/%s", dir, filename);
+    } else {
+        snprintf(out_path, path_len, "%s%s", dir, filename);
     }
+    return out_path;
 }
 
-static void perform_request(void) {
-    http_frame_t frame, *res;
-    memset(&frame, 0, sizeof(frame));
-    frame.method = "GET";
-    frame.file_path = file_path;
-    frame.header_len = 2;
-    
-    // "Host: " is 6 characters + null byte -> allocate length of hostname + 7
-    http_header_t conn_header = {"Connection", "close", NULL};
-    http_header_t host_header = {"Host", hostname, &conn_header};
-    frame.header_first = &host_header;
-
-    // Send request
-    int ret = http_send_req(sock, &frame);
-    if(ret != HTTP_SUCCESS) {
-        handle_http_err(ret, "error while sending request");
-    }
-    
-    // TODO: only open outfile when request successful
-    // Open output file
-    out = stdout;
-    if(outfile_path != NULL) {
-        if((out = fopen(outfile_path, "w")) == NULL) {
-            ERRPRINTF("fopen on %s failed: %s\n", outfile_path, strerror(errno));
-            cleanup_exit(EXIT_FAILURE);
+static int run_batch(FILE *urls) {
+    batch_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    fetch_pool_t pool;
+    if(fetch_pool_init(&pool, port, batch_connections) != FETCH_SUCCESS) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // Idle connections would only tie up the servers, there are no later requests
+    pool.keep_idle = 0;
+
+    // Read all URLs and submit them
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while((linelen = getline(&line, &linecap, urls)) > 0) {
+        while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'
+                || line[linelen - 1] == ' ' || line[linelen - 1] == '\t')) {
+            line[--linelen] = '\0';
+        }
+        char *url = line + strspn(line, " \t");
+        if(*url == '\0' || *url == '#') {
+            continue;
+        }
+
+        stats.total++;
+        job_t *job;
+        int ret = job_new(url, &stats, &job);
+        if(ret == FETCH_SUCCESS && (job->outfile_path = dir_out_path(outdir_opt, job->req.path)) == NULL) {
+            ret = FETCH_ERR_INTERNAL;
+        }
+        if(ret == FETCH_ERR_URL) {
+            printf("ERR invalid url %s\n", url);
+            stats.other_err++;
+            job_free(job);
+            continue;
+        }
+        if(ret != FETCH_SUCCESS || fetch_submit(&pool, &job->req) != FETCH_SUCCESS) {
+            ERRPRINTF("malloc failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
         }
     }
+    free(line);
 
-    // Receive response
-    ret = http_recv_res(sock, &res, out);
-    if(ret != HTTP_SUCCESS) {
-        http_free_frame(res);
-        handle_http_err(ret, "error while receiving response");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(fetch_run(&pool) != FETCH_SUCCESS) {
+        ERRPRINTF("poll failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d/%d fetched, %lld bytes in %.3f s (%.2f MiB/s, %.1f req/s)\n", stats.ok, stats.total,
+        (long long)stats.bytes, secs, secs > 0 ? stats.bytes / secs / (1024 * 1024) : 0.0,
+        secs > 0 ? stats.total / secs : 0.0);
+    fetch_pool_destroy(&pool);
+
+    if(stats.protocol_err > 0) {
+        return EXIT_PROTOCOL_ERR;
     }
+    if(stats.status_err > 0) {
+        return EXIT_STATUS_ERR;
+    }
+    return stats.other_err > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-    if(res->status != 200) {
-        ERRPRINTF("server returned with status: %lu %s\n", res->status, res->status_text);
-        clear_outfile();
-        http_free_frame(res);
-        cleanup_exit(EXIT_STATUS_ERR);
+static fetch_err_t job_new(const char *url, batch_stats_t *stats, job_t **job) {
+    if((*job = calloc(1, sizeof(job_t))) == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
     }
-    http_free_frame(res);
+    int ret = fetch_req_init(&(*job)->req, url);
+    (*job)->req.arg = *job;
+    (*job)->req.on_head = job_head;
+    (*job)->req.on_done = job_done;
+    (*job)->fd = -1;
+    (*job)->stats = stats;
+    return ret;
 }
 
-static void extract_out_file(void) {
-    if(outfile_opt == NULL && outdir_opt == NULL) {
-        outfile_path = NULL;
-    } else {
-        if(outfile_opt != NULL) {
-            outfile_path = outfile_opt;
-        } else {
-            outfile_path_alloc = 1;
-            char *filename;
-            if(file_path[strlen(file_path)-1] == '/') {
-                filename = "index.html";
-            } else {
-                filename = basename(file_path);
-            }
+static void job_free(job_t *job) {
+    if(job->fd > STDOUT_FILENO) {
+        close(job->fd);
+    }
+    fetch_req_free(&job->req);
+    free(job->outfile_path);
+    free(job);
+}
 
-            int trailing_slash = outdir_opt[strlen(outdir_opt)-1] == '/';
-            // Add 1 additional character for null byte
-            int path_len = strlen(outdir_opt) + strlen(filename) + (trailing_slash == 1 ? 0 : 1) + 1;
+static int job_head(fetch_req_t *req, const http_parser_t *res) {
+    job_t *job = req->arg;
+    snprintf(job->status_text, sizeof(job->status_text), "%.*s", (int)res->status_text.len, res->status_text.ptr);
+    if(res->status != 200) {
+        return 0;
+    }
+    if(job->outfile_path == NULL) {
+        job->fd = STDOUT_FILENO;
+    } else if((job->fd = open(job->outfile_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0) {
+        ERRPRINTF("open on %s failed: %s\n", job->outfile_path, strerror(errno));
+        return -1;
+    }
+    job->opened = 1;
+    req->sink_fd = job->fd;
+    return 0;
+}
 
-            outfile_path = malloc(path_len * sizeof(*outfile_path));
-            if(outfile_path == NULL) {
-                ERRPRINTF("malloc failed: %s\n", strerror(errno));
-                cleanup_exit(EXIT_FAILURE);
-            }
-            
-            if(trailing_slash == 0) {
-                snprintf(outfile_path, path_len, "%s/%s", outdir_opt, filename);
-            } else {
-                snprintf(outfile_path, path_len, "%s%s", outdir_opt, filename);
-            }
+static void job_done(fetch_req_t *req) {
+    job_t *job = req->arg;
+    if(job->fd > STDOUT_FILENO) {
+        if(close(job->fd) != 0 && req->err == FETCH_SUCCESS) {
+            req->err = FETCH_ERR_SINK;
+            req->sys_errno = errno;
         }
+        if(req->err != FETCH_SUCCESS) {
+            unlink(job->outfile_path);
+        }
+        job->fd = -1;
     }
-}
 
-static void handle_http_err(int err, char *cause) {
-    int status = EXIT_FAILURE;
-    switch(err) {
-    case HTTP_ERR_URL_FORMAT:
-        ERRPRINTF("'%s' is not a valid url\n", cause);
-        break;
-    case HTTP_ERR_INTERNAL:
-        ERRPRINTF("%s: %s\n", cause, strerror(errno));
-        break;
-    case HTTP_ERR_STREAM:
-        if (feof(sock) != 0) {
-            ERRPRINTF("%s: EOF reached\n", cause);
-            break;
+    batch_stats_t *stats = job->stats;
+    if(stats == NULL) {
+        return;
+    }
+    switch(req->err) {
+    case FETCH_SUCCESS:
+    case FETCH_ERR_STATUS:
+        printf("%d %lld %s\n", req->status, (long long)req->body_bytes, req->url);
+        stats->bytes += req->body_bytes;
+        if(req->err == FETCH_SUCCESS) {
+            stats->ok++;
+        } else {
+            stats->status_err++;
         }
-        ERRPRINTF("%s: %s\n", cause, strerror(ferror(sock)));
         break;
-    case HTTP_ERR_PROTOCOL:
-        ERRPUTS("Protocol error!\n");
-        status = EXIT_PROTOCOL_ERR;
+    case FETCH_ERR_PROTOCOL:
+        printf("ERR protocol error %s\n", req->url);
+        stats->protocol_err++;
         break;
     default:
-        ERRPRINTF("%s: unknown error", cause);
+        printf("ERR %s %s\n", fetch_strerror(req), req->url);
+        stats->other_err++;
     }
-    clear_outfile();
-    cleanup_exit(status);
+    job_free(job);
 }
 
-static void clear_outfile(void) {
-    if(outfile_path != NULL) {
-        if(remove(outfile_path) != 0) {
-            if(errno != ENOENT) {
-                ERRPRINTF("remove %s failed: %s\n", outfile_path, strerror(errno));
-            }
+static int run_segmented(const char *url, const char *outfile_path) {
+    int fd = open(outfile_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if(fd < 0) {
+        ERRPRINTF("open on %s failed: %s\n", outfile_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fetch_pool_t pool;
+    if(fetch_pool_init(&pool, port, segments_opt) != FETCH_SUCCESS) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // Probe with the first byte, servers without range support send the whole file
+    probe_t probe = {-1, ""};
+    fetch_req_t req;
+    if(fetch_req_init(&req, url) != FETCH_SUCCESS) {
+        ERRPRINTF("'%s' is not a valid url\n", url);
+        fetch_req_free(&req);
+        fetch_pool_destroy(&pool);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    req.range_first = req.range_last = 0;
+    req.sink_fd = fd;
+    req.sink_off = 0;
+    req.on_head = probe_head;
+    req.arg = &probe;
+    if(fetch_submit(&pool, &req) != FETCH_SUCCESS || fetch_run(&pool) != FETCH_SUCCESS) {
+        req.err = FETCH_ERR_INTERNAL;
+        req.sys_errno = errno;
+    }
+    if(req.err == FETCH_SUCCESS && req.status == 200) {
+        // The whole file was written over the start of the output file
+        int status = EXIT_SUCCESS;
+        if(ftruncate(fd, req.body_bytes) != 0) {
+            ERRPRINTF("writing %s failed: %s\n", outfile_path, strerror(errno));
+            status = EXIT_FAILURE;
+        }
+        fetch_req_free(&req);
+        fetch_pool_destroy(&pool);
+        close(fd);
+        return status;
+    }
+    if(req.err != FETCH_SUCCESS || probe.size < 0) {
+        if(req.err == FETCH_ERR_STATUS) {
+            ERRPRINTF("server returned with status: %d\n", req.status);
+        } else if(req.err == FETCH_SUCCESS) {
+            ERRPUTS("invalid Content-Range\n");
+            req.err = FETCH_ERR_PROTOCOL;
+        } else {
+            ERRPRINTF("error while receiving response: %s\n", fetch_strerror(&req));
         }
+        int status = exit_status(&req);
+        fetch_req_free(&req);
+        fetch_pool_destroy(&pool);
+        close(fd);
+        return status;
     }
+    fetch_req_free(&req);
+    int64_t size = probe.size;
+    // The connection of the probe is reused for the first segment, but no later
+    pool.keep_idle = 0;
+
+    char *state_path = malloc(strlen(outfile_path) + sizeof(SEGMENT_STATE_SUFFIX));
+    if(state_path == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    sprintf(state_path, "%s%s", outfile_path, SEGMENT_STATE_SUFFIX);
+
+    // Resume only downloads of the same version of the file
+    int cnt;
+    segment_t *segs = probe.validator[0] != '\0' ? load_segments(state_path, size, probe.validator, &cnt) : NULL;
+    int resumed = segs != NULL;
+    if(!resumed) {
+        cnt = size < segments_opt ? (size > 0 ? size : 1) : segments_opt;
+        if((segs = calloc(cnt, sizeof(segment_t))) == NULL) {
+            ERRPRINTF("malloc failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for(int i = 0; i < cnt; i++) {
+            segs[i].first = size * i / cnt;
+            segs[i].last = size * (i + 1) / cnt - 1;
+            segs[i].index = i;
+        }
+        if(ftruncate(fd, 0) != 0 || (size > 0 && posix_fallocate(fd, 0, size) != 0)) {
+            ERRPRINTF("preallocating %s failed: %s\n", outfile_path, strerror(errno));
+            free(segs);
+            free(state_path);
+            fetch_pool_destroy(&pool);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Header line followed by one fixed width line per segment, updated in place
+    segment_state_fd = open(state_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    char header[192];
+    segment_state_header = snprintf(header, sizeof(header), "osue-segments %lld %d %s\n", (long long)size, cnt,
+        probe.validator);
+    if(segment_state_fd < 0 || pwrite(segment_state_fd, header, segment_state_header, 0) < 0) {
+        ERRPRINTF("writing %s failed: %s\n", state_path, strerror(errno));
+        free(segs);
+        free(state_path);
+        fetch_pool_destroy(&pool);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    batch_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    for(int i = 0; i < cnt; i++) {
+        save_segment(&segs[i]);
+        if(segs[i].first + segs[i].done > segs[i].last) {
+            continue;
+        }
+        if(fetch_req_init(&segs[i].req, url) != FETCH_SUCCESS) {
+            ERRPRINTF("malloc failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        segs[i].req.range_first = segs[i].first + segs[i].done;
+        segs[i].req.range_last = segs[i].last;
+        segs[i].req.sink_fd = fd;
+        segs[i].req.sink_off = segs[i].req.range_first;
+        segs[i].req.on_progress = segment_progress;
+        segs[i].req.arg = &segs[i];
+        if(fetch_submit(&pool, &segs[i].req) != FETCH_SUCCESS) {
+            ERRPRINTF("malloc failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        stats.total++;
+    }
+    if(resumed) {
+        ERRPRINTF("resuming download of %s, %d of %d segments incomplete\n", outfile_path, stats.total, cnt);
+    }
+    if(fetch_run(&pool) != FETCH_SUCCESS) {
+        ERRPRINTF("poll failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fetch_pool_destroy(&pool);
+
+    for(int i = 0; i < cnt; i++) {
+        save_segment(&segs[i]);
+        if(segs[i].req.url == NULL) {
+            continue;
+        }
+        if(segs[i].req.err == FETCH_SUCCESS && segs[i].req.status == 206) {
+            stats.ok++;
+        } else if(segs[i].req.err == FETCH_ERR_PROTOCOL) {
+            stats.protocol_err++;
+        } else if(segs[i].req.err == FETCH_ERR_STATUS) {
+            stats.status_err++;
+        } else {
+            stats.other_err++;
+        }
+        fetch_req_free(&segs[i].req);
+    }
+    free(segs);
+    close(segment_state_fd);
+    segment_state_fd = -1;
+    close(fd);
+
+    int status = EXIT_SUCCESS;
+    if(stats.ok == stats.total) {
+        unlink(state_path);
+    } else {
+        ERRPRINTF("%d of %d segments failed, run again to resume\n", stats.total - stats.ok, stats.total);
+        status = stats.protocol_err > 0 ? EXIT_PROTOCOL_ERR : stats.status_err > 0 ? EXIT_STATUS_ERR : EXIT_FAILURE;
+    }
+    free(state_path);
+    return status;
+}
+
+static int probe_head(fetch_req_t *req, const http_parser_t *res) {
+    probe_t *probe = req->arg;
+    if(res->status != 206) {
+        return 0;
+    }
+
+    // "bytes 0-0/<size>"
+    http_slice_t content_range = http_header_find(&res->headers, "Content-Range");
+    const char *slash = content_range.ptr != NULL ? memchr(content_range.ptr, '/', content_range.len) : NULL;
+    char *end;
+    int64_t size = slash != NULL ? strtoll(slash + 1, &end, 10) : -1;
+    if(slash != NULL && size >= 0 && end == content_range.ptr + content_range.len) {
+        probe->size = size;
+    }
+    http_slice_t validator = http_header_find(&res->headers, "ETag");
+    if(validator.ptr == NULL) {
+        validator = http_header_find(&res->headers, "Last-Modified");
+    }
+    if(validator.ptr != NULL && validator.len < sizeof(probe->validator)) {
+        memcpy(probe->validator, validator.ptr, validator.len);
+        probe->validator[validator.len] = '\0';
+    }
+    return 0;
 }
 
-static void cleanup_exit(int status) {
-    free(hostname);
-    free(file_path);
-    if(outfile_path_alloc == 1) {
-        free(outfile_path);
+static segment_t *load_segments(const char *path, int64_t size, const char *validator, int *cnt) {
+    FILE *state = fopen(path, "r");
+    if(state == NULL) {
+        return NULL;
     }
+    char line[192];
+    long long state_size;
+    int n, consumed;
+    segment_t *segs = NULL;
+    if(fgets(line, sizeof(line), state) == NULL || sscanf(line, "osue-segments %lld %d %n", &state_size, &n, &consumed) != 2
+            || state_size != size || n <= 0 || strncmp(line + consumed, validator, strlen(validator)) != 0
+            || line[consumed + strlen(validator)] != '\n' || (segs = calloc(n, sizeof(segment_t))) == NULL) {
+        fclose(state);
+        return NULL;
+    }
+    for(int i = 0; i < n; i++) {
+        long long first, last, done;
+        if(fgets(line, sizeof(line), state) == NULL || sscanf(line, "%lld %lld %lld", &first, &last, &done) != 3
+                || done < 0 || first + done > last + 1) {
+            free(segs);
+            fclose(state);
+            return NULL;
+        }
+        segs[i].first = first;
+        segs[i].last = last;
+        segs[i].done = segs[i].saved = done;
+        segs[i].index = i;
+    }
+    fclose(state);
+    *cnt = n;
+    return segs;
+}
+
+static void save_segment(segment_t *seg) {
+    char line[64];
+    int len = snprintf(line, sizeof(line), "%020lld %020lld %020lld\n", (long long)seg->first, (long long)seg->last,
+        (long long)seg->done);
+    if(pwrite(segment_state_fd, line, len, segment_state_header + (off_t)seg->index * len) != len) {
+        ERRPRINTF("saving download progress failed: %s\n", strerror(errno));
+        return;
+    }
+    seg->saved = seg->done;
+}
 
-    if(sock != NULL) {
-        fclose(sock);
+static void segment_progress(fetch_req_t *req, int64_t len) {
+    segment_t *seg = req->arg;
+    if(req->status != 206) {
+        // The server sent the whole file, which says nothing about the range
+        return;
+    }
+    seg->done += len;
+    if(seg->done - seg->saved >= SEGMENT_SAVE_INTERVAL || seg->first + seg->done > seg->last) {
+        save_segment(seg);
     }
+}
 
-    if(out != NULL) {
-        fclose(out);
+static int exit_status(const fetch_req_t *req) {
+    switch(req->err) {
+    case FETCH_SUCCESS:
+        return EXIT_SUCCESS;
+    case FETCH_ERR_STATUS:
+        return EXIT_STATUS_ERR;
+    case FETCH_ERR_PROTOCOL:
+        return EXIT_PROTOCOL_ERR;
+    default:
+        return EXIT_FAILURE;
     }
-    exit(status);
 }
@@ -0,0 +1,255 @@
+/**
+ * @file compress.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the compressed variant cache defined in compress.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Entries are found through a hash table with chaining and kept in a
+ * doubly linked list in order of their last use for eviction. Compression uses
+ * zlib, so only the gzip coding can be produced.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "compress.h"
+#include "http.h"
+
+/**
+ * @brief Compute the bucket of a path and content coding.
+ *
+ * @param path Path of the file.
+ * @param encoding Content coding.
+ * @return size_t Index of the bucket.
+ */
+static size_t bucket_of(const char *path, int encoding);
+
+/**
+ * @brief Remove an entry from the hash table and the usage list.
+ *
+ * @param cache Cache.
+ * @param entry Cached entry which should be removed.
+ *
+ * @details The entry is freed if it is not referenced.
+ */
+static void unlink_entry(compress_cache_t *cache, compress_entry_t *entry);
+
+/**
+ * @brief Free an entry and its data.
+ */
+static void free_entry(compress_entry_t *entry);
+
+/**
+ * @brief Read a file and compress it with gzip.
+ *
+ * @param fd File descriptor of the file.
+ * @param size Size of the file.
+ * @param entry Entry the compressed data will be stored to.
+ * @return int 0 on success, -1 if reading or compressing failed (errno is set).
+ *
+ * @details The file is read with pread, its offset is left unchanged.
+ */
+static int compress_file(int fd, off_t size, compress_entry_t *entry);
+
+void compress_cache_init(compress_cache_t *cache, size_t max_size) {
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->head = cache->tail = NULL;
+    cache->size = 0;
+    cache->max_size = max_size;
+}
+
+void compress_cache_destroy(compress_cache_t *cache) {
+    while(cache->head != NULL) {
+        unlink_entry(cache, cache->head);
+    }
+}
+
+compress_entry_t *compress_cache_get(compress_cache_t *cache, const char *path, int fd, const struct stat *st,
+        int encoding) {
+    if(encoding != HTTP_ENC_GZIP) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    size_t bucket = bucket_of(path, encoding);
+    compress_entry_t *entry = cache->buckets[bucket];
+    while(entry != NULL) {
+        compress_entry_t *next = entry->hash_next;
+        if(entry->encoding == encoding && strcmp(entry->path, path) == 0) {
+            if(entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec
+                    && entry->file_size == st->st_size) {
+                // Move to the front of the usage list
+                if(entry != cache->head) {
+                    entry->prev->next = entry->next;
+                    if(entry->next != NULL) {
+                        entry->next->prev = entry->prev;
+                    } else {
+                        cache->tail = entry->prev;
+                    }
+                    entry->prev = NULL;
+                    entry->next = cache->head;
+                    cache->head->prev = entry;
+                    cache->head = entry;
+                }
+                entry->refs++;
+                return entry;
+            }
+            // Variant of a previous version of the file
+            unlink_entry(cache, entry);
+        }
+        entry = next;
+    }
+
+    size_t path_len = strlen(path);
+    if((entry = calloc(1, sizeof(compress_entry_t) + path_len + 1)) == NULL) {
+        return NULL;
+    }
+    entry->path = (char *)(entry + 1);
+    memcpy(entry->path, path, path_len + 1);
+    entry->mtime = st->st_mtim;
+    entry->file_size = st->st_size;
+    entry->encoding = encoding;
+    entry->refs = 1;
+    if(compress_file(fd, st->st_size, entry) != 0) {
+        int err = errno;
+        free(entry);
+        errno = err;
+        return NULL;
+    }
+    entry->size = sizeof(compress_entry_t) + path_len + 1 + entry->len;
+    if(entry->size > cache->max_size) {
+        // Too large for the cache, freed once released
+        return entry;
+    }
+
+    while(cache->size + entry->size > cache->max_size) {
+        unlink_entry(cache, cache->tail);
+    }
+    entry->cached = 1;
+    entry->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    entry->next = cache->head;
+    if(cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+    cache->size += entry->size;
+    return entry;
+}
+
+void compress_cache_release(compress_cache_t *cache, compress_entry_t *entry) {
+    if(entry == NULL) {
+        return;
+    }
+    if(--entry->refs == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+}
+
+static size_t bucket_of(const char *path, int encoding) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL ^ (unsigned)encoding;
+    for(const unsigned char *p = (const unsigned char *)path; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+    return hash % COMPRESS_BUCKETS;
+}
+
+static void unlink_entry(compress_cache_t *cache, compress_entry_t *entry) {
+    compress_entry_t **link = &cache->buckets[bucket_of(entry->path, entry->encoding)];
+    while(*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    if(entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if(entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    cache->size -= entry->size;
+
+    entry->cached = 0;
+    if(entry->refs == 0) {
+        free_entry(entry);
+    }
+}
+
+static void free_entry(compress_entry_t *entry) {
+    free(entry->data);
+    free(entry);
+}
+
+static int compress_file(int fd, off_t size, compress_entry_t *entry) {
+    unsigned char *in = malloc(size > 0 ? size : 1);
+    if(in == NULL) {
+        return -1;
+    }
+    size_t in_len = 0;
+    while(in_len < (size_t)size) {
+        ssize_t n = pread(fd, in + in_len, size - in_len, in_len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            int err = errno;
+            free(in);
+            errno = err;
+            return -1;
+        }
+        if(n == 0) {
+            break;
+        }
+        in_len += n;
+    }
+
+    // The cost is paid once per file version, so use the best compression
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(in);
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t bound = deflateBound(&zs, in_len);
+    unsigned char *out = malloc(bound);
+    if(out == NULL) {
+        deflateEnd(&zs);
+        free(in);
+        return -1;
+    }
+    zs.next_in = in;
+    zs.avail_in = in_len;
+    zs.next_out = out;
+    zs.avail_out = bound;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t out_len = zs.total_out;
+    deflateEnd(&zs);
+    free(in);
+    if(ret != Z_STREAM_END) {
+        free(out);
+        errno = EIO;
+        return -1;
+    }
+
+    if(out_len >= in_len) {
+        // Not worth it, remember to send the file uncompressed
+        free(out);
+        return 0;
+    }
+    unsigned char *shrunk = realloc(out, out_len);
+    entry->data = shrunk != NULL ? shrunk : out;
+    entry->len = out_len;
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file compress.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Cache of compressed file variants.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Files are compressed once when a compressed variant is requested for
+ * the first time and the result is kept in memory. Entries are keyed by the path,
+ * the modification time and the content coding of the file, so a modified file is
+ * compressed again on the next request. The cache is bounded by the total size of
+ * its entries; least recently used entries are evicted first. Entries handed out
+ * are reference counted and stay valid until they are released, even if they were
+ * evicted in the meantime. The cache is not thread safe; each thread should use
+ * its own cache.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Number of hash buckets of a cache.
+ */
+#define COMPRESS_BUCKETS 256
+
+/**
+ * @brief A compressed variant of a file.
+ * @details data contains len bytes of the file compressed with the content coding
+ * encoding. If compressing did not reduce the size of the file, data is NULL and
+ * the entry only records that the file should be sent uncompressed.
+ */
+typedef struct compress_entry {
+    struct compress_entry *prev;
+    struct compress_entry *next;
+    struct compress_entry *hash_next;
+
+    char *path;
+    struct timespec mtime;
+    off_t file_size;
+    int encoding;
+
+    unsigned char *data;
+    size_t len;
+
+    size_t size;
+    int refs;
+    int cached;
+} compress_entry_t;
+
+/**
+ * @brief A bounded cache of compressed variants.
+ * @details head is the most and tail the least recently used entry. size is the
+ * sum of the sizes of all cached entries and never exceeds max_size.
+ */
+typedef struct compress_cache {
+    compress_entry_t *buckets[COMPRESS_BUCKETS];
+    compress_entry_t *head;
+    compress_entry_t *tail;
+    size_t size;
+    size_t max_size;
+} compress_cache_t;
+
+/**
+ * @brief Initialize a cache.
+ *
+ * @param cache Cache which should be initialized.
+ * @param max_size Maximum total size of the cached entries in bytes.
+ */
+void compress_cache_init(compress_cache_t *cache, size_t max_size);
+
+/**
+ * @brief Free all entries of a cache.
+ *
+ * @param cache Cache which should be destroyed.
+ *
+ * @details Entries which are still referenced are freed once they are released.
+ */
+void compress_cache_destroy(compress_cache_t *cache);
+
+/**
+ * @brief Get the compressed variant of a file.
+ *
+ * @param cache Cache.
+ * @param path Path of the file, identifies the variant.
+ * @param fd File descriptor of the file, read with pread.
+ * @param st Status of the file.
+ * @param encoding Content coding (a single http_encoding_t flag, only HTTP_ENC_GZIP
+ * is supported).
+ * @return compress_entry_t* The variant, or NULL if the file could not be read or
+ * compressed (errno is set). The entry must be released with compress_cache_release.
+ *
+ * @details Returns the cached variant if there is one for the modification time
+ * and size in st, otherwise the file is compressed and the result is cached.
+ * Variants of previous versions of the file are removed from the cache.
+ */
+compress_entry_t *compress_cache_get(compress_cache_t *cache, const char *path, int fd, const struct stat *st,
+        int encoding);
+
+/**
+ * @brief Release an entry returned by compress_cache_get.
+ *
+ * @param cache Cache the entry was taken from.
+ * @param entry Entry which should be released, may be NULL.
+ */
+void compress_cache_release(compress_cache_t *cache, compress_entry_t *entry);
+
+#endif
@@ -0,0 +1,918 @@
+/**
+ * @file fetch.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the http client library defined in fetch.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Every connection is a small state machine (connecting, sending the
+ * request head, receiving the response head, receiving the body, idle) driven by
+ * poll. Response heads are parsed with the incremental parser of the parser module
+ * in the receive buffer of the connection, chunked bodies are decoded in place.
+ */
+
+// splice
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "fetch.h"
+#include "http.h"
+
+/**
+ * @brief Maximum number of body bytes moved by a single splice.
+ */
+#define FETCH_SPLICE_SIZE (1024 * 1024)
+
+/**
+ * @brief States of a connection.
+ */
+typedef enum fetch_state {
+    // Connected, no request assigned
+    FETCH_STATE_IDLE = 0,
+
+    // Non-blocking connect in progress
+    FETCH_STATE_CONNECTING,
+
+    // Sending the request head
+    FETCH_STATE_SENDING,
+
+    // Receiving the response head
+    FETCH_STATE_HEAD,
+
+    // Receiving the response body
+    FETCH_STATE_BODY
+} fetch_state_t;
+
+/**
+ * @brief A connection of a pool.
+ * @details req holds the serialized head of the current request, buf received
+ * bytes which have not been processed yet. After the response head was parsed,
+ * remaining is the number of body bytes still to be received (-1 for bodies
+ * delimited by the end of the connection) unless the body is chunked. If deliver
+ * is not set, the body is discarded; otherwise out_off is the offset of the next
+ * write to the sink (-1 for sequential writes) and splice is set if the body is
+ * moved to the sink with splice.
+ */
+typedef struct fetch_conn {
+    struct fetch_host *host;
+    struct fetch_conn *next;
+    int fd;
+    fetch_state_t state;
+    fetch_req_t *fetch;
+    int reused;
+
+    char req[HTTP_MAX_HEAD];
+    size_t req_len;
+    size_t req_sent;
+
+    char buf[HTTP_MAX_HEAD];
+    size_t len;
+    http_parser_t parser;
+
+    int deliver;
+    int splice;
+    int64_t out_off;
+    int64_t remaining;
+    int chunked;
+    http_chunked_t dec;
+    int keep_alive;
+} fetch_conn_t;
+
+/**
+ * @brief A host and port of a pool.
+ * @details Contains the resolved address (NULL if resolving failed with the
+ * getaddrinfo error resolve_err, or if it was not resolved yet), the queue of
+ * pending requests and all open connections to the host.
+ */
+typedef struct fetch_host {
+    char *name;
+    char *port;
+    struct addrinfo *ai;
+    int resolved;
+    int resolve_err;
+    fetch_req_t *queue;
+    fetch_req_t *queue_tail;
+    fetch_conn_t *conns;
+    int conn_cnt;
+    struct fetch_host *next;
+} fetch_host_t;
+
+/**
+ * @brief Find the host entry of a request, creating it if necessary.
+ *
+ * @return fetch_host_t* Host, or NULL if allocating failed.
+ */
+static fetch_host_t *find_host(fetch_pool_t *pool, const char *name, const char *port);
+
+/**
+ * @brief Start queued requests of a host.
+ *
+ * @param pool Pool.
+ * @param host Host.
+ *
+ * @details Assigns queued requests to idle connections and opens new connections
+ * as long as the host has less than max_conns. Requests which cannot be sent
+ * because the host cannot be resolved or connecting failed right away are
+ * finished with an error.
+ */
+static void dispatch(fetch_pool_t *pool, fetch_host_t *host);
+
+/**
+ * @brief Open a new non-blocking connection to a host.
+ *
+ * @return fetch_conn_t* Connecting connection, or NULL if creating the socket or
+ * connecting failed (errno is set).
+ */
+static fetch_conn_t *conn_open(fetch_pool_t *pool, fetch_host_t *host);
+
+/**
+ * @brief Assign the next queued request of its host to a connection.
+ *
+ * @param pool Pool.
+ * @param conn Connected (or connecting) connection.
+ * @return int 0 if a request was started, -1 if the queue is empty.
+ *
+ * @details Requests whose head does not fit into the request buffer are finished
+ * with FETCH_ERR_URL.
+ */
+static int conn_start(fetch_pool_t *pool, fetch_conn_t *conn);
+
+/**
+ * @brief Continue the work of a connection after poll reported it ready.
+ */
+static void conn_step(fetch_pool_t *pool, fetch_conn_t *conn);
+
+/**
+ * @brief Process the response head once it was parsed.
+ *
+ * @return int 0 on success, -1 if the request was finished.
+ */
+static int conn_head(fetch_pool_t *pool, fetch_conn_t *conn);
+
+/**
+ * @brief Process the buffered body bytes of the current response.
+ *
+ * @param conn Connection.
+ * @param eof Whether the server closed the connection.
+ * @param err Pointer where the error is stored if -1 is returned.
+ * @return int 1 if the body is complete, 0 if more data is needed and -1 on
+ * errors.
+ */
+static int conn_body(fetch_conn_t *conn, int eof, fetch_err_t *err);
+
+/**
+ * @brief Move body bytes from the socket to the sink with splice.
+ *
+ * @param pool Pool.
+ * @param conn Connection with an empty receive buffer.
+ * @param err Pointer where the error is stored if -1 is returned.
+ * @return int 1 if the body is complete, 0 if more data is needed and -1 on
+ * errors.
+ */
+static int conn_splice(fetch_pool_t *pool, fetch_conn_t *conn, fetch_err_t *err);
+
+/**
+ * @brief Deliver body data to the sink of the current request.
+ *
+ * @return int 0 on success, -1 if writing failed or the callback aborted (errno
+ * is set).
+ */
+static int conn_deliver(fetch_conn_t *conn, const char *data, size_t len);
+
+/**
+ * @brief Finish the current request of a connection.
+ *
+ * @param pool Pool.
+ * @param conn Connection.
+ * @param err Result of the request.
+ * @param sys_errno errno value of the error, or 0.
+ *
+ * @details Requests which failed because a reused connection was closed before
+ * the response started are queued again once. Otherwise the result is stored and
+ * on_done is called. The connection continues with the next queued request of its
+ * host if the response allows it. Without queued requests it is kept idle only if
+ * it is the last open connection to its host and keep_idle is set, otherwise it
+ * is closed.
+ */
+static void conn_finish(fetch_pool_t *pool, fetch_conn_t *conn, fetch_err_t err, int sys_errno);
+
+/**
+ * @brief Close and free a connection and start queued requests of its host.
+ */
+static void conn_close(fetch_pool_t *pool, fetch_conn_t *conn);
+
+/**
+ * @brief Store the result of a request and call its on_done callback.
+ */
+static void complete(fetch_pool_t *pool, fetch_req_t *req, fetch_err_t err, int sys_errno);
+
+/**
+ * @brief Check whether splice can write to a file descriptor.
+ *
+ * @return int 1 for pipes, sockets and regular files not opened with O_APPEND.
+ */
+static int can_splice(int fd);
+
+/**
+ * @brief Write a buffer completely to a file descriptor.
+ *
+ * @param fd File descriptor.
+ * @param buf Data.
+ * @param len Length of the data.
+ * @param offset Offset the data should be written to with pwrite, or -1 to write
+ * at the current file offset.
+ * @return int 0 on success, -1 on errors (errno is set).
+ */
+static int write_all(int fd, const char *buf, size_t len, int64_t offset);
+
+fetch_err_t fetch_pool_init(fetch_pool_t *pool, const char *default_port, int max_conns) {
+    memset(pool, 0, sizeof(*pool));
+    if((pool->default_port = strdup(default_port)) == NULL) {
+        return FETCH_ERR_INTERNAL;
+    }
+    pool->max_conns = max_conns > 0 ? max_conns : 1;
+    pool->keep_idle = 1;
+    pool->timeout = -1;
+    if(pipe2(pool->pipefd, O_CLOEXEC) == 0) {
+        fcntl(pool->pipefd[0], F_SETPIPE_SZ, FETCH_SPLICE_SIZE);
+    } else {
+        pool->pipefd[0] = pool->pipefd[1] = -1;
+    }
+    return FETCH_SUCCESS;
+}
+
+void fetch_pool_destroy(fetch_pool_t *pool) {
+    while(pool->hosts != NULL) {
+        fetch_host_t *host = pool->hosts;
+        while(host->conns != NULL) {
+            fetch_conn_t *conn = host->conns;
+            host->conns = conn->next;
+            close(conn->fd);
+            free(conn);
+        }
+        if(host->ai != NULL) {
+            freeaddrinfo(host->ai);
+        }
+        pool->hosts = host->next;
+        free(host->name);
+        free(host->port);
+        free(host);
+    }
+    if(pool->pipefd[0] >= 0) {
+        close(pool->pipefd[0]);
+        close(pool->pipefd[1]);
+    }
+    free(pool->default_port);
+}
+
+fetch_err_t fetch_req_init(fetch_req_t *req, const char *url) {
+    memset(req, 0, sizeof(*req));
+    req->range_first = -1;
+    req->range_last = -1;
+    req->sink_fd = -1;
+    req->sink_off = -1;
+    if((req->url = strdup(url)) == NULL) {
+        return FETCH_ERR_INTERNAL;
+    }
+    int ret = parse_url(req->url, &req->host, &req->path);
+    if(ret != HTTP_SUCCESS) {
+        return ret == HTTP_ERR_INTERNAL ? FETCH_ERR_INTERNAL : FETCH_ERR_URL;
+    }
+
+    // parse_url leaves an explicit port at the start of the path
+    if(req->path[0] == ':') {
+        size_t port_len = strspn(req->path + 1, "0123456789");
+        if(port_len == 0 || (req->path[port_len + 1] != '/' && req->path[port_len + 1] != '\0')) {
+            return FETCH_ERR_URL;
+        }
+        if((req->port = strndup(req->path + 1, port_len)) == NULL) {
+            return FETCH_ERR_INTERNAL;
+        }
+        memmove(req->path, req->path + port_len + 1, strlen(req->path + port_len + 1) + 1);
+        if(req->path[0] == '\0') {
+            strcpy(req->path, "/");
+        }
+    }
+    if(req->path[0] != '/') {
+        return FETCH_ERR_URL;
+    }
+    return FETCH_SUCCESS;
+}
+
+void fetch_req_free(fetch_req_t *req) {
+    free(req->url);
+    free(req->host);
+    free(req->port);
+    free(req->path);
+    req->url = req->host = req->port = req->path = NULL;
+}
+
+fetch_err_t fetch_submit(fetch_pool_t *pool, fetch_req_t *req) {
+    fetch_host_t *host = find_host(pool, req->host, req->port != NULL ? req->port : pool->default_port);
+    if(host == NULL) {
+        req->err = FETCH_ERR_INTERNAL;
+        req->sys_errno = errno;
+        return FETCH_ERR_INTERNAL;
+    }
+    req->err = FETCH_SUCCESS;
+    req->sys_errno = 0;
+    req->status = 0;
+    req->body_bytes = 0;
+    req->retried = 0;
+    req->next = NULL;
+    if(host->queue_tail != NULL) {
+        host->queue_tail->next = req;
+    } else {
+        host->queue = req;
+    }
+    host->queue_tail = req;
+    pool->pending++;
+    return FETCH_SUCCESS;
+}
+
+fetch_err_t fetch_run(fetch_pool_t *pool) {
+    struct pollfd *fds = NULL;
+    fetch_conn_t **ready = NULL;
+    int cap = 0;
+    fetch_err_t ret = FETCH_SUCCESS;
+
+    while(pool->pending > 0) {
+        // on_done callbacks may have queued requests at any host
+        for(fetch_host_t *host = pool->hosts; host != NULL; host = host->next) {
+            if(host->queue != NULL) {
+                dispatch(pool, host);
+            }
+        }
+        if(cap < pool->conn_cnt) {
+            cap = pool->conn_cnt * 2;
+            free(fds);
+            free(ready);
+            fds = malloc(cap * sizeof(struct pollfd));
+            ready = malloc(cap * sizeof(fetch_conn_t *));
+            if(fds == NULL || ready == NULL) {
+                ret = FETCH_ERR_INTERNAL;
+                break;
+            }
+        }
+
+        int nfds = 0;
+        for(fetch_host_t *host = pool->hosts; host != NULL; host = host->next) {
+            for(fetch_conn_t *conn = host->conns; conn != NULL; conn = conn->next) {
+                if(conn->state == FETCH_STATE_IDLE) {
+                    continue;
+                }
+                fds[nfds].fd = conn->fd;
+                fds[nfds].events = conn->state <= FETCH_STATE_SENDING ? POLLOUT : POLLIN;
+                fds[nfds].revents = 0;
+                ready[nfds++] = conn;
+            }
+        }
+        if(nfds == 0) {
+            // Everything was finished by dispatch
+            continue;
+        }
+        int ready_cnt = poll(fds, nfds, pool->timeout);
+        if(ready_cnt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            ret = FETCH_ERR_INTERNAL;
+            break;
+        }
+        if(ready_cnt == 0) {
+            // No connection made progress, retrying would wait just as long
+            for(int i = 0; i < nfds; i++) {
+                ready[i]->fetch->retried = 1;
+                ready[i]->keep_alive = 0;
+                conn_finish(pool, ready[i], FETCH_ERR_CONNECT, ETIMEDOUT);
+            }
+            continue;
+        }
+        // A step only frees its own connection, so the others stay valid
+        for(int i = 0; i < nfds; i++) {
+            if(fds[i].revents != 0) {
+                conn_step(pool, ready[i]);
+            }
+        }
+    }
+    int err = errno;
+    free(fds);
+    free(ready);
+    errno = err;
+    return ret;
+}
+
+const char *fetch_strerror(const fetch_req_t *req) {
+    switch(req->err) {
+    case FETCH_SUCCESS:
+        return "success";
+    case FETCH_ERR_URL:
+        return "invalid url";
+    case FETCH_ERR_RESOLVE:
+        return "host not found";
+    case FETCH_ERR_PROTOCOL:
+        return "protocol error";
+    case FETCH_ERR_STATUS:
+        return "unexpected status";
+    case FETCH_ERR_CONNECT:
+    case FETCH_ERR_SINK:
+    case FETCH_ERR_INTERNAL:
+        return strerror(req->sys_errno);
+    }
+    return "unknown error";
+}
+
+static fetch_host_t *find_host(fetch_pool_t *pool, const char *name, const char *port) {
+    fetch_host_t *host = pool->hosts;
+    while(host != NULL && (strcmp(host->name, name) != 0 || strcmp(host->port, port) != 0)) {
+        host = host->next;
+    }
+    if(host != NULL) {
+        return host;
+    }
+    if((host = calloc(1, sizeof(fetch_host_t))) == NULL) {
+        return NULL;
+    }
+    if((host->name = strdup(name)) == NULL || (host->port = strdup(port)) == NULL) {
+        free(host->name);
+        free(host);
+        return NULL;
+    }
+    host->next = pool->hosts;
+    pool->hosts = host;
+    return host;
+}
+
+static void dispatch(fetch_pool_t *pool, fetch_host_t *host) {
+    if(host->queue != NULL && !host->resolved) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        host->resolve_err = getaddrinfo(host->name, host->port, &hints, &host->ai);
+        if(host->resolve_err != 0) {
+            host->ai = NULL;
+        }
+        host->resolved = 1;
+    }
+
+    // Idle connections first, they need no handshake
+    for(fetch_conn_t *conn = host->conns; conn != NULL && host->queue != NULL; conn = conn->next) {
+        if(conn->state == FETCH_STATE_IDLE) {
+            conn->state = FETCH_STATE_SENDING;
+            conn->reused = 1;
+            if(conn_start(pool, conn) != 0) {
+                conn->state = FETCH_STATE_IDLE;
+            }
+        }
+    }
+    while(host->queue != NULL && host->conn_cnt < pool->max_conns) {
+        fetch_conn_t *conn = host->ai != NULL ? conn_open(pool, host) : NULL;
+        if(conn != NULL) {
+            if(conn_start(pool, conn) != 0) {
+                conn_close(pool, conn);
+            }
+            continue;
+        }
+
+        // Fail the request which would have been sent on this connection
+        int err = errno;
+        fetch_req_t *req = host->queue;
+        host->queue = req->next;
+        if(host->queue == NULL) {
+            host->queue_tail = NULL;
+        }
+        complete(pool, req, host->ai != NULL ? FETCH_ERR_CONNECT : FETCH_ERR_RESOLVE, host->ai != NULL ? err : 0);
+    }
+}
+
+static fetch_conn_t *conn_open(fetch_pool_t *pool, fetch_host_t *host) {
+    fetch_conn_t *conn = malloc(sizeof(fetch_conn_t));
+    if(conn == NULL) {
+        return NULL;
+    }
+    conn->fd = socket(host->ai->ai_family, host->ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, host->ai->ai_protocol);
+    if(conn->fd < 0 || (connect(conn->fd, host->ai->ai_addr, host->ai->ai_addrlen) != 0 && errno != EINPROGRESS)) {
+        int err = errno;
+        if(conn->fd >= 0) {
+            close(conn->fd);
+        }
+        free(conn);
+        errno = err;
+        return NULL;
+    }
+    conn->host = host;
+    conn->state = FETCH_STATE_CONNECTING;
+    conn->fetch = NULL;
+    conn->reused = 0;
+    conn->len = 0;
+    conn->keep_alive = 0;
+    conn->next = host->conns;
+    host->conns = conn;
+    host->conn_cnt++;
+    pool->conn_cnt++;
+    return conn;
+}
+
+static int conn_start(fetch_pool_t *pool, fetch_conn_t *conn) {
+    fetch_host_t *host = conn->host;
+    while(host->queue != NULL) {
+        fetch_req_t *req = host->queue;
+        host->queue = req->next;
+        if(host->queue == NULL) {
+            host->queue_tail = NULL;
+        }
+        req->next = NULL;
+
+        // Ports other than the default belong into the Host field
+        char range[64] = "";
+        if(req->range_first >= 0) {
+            snprintf(range, sizeof(range), "Range: bytes=%lld-%lld\r\n", (long long)req->range_first,
+                (long long)req->range_last);
+        }
+        int len = snprintf(conn->req, sizeof(conn->req), "GET %s " HTTP_VERSION "\r\nHost: %s%s%s\r\n%s%s\r\n",
+            req->path, host->name, req->port != NULL ? ":" : "", req->port != NULL ? req->port : "", range,
+            req->close ? "Connection: close\r\n" : "");
+        if(len < 0 || (size_t)len >= sizeof(conn->req)) {
+            complete(pool, req, FETCH_ERR_URL, 0);
+            continue;
+        }
+        conn->fetch = req;
+        conn->req_len = len;
+        conn->req_sent = 0;
+        conn->deliver = 0;
+        conn->splice = 0;
+        return 0;
+    }
+    return -1;
+}
+
+static void conn_step(fetch_pool_t *pool, fetch_conn_t *conn) {
+    switch(conn->state) {
+    case FETCH_STATE_IDLE:
+        return;
+    case FETCH_STATE_CONNECTING: {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0) {
+            err = errno;
+        }
+        if(err != 0) {
+            conn_finish(pool, conn, FETCH_ERR_CONNECT, err);
+            return;
+        }
+        conn->state = FETCH_STATE_SENDING;
+    }
+        // fall through
+    case FETCH_STATE_SENDING:
+        while(conn->req_sent < conn->req_len) {
+            ssize_t n = send(conn->fd, conn->req + conn->req_sent, conn->req_len - conn->req_sent, MSG_NOSIGNAL);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                    conn_finish(pool, conn, FETCH_ERR_CONNECT, errno);
+                }
+                return;
+            }
+            conn->req_sent += n;
+        }
+        conn->state = FETCH_STATE_HEAD;
+        http_parser_init(&conn->parser, HTTP_PARSE_RESPONSE);
+        // Bytes already buffered cannot belong to this response, the server sent garbage
+        if(conn->len > 0) {
+            conn_finish(pool, conn, FETCH_ERR_PROTOCOL, 0);
+        }
+        return;
+    case FETCH_STATE_HEAD:
+    case FETCH_STATE_BODY:
+        break;
+    }
+
+    fetch_err_t err;
+    int ret;
+    if(conn->state == FETCH_STATE_BODY && conn->splice && conn->len == 0) {
+        if((ret = conn_splice(pool, conn, &err)) != 0) {
+            conn_finish(pool, conn, ret < 0 ? err : FETCH_SUCCESS, ret < 0 ? errno : 0);
+        }
+        return;
+    }
+
+    ssize_t n = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+    if(n < 0) {
+        if(errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            conn_finish(pool, conn, FETCH_ERR_CONNECT, errno);
+        }
+        return;
+    }
+    conn->len += n;
+
+    if(conn->state == FETCH_STATE_HEAD) {
+        if(n == 0) {
+            if(conn->len == 0) {
+                conn_finish(pool, conn, FETCH_ERR_CONNECT, ECONNRESET);
+            } else {
+                conn_finish(pool, conn, FETCH_ERR_PROTOCOL, 0);
+            }
+            return;
+        }
+        ret = http_parse(&conn->parser, conn->buf, conn->len);
+        if(ret == HTTP_PARSE_AGAIN) {
+            return;
+        }
+        if(ret != HTTP_PARSE_DONE) {
+            conn_finish(pool, conn, FETCH_ERR_PROTOCOL, 0);
+            return;
+        }
+        if(conn_head(pool, conn) != 0) {
+            return;
+        }
+    }
+
+    if((ret = conn_body(conn, n == 0, &err)) != 0) {
+        conn_finish(pool, conn, ret < 0 ? err : FETCH_SUCCESS, ret < 0 ? errno : 0);
+    }
+}
+
+static int conn_head(fetch_pool_t *pool, fetch_conn_t *conn) {
+    // Determine how the body is delimited
+    http_parser_t *res = &conn->parser;
+    fetch_req_t *req = conn->fetch;
+    req->status = res->status;
+    conn->chunked = http_is_chunked(res->headers.known[HTTP_HDR_TRANSFER_ENCODING]);
+    conn->remaining = -1;
+    http_slice_t content_len = res->headers.known[HTTP_HDR_CONTENT_LENGTH];
+    if(res->status / 100 == 1 || res->status == 204 || res->status == 304) {
+        conn->remaining = 0;
+    } else if(conn->chunked) {
+        http_chunked_init(&conn->dec);
+    } else if(content_len.ptr != NULL) {
+        if(http_parse_num(content_len, &conn->remaining) != 0) {
+            conn_finish(pool, conn, FETCH_ERR_PROTOCOL, 0);
+            return -1;
+        }
+    }
+    http_slice_t conn_hdr = res->headers.known[HTTP_HDR_CONNECTION];
+    conn->keep_alive = !req->close && (conn->chunked || conn->remaining >= 0)
+        && !(conn_hdr.ptr != NULL && http_slice_eq(conn_hdr, "close"));
+
+    if(req->range_first >= 0 && res->status == 206) {
+        // The range must start where it was requested
+        http_slice_t content_range = http_header_find(&res->headers, "Content-Range");
+        char *end;
+        if(content_range.ptr == NULL || content_range.len < 6 || strncmp(content_range.ptr, "bytes ", 6) != 0
+                || strtoll(content_range.ptr + 6, &end, 10) != req->range_first || *end != '-') {
+            conn_finish(pool, conn, FETCH_ERR_PROTOCOL, 0);
+            return -1;
+        }
+        conn->deliver = 1;
+    } else if(res->status == 200) {
+        conn->deliver = 1;
+    }
+
+    // The sink may be set up by on_head
+    if(req->on_head != NULL && req->on_head(req, res) != 0) {
+        conn->keep_alive = 0;
+        conn_finish(pool, conn, FETCH_ERR_SINK, errno);
+        return -1;
+    }
+    conn->out_off = req->sink_off;
+    if(conn->out_off >= 0 && req->range_first >= 0 && res->status == 200) {
+        // Whole resource instead of the range
+        conn->out_off -= req->range_first;
+        if(conn->out_off < 0) {
+            conn->keep_alive = 0;
+            conn_finish(pool, conn, FETCH_ERR_SINK, ESPIPE);
+            return -1;
+        }
+    }
+    conn->splice = conn->deliver && !conn->chunked && req->sink_fd >= 0 && pool->pipefd[0] >= 0
+        && can_splice(req->sink_fd);
+
+    conn->len -= res->head_len;
+    memmove(conn->buf, conn->buf + res->head_len, conn->len);
+    conn->state = FETCH_STATE_BODY;
+    return 0;
+}
+
+static int conn_body(fetch_conn_t *conn, int eof, fetch_err_t *err) {
+    size_t data_len = conn->len, used = conn->len;
+    int done = 0;
+    if(conn->chunked) {
+        int ret = http_chunked_decode(&conn->dec, conn->buf, conn->len, &data_len, &used);
+        if(ret == HTTP_PARSE_ERROR) {
+            *err = FETCH_ERR_PROTOCOL;
+            return -1;
+        }
+        done = ret == HTTP_PARSE_DONE;
+    } else if(conn->remaining >= 0) {
+        if((int64_t)data_len > conn->remaining) {
+            data_len = used = conn->remaining;
+        }
+        conn->remaining -= data_len;
+        done = conn->remaining == 0;
+    } else {
+        done = eof;
+    }
+
+    if(data_len > 0 && conn->deliver && conn_deliver(conn, conn->buf, data_len) != 0) {
+        conn->keep_alive = 0;
+        *err = FETCH_ERR_SINK;
+        return -1;
+    }
+    conn->fetch->body_bytes += data_len;
+    conn->len -= used;
+    memmove(conn->buf, conn->buf + used, conn->len);
+
+    if(!done && eof) {
+        *err = FETCH_ERR_PROTOCOL;
+        return -1;
+    }
+    return done;
+}
+
+static int conn_splice(fetch_pool_t *pool, fetch_conn_t *conn, fetch_err_t *err) {
+    fetch_req_t *req = conn->fetch;
+    if(conn->remaining == 0) {
+        return 1;
+    }
+    size_t want = conn->remaining < 0 || conn->remaining > FETCH_SPLICE_SIZE ? FETCH_SPLICE_SIZE : (size_t)conn->remaining;
+    ssize_t n;
+    do {
+        n = splice(conn->fd, NULL, pool->pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        *err = FETCH_ERR_CONNECT;
+        return -1;
+    }
+    if(n == 0) {
+        if(conn->remaining < 0) {
+            return 1;
+        }
+        *err = FETCH_ERR_PROTOCOL;
+        return -1;
+    }
+
+    // Empty the pipe completely, it is shared by all connections
+    ssize_t left = n;
+    while(left > 0) {
+        loff_t off = conn->out_off;
+        ssize_t moved = splice(pool->pipefd[0], NULL, req->sink_fd, conn->out_off >= 0 ? &off : NULL, left,
+            SPLICE_F_MOVE);
+        if(moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if(moved <= 0) {
+            int sys_err = moved < 0 ? errno : EIO;
+            char discard[4096];
+            while(left > 0 && (moved = read(pool->pipefd[0], discard, left < (ssize_t)sizeof(discard) ? left : (ssize_t)sizeof(discard))) > 0) {
+                left -= moved;
+            }
+            conn->keep_alive = 0;
+            errno = sys_err;
+            *err = FETCH_ERR_SINK;
+            return -1;
+        }
+        left -= moved;
+        if(conn->out_off >= 0) {
+            conn->out_off += moved;
+        }
+        if(req->on_progress != NULL) {
+            req->on_progress(req, moved);
+        }
+    }
+    req->body_bytes += n;
+    if(conn->remaining > 0) {
+        conn->remaining -= n;
+    }
+    return conn->remaining == 0;
+}
+
+static int conn_deliver(fetch_conn_t *conn, const char *data, size_t len) {
+    fetch_req_t *req = conn->fetch;
+    if(req->sink_fd < 0) {
+        return req->on_data != NULL ? req->on_data(req, data, len) : 0;
+    }
+    if(write_all(req->sink_fd, data, len, conn->out_off) != 0) {
+        return -1;
+    }
+    if(conn->out_off >= 0) {
+        conn->out_off += len;
+    }
+    if(req->on_progress != NULL) {
+        req->on_progress(req, len);
+    }
+    return 0;
+}
+
+static void conn_finish(fetch_pool_t *pool, fetch_conn_t *conn, fetch_err_t err, int sys_errno) {
+    fetch_req_t *req = conn->fetch;
+    fetch_host_t *host = conn->host;
+    conn->fetch = NULL;
+
+    if(err == FETCH_ERR_CONNECT && conn->reused && !req->retried
+            && (conn->state == FETCH_STATE_SENDING || (conn->state == FETCH_STATE_HEAD && conn->len == 0))) {
+        // The server closed the idle connection, try again on a new one
+        req->retried = 1;
+        req->next = host->queue;
+        host->queue = req;
+        if(host->queue_tail == NULL) {
+            host->queue_tail = req;
+        }
+        conn_close(pool, conn);
+        return;
+    }
+
+    if(err != FETCH_SUCCESS) {
+        conn->keep_alive = 0;
+    } else if(!conn->deliver) {
+        err = FETCH_ERR_STATUS;
+    }
+    int keep = conn->keep_alive;
+    conn->state = FETCH_STATE_IDLE;
+    complete(pool, req, err, sys_errno);
+
+    // Only one idle connection per host, the others would tie up the server
+    if(!keep || (host->queue == NULL && (host->conn_cnt > 1 || !pool->keep_idle))) {
+        conn_close(pool, conn);
+        return;
+    }
+    conn->reused = 1;
+    if(host->queue != NULL) {
+        conn->state = FETCH_STATE_SENDING;
+        if(conn_start(pool, conn) == 0) {
+            // Send right away, the socket is most likely writable
+            conn_step(pool, conn);
+            return;
+        }
+        conn->state = FETCH_STATE_IDLE;
+    }
+}
+
+static void conn_close(fetch_pool_t *pool, fetch_conn_t *conn) {
+    fetch_host_t *host = conn->host;
+    if(conn->fetch != NULL) {
+        conn->keep_alive = 0;
+        conn_finish(pool, conn, FETCH_ERR_CONNECT, ECONNABORTED);
+        return;
+    }
+    fetch_conn_t **link = &host->conns;
+    while(*link != conn) {
+        link = &(*link)->next;
+    }
+    *link = conn->next;
+    close(conn->fd);
+    free(conn);
+    host->conn_cnt--;
+    pool->conn_cnt--;
+    dispatch(pool, host);
+}
+
+static void complete(fetch_pool_t *pool, fetch_req_t *req, fetch_err_t err, int sys_errno) {
+    req->err = err;
+    req->sys_errno = sys_errno;
+    pool->pending--;
+    if(req->on_done != NULL) {
+        req->on_done(req);
+    }
+}
+
+static int can_splice(int fd) {
+    struct stat st;
+    int flags = fcntl(fd, F_GETFL);
+    if(flags < 0 || fstat(fd, &st) != 0) {
+        return 0;
+    }
+    return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) || (S_ISREG(st.st_mode) && (flags & O_APPEND) == 0);
+}
+
+static int write_all(int fd, const char *buf, size_t len, int64_t offset) {
+    while(len > 0) {
+        ssize_t n = offset >= 0 ? pwrite(fd, buf, len, offset) : write(fd, buf, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        if(offset >= 0) {
+            offset += n;
+        }
+    }
+    return 0;
+}
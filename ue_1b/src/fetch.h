@@ -0,0 +1,208 @@
+/**
+ * @file fetch.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Embeddable http client with a pool of keep-alive connections.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Requests are described by fetch_req_t objects and submitted to a pool,
+ * which groups them by host and port and fetches them over up to max_conns
+ * concurrent non-blocking connections per host. Connections are kept open after
+ * a response and reused for queued requests to the same host; once a host has no
+ * queued requests, its last connection stays open for later requests, also across
+ * calls of fetch_run (unless keep_idle is cleared). The response body is written
+ * to a file descriptor (at a given offset or sequentially) or passed to a
+ * callback; where the file descriptor
+ * allows it, the body is moved with splice without being copied to user space.
+ * Errors are reported per request as fetch_err_t values, the module never prints
+ * or exits. A pool is not thread safe; each thread should use its own pool.
+ * The pool sits on top of the http module: requests are built and responses are
+ * parsed and decoded with its parser (parser.h), while the blocking FILE based
+ * message functions of http.h are not used, since a single thread has to serve
+ * many connections at once.
+ */
+
+#ifndef FETCH_H
+#define FETCH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "parser.h"
+
+/**
+ * @brief Results of a request.
+ */
+typedef enum fetch_err {
+    FETCH_SUCCESS = 0,
+
+    // The URL is not a valid http URL
+    FETCH_ERR_URL,
+
+    // The host name could not be resolved
+    FETCH_ERR_RESOLVE,
+
+    // Connecting failed or the connection was lost (sys_errno is set)
+    FETCH_ERR_CONNECT,
+
+    // The response is malformed or incomplete
+    FETCH_ERR_PROTOCOL,
+
+    // The response has a status other than 200 (or 206 for range requests)
+    FETCH_ERR_STATUS,
+
+    // Writing the body failed or a callback aborted the request (sys_errno is set)
+    FETCH_ERR_SINK,
+
+    // Out of memory (sys_errno is set)
+    FETCH_ERR_INTERNAL
+} fetch_err_t;
+
+struct fetch_host;
+
+/**
+ * @brief A GET request and its result.
+ * @details host, port and path are set by fetch_req_init; the remaining request
+ * fields may be changed before the request is submitted.
+ *
+ * If range_first >= 0, only the bytes range_first to range_last (inclusive) are
+ * requested. If close is set, the connection is closed after the response.
+ *
+ * The body of a successful response is written to sink_fd, at offset sink_off
+ * with pwrite or (sink_off == -1) sequentially with write. sink_off is the offset
+ * of the first requested byte, so if the server sends the whole resource in
+ * response to a range request, it is written at sink_off - range_first. If sink_fd
+ * is -1, the body is passed to on_data instead, which returns -1 (with errno set)
+ * to abort the request. Bodies of responses with other statuses are discarded.
+ *
+ * on_head (if != NULL) is called with the parsed response head before any body
+ * data is processed and may set up the sink (e.g. open sink_fd once the status
+ * is known); it returns -1 (with errno set) to abort the request. on_progress is
+ * called with the number of body bytes written after each write. on_done is called
+ * once the request is finished, successfully or not; it may submit further
+ * requests. arg is not used by the module.
+ *
+ * After completion, err holds the result, sys_errno the errno value for errors
+ * that have one, status the response status (0 if no response was received) and
+ * body_bytes the number of received body bytes.
+ */
+typedef struct fetch_req {
+    char *url;
+    char *host;
+    char *port;
+    char *path;
+    int64_t range_first;
+    int64_t range_last;
+    int close;
+
+    int sink_fd;
+    int64_t sink_off;
+    int (*on_data)(struct fetch_req *req, const char *data, size_t len);
+    int (*on_head)(struct fetch_req *req, const http_parser_t *res);
+    void (*on_progress)(struct fetch_req *req, int64_t len);
+    void (*on_done)(struct fetch_req *req);
+    void *arg;
+
+    fetch_err_t err;
+    int sys_errno;
+    int status;
+    int64_t body_bytes;
+
+    int retried;
+    struct fetch_req *next;
+} fetch_req_t;
+
+/**
+ * @brief A pool of connections.
+ * @details Requests are queued at their host, hosts are kept in a list together
+ * with their resolved address and their open connections. keep_idle (set by
+ * fetch_pool_init) controls whether the last connection to a host is kept open
+ * when there are no queued requests for it. timeout (-1 by fetch_pool_init) is
+ * the time in milliseconds fetch_run waits for progress of any connection before
+ * it fails the requests in progress with FETCH_ERR_CONNECT (ETIMEDOUT), -1 to
+ * wait without limit. pipefd is used to splice bodies to their sink (-1 if splice
+ * is not available). pending counts submitted requests which are not finished.
+ */
+typedef struct fetch_pool {
+    char *default_port;
+    int max_conns;
+    int keep_idle;
+    int timeout;
+    struct fetch_host *hosts;
+    int conn_cnt;
+    int pipefd[2];
+    int pending;
+} fetch_pool_t;
+
+/**
+ * @brief Initialize a pool.
+ *
+ * @param pool Pool which should be initialized.
+ * @param default_port Port (or service name) used for URLs without port.
+ * @param max_conns Maximum number of concurrent connections per host.
+ * @return fetch_err_t FETCH_SUCCESS, or FETCH_ERR_INTERNAL if allocating failed.
+ */
+fetch_err_t fetch_pool_init(fetch_pool_t *pool, const char *default_port, int max_conns);
+
+/**
+ * @brief Close all connections of a pool and free its resources.
+ *
+ * @param pool Pool without pending requests.
+ */
+void fetch_pool_destroy(fetch_pool_t *pool);
+
+/**
+ * @brief Initialize a request for a URL.
+ *
+ * @param req Request which should be initialized.
+ * @param url URL of the form "http://host[:port]/path".
+ * @return fetch_err_t FETCH_SUCCESS, FETCH_ERR_URL for invalid URLs or
+ * FETCH_ERR_INTERNAL if allocating failed.
+ *
+ * @details The request fetches the whole resource into an unset sink (sink_fd
+ * -1, no callbacks), so at least the sink must be set up before submitting it.
+ * The request must be freed with fetch_req_free, also if initializing failed.
+ */
+fetch_err_t fetch_req_init(fetch_req_t *req, const char *url);
+
+/**
+ * @brief Free the strings of a request.
+ *
+ * @param req Request which is not pending.
+ */
+void fetch_req_free(fetch_req_t *req);
+
+/**
+ * @brief Queue a request at a pool.
+ *
+ * @param pool Pool.
+ * @param req Initialized request, which must stay valid until on_done was called.
+ * @return fetch_err_t FETCH_SUCCESS, or FETCH_ERR_INTERNAL if allocating failed.
+ *
+ * @details The host of the request is resolved when it is used for the first
+ * time. The request is started by fetch_run; its result (including resolve
+ * errors) is reported through its fields and on_done.
+ */
+fetch_err_t fetch_submit(fetch_pool_t *pool, fetch_req_t *req);
+
+/**
+ * @brief Process requests until all submitted requests are finished.
+ *
+ * @param pool Pool.
+ * @return fetch_err_t FETCH_SUCCESS, or FETCH_ERR_INTERNAL if waiting for the
+ * connections failed (errno is set).
+ *
+ * @details Connections which are still open afterwards stay in the pool for the
+ * next requests.
+ */
+fetch_err_t fetch_run(fetch_pool_t *pool);
+
+/**
+ * @brief Describe a result.
+ *
+ * @param req Finished request.
+ * @return const char* Description of err, or the description of sys_errno (as
+ * returned by strerror) for errors which have one.
+ */
+const char *fetch_strerror(const fetch_req_t *req);
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file hist.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the histograms defined in hist.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Buckets [0, HIST_SUB_COUNT) hold the values with the same index. After
+ * that, each group of HIST_SUB_COUNT / 2 buckets covers the values with the same
+ * most significant bit, the bucket within the group is selected by the
+ * HIST_SUB_BITS - 1 bits following it.
+ */
+
+#include <string.h>
+
+#include "hist.h"
+
+/**
+ * @brief Compute the bucket of a value.
+ *
+ * @param value Value.
+ * @return int Index of the bucket.
+ */
+static int bucket_of(uint64_t value);
+
+/**
+ * @brief Compute the largest value of a bucket.
+ *
+ * @param bucket Index of the bucket.
+ * @return uint64_t Largest value counted in the bucket.
+ */
+static uint64_t bucket_max(int bucket);
+
+void hist_init(hist_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+void hist_record(hist_t *hist, uint64_t value) {
+    hist->buckets[bucket_of(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if(value > hist->max) {
+        hist->max = value;
+    }
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    for(int i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if(src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t hist_percentile(const hist_t *hist, double percent) {
+    // Count the buckets as the total, count may be ahead of them while merging
+    uint64_t total = 0;
+    for(int i = 0; i < HIST_BUCKETS; i++) {
+        total += hist->buckets[i];
+    }
+    if(total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percent / 100.0 * total + 0.5);
+    if(rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if(seen >= rank) {
+            uint64_t value = bucket_max(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static int bucket_of(uint64_t value) {
+    if(value >= (uint64_t)1 << HIST_VALUE_BITS) {
+        return HIST_BUCKETS - 1;
+    }
+    if(value < HIST_SUB_COUNT) {
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);
+    return HIST_SUB_COUNT + (shift - 1) * (HIST_SUB_COUNT / 2) + (int)(value >> shift) - HIST_SUB_COUNT / 2;
+}
+
+static uint64_t bucket_max(int bucket) {
+    if(bucket < HIST_SUB_COUNT) {
+        return bucket;
+    }
+    int shift = (bucket - HIST_SUB_COUNT) / (HIST_SUB_COUNT / 2) + 1;
+    uint64_t sub = (bucket - HIST_SUB_COUNT) % (HIST_SUB_COUNT / 2) + HIST_SUB_COUNT / 2;
+    return ((sub + 1) << shift) - 1;
+}
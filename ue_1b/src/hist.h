@@ -0,0 +1,91 @@
+/**
+ * @file hist.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Log-linear latency histograms.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Values (typically nanoseconds) are counted in buckets in the style of
+ * HdrHistogram: values below HIST_SUB_COUNT have a bucket each, larger values are
+ * grouped by their most significant bit into HIST_SUB_COUNT / 2 linear sub-buckets,
+ * so every bucket is narrower than 1/64 of its values. Recording a value takes
+ * constant time without allocating, histograms can be merged by adding their
+ * counts and percentiles are read with a single scan. A histogram is not thread
+ * safe; concurrent writers should each record into their own histogram.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/**
+ * @brief Number of bits of the sub-bucket index.
+ */
+#define HIST_SUB_BITS 7
+
+/**
+ * @brief Number of values with a bucket of their own.
+ */
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+
+/**
+ * @brief Number of significant bits of recorded values.
+ * @details Larger values (more than 18 minutes in nanoseconds) are counted in the
+ * last bucket.
+ */
+#define HIST_VALUE_BITS 40
+
+/**
+ * @brief Number of buckets of a histogram.
+ */
+#define HIST_BUCKETS (HIST_SUB_COUNT + (HIST_VALUE_BITS - HIST_SUB_BITS) * (HIST_SUB_COUNT / 2))
+
+/**
+ * @brief A histogram.
+ * @details count is the number of recorded values, sum their sum and max the
+ * largest value.
+ */
+typedef struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+/**
+ * @brief Reset a histogram.
+ *
+ * @param hist Histogram.
+ */
+void hist_init(hist_t *hist);
+
+/**
+ * @brief Count a value.
+ *
+ * @param hist Histogram.
+ * @param value Value which should be recorded.
+ */
+void hist_record(hist_t *hist, uint64_t value);
+
+/**
+ * @brief Add the values of a histogram to another.
+ *
+ * @param dst Histogram the values are added to.
+ * @param src Histogram whose values are added.
+ *
+ * @details src may be written concurrently, in that case the result is a
+ * consistent enough snapshot for reporting.
+ */
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/**
+ * @brief Get a percentile.
+ *
+ * @param hist Histogram.
+ * @param percent Percentile (e.g. 99.9).
+ * @return uint64_t Largest value of the bucket the percentile falls into (at most
+ * max), 0 if the histogram is empty.
+ */
+uint64_t hist_percentile(const hist_t *hist, double percent);
+
+#endif
@@ -7,69 +7,132 @@
  * @details This module contains the implementation of the function defined in http.h.
  * As reading requests/responses and writing requests/responses have a lot in common 
  * most of the code (such as for reading headers, piping body between socket and files)
- *  is abstracted into common static functions.
+ *  is abstracted into common static functions. Message heads are parsed with the 
+ * incremental parser of the parser module; the functions of this module copy the
+ * parse results into http_frame_t objects and decode chunked bodies with its chunked
+ * decoder. Other response bodies are moved from the socket to the output file with
+ * splice, without passing through stdio buffers.
  */
 
+// splice
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <limits.h>
 #include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include "http.h"
+#include "parser.h"
+
+/**
+ * @brief Maximum number of body bytes moved by a single splice when receiving a 
+ * response (also the requested pipe capacity).
+ */
+#define RECV_SPLICE_SIZE (1024 * 1024)
+
+/**
+ * @brief Size of the buffer used to receive response bodies which cannot be spliced.
+ */
+#define RECV_BUF_SIZE (256 * 1024)
+
+/**
+ * @brief Alignment of the receive buffer.
+ */
+#define RECV_BUF_ALIGN 4096
+
+/**
+ * @brief Destination of a received response body.
+ * @details If the output file supports splice, the data is moved through pipefd
+ * without being copied to user space. Otherwise it is received into buf, which is
+ * allocated on first use, and written to drain (-1 if the body is discarded).
+ */
+typedef struct recv_sink {
+    FILE *out;
+    int drain;
+    int pipefd[2];
+    char *buf;
+} recv_sink_t;
 
 void *http_errvar = NULL;
 
 /**
- * @brief Writes http headers.
+ * @brief Writes the head of a http message.
  * 
- * @param sock Stdio stream where the headers should be serialized to.
- * @param res Http frame containing the headers.
- * @return http_err_t HTTP_SUCCESS if writing the headers was successful, and an 
+ * @param sock Stdio stream where the head should be serialized to.
+ * @param first First token of the start line.
+ * @param second Second token of the start line.
+ * @param third Third token of the start line.
+ * @param headers Header table of the message.
+ * @return http_err_t HTTP_SUCCESS if writing the head was successful, and an 
  * error value as defined in http_err_t otherwise. 
  * 
- * @details Writes a linked list (starting with res->header_first) of headers 
- * fields (objects of http_header_t) to the given stdio stream. Each header 
- * will be written as single line ending with "\r\n". After all headers were 
- * written, the end header part of the http message will be indicated with an
- * empty line "\r\n".
+ * @details Serializes the start line "<first> <second> <third>\r\n", all header 
+ * fields (one "<name>: <value>\r\n" line each, well-known fields first) and the 
+ * terminating empty line into an io vector and writes it to the file descriptor 
+ * of sock with a single writev call (repeated only on partial writes). Data 
+ * buffered in sock is flushed beforehand.
  * Global variables: http_errvar.
  */
-static http_err_t write_headers(FILE *sock, http_frame_t *res);
+static http_err_t write_head(FILE *sock, const char *first, const char *second, const char *third,
+        const http_headers_t *headers);
+
+/**
+ * @brief Allocates memory for a value of a frame.
+ * 
+ * @param frame Frame the memory belongs to.
+ * @param size Number of bytes.
+ * @return void* The memory, or NULL if the allocation failed.
+ * 
+ * @details Allocates from frame->arena if set and with malloc otherwise.
+ */
+static void *frame_alloc(http_frame_t *frame, size_t size);
 
 /**
- * @brief Reads headers from stream.
+ * @brief Copies a slice to a null terminated string belonging to a frame.
  * 
- * @param sock Stdio stream where the headers should be read from.
- * @param res Http frame where the start of the header list show be stored to.
- * @return http_err_t HTTP_SUCCESS if reading the headers was successful, and an 
+ * @param frame Frame the string belongs to.
+ * @param slice Slice which should be copied.
+ * @return char* The string, or NULL if the allocation failed.
+ */
+static char *frame_strndup(http_frame_t *frame, http_slice_t slice);
+
+/**
+ * @brief Reads a message head from a stream and parses it.
+ * 
+ * @param sock Stdio stream where the head should be read from.
+ * @param parser Initialized parser which will contain the parse results.
+ * @param buf Buffer of at least HTTP_MAX_HEAD bytes where the head will be stored to.
+ * @return http_err_t HTTP_SUCCESS if a complete and valid head was read, and an 
  * error value as defined in http_err_t otherwise.
  * 
- * @details This is the reverse function of write_headers and reads all header
- * fields of a http message from the given stream into a linked list of dynamically
- * allocated http_header_t objects. A pointer to the first field will be stored to
- * res->header_first.
+ * @details Reads the head character by character, so that no byte following the
+ * empty line which terminates the head is consumed from the stream (the body is 
+ * left on the stream). The parser is invoked once per received line. 
  * Global variables: http_errvar.
  */
-static http_err_t read_headers(FILE *sock, http_frame_t **res);
+static http_err_t read_head(FILE *sock, http_parser_t *parser, char *buf);
 
 /**
- * @brief Reads the three tokens of the first line of an http message.
+ * @brief Copies the parsed header fields to a http frame.
  * 
- * @param sock Stream where the line should be read from.
- * @param line Pointer where the line pointer should be written to.
- * @param first Pointer where the pointer to the first token shoud be written to.
- * @param second Pointer where the pointer to the second token shoud be written to.
- * @param third Pointer where the pointer to the third token shoud be written to.
- * @return http_err_t http_err_t HTTP_SUCCESS if reading the tokens was successful, and an 
+ * @param parser Parser which completed a message head.
+ * @param buf Buffer the head was parsed from.
+ * @param frame Http frame where the headers should be stored to.
+ * @return http_err_t HTTP_SUCCESS if copying the headers was successful, and an 
  * error value as defined in http_err_t otherwise.
  * 
- * @details Extracts three space separated tokens (the last token will 
- * contain the remaining line) from the given stream and stores the token pointer
- * to the given addresses. Line will pointer to the begin of the allocated memory space.
- * Global variables: http_errvar.
+ * @details Copies the head to a single dynamically allocated buffer stored to 
+ * frame->head and fills frame->headers with the parsed header table, rebased to 
+ * that copy. Sets frame->body_len to the value of the Content-Length header or to 
+ * -1 if there is no such header.
  */
-static http_err_t read_first_line(FILE *sock, char **line, char **first, char **second, char **third);
+static http_err_t copy_headers(http_parser_t *parser, const char *buf, http_frame_t *frame);
 
 /**
  * @brief Pipes the src to drain.
@@ -77,7 +140,8 @@ static http_err_t read_first_line(FILE *sock, char **line, char **first, char **
  * @param src Source of the data pipe.
  * @param drain Drain of the data pipe.
  * @param len Number of characters to be read from src and written to drain. The value
- * -1 indicates that the operation should last until EOF of src is reached.
+ * -1 indicates that the operation should last until EOF of src is reached. If drain
+ * is NULL, the data is discarded.
  * @return http_err_t HTTP_SUCCESS if the pipe operation was successful, and an 
  * error value as defined in http_err_t otherwise.
  * 
@@ -85,7 +149,7 @@ static http_err_t read_first_line(FILE *sock, char **line, char **first, char **
  * writes it to drain. Used for sending and receiving request/response body.
  * Global variables: http_errvar.
  */
-static http_err_t stream_pipe(FILE *src, FILE *drain, int len);
+static http_err_t stream_pipe(FILE *src, FILE *drain, int64_t len);
 
 /**
  * @brief Helper function for reading the remaining request if a protocol error occured
@@ -101,6 +165,111 @@ static http_err_t stream_pipe(FILE *src, FILE *drain, int len);
  */
 static http_err_t skip_msg(FILE *sock);
 
+/**
+ * @brief Decode a chunked message body.
+ * 
+ * @param sock Stream the chunked body is read from.
+ * @param out Stream the decoded data is written to.
+ * @return http_err_t HTTP_SUCCESS if the whole body (including the trailer section)
+ * was read, an error value as defined in http_err_t otherwise.
+ * 
+ * @details The body is decoded by the chunked decoder of the parser module and
+ * written to out piece by piece, so it is never buffered as a whole. Chunk data is
+ * read in blocks, the framing byte by byte, so no byte of the next message is
+ * taken from sock. Chunk extensions and trailer fields are ignored.
+ * Global variables: http_errvar.
+ */
+static http_err_t recv_chunked(FILE *sock, FILE *out);
+
+/**
+ * @brief Look at data pending on a socket without consuming it.
+ * 
+ * @param sock Socket.
+ * @param buf Buffer the data is copied to.
+ * @param have Number of bytes already looked at.
+ * @param cap Size of buf.
+ * @return ssize_t Number of pending bytes copied to buf (more than have), or -1 if
+ * the connection was closed before (errno is ENODATA) or an error occured.
+ * 
+ * @details Waits until more than have bytes are pending, then copies as many as 
+ * are available (up to cap).
+ */
+static ssize_t peek_more(int sock, char *buf, size_t have, size_t cap);
+
+/**
+ * @brief Take bytes which were looked at with peek_more off a socket.
+ * 
+ * @param sock Stream of the socket.
+ * @param buf Buffer the bytes are copied to (again).
+ * @param len Number of bytes.
+ * @return http_err_t HTTP_SUCCESS, or HTTP_ERR_STREAM if receiving failed.
+ * Global variables: http_errvar.
+ */
+static http_err_t take_peeked(FILE *sock, char *buf, size_t len);
+
+/**
+ * @brief Read a message head from a socket.
+ * 
+ * @param sock Stream of the socket (without buffered input).
+ * @param parser Initialized parser.
+ * @param buf Buffer of HTTP_MAX_HEAD bytes the head is stored to.
+ * @return http_err_t HTTP_SUCCESS, or an error value as defined in http_err_t.
+ * 
+ * @details The pending data is parsed without consuming it; once the parser found
+ * the end of the head, exactly the bytes of the head are taken from the socket. 
+ * The body is left on the socket for recv_sink_move.
+ * Global variables: http_errvar.
+ */
+static http_err_t recv_head(FILE *sock, http_parser_t *parser, char *buf);
+
+/**
+ * @brief Prepare receiving a body to an output stream.
+ * 
+ * @param sink Sink which should be initialized.
+ * @param out Output stream, or NULL if the body should be discarded.
+ * @return http_err_t HTTP_SUCCESS, or HTTP_ERR_STREAM if out could not be flushed.
+ * 
+ * @details Data buffered in out is flushed, as the body is written to its file 
+ * descriptor directly. A pipe is only set up if splice can write to the file 
+ * (pipes, sockets and regular files not opened for appending).
+ * Global variables: http_errvar.
+ */
+static http_err_t recv_sink_open(recv_sink_t *sink, FILE *out);
+
+/**
+ * @brief Move body bytes from a socket to a sink.
+ * 
+ * @param sink Sink.
+ * @param sock Socket.
+ * @param len Number of bytes to move, or -1 to move data until the connection is 
+ * closed.
+ * @return http_err_t HTTP_SUCCESS, or HTTP_ERR_STREAM if the connection was closed 
+ * early (errno is ENODATA) or an io error occured.
+ * Global variables: http_errvar.
+ */
+static http_err_t recv_sink_move(recv_sink_t *sink, FILE *sock, int64_t len);
+
+/**
+ * @brief Release the pipe and buffer of a sink.
+ */
+static void recv_sink_close(recv_sink_t *sink);
+
+/**
+ * @brief Receive a chunked body from a socket.
+ * 
+ * @param sock Socket.
+ * @param sink Sink the decoded data is written to.
+ * @return http_err_t HTTP_SUCCESS if the whole body (including the trailer section)
+ * was read, an error value as defined in http_err_t otherwise.
+ * 
+ * @details The pending data is decoded by the chunked decoder of the parser module
+ * in the buffer of the sink without consuming it; afterwards exactly the decoded 
+ * bytes are taken from the socket, so a following message stays on it. Unlike
+ * bodies with a known length, chunked bodies therefore pass through user space.
+ * Global variables: http_errvar.
+ */
+static http_err_t recv_chunked_sock(FILE *sock, recv_sink_t *sink);
+
 http_err_t parse_url(char *url, char **hostname, char **file_path) {
     // 7 == length of "http://"
     if(strncmp(url, "http://", 7) != 0) {
@@ -135,40 +304,497 @@ http_err_t parse_url(char *url, char **hostname, char **file_path) {
     return HTTP_SUCCESS;
 }
 
-http_err_t http_frame(http_frame_t **frame) {
-    *frame = malloc(sizeof(http_frame_t));
+http_err_t http_frame(http_frame_t **frame, arena_t *arena) {
+    *frame = arena != NULL ? arena_alloc(arena, sizeof(http_frame_t)) : malloc(sizeof(http_frame_t));
     if(*frame == NULL) {
         return HTTP_ERR_INTERNAL;
     }
     memset(*frame, 0, sizeof(**frame));
+    http_headers_init(&(*frame)->headers);
+    (*frame)->arena = arena;
     return HTTP_SUCCESS;
 }
 
 void http_free_frame(http_frame_t *frame) {
+    if(frame == NULL || frame->arena != NULL) {
+        return;
+    }
     free(frame->status_text);
     free(frame->method);
     free(frame->file_path);
     free(frame->body);
+    free(frame->head);
 
-    http_header_t *last_header, *cur_header = frame->header_first;
-    while(cur_header != NULL) {
-        last_header = cur_header;
-        cur_header = cur_header->next;
-        free(last_header->name);
-        free(last_header->value);
-        free(last_header);
+    free(frame);
+}
+
+http_slice_t http_date(http_date_t *date) {
+    time_t now = time(NULL);
+    if(now != date->sec || date->len == 0) {
+        // On failure, the previous line is kept
+        if(http_format_date(date->line + 6, now) != 0) {
+            memcpy(date->line, "Date: ", 6);
+            memcpy(date->line + 6 + HTTP_DATE_LEN, "\r\n", 2);
+            date->len = 6 + HTTP_DATE_LEN + 2;
+            date->sec = now;
+        }
     }
+    http_slice_t line = {date->line, date->len};
+    return line;
+}
 
-    free(frame);
+size_t http_format_date(char *buf, time_t t) {
+    struct tm tm;
+    if(gmtime_r(&t, &tm) == NULL) {
+        return 0;
+    }
+    if(strftime(buf, HTTP_DATE_LEN + 1, "%a, %d %b %Y %H:%M:%S GMT", &tm) != HTTP_DATE_LEN) {
+        return 0;
+    }
+    return HTTP_DATE_LEN;
 }
 
-http_err_t http_send_req(FILE* sock, http_frame_t *req) {
-    if(fprintf(sock, "%s %s %s\r\n", req->method, req->file_path, HTTP_VERSION) < 0) {
-        http_errvar = sock;
-        return HTTP_ERR_STREAM;
+int http_parse_date(http_slice_t date, time_t *t) {
+    static const char *const months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    const char *p = date.ptr;
+    if(date.len != HTTP_DATE_LEN || p[3] != ',' || p[4] != ' ' || p[7] != ' ' || p[11] != ' '
+            || p[16] != ' ' || p[19] != ':' || p[22] != ':' || strncmp(p + 25, " GMT", 4) != 0) {
+        return -1;
+    }
+    static const int digits[] = {5, 6, 12, 13, 14, 15, 17, 18, 20, 21, 23, 24};
+    for(size_t i = 0; i < sizeof(digits) / sizeof(digits[0]); i++) {
+        if(p[digits[i]] < '0' || p[digits[i]] > '9') {
+            return -1;
+        }
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mon = -1;
+    for(int i = 0; i < 12; i++) {
+        if(strncmp(p + 8, months + 3 * i, 3) == 0) {
+            tm.tm_mon = i;
+        }
+    }
+    if(tm.tm_mon < 0) {
+        return -1;
+    }
+#define DIGITS2(i) ((p[i] - '0') * 10 + (p[i + 1] - '0'))
+    tm.tm_mday = DIGITS2(5);
+    tm.tm_year = DIGITS2(12) * 100 + DIGITS2(14) - 1900;
+    tm.tm_hour = DIGITS2(17);
+    tm.tm_min = DIGITS2(20);
+    tm.tm_sec = DIGITS2(23);
+#undef DIGITS2
+    if(tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+        return -1;
+    }
+    *t = timegm(&tm);
+    return *t == (time_t)-1 ? -1 : 0;
+}
+
+size_t http_format_etag(char *buf, const struct stat *st) {
+    return snprintf(buf, HTTP_ETAG_MAX + 1, "\"%llx-%llx-%llx.%lx\"", (unsigned long long)st->st_ino,
+        (unsigned long long)st->st_size, (unsigned long long)st->st_mtim.tv_sec, (unsigned long)st->st_mtim.tv_nsec);
+}
+
+int http_etag_match(http_slice_t if_none_match, http_slice_t etag) {
+    // Weak comparison ignores the weakness indicator
+    if(etag.len >= 2 && strncmp(etag.ptr, "W/", 2) == 0) {
+        etag.ptr += 2;
+        etag.len -= 2;
+    }
+
+    const char *p = if_none_match.ptr, *end = if_none_match.ptr + if_none_match.len;
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *tag = p;
+        while(p < end && *p != ',') {
+            p++;
+        }
+        const char *tag_end = p;
+        while(tag_end > tag && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+            tag_end--;
+        }
+        if(tag_end - tag == 1 && *tag == '*') {
+            return 1;
+        }
+        if(tag_end - tag >= 2 && strncmp(tag, "W/", 2) == 0) {
+            tag += 2;
+        }
+        if((size_t)(tag_end - tag) == etag.len && memcmp(tag, etag.ptr, etag.len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int http_accept_encoding(http_slice_t value) {
+    static const struct {
+        const char *name;
+        int encoding;
+    } codings[] = {
+        {"gzip", HTTP_ENC_GZIP},
+        {"x-gzip", HTTP_ENC_GZIP},
+        {"br", HTTP_ENC_BR},
+        {"zstd", HTTP_ENC_ZSTD}
+    };
+
+    int accepted = 0, listed = 0, any = 0;
+    const char *p = value.ptr, *end = value.ptr + value.len;
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *name = p;
+        while(p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        http_slice_t coding = {name, p - name};
+
+        // Only "q=0" (with any number of zero decimals) disables a coding
+        int zero = 0;
+        const char *param = p;
+        while(p < end && *p != ',') {
+            p++;
+        }
+        for(const char *q = param; q + 1 < p; q++) {
+            if((*q == 'q' || *q == 'Q') && q[1] == '=') {
+                zero = q + 2 < p && q[2] == '0';
+                for(const char *d = q + 3; zero && d < p && *d != ' ' && *d != '\t' && *d != ';'; d++) {
+                    zero = *d == '.' || *d == '0';
+                }
+                break;
+            }
+        }
+
+        if(coding.len == 1 && *coding.ptr == '*') {
+            any = zero ? -1 : 1;
+            continue;
+        }
+        for(size_t i = 0; i < sizeof(codings) / sizeof(codings[0]); i++) {
+            if(http_slice_eq(coding, codings[i].name)) {
+                listed |= codings[i].encoding;
+                if(!zero) {
+                    accepted |= codings[i].encoding;
+                }
+            }
+        }
+    }
+    if(any == 1) {
+        accepted |= (HTTP_ENC_GZIP | HTTP_ENC_BR | HTTP_ENC_ZSTD) & ~listed;
+    }
+    return accepted;
+}
+
+const char *http_encoding_name(int encoding) {
+    switch(encoding) {
+    case HTTP_ENC_GZIP:
+        return "gzip";
+    case HTTP_ENC_BR:
+        return "br";
+    case HTTP_ENC_ZSTD:
+        return "zstd";
+    default:
+        return NULL;
+    }
+}
+
+const char *http_encoding_ext(int encoding) {
+    switch(encoding) {
+    case HTTP_ENC_GZIP:
+        return ".gz";
+    case HTTP_ENC_BR:
+        return ".br";
+    case HTTP_ENC_ZSTD:
+        return ".zst";
+    default:
+        return NULL;
+    }
+}
+
+const char *http_mime_type(const char *path) {
+    static const struct {
+        const char *ext;
+        const char *mime;
+    } types[] = {
+        {"html", "text/html"},
+        {"htm", "text/html"},
+        {"css", "text/css"},
+        {"js", "application/javascript"},
+        {"mjs", "application/javascript"},
+        {"json", "application/json"},
+        {"xml", "application/xml"},
+        {"txt", "text/plain"},
+        {"md", "text/markdown"},
+        {"csv", "text/csv"},
+        {"svg", "image/svg+xml"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"webp", "image/webp"},
+        {"ico", "image/x-icon"},
+        {"wasm", "application/wasm"},
+        {"pdf", "application/pdf"},
+        {"woff", "font/woff"},
+        {"woff2", "font/woff2"},
+        {"mp4", "video/mp4"},
+        {"gz", "application/gzip"},
+        {"zip", "application/zip"}
+    };
+
+    const char *dot = strrchr(path, '.');
+    if(dot != NULL && strchr(dot, '/') == NULL) {
+        for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if(strcasecmp(dot + 1, types[i].ext) == 0) {
+                return types[i].mime;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+int http_mime_compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 || strcmp(mime, "application/javascript") == 0
+        || strcmp(mime, "application/json") == 0 || strcmp(mime, "application/xml") == 0
+        || strcmp(mime, "image/svg+xml") == 0 || strcmp(mime, "application/wasm") == 0;
+}
+
+int64_t http_cache_max_age(http_slice_t cache_control) {
+    int64_t max_age = -1, s_maxage = -1;
+    const char *p = cache_control.ptr, *end = cache_control.ptr + cache_control.len;
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *name = p;
+        while(p < end && *p != ',' && *p != '=' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        http_slice_t directive = {name, p - name};
+        int64_t value = -1;
+        if(p < end && *p == '=') {
+            // Values may be quoted, but delta-seconds never are
+            value = 0;
+            for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+                value = value < INT32_MAX ? value * 10 + (*p - '0') : INT32_MAX;
+            }
+            if(p < end && *p != ',' && *p != ' ' && *p != '\t') {
+                value = -1;
+            }
+        }
+        while(p < end && *p != ',') {
+            p++;
+        }
+
+        if(http_slice_eq(directive, "no-store") || http_slice_eq(directive, "no-cache")
+                || http_slice_eq(directive, "private")) {
+            return -1;
+        }
+        if(http_slice_eq(directive, "max-age")) {
+            max_age = value;
+        } else if(http_slice_eq(directive, "s-maxage")) {
+            s_maxage = value;
+        }
+    }
+    return s_maxage >= 0 ? s_maxage : max_age;
+}
+
+size_t http_format_u64(char *buf, uint64_t val) {
+    char tmp[20];
+    size_t len = 0;
+    do {
+        tmp[len++] = '0' + val % 10;
+        val /= 10;
+    } while(val > 0);
+    for(size_t i = 0; i < len; i++) {
+        buf[i] = tmp[len - i - 1];
     }
+    buf[len] = '\0';
+    return len;
+}
 
-    write_headers(sock, req);
+http_err_t http_writev(int fd, struct iovec *iov, int cnt) {
+    while(cnt > 0) {
+        ssize_t written = writev(fd, iov, cnt);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return HTTP_ERR_INTERNAL;
+        }
+        // Skip completely written vectors and advance into a partially written one
+        while(cnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return HTTP_SUCCESS;
+}
+
+http_err_t http_sendfile(int sock, int fd, int64_t offset, int64_t len) {
+    off_t off = offset;
+    while(len > 0) {
+        // Linux transfers at most 0x7ffff000 bytes per call
+        size_t count = len > 0x7ffff000 ? 0x7ffff000 : (size_t)len;
+        ssize_t sent = sendfile(sock, fd, &off, count);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return HTTP_ERR_INTERNAL;
+        }
+        if(sent == 0) {
+            // The file is shorter than announced
+            errno = EPIPE;
+            return HTTP_ERR_INTERNAL;
+        }
+        len -= sent;
+    }
+    return HTTP_SUCCESS;
+}
+
+http_err_t http_write_chunk(int fd, const void *data, size_t len) {
+    char size_line[24];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    struct iovec iov[] = {{size_line, size_len}, {(void *)data, len}, {"\r\n", 2}};
+    if(len == 0) {
+        // The last chunk is followed by an empty trailer section
+        iov[1] = iov[2];
+        return http_writev(fd, iov, 2);
+    }
+    return http_writev(fd, iov, 3);
+}
+
+http_err_t http_send_chunked(int sock, int fd) {
+    char buf[16 * 1024];
+    for(;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return HTTP_ERR_INTERNAL;
+        }
+        if(http_write_chunk(sock, buf, n) != HTTP_SUCCESS) {
+            return HTTP_ERR_INTERNAL;
+        }
+        if(n == 0) {
+            return HTTP_SUCCESS;
+        }
+    }
+}
+
+int http_is_chunked(http_slice_t transfer_encoding) {
+    if(transfer_encoding.ptr == NULL) {
+        return 0;
+    }
+    // The last coding is the one applied last, it must be "chunked"
+    const char *end = transfer_encoding.ptr + transfer_encoding.len;
+    const char *start = end;
+    while(start > transfer_encoding.ptr && start[-1] != ',') {
+        start--;
+    }
+    while(start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    http_slice_t last = {start, end - start};
+    return http_slice_eq(last, "chunked");
+}
+
+int http_parse_num(http_slice_t slice, int64_t *val) {
+    if(slice.len == 0) {
+        return -1;
+    }
+    *val = 0;
+    for(size_t i = 0; i < slice.len; i++) {
+        if(slice.ptr[i] < '0' || slice.ptr[i] > '9' || *val > (INT64_MAX - 9) / 10) {
+            return -1;
+        }
+        *val = *val * 10 + (slice.ptr[i] - '0');
+    }
+    return 0;
+}
+
+int http_parse_range(http_slice_t value, int64_t size, http_range_t *ranges) {
+    if(value.len < 6 || strncasecmp(value.ptr, "bytes=", 6) != 0) {
+        return -1;
+    }
+
+    const char *p = value.ptr + 6, *end = value.ptr + value.len;
+    int cnt = 0, specs = 0;
+    while(p < end) {
+        while(p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if(p < end && *p == ',') {
+            p++;
+            continue;
+        }
+        const char *spec = p;
+        while(p < end && *p != ',' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        if(p == spec) {
+            break;
+        }
+        if(++specs > HTTP_MAX_RANGES) {
+            return -1;
+        }
+
+        const char *dash = memchr(spec, '-', p - spec);
+        if(dash == NULL) {
+            return -1;
+        }
+        http_slice_t first_str = {spec, dash - spec}, last_str = {dash + 1, p - dash - 1};
+        int64_t first, last;
+        if(first_str.len == 0) {
+            // Suffix range: the last bytes of the representation
+            if(http_parse_num(last_str, &last) != 0) {
+                return -1;
+            }
+            if(last == 0 || size == 0) {
+                continue;
+            }
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        } else {
+            if(http_parse_num(first_str, &first) != 0) {
+                return -1;
+            }
+            if(last_str.len == 0) {
+                last = size - 1;
+            } else if(http_parse_num(last_str, &last) != 0 || last < first) {
+                return -1;
+            }
+            if(first >= size) {
+                continue;
+            }
+            if(last >= size) {
+                last = size - 1;
+            }
+        }
+        ranges[cnt].first = first;
+        ranges[cnt].last = last;
+        cnt++;
+    }
+    return specs == 0 ? -1 : cnt;
+}
+
+http_err_t http_send_req(FILE* sock, http_frame_t *req) {
+    int ret = write_head(sock, req->method, req->file_path, HTTP_VERSION, &req->headers);
+    if(ret != HTTP_SUCCESS) {
+        return ret;
+    }
 
     if(req->body_len != 0) {
         if(fwrite(req->body, 1, req->body_len, sock) != req->body_len) {
@@ -183,15 +809,23 @@ http_err_t http_send_req(FILE* sock, http_frame_t *req) {
 }
 
 http_err_t http_send_res(FILE* sock, http_frame_t *res) {
-    if(fprintf(sock, "%s %lu %s\r\n", HTTP_VERSION, res->status, res->status_text) < 0) {
-        http_errvar = sock;
-        return HTTP_ERR_STREAM;
+    // Status codes have three digits
+    char status[4];
+    snprintf(status, sizeof(status), "%03lu", res->status % 1000);
+    int ret = write_head(sock, HTTP_VERSION, status, res->status_text, &res->headers);
+    if(ret != HTTP_SUCCESS) {
+        return ret;
     }
 
-    write_headers(sock, res);
-
     if(res->body != NULL) {
-        int ret = stream_pipe(res->body, sock, res->body_len);
+        if(res->body_len == -1 && http_is_chunked(res->headers.known[HTTP_HDR_TRANSFER_ENCODING])) {
+            if(http_send_chunked(fileno(sock), fileno(res->body)) != HTTP_SUCCESS) {
+                http_errvar = sock;
+                return HTTP_ERR_STREAM;
+            }
+            return HTTP_SUCCESS;
+        }
+        ret = stream_pipe(res->body, sock, res->body_len);
         if(ret != HTTP_SUCCESS) {
             return ret;
         }
@@ -200,46 +834,33 @@ http_err_t http_send_res(FILE* sock, http_frame_t *res) {
     return HTTP_SUCCESS;
 }
 
-http_err_t http_recv_res(FILE *sock, http_frame_t **res, FILE *out) {
-    int ret = http_frame(res);
+http_err_t http_recv_res(FILE *sock, http_frame_t **res, FILE *out, arena_t *arena) {
+    int ret = http_frame(res, arena);
     if(ret != HTTP_SUCCESS){
         return ret;
     }
     
-    char *first_line = NULL,
-         *http_version = NULL,
-         *status = NULL,
-         *status_text = NULL;
-    ret = read_first_line(sock, &first_line, &http_version, &status, &status_text);
+    http_parser_t parser;
+    char buf[HTTP_MAX_HEAD];
+    http_parser_init(&parser, HTTP_PARSE_RESPONSE);
+    ret = recv_head(sock, &parser, buf);
     if(ret != HTTP_SUCCESS) {
-        free(first_line);
         return ret;
     }
 
     // Check http version
-    if(strcmp(http_version, HTTP_VERSION) != 0) {
-        free(first_line);
-        return HTTP_ERR_PROTOCOL;
-    }
-    // Convert status
-    errno = 0;
-    (*res)->status = strtol(status, NULL, 10);
-    // Check for various possible errors (code from man 3 strtol)
-    if ((errno == ERANGE && ((*res)->status == LONG_MAX || (*res)->status == LONG_MIN))
-            || (errno != 0 && (*res)->status == 0)) {
-        free(first_line);
+    if(!http_slice_eq(parser.version, HTTP_VERSION)) {
         return HTTP_ERR_PROTOCOL;
     }
+    (*res)->status = parser.status;
     // Save status text
-    (*res)->status_text = strdup(status_text);
+    (*res)->status_text = frame_strndup(*res, parser.status_text);
     if((*res)->status_text == NULL) {
-        free(first_line);
         return HTTP_ERR_INTERNAL;
     }
-    free(first_line);
 
-    // Continue parsing the other headers
-    ret = read_headers(sock, res);
+    // Continue with the other headers
+    ret = copy_headers(&parser, buf, *res);
     if(ret != HTTP_SUCCESS){
         return ret;
     }
@@ -250,27 +871,31 @@ http_err_t http_recv_res(FILE *sock, http_frame_t **res, FILE *out) {
         return HTTP_SUCCESS;
     }
 
-    ret = stream_pipe(sock, out, (*res)->body_len);
+    recv_sink_t sink;
+    ret = recv_sink_open(&sink, out);
     if(ret != HTTP_SUCCESS) {
         return ret;
     }
-
-    return HTTP_SUCCESS;
+    if(http_is_chunked((*res)->headers.known[HTTP_HDR_TRANSFER_ENCODING])) {
+        ret = recv_chunked_sock(sock, &sink);
+    } else {
+        ret = recv_sink_move(&sink, sock, (*res)->body_len);
+    }
+    recv_sink_close(&sink);
+    return ret;
 }
 
-http_err_t http_recv_req(FILE* sock, http_frame_t **req) {
-    int ret = http_frame(req);
+http_err_t http_recv_req(FILE* sock, http_frame_t **req, FILE *body, arena_t *arena) {
+    int ret = http_frame(req, arena);
     if(ret != HTTP_SUCCESS){
         return ret;
     }
 
-    char *first_line = NULL,
-         *method = NULL,
-         *file_path = NULL,
-         *http_version = NULL;
-    ret = read_first_line(sock, &first_line, &method, &file_path, &http_version);
+    http_parser_t parser;
+    char buf[HTTP_MAX_HEAD];
+    http_parser_init(&parser, HTTP_PARSE_REQUEST);
+    ret = read_head(sock, &parser, buf);
     if(ret != HTTP_SUCCESS) {
-        free(first_line);
         if(ret == HTTP_ERR_PROTOCOL) {
             int skip_ret;
             if((skip_ret = skip_msg(sock)) != HTTP_SUCCESS) {
@@ -280,162 +905,150 @@ http_err_t http_recv_req(FILE* sock, http_frame_t **req) {
         return ret;
     }
     // Check http version
-    if(strcmp(http_version, HTTP_VERSION) != 0) {
-        free(first_line);
-        if((ret = skip_msg(sock)) != HTTP_SUCCESS) {
-            return ret;
-        }
+    if(!http_slice_eq(parser.version, HTTP_VERSION)) {
         return HTTP_ERR_PROTOCOL;
     }
     // Save method and file path
-    (*req)->method = strdup(method);
+    (*req)->method = frame_strndup(*req, parser.method);
     if((*req)->method == NULL) {
-        free(first_line);
         return HTTP_ERR_INTERNAL;
     }
-    (*req)->file_path = strdup(file_path);
+    (*req)->file_path = frame_strndup(*req, parser.path);
     if((*req)->file_path == NULL) {
-        free(first_line);
         return HTTP_ERR_INTERNAL;
     }
-    free(first_line);
 
-    // Read headers
-    ret = read_headers(sock, req);
+    // Copy headers
+    ret = copy_headers(&parser, buf, *req);
     if(ret != HTTP_SUCCESS){
-        if(ret == HTTP_ERR_PROTOCOL) {
-            int skip_ret;
-            if((skip_ret = skip_msg(sock)) != HTTP_SUCCESS) {
-                return skip_ret;
-            }
-        }
         return ret;
     }
 
-    // Request bodies are not supported, ignore them
-    return HTTP_SUCCESS;
-}
-
-static http_err_t read_first_line(FILE *sock, char **line, char **first, char **second, char **third) {
-    size_t linecap = 0;
-    ssize_t linelen;
-    
-    // Read first header line with response status
-    if((linelen = getline(line, &linecap, sock)) <= 0) {
-        http_errvar = sock;
-        return HTTP_ERR_STREAM;
+    // Requests without Content-Length and Transfer-Encoding have no body
+    if(http_is_chunked((*req)->headers.known[HTTP_HDR_TRANSFER_ENCODING])) {
+        return recv_chunked(sock, body);
     }
-
-    char* tok = strtok(*line, " ");
-    if(tok == NULL) {
+    if((*req)->headers.known[HTTP_HDR_TRANSFER_ENCODING].ptr != NULL) {
         return HTTP_ERR_PROTOCOL;
     }
-    *first = tok;
-
-    if((tok = strtok(NULL, " ")) == NULL) {
-        return HTTP_ERR_PROTOCOL;
+    if((*req)->body_len > 0) {
+        return stream_pipe(sock, body, (*req)->body_len);
     }
-    *second = tok;
+    return HTTP_SUCCESS;
+}
 
-    if((tok = strtok(NULL, "\r")) == NULL) {
-        return HTTP_ERR_PROTOCOL;
+static void *frame_alloc(http_frame_t *frame, size_t size) {
+    if(frame->arena != NULL) {
+        return arena_alloc(frame->arena, size);
     }
-    *third = tok;
+    return malloc(size);
+}
 
-    return HTTP_SUCCESS;
+static char *frame_strndup(http_frame_t *frame, http_slice_t slice) {
+    char *str = frame_alloc(frame, slice.len + 1);
+    if(str == NULL) {
+        return NULL;
+    }
+    memcpy(str, slice.ptr, slice.len);
+    str[slice.len] = '\0';
+    return str;
 }
 
-static http_err_t write_headers(FILE *sock, http_frame_t *res) {
-    for(http_header_t *cur_header = res->header_first; cur_header != NULL; cur_header = cur_header->next) {
-        if(fprintf(sock, "%s: %s\r\n", cur_header->name, cur_header->value) < 0) {
+static http_err_t read_head(FILE *sock, http_parser_t *parser, char *buf) {
+    size_t len = 0;
+    int c;
+    http_parse_res_t res = HTTP_PARSE_AGAIN;
+
+    while(res == HTTP_PARSE_AGAIN) {
+        if((c = getc(sock)) == EOF) {
             http_errvar = sock;
             return HTTP_ERR_STREAM;
         }
+        buf[len++] = c;
+        if(c == '\n' || len == HTTP_MAX_HEAD) {
+            res = http_parse(parser, buf, len);
+        }
     }
-    if(fputs("\r\n", sock) == EOF) {
-        http_errvar = sock;
-        return HTTP_ERR_STREAM;
-    }
-    return HTTP_SUCCESS;
+    return res == HTTP_PARSE_DONE ? HTTP_SUCCESS : HTTP_ERR_PROTOCOL;
 }
 
-static http_err_t read_headers(FILE *sock, http_frame_t **res) {
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    
-    // Body length of -1 indicates that no content-length header was present
-    (*res)->body_len = -1;
+static http_err_t copy_headers(http_parser_t *parser, const char *buf, http_frame_t *frame) {
+    frame->head = frame_alloc(frame, parser->head_len);
+    if(frame->head == NULL) {
+        return HTTP_ERR_INTERNAL;
+    }
+    memcpy(frame->head, buf, parser->head_len);
 
-    http_header_t *last_header = NULL, *cur_header;
-    for(int len = 0; ; last_header = cur_header, len++) {
-        if((linelen = getline(&line, &linecap, sock)) <= 0) {
-            free(line);
-            http_errvar = sock;
-            return HTTP_ERR_STREAM;
+    // Rebase all slices from buf to the copy
+    frame->headers = parser->headers;
+    for(int i = 0; i < HTTP_HDR_KNOWN_COUNT; i++) {
+        if(frame->headers.known[i].ptr != NULL) {
+            frame->headers.known[i].ptr = frame->head + (frame->headers.known[i].ptr - buf);
         }
+    }
+    for(size_t i = 0; i < frame->headers.other_len; i++) {
+        frame->headers.other[i].name.ptr = frame->head + (frame->headers.other[i].name.ptr - buf);
+        frame->headers.other[i].value.ptr = frame->head + (frame->headers.other[i].value.ptr - buf);
+    }
 
-        if(strcmp(line, "\r\n") == 0) {
-            break;
-        }
+    // Body length of -1 indicates that no content-length header was present, a
+    // transfer coding overrides the content length
+    frame->body_len = -1;
+    http_slice_t content_len = frame->headers.known[HTTP_HDR_CONTENT_LENGTH];
+    if(frame->headers.known[HTTP_HDR_TRANSFER_ENCODING].ptr == NULL && content_len.ptr != NULL 
+            && http_parse_num(content_len, &frame->body_len) != 0) {
+        return HTTP_ERR_PROTOCOL;
+    }
+    return HTTP_SUCCESS;
+}
 
-        cur_header = malloc(sizeof(http_frame_t));
-        if(cur_header == NULL) {
-            free(line);
-            return HTTP_ERR_INTERNAL;
-        }
-        memset(cur_header, 0, sizeof(*cur_header));
-        if((*res)->header_first == NULL) {
-            (*res)->header_first = cur_header;
-        } else {
-            last_header->next = cur_header;
-        }
+static http_err_t write_head(FILE *sock, const char *first, const char *second, const char *third,
+        const http_headers_t *headers) {
+    // Start line, four vectors per field and the empty line
+    struct iovec iov[6 + 4 * (HTTP_HDR_KNOWN_COUNT + HTTP_MAX_HEADERS) + 1];
+    int cnt = 0;
 
-        char *sep = strpbrk(line, ":");
-        if(sep == NULL) {
-            free(line);
-            return HTTP_ERR_PROTOCOL;
-        }
-        sep[0] = '\0';
-        cur_header->name = strdup(line);
-        if(cur_header->name == NULL) {
-            free(line);
-            return HTTP_ERR_INTERNAL;
-        }
+#define IOV_PUSH(p, l) \
+    iov[cnt].iov_base = (void *)(p); \
+    iov[cnt].iov_len = (l); \
+    cnt++;
 
-        // strip delimiter and whitespaces
-        do {
-            if((sep - line)/sizeof(*line) >= linelen) {
-                free(line);
-                return HTTP_ERR_PROTOCOL;
-            }
-            sep++;
-        } while(sep[0] == ' ');
-        cur_header->value = strdup(sep);
-        if(cur_header->value == NULL) {
-            free(line);
-            return HTTP_ERR_INTERNAL;
+    IOV_PUSH(first, strlen(first));
+    IOV_PUSH(" ", 1);
+    IOV_PUSH(second, strlen(second));
+    IOV_PUSH(" ", 1);
+    IOV_PUSH(third, strlen(third));
+    IOV_PUSH("\r\n", 2);
+    for(int i = 0; i < HTTP_HDR_KNOWN_COUNT; i++) {
+        if(headers->known[i].ptr != NULL) {
+            http_slice_t name = http_header_name(i);
+            IOV_PUSH(name.ptr, name.len);
+            IOV_PUSH(": ", 2);
+            IOV_PUSH(headers->known[i].ptr, headers->known[i].len);
+            IOV_PUSH("\r\n", 2);
         }
+    }
+    for(size_t i = 0; i < headers->other_len; i++) {
+        IOV_PUSH(headers->other[i].name.ptr, headers->other[i].name.len);
+        IOV_PUSH(": ", 2);
+        IOV_PUSH(headers->other[i].value.ptr, headers->other[i].value.len);
+        IOV_PUSH("\r\n", 2);
+    }
+    IOV_PUSH("\r\n", 2);
+#undef IOV_PUSH
 
-        // Check for content length
-        if(strcasecmp(cur_header->name, "Content-Length") == 0) {
-            errno = 0;
-            (*res)->body_len = strtol(cur_header->value, NULL, 10);
-            if(((errno == ERANGE && ((*res)->body_len == LONG_MAX || (*res)->body_len == LONG_MIN))
-                || (errno != 0 && (*res)->body_len == 0))) {
-                free(line);
-                return HTTP_ERR_PROTOCOL;
-            }
-        }
+    if(fflush(sock) != 0 || http_writev(fileno(sock), iov, cnt) != HTTP_SUCCESS) {
+        http_errvar = sock;
+        return HTTP_ERR_STREAM;
     }
-    free(line);
     return HTTP_SUCCESS;
 }
 
-static http_err_t stream_pipe(FILE *src, FILE *drain, int len) {
+static http_err_t stream_pipe(FILE *src, FILE *drain, int64_t len) {
     char buf[1024];
     memset(buf, 0, sizeof(buf));
-    int to_read, act_read, body_remaining;
+    size_t to_read, act_read;
+    int64_t body_remaining;
     
     if(len != -1) {
         body_remaining = len;
@@ -443,7 +1056,7 @@ static http_err_t stream_pipe(FILE *src, FILE *drain, int len) {
         body_remaining = sizeof(buf);
     }
     while(body_remaining > 0) {
-        to_read = sizeof(buf) < body_remaining ? sizeof(buf) : body_remaining;
+        to_read = (int64_t)sizeof(buf) < body_remaining ? sizeof(buf) : (size_t)body_remaining;
         if((act_read = fread(buf, 1, to_read, src)) != to_read) {
             if(len == -1 && feof(src) != 0) {
                 body_remaining = 0;
@@ -453,7 +1066,7 @@ static http_err_t stream_pipe(FILE *src, FILE *drain, int len) {
             }
         }
 
-        if(fwrite(buf, 1, act_read, drain) != act_read) {
+        if(drain != NULL && fwrite(buf, 1, act_read, drain) != act_read) {
             http_errvar = drain;
             return HTTP_ERR_STREAM;
         }
@@ -463,7 +1076,223 @@ static http_err_t stream_pipe(FILE *src, FILE *drain, int len) {
         }
     }
 
-    fflush(drain);
+    if(drain != NULL) {
+        fflush(drain);
+    }
+    return HTTP_SUCCESS;
+}
+
+static http_err_t recv_chunked(FILE *sock, FILE *out) {
+    char buf[1024];
+    http_chunked_t dec;
+    http_chunked_init(&dec);
+    http_parse_res_t res = HTTP_PARSE_AGAIN;
+    while(res == HTTP_PARSE_AGAIN) {
+        // While a size line is parsed, remaining is at most the size of the chunk, 
+        // so reading it never takes bytes following the body
+        size_t want = dec.remaining == 0 ? 1 : dec.remaining < sizeof(buf) ? dec.remaining : sizeof(buf);
+        if(fread(buf, 1, want, sock) != want) {
+            http_errvar = sock;
+            return HTTP_ERR_STREAM;
+        }
+        size_t out_len, used;
+        res = http_chunked_decode(&dec, buf, want, &out_len, &used);
+        if(res == HTTP_PARSE_ERROR) {
+            return HTTP_ERR_PROTOCOL;
+        }
+        if(out != NULL && out_len > 0 && fwrite(buf, 1, out_len, out) != out_len) {
+            http_errvar = out;
+            return HTTP_ERR_STREAM;
+        }
+    }
+    return HTTP_SUCCESS;
+}
+
+static ssize_t peek_more(int sock, char *buf, size_t have, size_t cap) {
+    ssize_t n;
+    do {
+        // Wait for at least one new byte, then take whatever else is there
+        n = recv(sock, buf, have > 0 ? have + 1 : cap, MSG_PEEK | (have > 0 ? MSG_WAITALL : 0));
+    } while(n < 0 && errno == EINTR);
+    if(n < 0) {
+        return -1;
+    }
+    if((size_t)n <= have) {
+        errno = ENODATA;
+        return -1;
+    }
+    if(have > 0 && (size_t)n < cap) {
+        ssize_t avail = recv(sock, buf, cap, MSG_PEEK | MSG_DONTWAIT);
+        if(avail > n) {
+            n = avail;
+        }
+    }
+    return n;
+}
+
+static http_err_t recv_head(FILE *sock, http_parser_t *parser, char *buf) {
+    size_t len = 0;
+    http_parse_res_t res = HTTP_PARSE_AGAIN;
+    while(res == HTTP_PARSE_AGAIN) {
+        ssize_t n = peek_more(fileno(sock), buf, len, HTTP_MAX_HEAD);
+        if(n < 0) {
+            http_errvar = sock;
+            return HTTP_ERR_STREAM;
+        }
+        len = n;
+        res = http_parse(parser, buf, len);
+    }
+    if(res != HTTP_PARSE_DONE) {
+        return HTTP_ERR_PROTOCOL;
+    }
+
+    // Take the head (the same bytes again) off the socket
+    return take_peeked(sock, buf, parser->head_len);
+}
+
+static http_err_t take_peeked(FILE *sock, char *buf, size_t len) {
+    for(size_t taken = 0; taken < len; ) {
+        ssize_t n = recv(fileno(sock), buf + taken, len - taken, MSG_WAITALL);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n == 0) {
+                errno = ENODATA;
+            }
+            http_errvar = sock;
+            return HTTP_ERR_STREAM;
+        }
+        taken += n;
+    }
+    return HTTP_SUCCESS;
+}
+
+static http_err_t recv_sink_open(recv_sink_t *sink, FILE *out) {
+    sink->out = out;
+    sink->drain = -1;
+    sink->pipefd[0] = sink->pipefd[1] = -1;
+    sink->buf = NULL;
+    if(out == NULL) {
+        return HTTP_SUCCESS;
+    }
+    if(fflush(out) != 0) {
+        http_errvar = out;
+        return HTTP_ERR_STREAM;
+    }
+    sink->drain = fileno(out);
+
+    // splice cannot write to terminals or files opened with O_APPEND
+    struct stat st;
+    int flags = fcntl(sink->drain, F_GETFL);
+    if(fstat(sink->drain, &st) == 0 && flags >= 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)
+            || (S_ISREG(st.st_mode) && (flags & O_APPEND) == 0)) && pipe2(sink->pipefd, O_CLOEXEC) == 0) {
+        fcntl(sink->pipefd[0], F_SETPIPE_SZ, RECV_SPLICE_SIZE);
+    }
+    return HTTP_SUCCESS;
+}
+
+static http_err_t recv_sink_move(recv_sink_t *sink, FILE *sock, int64_t len) {
+    while(len != 0) {
+        size_t want = len < 0 || len > RECV_SPLICE_SIZE ? RECV_SPLICE_SIZE : (size_t)len;
+        ssize_t n;
+        if(sink->pipefd[0] >= 0) {
+            n = splice(fileno(sock), NULL, sink->pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if(n < 0 && errno == EINVAL) {
+                // sock does not support splice, nothing was moved
+                close(sink->pipefd[0]);
+                close(sink->pipefd[1]);
+                sink->pipefd[0] = sink->pipefd[1] = -1;
+                continue;
+            }
+        } else {
+            if(sink->buf == NULL && posix_memalign((void **)&sink->buf, RECV_BUF_ALIGN, RECV_BUF_SIZE) != 0) {
+                sink->buf = NULL;
+                return HTTP_ERR_INTERNAL;
+            }
+            n = recv(fileno(sock), sink->buf, want < RECV_BUF_SIZE ? want : RECV_BUF_SIZE, 0);
+        }
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            http_errvar = sock;
+            return HTTP_ERR_STREAM;
+        }
+        if(n == 0) {
+            if(len < 0) {
+                break;
+            }
+            errno = ENODATA;
+            http_errvar = sock;
+            return HTTP_ERR_STREAM;
+        }
+        if(len > 0) {
+            len -= n;
+        }
+
+        if(sink->pipefd[0] >= 0) {
+            while(n > 0) {
+                ssize_t moved = splice(sink->pipefd[0], NULL, sink->drain, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if(moved < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(moved <= 0) {
+                    http_errvar = sink->out;
+                    return HTTP_ERR_STREAM;
+                }
+                n -= moved;
+            }
+        } else if(sink->drain >= 0) {
+            struct iovec iov = {sink->buf, n};
+            if(http_writev(sink->drain, &iov, 1) != HTTP_SUCCESS) {
+                http_errvar = sink->out;
+                return HTTP_ERR_STREAM;
+            }
+        }
+    }
+    return HTTP_SUCCESS;
+}
+
+static void recv_sink_close(recv_sink_t *sink) {
+    if(sink->pipefd[0] >= 0) {
+        close(sink->pipefd[0]);
+        close(sink->pipefd[1]);
+    }
+    free(sink->buf);
+}
+
+static http_err_t recv_chunked_sock(FILE *sock, recv_sink_t *sink) {
+    if(sink->buf == NULL && posix_memalign((void **)&sink->buf, RECV_BUF_ALIGN, RECV_BUF_SIZE) != 0) {
+        sink->buf = NULL;
+        return HTTP_ERR_INTERNAL;
+    }
+    http_chunked_t dec;
+    http_chunked_init(&dec);
+    http_parse_res_t res = HTTP_PARSE_AGAIN;
+    while(res == HTTP_PARSE_AGAIN) {
+        ssize_t n = peek_more(fileno(sock), sink->buf, 0, RECV_BUF_SIZE);
+        if(n < 0) {
+            http_errvar = sock;
+            return HTTP_ERR_STREAM;
+        }
+        size_t out_len, used;
+        res = http_chunked_decode(&dec, sink->buf, n, &out_len, &used);
+        if(res == HTTP_PARSE_ERROR) {
+            return HTTP_ERR_PROTOCOL;
+        }
+        if(out_len > 0 && sink->drain >= 0) {
+            struct iovec iov = {sink->buf, out_len};
+            if(http_writev(sink->drain, &iov, 1) != HTTP_SUCCESS) {
+                http_errvar = sink->out;
+                return HTTP_ERR_STREAM;
+            }
+        }
+        int ret = take_peeked(sock, sink->buf, used);
+        if(ret != HTTP_SUCCESS) {
+            return ret;
+        }
+    }
     return HTTP_SUCCESS;
 }
 
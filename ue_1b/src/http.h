@@ -18,6 +18,14 @@
 #define HTTP_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "parser.h"
+#include "arena.h"
 
 /**
  * @brief Http version.
@@ -26,6 +34,36 @@
  */
 #define HTTP_VERSION "HTTP/1.1"
 
+/**
+ * @brief Length of a formatted http date.
+ * @details Dates are formatted as IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT").
+ */
+#define HTTP_DATE_LEN 29
+
+/**
+ * @brief Maximum length of an entity tag formatted by http_format_etag (including quotes).
+ */
+#define HTTP_ETAG_MAX 72
+
+/**
+ * @brief Maximum number of ranges of a Range header.
+ * @details Range headers with more ranges are ignored and the whole representation
+ * is sent instead.
+ */
+#define HTTP_MAX_RANGES 16
+
+/**
+ * @brief Content codings.
+ * @details Values are bit flags, so a set of acceptable codings can be stored in
+ * an int.
+ */
+typedef enum http_encoding {
+    HTTP_ENC_IDENTITY = 0,
+    HTTP_ENC_GZIP = 1,
+    HTTP_ENC_BR = 2,
+    HTTP_ENC_ZSTD = 4
+} http_encoding_t;
+
 typedef enum http_err {
     // Operation was successful
     HTTP_SUCCESS = 0, 
@@ -36,35 +74,24 @@ typedef enum http_err {
     // An error outside the boundries of this module occoured -> consult errno()
     HTTP_ERR_INTERNAL = 2,
 
-    // An error stdio error occured -> consult ferror()
+    // Reading or writing a stream failed -> http_errvar points to the stream, consult errno
+    // (ENODATA if the peer closed the connection early)
     HTTP_ERR_STREAM = 3,
 
     // Protocol error occured during read or write from the network (e.g. invalid message format)
     HTTP_ERR_PROTOCOL = 4
 } http_err_t;
 
-/**
- * @brief Struct for storing data of a single header field.
- * @details This is a helper structure for http_frame_t and contains the data
- * for a single header field where name contains the left part of the header 
- * and value the right path (the serialization to the http header string would
- * be "<name>: <value>"). In addition to that, it contains a pointer to a potential
- * next header field. 
- */
-typedef struct http_header {
-    char *name;
-    char *value;
-    struct http_header *next;
-} http_header_t;
-
 /**
  * @brief Stores information about a http message (request or reply).
  * @details This structure is used for passing around http message data within
  * the program and in particular between function of the module and the calling
  * function. It contains fields for both request and response messages, where some 
  * field are request only (method, file_path) and some are response only 
- * (status, status_text). Headers are stored as a linked list of http_header_t 
- * pointers. 
+ * (status, status_text). Headers are stored in a http_headers_t table; for
+ * received messages, the slices of the table point into head, a single dynamically
+ * allocated copy of the message head. If arena != NULL, the frame and all of its
+ * values were allocated from that arena and are released by resetting it.
  */
 typedef struct http_frame {
     long int status; // Response only
@@ -73,13 +100,35 @@ typedef struct http_frame {
     char *method; // Request only
     char *file_path; // Request only
 
-    int header_len; 
-    http_header_t *header_first;
+    http_headers_t headers;
+    char *head;
 
-    long int body_len;
+    arena_t *arena;
+
+    int64_t body_len;
     void *body;
 } http_frame_t;
 
+/**
+ * @brief A byte range of a representation.
+ * @details first and last are the offsets of the first and last byte (inclusive).
+ */
+typedef struct http_range {
+    int64_t first;
+    int64_t last;
+} http_range_t;
+
+/**
+ * @brief Cached Date header line.
+ * @details Holds the serialized header line "Date: <IMF-fixdate>\r\n" for the
+ * second sec. Each thread sending responses should own one cache.
+ */
+typedef struct http_date {
+    time_t sec;
+    size_t len;
+    char line[40];
+} http_date_t;
+
 /**
  * @brief Error variable used to indicated error causes 
  * (in particular, streams that caused an error).
@@ -106,16 +155,18 @@ extern void *http_errvar;
 http_err_t parse_url(char *url, char **hostname, char **file_path);
 
 /**
- * @brief Initialize a new http_frame_t on the heap.
+ * @brief Initialize a new http_frame_t on the heap or in an arena.
  * 
  * @param frame Pointer where the address to the http frame will be stored.
+ * @param arena Arena the frame and its values should be allocated from, or NULL 
+ * if malloc should be used.
  * @return int HTTP_SUCCESS if the frame initialization was successful, HTTP_ERR_INTERNAL
- * if malloc returned with an error.
+ * if the allocation failed.
  * 
- * @details Allocates heap space for a http_frame_t object and initializes all values with 0.
+ * @details Allocates space for a http_frame_t object and initializes all values with 0.
  * The address to the frame will be stored to the given pointer.
  */
-http_err_t http_frame(http_frame_t **frame);
+http_err_t http_frame(http_frame_t **frame, arena_t *arena);
 
 /**
  * @brief Frees a dynamically allocated http frame object.
@@ -123,12 +174,228 @@ http_err_t http_frame(http_frame_t **frame);
  * @param frame The frame which should be freed.
  * 
  * @details Frees the memory allocated for the given http frame, including all
- * its values. This function assumes (and may therefore only be called if those
+ * its values. Frames allocated from an arena are left untouched, their memory is 
+ * released when the arena is reset. Otherwise this function assumes (and may therefore only be called if those
  * assuptions apply to the frame) that all values (e.g. status_text) including the 
- * http headers objects are also pointers to dynamically allocated memory. 
+ * copy of the message head are also pointers to dynamically allocated memory. 
  */
 void http_free_frame(http_frame_t *frame);
 
+/**
+ * @brief Get the current Date header line.
+ * 
+ * @param date Date cache.
+ * @return http_slice_t The header line "Date: <date>\r\n" including the line break.
+ * 
+ * @details The line is formatted at most once per second; all other calls return 
+ * the cached line. The slice remains valid until the next call with the same cache.
+ */
+http_slice_t http_date(http_date_t *date);
+
+/**
+ * @brief Format a timestamp as http date.
+ * 
+ * @param buf Buffer of at least HTTP_DATE_LEN + 1 characters.
+ * @param t Timestamp which should be formatted.
+ * @return size_t HTTP_DATE_LEN if successful, 0 if the timestamp cannot be represented.
+ */
+size_t http_format_date(char *buf, time_t t);
+
+/**
+ * @brief Parse a http date.
+ * 
+ * @param date Slice containing the date.
+ * @param t Pointer where the timestamp will be stored to.
+ * @return int 0 if the date is a valid IMF-fixdate, -1 otherwise.
+ * 
+ * @details Only the IMF-fixdate format is accepted, dates in the obsolete formats 
+ * are treated as invalid.
+ */
+int http_parse_date(http_slice_t date, time_t *t);
+
+/**
+ * @brief Format the entity tag of a file.
+ * 
+ * @param buf Buffer of at least HTTP_ETAG_MAX + 1 characters.
+ * @param st Status of the file.
+ * @return size_t Length of the entity tag.
+ * 
+ * @details The strong entity tag is derived from the inode number, the size and the
+ * modification time of the file, so it changes whenever the file is replaced or
+ * modified.
+ */
+size_t http_format_etag(char *buf, const struct stat *st);
+
+/**
+ * @brief Check whether an If-None-Match header matches an entity tag.
+ * 
+ * @param if_none_match Value of the If-None-Match header.
+ * @param etag Entity tag of the resource.
+ * @return int 1 if the header is "*" or lists the entity tag (weak comparison), 0 otherwise.
+ */
+int http_etag_match(http_slice_t if_none_match, http_slice_t etag);
+
+/**
+ * @brief Parse the value of an Accept-Encoding header.
+ * 
+ * @param value Value of the Accept-Encoding header.
+ * @return int Set of http_encoding_t flags of the acceptable content codings.
+ * 
+ * @details Codings with a quality value of 0 are not acceptable; "*" accepts all 
+ * codings which are not listed explicitly. Other quality values are not ranked.
+ */
+int http_accept_encoding(http_slice_t value);
+
+/**
+ * @brief Get the name of a content coding.
+ * 
+ * @param encoding A single http_encoding_t flag.
+ * @return const char* The coding name used in Content-Encoding ("gzip", "br", "zstd"),
+ * or NULL for HTTP_ENC_IDENTITY.
+ */
+const char *http_encoding_name(int encoding);
+
+/**
+ * @brief Get the file name extension of precompressed files of a content coding.
+ * 
+ * @param encoding A single http_encoding_t flag.
+ * @return const char* The extension including the dot (".gz", ".br", ".zst"), or 
+ * NULL for HTTP_ENC_IDENTITY.
+ */
+const char *http_encoding_ext(int encoding);
+
+/**
+ * @brief Get the media type of a file.
+ * 
+ * @param path Path or name of the file.
+ * @return const char* The media type derived from the file name extension, 
+ * "application/octet-stream" for unknown extensions.
+ */
+const char *http_mime_type(const char *path);
+
+/**
+ * @brief Check whether a media type benefits from compression.
+ * 
+ * @param mime Media type as returned by http_mime_type.
+ * @return int 1 for textual types, 0 for already compressed or binary types.
+ */
+int http_mime_compressible(const char *mime);
+
+/**
+ * @brief Determine how long a response may be cached by a shared cache.
+ * 
+ * @param cache_control Value of the Cache-Control header of the response (ptr is
+ * NULL if the header is absent).
+ * @return int64_t Freshness lifetime in seconds, or -1 if the response must not be
+ * stored.
+ * 
+ * @details s-maxage takes precedence over max-age. Responses with no-store, 
+ * no-cache or private, and responses without an explicit lifetime are not stored.
+ */
+int64_t http_cache_max_age(http_slice_t cache_control);
+
+/**
+ * @brief Format an unsigned number in decimal.
+ * 
+ * @param buf Buffer of at least 21 characters.
+ * @param val Number which should be formatted.
+ * @return size_t Number of characters written (without the null byte).
+ */
+size_t http_format_u64(char *buf, uint64_t val);
+
+/**
+ * @brief Write an io vector to a file descriptor.
+ * 
+ * @param fd File descriptor which should be written to.
+ * @param iov Io vector, which will be modified on partial writes.
+ * @param cnt Number of elements of iov.
+ * @return http_err_t HTTP_SUCCESS if all bytes were written, HTTP_ERR_INTERNAL otherwise
+ * (consult errno).
+ * 
+ * @details Calls writev until all bytes were written, continuing after partial 
+ * writes and interrupts.
+ */
+http_err_t http_writev(int fd, struct iovec *iov, int cnt);
+
+/**
+ * @brief Send a part of a file.
+ * 
+ * @param sock Socket the data will be sent to.
+ * @param fd File descriptor of the file.
+ * @param offset Offset of the first byte which should be sent.
+ * @param len Number of bytes to send.
+ * @return http_err_t HTTP_SUCCESS if all bytes were sent, HTTP_ERR_INTERNAL otherwise
+ * (consult errno, EPIPE if the file was truncated).
+ * 
+ * @details Uses sendfile, so the data is not copied to user space. The file offset 
+ * of fd is not changed.
+ */
+http_err_t http_sendfile(int sock, int fd, int64_t offset, int64_t len);
+
+/**
+ * @brief Write a chunk of a chunked message body.
+ * 
+ * @param fd File descriptor which should be written to.
+ * @param data Chunk data.
+ * @param len Length of the chunk, 0 for the last chunk which terminates the body.
+ * @return http_err_t HTTP_SUCCESS if the chunk was written, HTTP_ERR_INTERNAL otherwise
+ * (consult errno).
+ * 
+ * @details The chunk size line, the data and the line break are written with a 
+ * single writev. Bodies which are generated piece by piece can be sent by calling 
+ * this function for each piece.
+ */
+http_err_t http_write_chunk(int fd, const void *data, size_t len);
+
+/**
+ * @brief Send the contents of a file descriptor as chunked message body.
+ * 
+ * @param sock Socket the body will be sent to.
+ * @param fd File descriptor which is read until EOF, e.g. a pipe.
+ * @return http_err_t HTTP_SUCCESS if the whole body was sent, HTTP_ERR_INTERNAL 
+ * otherwise (consult errno).
+ * 
+ * @details Each read from fd is sent as one chunk as soon as it returns, so data 
+ * from pipes is forwarded without waiting for more input and without knowing the
+ * length of the body in advance.
+ */
+http_err_t http_send_chunked(int sock, int fd);
+
+/**
+ * @brief Check whether a message body uses the chunked transfer coding.
+ * 
+ * @param transfer_encoding Value of the Transfer-Encoding header (ptr may be NULL).
+ * @return int 1 if the last transfer coding is "chunked", 0 otherwise.
+ */
+int http_is_chunked(http_slice_t transfer_encoding);
+
+/**
+ * @brief Parse a decimal number from a slice.
+ * 
+ * @param slice Slice which should contain only digits (e.g. a Content-Length value).
+ * @param val Pointer where the number will be stored to.
+ * @return int 0 if the slice is a valid non-negative number, -1 if it is empty,
+ * contains anything but digits (including signs and whitespace) or overflows.
+ */
+int http_parse_num(http_slice_t slice, int64_t *val);
+
+/**
+ * @brief Parse the value of a Range header.
+ * 
+ * @param value Value of the Range header.
+ * @param size Size of the representation.
+ * @param ranges Array of at least HTTP_MAX_RANGES elements where the satisfiable 
+ * ranges will be stored to.
+ * @return int The number of satisfiable ranges, 0 if no range is satisfiable (416
+ * should be replied) or -1 if the header is invalid or not supported and should be
+ * ignored.
+ * 
+ * @details Supports the "bytes" unit with ranges of the forms "first-last", "first-"
+ * and "-suffix_length". Ranges are clamped to the size of the representation; 
+ * unsatisfiable ranges are dropped.
+ */
+int http_parse_range(http_slice_t value, int64_t size, http_range_t *ranges);
+
 /**
  * @brief Send a http request.
  * 
@@ -138,7 +405,7 @@ void http_free_frame(http_frame_t *frame);
  * as defined in http_err_t otherwise.
  * 
  * @details Sends a http request with the method req->method to sock, containing
- * all headers in the linked list beginning with req->header_first and, if 
+ * all headers of req->headers and, if 
  * req->content_len > 0 the request body req->body. All headers (especially)
  * the Content-Length must be already set correctly. 
  * Global variables: http_errvar.
@@ -155,10 +422,12 @@ http_err_t http_send_req(FILE* sock, http_frame_t *req);
  * as defined in http_err_t otherwise.
  * 
  * @details Sends a http response with the status code res->status and res->status_text
- * to sock, containing all headers in the linked list beginning with res->header_first
- * and, if != NULL, the request body res->body. All headers (especially)
+ * to sock, containing all headers of res->headers and, if != NULL, the request 
+ * body res->body. The status line and the headers are written with a single writev. All headers (especially)
  * the Content-Length must be already set correctly. 
- * A res->body_len of -1 indicates that the stream should be read until EOF.
+ * A res->body_len of -1 indicates that the stream should be read until EOF. If
+ * the Transfer-Encoding header of res is "chunked", such a body is sent in chunks
+ * as the data becomes available on the stream.
  * Global variables: http_errvar.
  */
 http_err_t http_send_res(FILE* sock, http_frame_t *res);
@@ -168,17 +437,22 @@ http_err_t http_send_res(FILE* sock, http_frame_t *res);
  * 
  * @param sock Socket where the request should be read from.
  * @param req Pointer where the address of the http request frame will be stored. 
+ * @param body Output stream where the request body will be written to, or NULL if
+ * the body should be discarded.
+ * @param arena Arena the frame should be allocated from, or NULL.
  * @return http_err_t HTTP_SUCCESS if the request was successfully received and an 
  * error value as defined in http_err_t otherwise. 
  * 
  * @details Reads an http request from sock and stores that request data in a newly 
- * allocated http_frame_t struct. This function does not support request bodies and 
- * will also not consider the Content-Length header and drop the request body from
- * the stream. Requests with request bodies will therefore leave the body unread
- * on the stream.
+ * allocated http_frame_t struct. The head is parsed with the incremental parser of the
+ * parser module and the results are copied to the frame; code which owns the 
+ * connection buffer should use the parser directly instead, which does not allocate
+ * memory. The request body (delimited by Content-Length or chunked transfer 
+ * coding) is read completely and written to body, so the next request can be 
+ * read from sock afterwards.
  * Global variables: http_errvar.
  */
-http_err_t http_recv_req(FILE* sock, http_frame_t **req);
+http_err_t http_recv_req(FILE* sock, http_frame_t **req, FILE *body, arena_t *arena);
 
 /**
  * @brief Receive a http response from the given socket.
@@ -186,17 +460,26 @@ http_err_t http_recv_req(FILE* sock, http_frame_t **req);
  * @param sock Socket where the response should be read from.
  * @param res Pointer where the address of the http response frame will be stored. 
  * @param out Output stream where the response body will be written to. 
+ * @param arena Arena the frame should be allocated from, or NULL.
  * @return int HTTP_SUCCESS if the response was successfully received and an 
  * error value as defined in http_err_t otherwise. 
  *  
  * @details Reads an http response from sock. If the response status == 200, it will
- * also read the response body and write it to out. This function will not free the
+ * also read the response body and write it to out. Chunked bodies are decoded 
+ * chunk by chunk while they are received; bodies without Content-Length or chunked
+ * transfer coding are read until the connection is closed. Only the head is copied 
+ * to user space: it is parsed while still pending on the socket and then taken 
+ * off exactly, the body is moved from the socket to out with splice (or received
+ * into a large buffer if out does not support splice, e.g. a terminal). sock must 
+ * therefore not have buffered input, and data buffered in out is flushed before.
+ * A connection closed before the response was complete is reported as 
+ * HTTP_ERR_STREAM with errno set to ENODATA. This function will not free the
  * http response frame when an error occurs while reading the response as it might
  * contain relevant debugging information. Thus, if res != NULL after the function 
  * returns and the response frame will not be used further, http_free_frame should be
  * called manually. 
  * Global variables: http_errvar.
  */
-http_err_t http_recv_res(FILE *sock, http_frame_t **res, FILE *out);
+http_err_t http_recv_res(FILE *sock, http_frame_t **res, FILE *out, arena_t *arena);
 
 #endif
@@ -0,0 +1,214 @@
+/**
+ * @file lookup.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the path resolution and lookup cache defined in lookup.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Each path maps to a single slot by its hash; a new result replaces the
+ * entry in its slot unless that entry is referenced, in which case the result is
+ * handed out without being cached. glibc has no wrapper for openat2, so it is
+ * invoked through syscall.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "lookup.h"
+
+/**
+ * @brief Compute the slot of a path.
+ *
+ * @param path Path.
+ * @param len Length of path.
+ * @return size_t Index of the slot.
+ */
+static size_t slot_of(const char *path, size_t len);
+
+/**
+ * @brief Store a result in a slot.
+ *
+ * @param slot Slot without references.
+ * @param path Path.
+ * @param len Length of path.
+ * @param fd File descriptor, or -1 for negative entries.
+ * @param st Status of the file (ignored for negative entries).
+ * @param expires Expiration time.
+ */
+static void fill_slot(lookup_entry_t *slot, const char *path, size_t len, int fd, const struct stat *st,
+        uint64_t expires);
+
+/**
+ * @brief Whether openat2 is available.
+ * @details Cleared once openat2 failed with ENOSYS.
+ */
+static int have_openat2 = 1;
+
+int lookup_has_dot_dot(const char *path, size_t len) {
+    for(size_t i = 0; i + 1 < len; i++) {
+        if((i == 0 || path[i - 1] == '/') && path[i] == '.' && path[i + 1] == '.'
+                && (i + 2 == len || path[i + 2] == '/')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int lookup_open(int root, const char *path, int flags) {
+    if(have_openat2) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        long fd = syscall(SYS_openat2, root, path, &how, sizeof(how));
+        if(fd >= 0 || errno != ENOSYS) {
+            return fd;
+        }
+        have_openat2 = 0;
+    }
+    if(path[0] == '/' || lookup_has_dot_dot(path, strlen(path))) {
+        errno = EXDEV;
+        return -1;
+    }
+    return openat(root, path, flags);
+}
+
+int lookup_cache_init(lookup_cache_t *cache, int root, uint64_t ttl) {
+    cache->root = root;
+    cache->ttl = ttl;
+    if((cache->slots = calloc(LOOKUP_SLOTS, sizeof(lookup_entry_t))) == NULL) {
+        return -1;
+    }
+    for(int i = 0; i < LOOKUP_SLOTS; i++) {
+        cache->slots[i].fd = -1;
+        cache->slots[i].cached = 1;
+    }
+    return 0;
+}
+
+void lookup_cache_destroy(lookup_cache_t *cache) {
+    for(int i = 0; i < LOOKUP_SLOTS; i++) {
+        if(cache->slots[i].fd >= 0) {
+            close(cache->slots[i].fd);
+        }
+    }
+    free(cache->slots);
+    cache->slots = NULL;
+}
+
+lookup_entry_t *lookup_get(lookup_cache_t *cache, const char *path, uint64_t now) {
+    size_t len = strlen(path);
+    lookup_entry_t *slot = NULL;
+    if(len <= LOOKUP_KEY_MAX) {
+        slot = &cache->slots[slot_of(path, len)];
+        if(slot->key_len == len && now < slot->expires && memcmp(slot->key, path, len) == 0) {
+            if(slot->fd < 0) {
+                errno = ENOENT;
+                return NULL;
+            }
+            slot->refs++;
+            return slot;
+        }
+        if(slot->refs > 0) {
+            slot = NULL;
+        }
+    }
+
+    int fd = lookup_open(cache->root, path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if(fd >= 0 && !S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode)) {
+        // Directories and devices are not served
+        close(fd);
+        fd = -1;
+        errno = ENOENT;
+    }
+    if(fd < 0) {
+        // Paths escaping the document root are treated as missing
+        if(errno != ENOENT && errno != ENOTDIR && errno != EXDEV && errno != ELOOP) {
+            return NULL;
+        }
+        if(slot != NULL) {
+            fill_slot(slot, path, len, -1, NULL, now + cache->ttl);
+        }
+        errno = ENOENT;
+        return NULL;
+    }
+
+    if(slot == NULL || S_ISFIFO(st.st_mode)) {
+        lookup_entry_t *entry = malloc(sizeof(lookup_entry_t));
+        if(entry == NULL) {
+            close(fd);
+            return NULL;
+        }
+        entry->fd = fd;
+        entry->st = st;
+        entry->refs = 1;
+        entry->cached = 0;
+        entry->key_len = 0;
+        return entry;
+    }
+    fill_slot(slot, path, len, fd, &st, now + cache->ttl);
+    slot->refs = 1;
+    return slot;
+}
+
+void lookup_release(lookup_cache_t *cache, lookup_entry_t *entry) {
+    if(entry == NULL) {
+        return;
+    }
+    if(!entry->cached) {
+        close(entry->fd);
+        free(entry);
+        return;
+    }
+    entry->refs--;
+}
+
+void lookup_invalidate(lookup_cache_t *cache, const char *path) {
+    size_t len = strlen(path);
+    if(len > LOOKUP_KEY_MAX) {
+        return;
+    }
+    lookup_entry_t *slot = &cache->slots[slot_of(path, len)];
+    if(slot->key_len != len || memcmp(slot->key, path, len) != 0) {
+        return;
+    }
+    if(slot->refs > 0) {
+        slot->expires = 0;
+        return;
+    }
+    fill_slot(slot, "", 0, -1, NULL, 0);
+}
+
+static size_t slot_of(const char *path, size_t len) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)path[i]) * 1099511628211ULL;
+    }
+    return hash % LOOKUP_SLOTS;
+}
+
+static void fill_slot(lookup_entry_t *slot, const char *path, size_t len, int fd, const struct stat *st,
+        uint64_t expires) {
+    if(slot->fd >= 0) {
+        close(slot->fd);
+    }
+    slot->fd = fd;
+    if(st != NULL) {
+        slot->st = *st;
+    }
+    slot->expires = expires;
+    slot->key_len = len;
+    memcpy(slot->key, path, len);
+}
@@ -0,0 +1,138 @@
+/**
+ * @file lookup.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Resolution of request paths beneath the document root with a lookup cache.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Paths are resolved relative to a directory file descriptor of the
+ * document root with openat2 and RESOLVE_BENEATH, so neither ".." segments nor
+ * symbolic links can escape the document root and the kernel only walks the
+ * relative part of the path. Results are kept in a small direct-mapped cache for
+ * a limited time: positive entries hold the opened file and its status, negative
+ * entries remember that nothing servable exists at the path. Repeated requests
+ * for the same path therefore do not touch the file system until the entry
+ * expires; changes made by other processes may be unnoticed for that long.
+ * Entries handed out are reference counted and are not evicted while referenced.
+ * The cache is not thread safe; each thread should use its own cache.
+ */
+
+#ifndef LOOKUP_H
+#define LOOKUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Number of entries of a cache.
+ */
+#define LOOKUP_SLOTS 256
+
+/**
+ * @brief Maximum length of a cached path.
+ * @details Longer paths are resolved without the cache.
+ */
+#define LOOKUP_KEY_MAX 200
+
+/**
+ * @brief Result of resolving a path.
+ * @details fd is the file opened read-only and non-blocking (-1 for negative
+ * entries), st its status. expires is the time (monotonic clock, in nanoseconds)
+ * after which a cached entry is resolved again. Entries which are not cached (e.g.
+ * named pipes, which must be opened per request) are freed when released.
+ */
+typedef struct lookup_entry {
+    int fd;
+    struct stat st;
+    uint64_t expires;
+    int refs;
+    int cached;
+    size_t key_len;
+    char key[LOOKUP_KEY_MAX];
+} lookup_entry_t;
+
+/**
+ * @brief A lookup cache.
+ * @details root is the directory file descriptor paths are resolved against, ttl
+ * the time in nanoseconds entries stay valid.
+ */
+typedef struct lookup_cache {
+    int root;
+    uint64_t ttl;
+    lookup_entry_t *slots;
+} lookup_cache_t;
+
+/**
+ * @brief Check whether a path contains a ".." segment.
+ *
+ * @param path Path, which need not be null terminated.
+ * @param len Length of path.
+ * @return int 1 if the path refers to a parent directory, 0 otherwise.
+ *
+ * @details Used where a path must not escape the document root although it is
+ * not resolved with RESOLVE_BENEATH.
+ */
+int lookup_has_dot_dot(const char *path, size_t len);
+
+/**
+ * @brief Open a path beneath a directory.
+ *
+ * @param root Directory file descriptor.
+ * @param path Relative path.
+ * @param flags Flags of open (O_CREAT is not supported).
+ * @return int File descriptor, or -1 on errors (errno is set, EXDEV if the path
+ * escapes root).
+ *
+ * @details On kernels without openat2, openat is used and paths containing ".."
+ * segments are rejected instead.
+ */
+int lookup_open(int root, const char *path, int flags);
+
+/**
+ * @brief Initialize a cache.
+ *
+ * @param cache Cache which should be initialized.
+ * @param root Directory file descriptor of the document root.
+ * @param ttl Time in nanoseconds entries stay valid.
+ * @return int 0 on success, -1 if allocating failed.
+ */
+int lookup_cache_init(lookup_cache_t *cache, int root, uint64_t ttl);
+
+/**
+ * @brief Close all files of a cache and free it.
+ *
+ * @param cache Cache without referenced entries.
+ */
+void lookup_cache_destroy(lookup_cache_t *cache);
+
+/**
+ * @brief Resolve a path.
+ *
+ * @param cache Cache.
+ * @param path Path relative to the document root.
+ * @param now Current time (monotonic clock, in nanoseconds).
+ * @return lookup_entry_t* Entry of a regular file or named pipe, which must be
+ * released with lookup_release. NULL if there is none (errno is ENOENT) or
+ * resolving failed (errno is set).
+ */
+lookup_entry_t *lookup_get(lookup_cache_t *cache, const char *path, uint64_t now);
+
+/**
+ * @brief Release an entry returned by lookup_get.
+ *
+ * @param cache Cache the entry was taken from.
+ * @param entry Entry which should be released, may be NULL.
+ */
+void lookup_release(lookup_cache_t *cache, lookup_entry_t *entry);
+
+/**
+ * @brief Remove a path from a cache.
+ *
+ * @param cache Cache.
+ * @param path Path relative to the document root which was modified.
+ *
+ * @details Entries which are still referenced expire immediately instead.
+ */
+void lookup_invalidate(lookup_cache_t *cache, const char *path);
+
+#endif
@@ -0,0 +1,455 @@
+/**
+ * @file pack.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Packs a document root into an archive served by the server with -a.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Collects all regular files beneath the document root, resolved the
+ * same way as by the server, and writes them sorted by path into an archive
+ * together with their media types, entity tags and modification times (see
+ * archive.h). Precompressed siblings (a.css.gz, a.css.br, a.css.zst) which are
+ * not older than their file are stored once and referenced as variants of the
+ * file as well. With -z, compressible files without a gzip sibling get a gzip
+ * variant compressed by the program. The archive is written to a temporary file
+ * which replaces ARCHIVE once it is complete, so a running server can be pointed
+ * at the new archive with a reload.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "archive.h"
+#include "compress.h"
+#include "lookup.h"
+#include "http.h"
+
+/**
+ * @brief Minimum size of files compressed with -z.
+ * @details Smaller files do not benefit from compression.
+ */
+#define PACK_GZIP_MIN 256
+
+/**
+ * @brief A file to be packed.
+ * @details path is relative to the document root, st the status of the file when
+ * it was collected and entry its entry of the index (offsets are filled in while
+ * writing the archive).
+ */
+typedef struct pack_file {
+    char *path;
+    size_t path_len;
+    struct stat st;
+    archive_entry_t entry;
+} pack_file_t;
+
+/**
+ * @brief Program name.
+ * @details Name of the executable used for usage and error messages.
+ */
+static char *progname;
+
+/**
+ * @brief Whether compressible files get a gzip variant (-z cli argument).
+ */
+static int gzip_opt = 0;
+
+/**
+ * @brief Directory file descriptor of the document root.
+ */
+static int root_fd = -1;
+
+/**
+ * @brief The collected files, sorted by path once collecting is done.
+ */
+static pack_file_t *files;
+
+/**
+ * @brief Number of collected files and capacity of files.
+ */
+static size_t file_cnt, file_cap;
+
+/**
+ * @brief The temporary archive file and its path.
+ */
+static int out_fd = -1;
+static char *tmp_path;
+
+/**
+ * @brief Device and inode of the temporary archive file, skipped when collecting.
+ */
+static struct stat out_st;
+
+/**
+ * @brief Current size of the archive being written.
+ */
+static uint64_t out_pos;
+
+/**
+ * @brief Content codings of the variants, indexed by archive_variant_t.
+ */
+static const int variant_encodings[ARCHIVE_VARIANTS] = {HTTP_ENC_IDENTITY, HTTP_ENC_GZIP, HTTP_ENC_BR, HTTP_ENC_ZSTD};
+
+/**
+ * @brief Print the usage message and exit with EXIT_FAILURE.
+ */
+static void usage(void);
+
+/**
+ * @brief Remove the temporary archive and exit.
+ *
+ * @param status Exit status.
+ */
+static void cleanup_exit(int status);
+
+/**
+ * @brief Collect the files beneath a directory.
+ *
+ * @param dir Path of the directory relative to the document root, "" for the
+ * document root itself.
+ *
+ * @details Global variables: root_fd, files, file_cnt, file_cap, out_st.
+ */
+static void collect(const char *dir);
+
+/**
+ * @brief Compare two files by path, in the order of the index.
+ *
+ * @param a First file.
+ * @param b Second file.
+ * @return int Result of archive_path_cmp.
+ */
+static int compare_files(const void *a, const void *b);
+
+/**
+ * @brief Find a collected file.
+ *
+ * @param path Path relative to the document root.
+ * @param len Length of path.
+ * @return pack_file_t* File, or NULL if the path was not collected.
+ *
+ * @details Global variables: files, file_cnt.
+ */
+static pack_file_t *find_file(const char *path, size_t len);
+
+/**
+ * @brief Open a collected file.
+ *
+ * @param file File.
+ * @return int File descriptor, exits on errors or if the file was modified since
+ * it was collected.
+ *
+ * @details Global variables: root_fd.
+ */
+static int open_file(const pack_file_t *file);
+
+/**
+ * @brief Append the contents of a file to the archive.
+ *
+ * @param file File.
+ *
+ * @details Sets the identity variant of the entry of the file.
+ * Global variables: out_fd, out_pos.
+ */
+static void write_contents(pack_file_t *file);
+
+/**
+ * @brief Add the compressed variants of a file.
+ *
+ * @param file File whose contents were written.
+ * @param cache Cache without limit used to compress the file with -z.
+ * @return int Number of variants compressed by the program.
+ *
+ * @details Refers to the contents of fresh precompressed siblings, with -z a
+ * gzip variant is appended to the archive instead if there is no sibling.
+ * Global variables: gzip_opt, out_fd, out_pos.
+ */
+static int add_variants(pack_file_t *file, compress_cache_t *cache);
+
+/**
+ * @brief Append data to the archive.
+ *
+ * @param data Data.
+ * @param len Length of data.
+ * @return archive_span_t Location of the data in the archive.
+ *
+ * @details Global variables: out_fd, out_pos.
+ */
+static archive_span_t append(const void *data, size_t len);
+
+int main(int argc, char **argv) {
+    progname = argv[0];
+
+    int c;
+    while((c = getopt(argc, argv, "z")) != -1) {
+        switch(c) {
+        case 'z':
+            gzip_opt = 1;
+            break;
+        case '?':
+        default:
+            usage();
+        }
+    }
+    if(argc - optind != 2) {
+        usage();
+    }
+    char *docroot = argv[optind], *archive_path = argv[optind + 1];
+
+    if((root_fd = open(docroot, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        ERRPRINTF("open on %s failed: %s\n", docroot, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if((tmp_path = malloc(strlen(archive_path) + 5)) == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    sprintf(tmp_path, "%s.tmp", archive_path);
+    if((out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+            || fstat(out_fd, &out_st) != 0) {
+        ERRPRINTF("open on %s failed: %s\n", tmp_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    collect("");
+    qsort(files, file_cnt, sizeof(pack_file_t), compare_files);
+
+    // The header is written last, once the location of the index is known
+    archive_header_t header;
+    memset(&header, 0, sizeof(header));
+    append(&header, sizeof(header));
+    uint64_t content_size = 0;
+    for(size_t i = 0; i < file_cnt; i++) {
+        write_contents(&files[i]);
+        content_size += files[i].st.st_size;
+    }
+    compress_cache_t cache;
+    compress_cache_init(&cache, 0);
+    int compressed = 0, precompressed = 0;
+    for(size_t i = 0; i < file_cnt; i++) {
+        compressed += add_variants(&files[i], &cache);
+        precompressed += __builtin_popcount(files[i].entry.variant_mask) - 1;
+    }
+    precompressed -= compressed;
+    compress_cache_destroy(&cache);
+
+    for(size_t i = 0; i < file_cnt; i++) {
+        pack_file_t *file = &files[i];
+        char etag[HTTP_ETAG_MAX + 1];
+        const char *mime = http_mime_type(file->path);
+        file->entry.path = append(file->path, file->path_len);
+        file->entry.mime = append(mime, strlen(mime));
+        file->entry.etag = append(etag, http_format_etag(etag, &file->st));
+        file->entry.mtime = file->st.st_mtime;
+    }
+    static const char padding[8];
+    append(padding, (8 - out_pos % 8) % 8);
+    header.index.offset = out_pos;
+    for(size_t i = 0; i < file_cnt; i++) {
+        append(&files[i].entry, sizeof(archive_entry_t));
+    }
+    header.index.len = out_pos - header.index.offset;
+
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.order = 0x01020304;
+    header.size = out_pos;
+    header.entry_cnt = file_cnt;
+    if(pwrite(out_fd, &header, sizeof(header), 0) != sizeof(header) || fsync(out_fd) != 0) {
+        ERRPRINTF("write on %s failed: %s\n", tmp_path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    if(rename(tmp_path, archive_path) != 0) {
+        ERRPRINTF("rename to %s failed: %s\n", archive_path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    close(out_fd);
+
+    printf("Packed %zu files (%llu bytes, %d precompressed and %d compressed variants) into %s (%llu bytes)\n",
+        file_cnt, (unsigned long long)content_size, precompressed, compressed, archive_path,
+        (unsigned long long)out_pos);
+    return EXIT_SUCCESS;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [-z] DOC_ROOT ARCHIVE\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+static void cleanup_exit(int status) {
+    if(out_fd >= 0) {
+        close(out_fd);
+        unlink(tmp_path);
+    }
+    exit(status);
+}
+
+static void collect(const char *dir) {
+    int dir_fd = *dir == '\0' ? openat(root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+        : lookup_open(root_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *stream = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+    if(stream == NULL) {
+        ERRPRINTF("opening directory %s failed: %s\n", *dir == '\0' ? "." : dir, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+
+    struct dirent *ent;
+    while((ent = readdir(stream)) != NULL) {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        char path[PATH_MAX];
+        int path_len = snprintf(path, sizeof(path), "%s%s%s", dir, *dir == '\0' ? "" : "/", ent->d_name);
+        if(path_len >= (int)sizeof(path)) {
+            ERRPRINTF("path %s/%s is too long\n", dir, ent->d_name);
+            cleanup_exit(EXIT_FAILURE);
+        }
+
+        // Symbolic links to directories are not followed, so the walk cannot loop
+        struct stat st;
+        if(fstatat(dir_fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            ERRPRINTF("stat on %s failed: %s\n", path, strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        if(S_ISDIR(st.st_mode)) {
+            collect(path);
+            continue;
+        }
+
+        // Files are resolved like by the server, links escaping the document root are skipped
+        int fd = lookup_open(root_fd, path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if(fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+                || (st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino)) {
+            if(fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        close(fd);
+
+        if(file_cnt == file_cap) {
+            file_cap = file_cap == 0 ? 64 : 2 * file_cap;
+            pack_file_t *grown = realloc(files, file_cap * sizeof(pack_file_t));
+            if(grown == NULL) {
+                ERRPRINTF("realloc failed: %s\n", strerror(errno));
+                cleanup_exit(EXIT_FAILURE);
+            }
+            files = grown;
+        }
+        pack_file_t *file = &files[file_cnt++];
+        memset(file, 0, sizeof(*file));
+        if((file->path = strdup(path)) == NULL) {
+            ERRPRINTF("strdup failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        file->path_len = path_len;
+        file->st = st;
+    }
+    closedir(stream);
+}
+
+static int compare_files(const void *a, const void *b) {
+    const pack_file_t *fa = a, *fb = b;
+    return archive_path_cmp(fa->path, fa->path_len, fb->path, fb->path_len);
+}
+
+static pack_file_t *find_file(const char *path, size_t len) {
+    size_t low = 0, high = file_cnt;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = archive_path_cmp(files[mid].path, files[mid].path_len, path, len);
+        if(cmp == 0) {
+            return &files[mid];
+        }
+        if(cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+static int open_file(const pack_file_t *file) {
+    int fd = lookup_open(root_fd, file->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        ERRPRINTF("open on %s failed: %s\n", file->path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    // The entity tag was derived from the status when the file was collected
+    if(st.st_ino != file->st.st_ino || st.st_size != file->st.st_size
+            || st.st_mtim.tv_sec != file->st.st_mtim.tv_sec || st.st_mtim.tv_nsec != file->st.st_mtim.tv_nsec) {
+        ERRPRINTF("%s was modified while packing\n", file->path);
+        cleanup_exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void write_contents(pack_file_t *file) {
+    int fd = open_file(file);
+    if(http_sendfile(out_fd, fd, 0, file->st.st_size) != HTTP_SUCCESS) {
+        ERRPRINTF("copying %s failed: %s\n", file->path, errno == EPIPE ? "file was truncated" : strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    close(fd);
+    file->entry.variants[ARCHIVE_IDENTITY].offset = out_pos;
+    file->entry.variants[ARCHIVE_IDENTITY].len = file->st.st_size;
+    file->entry.variant_mask = 1 << ARCHIVE_IDENTITY;
+    out_pos += file->st.st_size;
+}
+
+static int add_variants(pack_file_t *file, compress_cache_t *cache) {
+    for(int i = ARCHIVE_IDENTITY + 1; i < ARCHIVE_VARIANTS; i++) {
+        // Precompressed files older than the file are stale
+        const char *ext = http_encoding_ext(variant_encodings[i]);
+        char path[PATH_MAX + 8];
+        size_t len = snprintf(path, sizeof(path), "%s%s", file->path, ext);
+        pack_file_t *sibling = find_file(path, len);
+        if(sibling != NULL && (sibling->st.st_mtim.tv_sec > file->st.st_mtim.tv_sec
+                || (sibling->st.st_mtim.tv_sec == file->st.st_mtim.tv_sec
+                    && sibling->st.st_mtim.tv_nsec >= file->st.st_mtim.tv_nsec))) {
+            file->entry.variants[i] = sibling->entry.variants[ARCHIVE_IDENTITY];
+            file->entry.variant_mask |= 1 << i;
+        }
+    }
+
+    if(!gzip_opt || (file->entry.variant_mask & (1 << ARCHIVE_GZIP)) || file->st.st_size < PACK_GZIP_MIN
+            || !http_mime_compressible(http_mime_type(file->path))) {
+        return 0;
+    }
+    int fd = open_file(file);
+    compress_entry_t *entry = compress_cache_get(cache, file->path, fd, &file->st, HTTP_ENC_GZIP);
+    if(entry == NULL) {
+        ERRPRINTF("compressing %s failed: %s\n", file->path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    close(fd);
+    if(entry->data == NULL) {
+        // Compression does not reduce the size of this file
+        compress_cache_release(cache, entry);
+        return 0;
+    }
+    file->entry.variants[ARCHIVE_GZIP] = append(entry->data, entry->len);
+    file->entry.variant_mask |= 1 << ARCHIVE_GZIP;
+    compress_cache_release(cache, entry);
+    return 1;
+}
+
+static archive_span_t append(const void *data, size_t len) {
+    archive_span_t span = {out_pos, len};
+    struct iovec iov = {(void *)data, len};
+    if(http_writev(out_fd, &iov, 1) != HTTP_SUCCESS) {
+        ERRPRINTF("write on %s failed: %s\n", tmp_path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    out_pos += len;
+    return span;
+}
@@ -0,0 +1,518 @@
+/**
+ * @file parser.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the http head parser defined in parser.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The parser is a byte oriented state machine. The current state and the
+ * offset of the next unconsumed byte are stored in the parser struct, which allows
+ * the parser to be suspended at any byte boundary and resumed once more data was
+ * received. Tokens are recorded as offsets into the caller's buffer (mark and
+ * mark_end) until they are complete and then stored as slices.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "parser.h"
+
+/**
+ * @brief States of the parser state machine.
+ */
+enum parse_state {
+    S_START = 0,
+    S_TOKEN_1,
+    S_TOKEN_2,
+    S_TOKEN_3,
+    S_LINE_LF,
+    S_HEADER_START,
+    S_HEADER_NAME,
+    S_HEADER_OWS,
+    S_HEADER_VALUE,
+    S_HEADER_LF,
+    S_HEAD_LF,
+    S_DONE
+};
+
+/**
+ * @brief States of the chunked body decoder.
+ */
+enum chunk_state {
+    C_SIZE_START = 0,
+    C_SIZE,
+    C_EXT,
+    C_SIZE_LF,
+    C_DATA,
+    C_DATA_CR,
+    C_DATA_LF,
+    C_TRAILER_START,
+    C_TRAILER,
+    C_END_LF,
+    C_DONE
+};
+
+/**
+ * @brief Check whether a character is a token character.
+ *
+ * @param c Character which should be checked.
+ * @return int 1 if c may be part of a method or header name, 0 otherwise.
+ *
+ * @details Implements the tchar rule of RFC 7230.
+ */
+static int is_tchar(unsigned char c);
+
+/**
+ * @brief Check whether a version slice has the format "HTTP/<digit>.<digit>".
+ *
+ * @param version Slice which should be checked.
+ * @return int 1 if the format is valid, 0 otherwise.
+ */
+static int is_version(http_slice_t version);
+
+/**
+ * @brief Finish the start line of the message.
+ *
+ * @param parser Parser state.
+ * @param buf Parse buffer.
+ * @return http_parse_res_t HTTP_PARSE_AGAIN if the start line is valid and parsing
+ * should continue and HTTP_PARSE_ERROR otherwise.
+ *
+ * @details Stores the third token of the start line and validates the version and
+ * (for responses) the status code.
+ */
+static http_parse_res_t finish_start_line(http_parser_t *parser, const char *buf);
+
+/**
+ * @brief Store a completely parsed header field to the header table.
+ *
+ * @param parser Parser state, header_name contains the name of the field.
+ * @param buf Parse buffer.
+ * @return http_parse_res_t HTTP_PARSE_AGAIN if the field was stored and 
+ * HTTP_PARSE_ERROR if it is a forbidden repetition of a well-known field.
+ *
+ * @details Repeated Host and Content-Length fields are rejected, as they would make
+ * the message ambiguous.
+ */
+static http_parse_res_t store_header(http_parser_t *parser, const char *buf);
+
+/**
+ * @brief Canonical names of the well-known header fields, indexed by http_header_id_t.
+ */
+static const char *const known_names[HTTP_HDR_KNOWN_COUNT] = {
+    [HTTP_HDR_HOST] = "Host",
+    [HTTP_HDR_CONNECTION] = "Connection",
+    [HTTP_HDR_CONTENT_LENGTH] = "Content-Length",
+    [HTTP_HDR_RANGE] = "Range",
+    [HTTP_HDR_IF_NONE_MATCH] = "If-None-Match",
+    [HTTP_HDR_ACCEPT_ENCODING] = "Accept-Encoding",
+    [HTTP_HDR_IF_MODIFIED_SINCE] = "If-Modified-Since",
+    [HTTP_HDR_TRANSFER_ENCODING] = "Transfer-Encoding"
+};
+
+void http_parser_init(http_parser_t *parser, http_parse_type_t type) {
+    parser->type = type;
+    parser->state = S_START;
+    parser->pos = 0;
+    parser->mark = 0;
+    parser->mark_end = 0;
+    parser->header_len = 0;
+    parser->head_len = 0;
+    http_headers_init(&parser->headers);
+    parser->status = 0;
+    parser->method.ptr = parser->path.ptr = parser->version.ptr = parser->status_text.ptr = NULL;
+    parser->method.len = parser->path.len = parser->version.len = parser->status_text.len = 0;
+}
+
+http_parse_res_t http_parse(http_parser_t *parser, const char *buf, size_t len) {
+    for(; parser->pos < len; parser->pos++) {
+        if(parser->pos >= HTTP_MAX_HEAD) {
+            return HTTP_PARSE_TOO_LARGE;
+        }
+
+        unsigned char c = buf[parser->pos];
+        switch(parser->state) {
+        case S_START:
+            // Tolerate empty lines preceding the start line (RFC 7230, 3.5)
+            if(c == '\r' || c == '\n') {
+                break;
+            }
+            parser->mark = parser->pos;
+            parser->state = S_TOKEN_1;
+            // fall through
+        case S_TOKEN_1:
+            if(c == ' ') {
+                if(parser->pos == parser->mark) {
+                    return HTTP_PARSE_ERROR;
+                }
+                http_slice_t tok = {buf + parser->mark, parser->pos - parser->mark};
+                if(parser->type == HTTP_PARSE_REQUEST) {
+                    parser->method = tok;
+                } else {
+                    parser->version = tok;
+                }
+                parser->mark = parser->pos + 1;
+                parser->state = S_TOKEN_2;
+            } else if(parser->type == HTTP_PARSE_REQUEST ? !is_tchar(c) : (c <= ' ' || c == 127)) {
+                return HTTP_PARSE_ERROR;
+            }
+            break;
+        case S_TOKEN_2:
+            if(c == ' ' || ((c == '\r' || c == '\n') && parser->type == HTTP_PARSE_RESPONSE)) {
+                if(parser->pos == parser->mark) {
+                    return HTTP_PARSE_ERROR;
+                }
+                http_slice_t tok = {buf + parser->mark, parser->pos - parser->mark};
+                if(parser->type == HTTP_PARSE_REQUEST) {
+                    parser->path = tok;
+                } else {
+                    if(tok.len != 3) {
+                        return HTTP_PARSE_ERROR;
+                    }
+                    parser->status = (tok.ptr[0] - '0') * 100 + (tok.ptr[1] - '0') * 10 + (tok.ptr[2] - '0');
+                }
+                if(c == ' ') {
+                    parser->mark = parser->pos + 1;
+                    parser->state = S_TOKEN_3;
+                    break;
+                }
+                // Response without status text
+                parser->mark = parser->pos;
+                if(finish_start_line(parser, buf) != HTTP_PARSE_AGAIN) {
+                    return HTTP_PARSE_ERROR;
+                }
+                parser->state = c == '\r' ? S_LINE_LF : S_HEADER_START;
+            } else if(parser->type == HTTP_PARSE_RESPONSE && (c < '0' || c > '9')) {
+                return HTTP_PARSE_ERROR;
+            } else if(parser->type == HTTP_PARSE_REQUEST && parser->pos == parser->mark && c != '/') {
+                // Only origin-form targets are supported, no absolute URIs or "*"
+                return HTTP_PARSE_ERROR;
+            } else if(c < ' ' || c == 127) {
+                return HTTP_PARSE_ERROR;
+            }
+            break;
+        case S_TOKEN_3:
+            if(c == '\r' || c == '\n') {
+                if(finish_start_line(parser, buf) != HTTP_PARSE_AGAIN) {
+                    return HTTP_PARSE_ERROR;
+                }
+                parser->state = c == '\r' ? S_LINE_LF : S_HEADER_START;
+            } else if((c < ' ' && c != '\t') || c == 127) {
+                return HTTP_PARSE_ERROR;
+            }
+            break;
+        case S_LINE_LF:
+        case S_HEADER_LF:
+            if(c != '\n') {
+                return HTTP_PARSE_ERROR;
+            }
+            if(parser->state == S_HEADER_LF && store_header(parser, buf) != HTTP_PARSE_AGAIN) {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->state = S_HEADER_START;
+            break;
+        case S_HEADER_START:
+            if(c == '\r') {
+                parser->state = S_HEAD_LF;
+                break;
+            }
+            if(c == '\n') {
+                parser->state = S_DONE;
+                parser->head_len = ++parser->pos;
+                return HTTP_PARSE_DONE;
+            }
+            // Obsolete line folding (leading whitespace) is rejected
+            if(!is_tchar(c)) {
+                return HTTP_PARSE_ERROR;
+            }
+            if(parser->header_len == HTTP_MAX_HEADERS) {
+                return HTTP_PARSE_TOO_LARGE;
+            }
+            parser->mark = parser->pos;
+            parser->state = S_HEADER_NAME;
+            break;
+        case S_HEADER_NAME:
+            if(c == ':') {
+                parser->header_name.ptr = buf + parser->mark;
+                parser->header_name.len = parser->pos - parser->mark;
+                parser->mark = parser->mark_end = parser->pos + 1;
+                parser->state = S_HEADER_OWS;
+            } else if(!is_tchar(c)) {
+                return HTTP_PARSE_ERROR;
+            }
+            break;
+        case S_HEADER_OWS:
+            if(c == ' ' || c == '\t') {
+                parser->mark = parser->mark_end = parser->pos + 1;
+                break;
+            }
+            parser->state = S_HEADER_VALUE;
+            // fall through
+        case S_HEADER_VALUE:
+            if(c == '\r' || c == '\n') {
+                if(c == '\r') {
+                    parser->state = S_HEADER_LF;
+                    break;
+                }
+                if(store_header(parser, buf) != HTTP_PARSE_AGAIN) {
+                    return HTTP_PARSE_ERROR;
+                }
+                parser->state = S_HEADER_START;
+            } else if((c < ' ' && c != '\t') || c == 127) {
+                return HTTP_PARSE_ERROR;
+            } else if(c != ' ' && c != '\t') {
+                // Trailing whitespace is not part of the value
+                parser->mark_end = parser->pos + 1;
+            }
+            break;
+        case S_HEAD_LF:
+            if(c != '\n') {
+                return HTTP_PARSE_ERROR;
+            }
+            parser->state = S_DONE;
+            parser->head_len = ++parser->pos;
+            return HTTP_PARSE_DONE;
+        case S_DONE:
+            return HTTP_PARSE_DONE;
+        }
+    }
+
+    if(parser->state == S_DONE) {
+        return HTTP_PARSE_DONE;
+    }
+    return parser->pos >= HTTP_MAX_HEAD ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_AGAIN;
+}
+
+int http_slice_eq(http_slice_t slice, const char *str) {
+    return strncasecmp(slice.ptr, str, slice.len) == 0 && str[slice.len] == '\0';
+}
+
+http_slice_t http_slice(const char *str) {
+    http_slice_t slice = {str, strlen(str)};
+    return slice;
+}
+
+http_header_id_t http_header_id(http_slice_t name) {
+    http_header_id_t id;
+    switch(name.len) {
+    case 4:
+        id = HTTP_HDR_HOST;
+        break;
+    case 5:
+        id = HTTP_HDR_RANGE;
+        break;
+    case 10:
+        id = HTTP_HDR_CONNECTION;
+        break;
+    case 13:
+        id = HTTP_HDR_IF_NONE_MATCH;
+        break;
+    case 14:
+        id = HTTP_HDR_CONTENT_LENGTH;
+        break;
+    case 15:
+        id = HTTP_HDR_ACCEPT_ENCODING;
+        break;
+    case 17:
+        id = (name.ptr[0] | 0x20) == 't' ? HTTP_HDR_TRANSFER_ENCODING : HTTP_HDR_IF_MODIFIED_SINCE;
+        break;
+    default:
+        return HTTP_HDR_OTHER;
+    }
+    return strncasecmp(name.ptr, known_names[id], name.len) == 0 ? id : HTTP_HDR_OTHER;
+}
+
+http_slice_t http_header_name(http_header_id_t id) {
+    return http_slice(known_names[id]);
+}
+
+void http_headers_init(http_headers_t *headers) {
+    for(int i = 0; i < HTTP_HDR_KNOWN_COUNT; i++) {
+        headers->known[i].ptr = NULL;
+        headers->known[i].len = 0;
+    }
+    headers->other_len = 0;
+}
+
+void http_header_set(http_headers_t *headers, http_header_id_t id, const char *value) {
+    headers->known[id] = http_slice(value);
+}
+
+int http_header_add(http_headers_t *headers, http_slice_t name, http_slice_t value) {
+    http_header_id_t id = http_header_id(name);
+    if(id != HTTP_HDR_OTHER && headers->known[id].ptr == NULL) {
+        headers->known[id] = value;
+        return 0;
+    }
+    if(headers->other_len == HTTP_MAX_HEADERS) {
+        return -1;
+    }
+    headers->other[headers->other_len].name = name;
+    headers->other[headers->other_len].value = value;
+    headers->other_len++;
+    return 0;
+}
+
+http_slice_t http_header_find(const http_headers_t *headers, const char *name) {
+    http_header_id_t id = http_header_id(http_slice(name));
+    if(id != HTTP_HDR_OTHER) {
+        return headers->known[id];
+    }
+    for(size_t i = 0; i < headers->other_len; i++) {
+        if(http_slice_eq(headers->other[i].name, name)) {
+            return headers->other[i].value;
+        }
+    }
+    http_slice_t none = {NULL, 0};
+    return none;
+}
+
+static http_parse_res_t store_header(http_parser_t *parser, const char *buf) {
+    http_slice_t value = {buf + parser->mark, parser->mark_end - parser->mark};
+    http_header_id_t id = http_header_id(parser->header_name);
+    if((id == HTTP_HDR_HOST || id == HTTP_HDR_CONTENT_LENGTH) && parser->headers.known[id].ptr != NULL) {
+        return HTTP_PARSE_ERROR;
+    }
+    // Cannot fail, the number of fields was checked at the start of the line
+    http_header_add(&parser->headers, parser->header_name, value);
+    parser->header_len++;
+    return HTTP_PARSE_AGAIN;
+}
+
+static http_parse_res_t finish_start_line(http_parser_t *parser, const char *buf) {
+    http_slice_t tok = {buf + parser->mark, parser->pos - parser->mark};
+    if(parser->type == HTTP_PARSE_REQUEST) {
+        parser->version = tok;
+    } else {
+        parser->status_text = tok;
+    }
+    if(!is_version(parser->version)) {
+        return HTTP_PARSE_ERROR;
+    }
+    return HTTP_PARSE_AGAIN;
+}
+
+static int is_tchar(unsigned char c) {
+    if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return 1;
+    }
+    switch(c) {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+    case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int is_version(http_slice_t version) {
+    return version.len == 8 && strncmp(version.ptr, "HTTP/", 5) == 0
+        && version.ptr[5] >= '0' && version.ptr[5] <= '9'
+        && version.ptr[6] == '.'
+        && version.ptr[7] >= '0' && version.ptr[7] <= '9';
+}
+
+void http_chunked_init(http_chunked_t *dec) {
+    dec->state = C_SIZE_START;
+    dec->remaining = 0;
+    dec->total = 0;
+}
+
+http_parse_res_t http_chunked_decode(http_chunked_t *dec, char *buf, size_t len, size_t *out_len, size_t *used) {
+    size_t in = 0, out = 0;
+    while(in < len && dec->state != C_DONE) {
+        if(dec->state == C_DATA) {
+            // Move as much chunk data as available at once
+            size_t n = len - in < dec->remaining ? len - in : (size_t)dec->remaining;
+            memmove(buf + out, buf + in, n);
+            in += n;
+            out += n;
+            dec->remaining -= n;
+            dec->total += n;
+            if(dec->remaining == 0) {
+                dec->state = C_DATA_CR;
+            }
+            continue;
+        }
+
+        unsigned char c = buf[in++];
+        switch(dec->state) {
+        case C_SIZE_START:
+        case C_SIZE: {
+            int digit = c >= '0' && c <= '9' ? c - '0'
+                : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+            if(digit >= 0) {
+                if(dec->remaining > (UINT64_MAX >> 4)) {
+                    return HTTP_PARSE_ERROR;
+                }
+                dec->remaining = (dec->remaining << 4) | digit;
+                dec->state = C_SIZE;
+                break;
+            }
+            if(dec->state == C_SIZE_START) {
+                return HTTP_PARSE_ERROR;
+            }
+            if(c == ';' || c == ' ' || c == '\t') {
+                dec->state = C_EXT;
+                break;
+            }
+        }
+            // fall through
+        case C_EXT:
+            if(c == '\r') {
+                dec->state = C_SIZE_LF;
+                break;
+            }
+            if(c != '\n') {
+                if(dec->state != C_EXT) {
+                    return HTTP_PARSE_ERROR;
+                }
+                break;
+            }
+            // fall through
+        case C_SIZE_LF:
+            if(c != '\n') {
+                return HTTP_PARSE_ERROR;
+            }
+            dec->state = dec->remaining == 0 ? C_TRAILER_START : C_DATA;
+            break;
+        case C_DATA_CR:
+            if(c == '\r') {
+                dec->state = C_DATA_LF;
+                break;
+            }
+            // fall through
+        case C_DATA_LF:
+            if(c != '\n') {
+                return HTTP_PARSE_ERROR;
+            }
+            dec->state = C_SIZE_START;
+            break;
+        case C_TRAILER_START:
+            if(c == '\r') {
+                dec->state = C_END_LF;
+                break;
+            }
+            if(c == '\n') {
+                dec->state = C_DONE;
+                break;
+            }
+            dec->state = C_TRAILER;
+            // fall through
+        case C_TRAILER:
+            if(c == '\n') {
+                dec->state = C_TRAILER_START;
+            }
+            break;
+        case C_END_LF:
+            if(c != '\n') {
+                return HTTP_PARSE_ERROR;
+            }
+            dec->state = C_DONE;
+            break;
+        }
+    }
+
+    *out_len = out;
+    *used = in;
+    return dec->state == C_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_AGAIN;
+}
@@ -0,0 +1,293 @@
+/**
+ * @file parser.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Incremental, allocation free parser for http message heads.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details This module contains a resumable state machine which parses the head
+ * (start line and header fields) of a http request or response. The parser does
+ * not own any memory: the caller accumulates the received bytes in a buffer and
+ * passes the whole buffer (always starting at the first byte of the message) to
+ * http_parse each time new data arrived. Parsing continues where the previous
+ * call stopped, so partial input spread across several reads is handled without
+ * rescanning. All parsed tokens are returned as slices (pointer and length) into
+ * the caller's buffer, which therefore must not be moved or modified while the
+ * parse results are in use.
+ */
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Maximum size of a message head.
+ * @details Upper bound for the number of bytes of the start line and all header
+ * fields including the terminating empty line. Longer heads are rejected with
+ * HTTP_PARSE_TOO_LARGE.
+ */
+#define HTTP_MAX_HEAD 8192
+
+/**
+ * @brief Maximum number of header fields.
+ * @details Upper bound for the number of header fields of a single message.
+ * Messages with more fields are rejected with HTTP_PARSE_TOO_LARGE.
+ */
+#define HTTP_MAX_HEADERS 64
+
+/**
+ * @brief Pointer and length of a token within the parse buffer.
+ * @details Slices are not null terminated.
+ */
+typedef struct http_slice {
+    const char *ptr;
+    size_t len;
+} http_slice_t;
+
+/**
+ * @brief Initializer of a slice covering a string literal.
+ */
+#define HTTP_SLICE_LIT(str) {(str), sizeof(str) - 1}
+
+/**
+ * @brief Identifiers of well-known header fields.
+ * @details Header fields with an identifier are stored at a fixed position of
+ * http_headers_t, so looking them up does not require comparing names. All other 
+ * fields have the identifier HTTP_HDR_OTHER.
+ */
+typedef enum http_header_id {
+    HTTP_HDR_OTHER = -1,
+    HTTP_HDR_HOST = 0,
+    HTTP_HDR_CONNECTION,
+    HTTP_HDR_CONTENT_LENGTH,
+    HTTP_HDR_RANGE,
+    HTTP_HDR_IF_NONE_MATCH,
+    HTTP_HDR_ACCEPT_ENCODING,
+    HTTP_HDR_IF_MODIFIED_SINCE,
+    HTTP_HDR_TRANSFER_ENCODING,
+
+    // Number of well-known header fields, not a valid identifier
+    HTTP_HDR_KNOWN_COUNT
+} http_header_id_t;
+
+/**
+ * @brief Name and value of a single header field.
+ */
+typedef struct http_header {
+    http_slice_t name;
+    http_slice_t value;
+} http_header_t;
+
+/**
+ * @brief Table of the header fields of a http message.
+ * @details Values of well-known fields are stored in known, indexed by their 
+ * http_header_id_t (a slice with ptr == NULL denotes a missing field). All other
+ * fields, as well as repeated well-known fields, are stored in order of appearance
+ * in the contiguous array other. The table does not own the memory the slices 
+ * point to.
+ */
+typedef struct http_headers {
+    http_slice_t known[HTTP_HDR_KNOWN_COUNT];
+    size_t other_len;
+    http_header_t other[HTTP_MAX_HEADERS];
+} http_headers_t;
+
+typedef enum http_parse_type {
+    // Parse a request ("<method> <path> <version>")
+    HTTP_PARSE_REQUEST = 0,
+
+    // Parse a response ("<version> <status> <status text>")
+    HTTP_PARSE_RESPONSE = 1
+} http_parse_type_t;
+
+typedef enum http_parse_res {
+    // The head was parsed completely
+    HTTP_PARSE_DONE = 0,
+
+    // More input is needed
+    HTTP_PARSE_AGAIN = 1,
+
+    // The input is not a valid http message head
+    HTTP_PARSE_ERROR = 2,
+
+    // The head exceeds HTTP_MAX_HEAD or HTTP_MAX_HEADERS
+    HTTP_PARSE_TOO_LARGE = 3
+} http_parse_res_t;
+
+/**
+ * @brief State of the incremental parser.
+ * @details Contains the internal state machine position along with the results
+ * parsed so far. For requests, method, path and version are set, for responses
+ * version, status and status_text. The path of a request is its origin-form target
+ * (including the query), so it always starts with a slash. head_len is the number of bytes of the head
+ * (including the empty line) once http_parse returned HTTP_PARSE_DONE; bytes after
+ * that offset belong to the message body or to the next message. The header fields
+ * are stored to the headers table, header_len counts all of them.
+ */
+typedef struct http_parser {
+    http_parse_type_t type;
+    int state;
+    size_t pos;
+    size_t mark;
+    size_t mark_end;
+
+    http_slice_t method;
+    http_slice_t path;
+    http_slice_t version;
+    int status;
+    http_slice_t status_text;
+
+    size_t header_len;
+    http_slice_t header_name;
+    http_headers_t headers;
+
+    size_t head_len;
+} http_parser_t;
+
+/**
+ * @brief State of the decoder for chunked message bodies.
+ * @details remaining is the number of data bytes of the current chunk which have 
+ * not been received yet, total the number of data bytes decoded so far.
+ */
+typedef struct http_chunked {
+    int state;
+    uint64_t remaining;
+    uint64_t total;
+} http_chunked_t;
+
+/**
+ * @brief Initialize or reset a parser.
+ *
+ * @param parser Parser which should be initialized.
+ * @param type Whether requests or responses should be parsed.
+ *
+ * @details Resets the parser to the start of a new message. Must be called before
+ * the first call of http_parse and before parsing the next message on a connection.
+ */
+void http_parser_init(http_parser_t *parser, http_parse_type_t type);
+
+/**
+ * @brief Continue parsing a message head.
+ *
+ * @param parser Parser state.
+ * @param buf Buffer containing the message received so far, starting with the
+ * first byte of the message.
+ * @param len Number of valid bytes in buf.
+ * @return http_parse_res_t HTTP_PARSE_DONE if the head is complete, HTTP_PARSE_AGAIN if
+ * more input is needed and HTTP_PARSE_ERROR or HTTP_PARSE_TOO_LARGE otherwise.
+ *
+ * @details Parses the bytes of buf which have not been consumed by a previous call.
+ * buf must be the same buffer on each call (previously passed bytes may not change)
+ * and len must not decrease. Once HTTP_PARSE_DONE is returned, further calls return
+ * HTTP_PARSE_DONE without consuming input.
+ */
+http_parse_res_t http_parse(http_parser_t *parser, const char *buf, size_t len);
+
+/**
+ * @brief Initialize a chunked body decoder.
+ *
+ * @param dec Decoder which should be initialized.
+ */
+void http_chunked_init(http_chunked_t *dec);
+
+/**
+ * @brief Decode the next part of a chunked message body in place.
+ *
+ * @param dec Decoder state.
+ * @param buf Bytes of the body received since the previous call. The decoded data 
+ * is moved to the start of buf.
+ * @param len Number of valid bytes in buf.
+ * @param out_len Pointer where the number of decoded data bytes will be stored.
+ * @param used Pointer where the number of consumed bytes of buf will be stored; it
+ * is less than len only if the body ended and the remaining bytes belong to the next
+ * message.
+ * @return http_parse_res_t HTTP_PARSE_DONE if the end of the body (including the 
+ * trailer section) was reached, HTTP_PARSE_AGAIN if more input is needed and 
+ * HTTP_PARSE_ERROR if the chunk framing is invalid.
+ *
+ * @details Unlike http_parse, each call only receives the new bytes, so the caller
+ * can reuse its buffer once the decoded data was processed. Chunk extensions and
+ * trailer fields are skipped.
+ */
+http_parse_res_t http_chunked_decode(http_chunked_t *dec, char *buf, size_t len, size_t *out_len, size_t *used);
+
+/**
+ * @brief Compare a slice with a null terminated string.
+ *
+ * @param slice Slice which should be compared.
+ * @param str String which should be compared.
+ * @return int 1 if both are equal ignoring case, 0 otherwise.
+ */
+int http_slice_eq(http_slice_t slice, const char *str);
+
+/**
+ * @brief Create a slice from a null terminated string.
+ *
+ * @param str String the slice should refer to.
+ * @return http_slice_t Slice covering str without the null byte.
+ */
+http_slice_t http_slice(const char *str);
+
+/**
+ * @brief Get the identifier of a header name.
+ *
+ * @param name Header name (case insensitive).
+ * @return http_header_id_t The identifier of the well-known field or HTTP_HDR_OTHER.
+ *
+ * @details Dispatches on the length (and, for names of equal length, the first
+ * character) of the name, so at most one string comparison is performed.
+ */
+http_header_id_t http_header_id(http_slice_t name);
+
+/**
+ * @brief Get the name of a well-known header field.
+ *
+ * @param id Identifier of the field.
+ * @return http_slice_t The canonical name of the field.
+ */
+http_slice_t http_header_name(http_header_id_t id);
+
+/**
+ * @brief Remove all fields from a header table.
+ *
+ * @param headers Header table which should be cleared.
+ */
+void http_headers_init(http_headers_t *headers);
+
+/**
+ * @brief Set the value of a well-known header field.
+ *
+ * @param headers Header table.
+ * @param id Identifier of the field.
+ * @param value Value of the field, the string must outlive the table.
+ */
+void http_header_set(http_headers_t *headers, http_header_id_t id, const char *value);
+
+/**
+ * @brief Add a header field.
+ *
+ * @param headers Header table.
+ * @param name Name of the field.
+ * @param value Value of the field.
+ * @return int 0 if the field was added, -1 if the table is full.
+ *
+ * @details Well-known fields which are not yet present are stored to their fixed
+ * position, all others are appended to the other array. 
+ */
+int http_header_add(http_headers_t *headers, http_slice_t name, http_slice_t value);
+
+/**
+ * @brief Look up a header field by name.
+ *
+ * @param headers Header table.
+ * @param name Header name (case insensitive).
+ * @return http_slice_t The value of the first field with the given name, or a slice
+ * with ptr == NULL if there is no such field.
+ *
+ * @details Well-known fields are found in constant time, other fields are searched
+ * linearly.
+ */
+http_slice_t http_header_find(const http_headers_t *headers, const char *name);
+
+#endif
@@ -0,0 +1,571 @@
+/**
+ * @file proxy.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the caching reverse proxy defined in proxy.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Entries are found through a hash table with chaining and kept in a
+ * doubly linked list in order of their last use for eviction, as in the cache of
+ * compressed variants, but shared by all workers under a mutex. Every fetcher
+ * thread owns a pool of the fetch module, which keeps the connection to the
+ * upstream open for the next request. The pool is used instead of http_send_req
+ * and http_recv_res of http.h, which block without a timeout and only read the
+ * body of 200 responses; it parses responses with the same parser. Bodies are
+ * written to a file by the fetch module; a file in the cache directory starts with a header recording the key,
+ * the media type and the expiry time and is named after the hash of the key, so
+ * it is found again after a restart.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "proxy.h"
+#include "fetch.h"
+#include "http.h"
+
+/**
+ * @brief Magic number at the start of a file of the cache directory.
+ */
+#define PROXY_MAGIC "OSUEPRXY"
+
+/**
+ * @brief Header of a file of the cache directory.
+ * @details Followed by the key (key_len bytes), the media type (mime_len bytes)
+ * and the body. expires is the time the response becomes stale.
+ */
+typedef struct proxy_file_header {
+    char magic[8];
+    int64_t expires;
+    uint32_t key_len;
+    uint32_t mime_len;
+} proxy_file_header_t;
+
+/**
+ * @brief State of the fetch of an entry.
+ * @details fd is the file the response is written to and tmp_name its name in the
+ * directory of the cache. body_off is the offset of the body in the file.
+ */
+typedef struct fetch_job {
+    proxy_t *proxy;
+    proxy_entry_t *entry;
+    int fd;
+    char tmp_name[48];
+    int64_t body_off;
+} fetch_job_t;
+
+/**
+ * @brief Contains the loop of a fetcher thread.
+ *
+ * @param arg The cache.
+ * @return void* NULL, the thread does not terminate.
+ *
+ * @details Takes entries from the job queue, completes them from the cache
+ * directory or the upstream and hands them to the waiting requests.
+ */
+static void *run_fetcher(void *arg);
+
+/**
+ * @brief Fetch the response of an entry from the upstream.
+ *
+ * @param proxy Cache.
+ * @param pool Pool of the calling thread.
+ * @param entry Entry being fetched.
+ *
+ * @details Sets the fields of the response. The body is written to a temporary
+ * file, which is renamed to the file of the key in the cache directory if the
+ * response may be reused.
+ */
+static void fetch_entry(proxy_t *proxy, fetch_pool_t *pool, proxy_entry_t *entry);
+
+/**
+ * @brief Process the response head of the upstream.
+ *
+ * @param req Request of a fetch_job_t.
+ * @param res Parsed response head.
+ * @return int 0 on success, -1 if writing the file header failed (errno is set).
+ *
+ * @details For successful responses, takes the media type and the lifetime from
+ * the head, writes the file header and lets the body be written behind it.
+ */
+static int on_head(fetch_req_t *req, const http_parser_t *res);
+
+/**
+ * @brief Complete an entry from the file of its key in the cache directory.
+ *
+ * @param proxy Cache.
+ * @param entry Entry being fetched.
+ * @return int 0 if a fresh response for the key was found, -1 otherwise.
+ */
+static int load_file(proxy_t *proxy, proxy_entry_t *entry);
+
+/**
+ * @brief Read the body of an entry into memory and close its file.
+ *
+ * @param entry Successfully completed entry with its body in a file.
+ * @return int 0 on success, -1 if allocating or reading failed.
+ */
+static int load_body(proxy_entry_t *entry);
+
+/**
+ * @brief Mark an entry as ready and wake up the requests waiting for it.
+ *
+ * @param proxy Locked cache.
+ * @param entry Entry whose response was set by its fetcher thread.
+ *
+ * @details Reusable responses are added to the usage list, evicting the least
+ * recently used entries if necessary; others are removed from the hash table, so
+ * later requests fetch them again. Releases the reference of the fetcher thread.
+ */
+static void complete(proxy_t *proxy, proxy_entry_t *entry);
+
+/**
+ * @brief Remove an entry from the hash table and the usage list.
+ *
+ * @param proxy Locked cache.
+ * @param entry Entry in the hash table.
+ *
+ * @details The entry is freed if it is not referenced.
+ */
+static void unlink_entry(proxy_t *proxy, proxy_entry_t *entry);
+
+/**
+ * @brief Free an entry, its body and its file.
+ */
+static void free_entry(proxy_entry_t *entry);
+
+/**
+ * @brief Compute the hash of a key.
+ *
+ * @param key Key.
+ * @param len Length of key.
+ * @return uint64_t FNV-1a hash of the key.
+ */
+static uint64_t hash_key(const char *key, size_t len);
+
+/**
+ * @brief Format the name of the file of a key in the cache directory.
+ *
+ * @param buf Buffer of at least 17 characters.
+ * @param hash Hash of the key.
+ */
+static void file_name(char *buf, uint64_t hash);
+
+int proxy_init(proxy_t *proxy, const char *upstream, const char *cache_dir, size_t max_size, int timeout,
+        void (*notify)(void *arg)) {
+    memset(proxy, 0, sizeof(*proxy));
+    proxy->max_size = max_size;
+    proxy->timeout = timeout;
+    proxy->notify = notify;
+
+    // Request paths start with a slash
+    size_t len = strlen(upstream);
+    while(len > 0 && upstream[len - 1] == '/') {
+        len--;
+    }
+    if((proxy->upstream = malloc(len + 2)) == NULL) {
+        return -1;
+    }
+    memcpy(proxy->upstream, upstream, len);
+    strcpy(proxy->upstream + len, "/");
+    fetch_req_t req;
+    fetch_err_t err = fetch_req_init(&req, proxy->upstream);
+    fetch_req_free(&req);
+    proxy->upstream[len] = '\0';
+    if(err != FETCH_SUCCESS) {
+        free(proxy->upstream);
+        errno = err == FETCH_ERR_INTERNAL ? ENOMEM : EINVAL;
+        return -1;
+    }
+
+    proxy->persist = cache_dir != NULL;
+    if(cache_dir == NULL && (cache_dir = getenv("TMPDIR")) == NULL) {
+        cache_dir = P_tmpdir;
+    }
+    if((proxy->dir_fd = open(cache_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        int open_err = errno;
+        free(proxy->upstream);
+        errno = open_err;
+        return -1;
+    }
+    pthread_mutex_init(&proxy->lock, NULL);
+    pthread_cond_init(&proxy->jobs_cond, NULL);
+
+    // Signals are handled by the workers
+    sigset_t mask, old_mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+    for(int i = 0; i < PROXY_THREADS; i++) {
+        int ret = pthread_create(&proxy->threads[i], NULL, run_fetcher, proxy);
+        if(ret != 0) {
+            pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+            errno = ret;
+            return -1;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
+
+proxy_entry_t *proxy_get(proxy_t *proxy, const char *key, size_t key_len, proxy_waiter_t *waiter, int *hit) {
+    uint64_t hash = hash_key(key, key_len);
+    pthread_mutex_lock(&proxy->lock);
+    proxy_entry_t *entry = proxy->buckets[hash % PROXY_BUCKETS];
+    while(entry != NULL && (entry->hash != hash || entry->key_len != key_len
+            || memcmp(entry->key, key, key_len) != 0)) {
+        entry = entry->hash_next;
+    }
+    if(entry != NULL && entry->ready && entry->expires <= time(NULL)) {
+        // Stale, requests still sending it keep their reference
+        unlink_entry(proxy, entry);
+        entry = NULL;
+    }
+
+    if(entry == NULL) {
+        if((entry = calloc(1, sizeof(proxy_entry_t) + key_len)) == NULL) {
+            pthread_mutex_unlock(&proxy->lock);
+            return NULL;
+        }
+        entry->key = (char *)(entry + 1);
+        memcpy(entry->key, key, key_len);
+        entry->key_len = key_len;
+        entry->hash = hash;
+        entry->fd = -1;
+        // The fetcher thread holds a reference until the entry is complete
+        entry->refs = 1;
+        entry->cached = 1;
+        entry->hash_next = proxy->buckets[hash % PROXY_BUCKETS];
+        proxy->buckets[hash % PROXY_BUCKETS] = entry;
+        if(proxy->jobs_tail != NULL) {
+            proxy->jobs_tail->job_next = entry;
+        } else {
+            proxy->jobs = entry;
+        }
+        proxy->jobs_tail = entry;
+        pthread_cond_signal(&proxy->jobs_cond);
+    } else if(entry->ready && entry != proxy->head) {
+        // Move to the front of the usage list
+        entry->prev->next = entry->next;
+        if(entry->next != NULL) {
+            entry->next->prev = entry->prev;
+        } else {
+            proxy->tail = entry->prev;
+        }
+        entry->prev = NULL;
+        entry->next = proxy->head;
+        proxy->head->prev = entry;
+        proxy->head = entry;
+    }
+
+    entry->refs++;
+    *hit = entry->ready;
+    if(!entry->ready) {
+        waiter->next = entry->waiters;
+        entry->waiters = waiter;
+    }
+    pthread_mutex_unlock(&proxy->lock);
+    return entry;
+}
+
+int proxy_ready(const proxy_entry_t *entry) {
+    return __atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE);
+}
+
+void proxy_cancel(proxy_t *proxy, proxy_entry_t *entry, proxy_waiter_t *waiter) {
+    pthread_mutex_lock(&proxy->lock);
+    proxy_waiter_t **link = &entry->waiters;
+    while(*link != NULL && *link != waiter) {
+        link = &(*link)->next;
+    }
+    if(*link != NULL) {
+        *link = waiter->next;
+    }
+    pthread_mutex_unlock(&proxy->lock);
+}
+
+void proxy_release(proxy_t *proxy, proxy_entry_t *entry) {
+    if(entry == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&proxy->lock);
+    if(--entry->refs == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+    pthread_mutex_unlock(&proxy->lock);
+}
+
+static void *run_fetcher(void *arg) {
+    proxy_t *proxy = arg;
+    fetch_pool_t pool;
+    if(fetch_pool_init(&pool, "80", 1) != FETCH_SUCCESS) {
+        return NULL;
+    }
+    pool.timeout = proxy->timeout;
+
+    for(;;) {
+        pthread_mutex_lock(&proxy->lock);
+        while(proxy->jobs == NULL) {
+            pthread_cond_wait(&proxy->jobs_cond, &proxy->lock);
+        }
+        proxy_entry_t *entry = proxy->jobs;
+        proxy->jobs = entry->job_next;
+        if(proxy->jobs == NULL) {
+            proxy->jobs_tail = NULL;
+        }
+        pthread_mutex_unlock(&proxy->lock);
+
+        // The entry is only read by others once it is ready
+        if(!proxy->persist || load_file(proxy, entry) != 0) {
+            fetch_entry(proxy, &pool, entry);
+        }
+        if(entry->status == 200 && entry->len <= PROXY_MEM_MAX && load_body(entry) != 0) {
+            close(entry->fd);
+            entry->fd = -1;
+            entry->status = 502;
+        }
+
+        pthread_mutex_lock(&proxy->lock);
+        complete(proxy, entry);
+        pthread_mutex_unlock(&proxy->lock);
+    }
+    return NULL;
+}
+
+static void fetch_entry(proxy_t *proxy, fetch_pool_t *pool, proxy_entry_t *entry) {
+    entry->status = 502;
+    fetch_job_t job = {proxy, entry, -1, "", 0};
+    snprintf(job.tmp_name, sizeof(job.tmp_name), ".tmp-%ld-%u", (long)getpid(),
+        __atomic_fetch_add(&proxy->tmp_seq, 1, __ATOMIC_RELAXED));
+    if((job.fd = openat(proxy->dir_fd, job.tmp_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600)) < 0) {
+        return;
+    }
+    if(!proxy->persist) {
+        // Only the descriptor refers to the file
+        unlinkat(proxy->dir_fd, job.tmp_name, 0);
+    }
+
+    fetch_req_t req;
+    memset(&req, 0, sizeof(req));
+    size_t upstream_len = strlen(proxy->upstream);
+    char *url = malloc(upstream_len + entry->key_len + 1);
+    if(url != NULL) {
+        memcpy(url, proxy->upstream, upstream_len);
+        memcpy(url + upstream_len, entry->key, entry->key_len);
+        url[upstream_len + entry->key_len] = '\0';
+        if(fetch_req_init(&req, url) == FETCH_SUCCESS) {
+            req.sink_fd = job.fd;
+            req.on_head = on_head;
+            req.arg = &job;
+            if(fetch_submit(pool, &req) == FETCH_SUCCESS && fetch_run(pool) == FETCH_SUCCESS) {
+                if(req.err == FETCH_SUCCESS) {
+                    entry->status = 200;
+                    entry->offset = job.body_off;
+                    entry->len = req.body_bytes;
+                } else if(req.err == FETCH_ERR_STATUS && req.status == 404) {
+                    entry->status = 404;
+                } else if(req.err == FETCH_ERR_CONNECT && req.sys_errno == ETIMEDOUT) {
+                    entry->status = 504;
+                }
+            }
+        }
+        free(url);
+    }
+    fetch_req_free(&req);
+
+    int reuse = entry->status == 200 && entry->expires > time(NULL);
+    if(proxy->persist) {
+        char name[17];
+        file_name(name, entry->hash);
+        if(!reuse || renameat(proxy->dir_fd, job.tmp_name, proxy->dir_fd, name) != 0) {
+            // A stale copy must not be found after a restart either
+            unlinkat(proxy->dir_fd, job.tmp_name, 0);
+            unlinkat(proxy->dir_fd, name, 0);
+        }
+    }
+    if(entry->status == 200) {
+        entry->fd = job.fd;
+    } else {
+        close(job.fd);
+    }
+}
+
+static int on_head(fetch_req_t *req, const http_parser_t *res) {
+    fetch_job_t *job = req->arg;
+    proxy_entry_t *entry = job->entry;
+    if(res->status != 200) {
+        return 0;
+    }
+    http_slice_t type = http_header_find(&res->headers, "Content-Type");
+    if(type.ptr == NULL || type.len >= PROXY_MIME_MAX) {
+        type = http_slice("application/octet-stream");
+    }
+    memcpy(entry->mime, type.ptr, type.len);
+    entry->mime[type.len] = '\0';
+    int64_t max_age = http_cache_max_age(http_header_find(&res->headers, "Cache-Control"));
+    entry->expires = max_age > 0 ? time(NULL) + max_age : 0;
+
+    proxy_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROXY_MAGIC, sizeof(header.magic));
+    header.expires = entry->expires;
+    header.key_len = entry->key_len;
+    header.mime_len = type.len;
+    struct iovec iov[] = {{&header, sizeof(header)}, {entry->key, entry->key_len}, {entry->mime, type.len}};
+    job->body_off = sizeof(header) + entry->key_len + type.len;
+    ssize_t n = pwritev(job->fd, iov, 3, 0);
+    if(n != job->body_off) {
+        if(n >= 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    req->sink_off = job->body_off;
+    return 0;
+}
+
+static int load_file(proxy_t *proxy, proxy_entry_t *entry) {
+    char name[17];
+    file_name(name, entry->hash);
+    int fd = openat(proxy->dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return -1;
+    }
+    proxy_file_header_t header;
+    struct stat st;
+    char *key = NULL;
+    int64_t body_off = sizeof(header) + entry->key_len;
+    // Files of other keys with the same hash are replaced by the fetch
+    if(pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, PROXY_MAGIC, 8) != 0
+            || header.key_len != entry->key_len || header.mime_len >= PROXY_MIME_MAX || fstat(fd, &st) != 0
+            || st.st_size < body_off + header.mime_len || (key = malloc(entry->key_len + 1)) == NULL
+            || pread(fd, key, entry->key_len, sizeof(header)) != (ssize_t)entry->key_len
+            || memcmp(key, entry->key, entry->key_len) != 0
+            || pread(fd, entry->mime, header.mime_len, body_off) != (ssize_t)header.mime_len
+            || header.expires <= time(NULL)) {
+        free(key);
+        close(fd);
+        return -1;
+    }
+    free(key);
+    entry->mime[header.mime_len] = '\0';
+    entry->status = 200;
+    entry->fd = fd;
+    entry->offset = body_off + header.mime_len;
+    entry->len = st.st_size - entry->offset;
+    entry->expires = header.expires;
+    entry->stored = 1;
+    return 0;
+}
+
+static int load_body(proxy_entry_t *entry) {
+    char *data = malloc(entry->len > 0 ? entry->len : 1);
+    if(data == NULL) {
+        return -1;
+    }
+    int64_t done = 0;
+    while(done < entry->len) {
+        ssize_t n = pread(entry->fd, data + done, entry->len - done, entry->offset + done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            free(data);
+            return -1;
+        }
+        done += n;
+    }
+    close(entry->fd);
+    entry->fd = -1;
+    entry->data = data;
+    entry->offset = 0;
+    return 0;
+}
+
+static void complete(proxy_t *proxy, proxy_entry_t *entry) {
+    // Waiters are only freed after their request released the entry, which needs the lock
+    __atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+    for(proxy_waiter_t *waiter = entry->waiters; waiter != NULL; waiter = waiter->next) {
+        proxy->notify(waiter->arg);
+    }
+    entry->waiters = NULL;
+
+    size_t size = sizeof(proxy_entry_t) + entry->key_len + (entry->data != NULL ? entry->len : 0);
+    int file = entry->data == NULL && entry->fd >= 0;
+    if(entry->status != 200 || entry->expires <= time(NULL) || size > proxy->max_size) {
+        unlink_entry(proxy, entry);
+    } else {
+        while(proxy->tail != NULL && (proxy->size + size > proxy->max_size
+                || (file && proxy->file_cnt >= PROXY_MAX_FILES))) {
+            unlink_entry(proxy, proxy->tail);
+        }
+        entry->size = size;
+        entry->next = proxy->head;
+        if(proxy->head != NULL) {
+            proxy->head->prev = entry;
+        } else {
+            proxy->tail = entry;
+        }
+        proxy->head = entry;
+        proxy->size += size;
+        proxy->file_cnt += file;
+    }
+    if(--entry->refs == 0 && !entry->cached) {
+        free_entry(entry);
+    }
+}
+
+static void unlink_entry(proxy_t *proxy, proxy_entry_t *entry) {
+    proxy_entry_t **link = &proxy->buckets[entry->hash % PROXY_BUCKETS];
+    while(*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    if(entry->size > 0) {
+        if(entry->prev != NULL) {
+            entry->prev->next = entry->next;
+        } else {
+            proxy->head = entry->next;
+        }
+        if(entry->next != NULL) {
+            entry->next->prev = entry->prev;
+        } else {
+            proxy->tail = entry->prev;
+        }
+        proxy->size -= entry->size;
+        proxy->file_cnt -= entry->data == NULL && entry->fd >= 0;
+        entry->size = 0;
+    }
+
+    entry->cached = 0;
+    if(entry->refs == 0) {
+        free_entry(entry);
+    }
+}
+
+static void free_entry(proxy_entry_t *entry) {
+    if(entry->fd >= 0) {
+        close(entry->fd);
+    }
+    free(entry->data);
+    free(entry);
+}
+
+static uint64_t hash_key(const char *key, size_t len) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void file_name(char *buf, uint64_t hash) {
+    snprintf(buf, 17, "%016llx", (unsigned long long)hash);
+}
@@ -0,0 +1,203 @@
+/**
+ * @file proxy.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Caching reverse proxy for requests the server cannot answer itself.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Responses are fetched from an upstream server by a few fetcher threads,
+ * each of which keeps its connection to the upstream open between requests. The
+ * responses are kept in a cache shared by all workers and keyed by the request
+ * path (including the query). Successful responses are stored for the lifetime
+ * given by the Cache-Control header of the upstream; small bodies are held in
+ * memory, larger ones in files, which are kept in a cache directory across
+ * restarts if one is configured. Concurrent requests for a key which is being
+ * fetched wait for the same entry, so the upstream sees a single request. Entries
+ * handed out are reference counted and stay valid until they are released, even
+ * if they were evicted or expired in the meantime. Workers waiting for an entry
+ * are notified through a callback once it is complete.
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/**
+ * @brief Number of hash buckets of the cache.
+ */
+#define PROXY_BUCKETS 1024
+
+/**
+ * @brief Number of fetcher threads, and thus of concurrent upstream requests.
+ */
+#define PROXY_THREADS 4
+
+/**
+ * @brief Size of the buffer for the media type of a response.
+ * @details Longer media types are replaced by application/octet-stream.
+ */
+#define PROXY_MIME_MAX 96
+
+/**
+ * @brief Largest body kept in memory; larger bodies are sent from their file.
+ */
+#define PROXY_MEM_MAX (256 * 1024)
+
+/**
+ * @brief Maximum number of cached entries whose body is kept in an open file.
+ */
+#define PROXY_MAX_FILES 256
+
+/**
+ * @brief A request waiting for an entry.
+ * @details arg is passed to the notify callback of the cache.
+ */
+typedef struct proxy_waiter {
+    struct proxy_waiter *next;
+    void *arg;
+} proxy_waiter_t;
+
+/**
+ * @brief A response of the upstream.
+ * @details ready is set once the entry is complete; only then the remaining
+ * fields are valid. status is 200 for a successful response, 404 if the upstream
+ * does not have the resource, 504 if it did not answer in time and 502 for any
+ * other failure. The body of a successful response is either len bytes at data,
+ * or, if data is NULL and len > 0, len bytes at offset of the file fd. expires is
+ * the time (wall clock) the entry becomes stale, 0 if it must not be reused.
+ * stored is set if the body was read from the cache directory instead of being
+ * fetched. The remaining fields belong to the cache: cached is set while the
+ * entry is in the hash table, size is its accounted size while it is in the usage
+ * list (0 otherwise) and waiters the list of requests waiting for it.
+ */
+typedef struct proxy_entry {
+    struct proxy_entry *prev;
+    struct proxy_entry *next;
+    struct proxy_entry *hash_next;
+    struct proxy_entry *job_next;
+
+    char *key;
+    size_t key_len;
+    uint64_t hash;
+
+    int ready;
+    int status;
+    char mime[PROXY_MIME_MAX];
+    char *data;
+    int fd;
+    int64_t offset;
+    int64_t len;
+    time_t expires;
+    int stored;
+
+    size_t size;
+    int refs;
+    int cached;
+    proxy_waiter_t *waiters;
+} proxy_entry_t;
+
+/**
+ * @brief The cache and its fetcher threads.
+ * @details upstream, dir_fd, persist, timeout and notify are not changed after
+ * proxy_init, the other fields are protected by lock. upstream is the URL the
+ * request paths are appended to. dir_fd is the directory the bodies are written
+ * to: the cache directory if persist is set, otherwise the directory for
+ * temporary files, whose files are removed right after they were created. jobs is
+ * the queue of entries to be fetched. The hash table holds the entries being fetched and the
+ * cached entries; only the latter are in the usage list (head is the most, tail
+ * the least recently used entry). size is the sum of their sizes and never
+ * exceeds max_size, file_cnt the number of those with a body in a file. timeout
+ * is the time in milliseconds an upstream request may make no progress, -1 for no
+ * limit.
+ */
+typedef struct proxy {
+    pthread_mutex_t lock;
+    pthread_cond_t jobs_cond;
+    proxy_entry_t *jobs;
+    proxy_entry_t *jobs_tail;
+    proxy_entry_t *buckets[PROXY_BUCKETS];
+    proxy_entry_t *head;
+    proxy_entry_t *tail;
+    size_t size;
+    size_t max_size;
+    int file_cnt;
+    char *upstream;
+    int dir_fd;
+    int persist;
+    int timeout;
+    unsigned int tmp_seq;
+    void (*notify)(void *arg);
+    pthread_t threads[PROXY_THREADS];
+} proxy_t;
+
+/**
+ * @brief Initialize the cache and start the fetcher threads.
+ *
+ * @param proxy Cache which should be initialized.
+ * @param upstream URL of the upstream of the form "http://host[:port][/prefix]".
+ * @param cache_dir Directory the responses are stored in, NULL to keep them only
+ * while the server runs.
+ * @param max_size Maximum total size of the cached entries in bytes.
+ * @param timeout Time in milliseconds an upstream request may make no progress,
+ * -1 for no limit.
+ * @param notify Callback invoked with the arg of each waiter once the entry it
+ * waits for is ready. It is called by a fetcher thread with the cache locked, so
+ * it must neither block nor use the cache.
+ * @return int 0 on success, -1 on errors (errno is set, EINVAL if the URL is
+ * invalid).
+ *
+ * @details The fetcher threads block all signals.
+ */
+int proxy_init(proxy_t *proxy, const char *upstream, const char *cache_dir, size_t max_size, int timeout,
+        void (*notify)(void *arg));
+
+/**
+ * @brief Get the entry of a request path.
+ *
+ * @param proxy Cache.
+ * @param key Request path including the query.
+ * @param key_len Length of key.
+ * @param waiter Waiter which is registered if the entry is not ready yet.
+ * @param hit Set to 1 if the entry was ready, 0 otherwise.
+ * @return proxy_entry_t* The entry, or NULL if the allocation failed (errno is
+ * set). The entry must be released with proxy_release.
+ *
+ * @details Returns the cached entry if there is one which has not expired,
+ * otherwise the entry being fetched for key, starting a fetch if there is none.
+ * If the entry is not ready (see proxy_ready), the notify callback is invoked
+ * with the arg of waiter once it is, unless the waiter was cancelled before.
+ */
+proxy_entry_t *proxy_get(proxy_t *proxy, const char *key, size_t key_len, proxy_waiter_t *waiter, int *hit);
+
+/**
+ * @brief Check whether an entry is complete.
+ *
+ * @param entry Entry returned by proxy_get.
+ * @return int 1 if the response of the entry may be read, 0 otherwise.
+ */
+int proxy_ready(const proxy_entry_t *entry);
+
+/**
+ * @brief Stop waiting for an entry.
+ *
+ * @param proxy Cache.
+ * @param entry Entry returned by proxy_get.
+ * @param waiter Waiter passed to proxy_get.
+ *
+ * @details Once this function returned, the notify callback is not invoked for
+ * the waiter anymore.
+ */
+void proxy_cancel(proxy_t *proxy, proxy_entry_t *entry, proxy_waiter_t *waiter);
+
+/**
+ * @brief Release an entry returned by proxy_get.
+ *
+ * @param proxy Cache.
+ * @param entry Entry which should be released, may be NULL.
+ */
+void proxy_release(proxy_t *proxy, proxy_entry_t *entry);
+
+#endif
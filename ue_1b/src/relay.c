@@ -0,0 +1,156 @@
+/**
+ * @file relay.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the proxied requests defined in relay.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details A fetcher thread which completed an entry calls wake_proxy, which
+ * writes the proxy_fd of the worker the waiting request belongs to. The worker then
+ * answers its waiting requests whose entries are ready; the cached response is sent
+ * as a file or from memory by the send path.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "relay.h"
+#include "sched.h"
+#include "utils.h"
+
+/**
+ * @brief Send the response of a request answered by the reverse proxy.
+ * 
+ * @param conn Client connection.
+ * @param preq Request whose entry is ready.
+ * @return int 1 if the connection should be kept open for further requests, 0 if
+ * it should be closed.
+ * 
+ * @details Successful responses carry the remaining lifetime of the entry in
+ * Cache-Control and whether it was answered without asking the upstream in
+ * X-Cache; Range headers are ignored. Failures are replied with 404, 502 or 504.
+ */
+static int send_proxied(conn_t *conn, const proxy_req_t *preq);
+
+int handle_proxy(conn_t *conn, size_t head_len, int head_only, int keep_alive) {
+    worker_t *worker = conn->worker;
+    proxy_req_t *preq = arena_alloc(conn->arena, sizeof(proxy_req_t));
+    if(preq == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return consume_req(conn, head_len, keep_alive);
+    }
+    preq->waiter.arg = worker;
+    preq->conn = conn;
+    preq->head_len = head_len;
+    preq->head_only = head_only;
+    preq->keep_alive = keep_alive;
+    http_slice_t path = conn->parser.path;
+    if((preq->entry = proxy_get(&proxy, path.ptr, path.len, &preq->waiter, &preq->hit)) == NULL) {
+        ERRPRINTF("calloc failed: %s\n", strerror(errno));
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return consume_req(conn, head_len, keep_alive);
+    }
+    // The entry is released once the response was sent
+    conn->proxy = preq;
+    if(preq->hit) {
+        return consume_req(conn, head_len, send_proxied(conn, preq));
+    }
+
+    // Pipelined requests stay unread until this one is answered
+    if(watch_conn(conn, 0) != 0) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+    }
+    conn->state = CONN_PROXY;
+    preq->prev = NULL;
+    preq->next = worker->proxy_waits;
+    if(preq->next != NULL) {
+        preq->next->prev = preq;
+    }
+    worker->proxy_waits = preq;
+    return keep_alive;
+}
+
+static int send_proxied(conn_t *conn, const proxy_req_t *preq) {
+    const proxy_entry_t *entry = preq->entry;
+    int keep_alive = preq->keep_alive;
+    if(entry->status != 200) {
+        SEND_ERR_RES(entry->status == 404 ? RES_NOT_FOUND
+            : entry->status == 504 ? RES_GATEWAY_TIMEOUT : RES_BAD_GATEWAY);
+        return keep_alive;
+    }
+
+    // "Cache-Control: max-age=" + 20 digits + "\r\n" + "X-Cache: MISS\r\n"
+    char cache_lines[64];
+    size_t cache_len = 0;
+    time_t now = time(NULL);
+    if(entry->expires > now) {
+        char num[21];
+        cache_len = append_header(cache_lines, 0, "Cache-Control: max-age=", num,
+            http_format_u64(num, entry->expires - now));
+    }
+    const char *x_cache = preq->hit || entry->stored ? "HIT" : "MISS";
+    cache_len = append_header(cache_lines, cache_len, "X-Cache: ", x_cache, strlen(x_cache));
+    struct iovec hdrs[] = {{cache_lines, cache_len}, {NULL, 0}};
+
+    if(entry->data != NULL) {
+        if(format_type(conn, entry->mime, &hdrs[1]) != 0) {
+            return 0;
+        }
+        if(send_data(conn, preq->head_only ? NULL : entry->data, entry->len, hdrs, 2, keep_alive) != 0) {
+            keep_alive = 0;
+        }
+        return keep_alive;
+    }
+    if(send_file(conn, preq->head_only ? -1 : entry->fd, entry->offset, entry->len, entry->mime, NULL, -1, hdrs, 1,
+            keep_alive) != 0) {
+        keep_alive = 0;
+    }
+    return keep_alive;
+}
+
+void resume_proxied(worker_t *worker) {
+    uint64_t cnt;
+    if(read(worker->proxy_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+        ERRPRINTF("read on eventfd failed: %s\n", strerror(errno));
+    }
+    // Answering a request only adds new waiting requests at the front
+    proxy_req_t *preq = worker->proxy_waits;
+    while(preq != NULL) {
+        proxy_req_t *next = preq->next;
+        if(proxy_ready(preq->entry)) {
+            conn_t *conn = preq->conn;
+            stop_waiting(conn);
+            int keep_alive = consume_req(conn, preq->head_len, send_proxied(conn, preq));
+            if(send_out(conn, keep_alive) == 1) {
+                conn->out_keep_alive = keep_alive;
+                finish_send(conn);
+            }
+        }
+        preq = next;
+    }
+}
+
+void stop_waiting(conn_t *conn) {
+    worker_t *worker = conn->worker;
+    proxy_req_t *preq = conn->proxy;
+    if(preq->prev != NULL) {
+        preq->prev->next = preq->next;
+    } else {
+        worker->proxy_waits = preq->next;
+    }
+    if(preq->next != NULL) {
+        preq->next->prev = preq->prev;
+    }
+    conn->state = CONN_HEAD;
+}
+
+void wake_proxy(void *arg) {
+    worker_t *worker = arg;
+    uint64_t one = 1;
+    if(write(worker->proxy_fd, &one, sizeof(one)) != sizeof(one)) {
+        ERRPRINTF("write on eventfd failed: %s\n", strerror(errno));
+    }
+}
@@ -0,0 +1,86 @@
+/**
+ * @file relay.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Requests of the http server answered by the reverse proxy.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details With -P, requests for files which do not exist are answered with the
+ * response of the upstream server from the cache of the proxy module. A request
+ * whose response is not cached yet waits in CONN_PROXY while the fetcher threads of
+ * the proxy fetch it, without blocking the worker.
+ */
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stddef.h>
+
+#include "server.h"
+
+/**
+ * @brief State of a request answered by the reverse proxy.
+ * @details entry is the response in the cache of the proxy. While it is fetched,
+ * waiter is registered at it and prev and next link the waiting requests of the
+ * worker. head_len, head_only and keep_alive are the properties of the request
+ * needed to answer it once the entry is ready, hit is set if the entry was ready
+ * when the request arrived.
+ */
+typedef struct proxy_req {
+    proxy_waiter_t waiter;
+    proxy_entry_t *entry;
+    struct conn *conn;
+    struct proxy_req *prev;
+    struct proxy_req *next;
+    size_t head_len;
+    int head_only;
+    int keep_alive;
+    int hit;
+} proxy_req_t;
+
+/**
+ * @brief Answer a request by the reverse proxy.
+ * 
+ * @param conn Client connection.
+ * @param head_len Length of the head of the request.
+ * @param head_only Whether only the head should be sent.
+ * @param keep_alive Whether the connection may be kept open.
+ * @return int 1 if the connection should be kept open for further requests, 0 if
+ * it should be closed. Not meaningful if the connection is left in CONN_PROXY.
+ * 
+ * @details The request path including the query is the key of the response in the
+ * cache of the proxy. A cached response is sent right away. Otherwise the response
+ * is fetched from the upstream (or, if another request is fetching it already,
+ * awaited along with that request) and the connection is left in CONN_PROXY
+ * without watching its socket; the request head stays in the connection buffer
+ * until the worker is notified and resume_proxied answers the request.
+ * Global variables: proxy.
+ */
+int handle_proxy(conn_t *conn, size_t head_len, int head_only, int keep_alive);
+
+/**
+ * @brief Answer the requests of a worker whose response was fetched.
+ * 
+ * @param worker Worker woken up through its proxy_fd.
+ * 
+ * @details Requests pipelined behind the answered ones are served afterwards.
+ * Global variables: use_uring.
+ */
+void resume_proxied(worker_t *worker);
+
+/**
+ * @brief Stop waiting for the response of a request answered by the reverse proxy.
+ * 
+ * @param conn Client connection in CONN_PROXY, which is left in CONN_HEAD.
+ */
+void stop_waiting(conn_t *conn);
+
+/**
+ * @brief Wake up a worker whose request can be answered by the reverse proxy.
+ * 
+ * @param arg The worker.
+ * 
+ * @details Called by the fetcher threads of the proxy.
+ */
+void wake_proxy(void *arg);
+
+#endif
@@ -0,0 +1,420 @@
+/**
+ * @file ring.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the io_uring backend defined in ring.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The connections of a worker are allocated in advance, so their receive
+ * buffers can be registered with the ring. The user data of an operation of a
+ * connection is the address of its conn_t tagged with the ring_op_t in the low
+ * bits; at most one such operation is in progress per connection (ring_op), apart
+ * from the operations linked to a send.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "ring.h"
+#include "sched.h"
+#include "relay.h"
+#include "utils.h"
+
+/**
+ * @brief Number of submission queue entries of the ring of a worker.
+ */
+#define URING_ENTRIES 256
+
+/**
+ * @brief Size of a slot of the registered buffer responses are assembled in with io_uring.
+ * @details Responses for whole files or single ranges whose head and body fit are
+ * sent with linked operations, others as with epoll.
+ */
+#define URING_SEND_SIZE (64 * 1024)
+
+/**
+ * @brief Number of slots of the registered send buffer of a worker.
+ * @details At most 32, as the free slots are kept in a bitmask. Responses for which
+ * no slot is free are sent as with epoll.
+ */
+#define URING_SEND_SLOTS 8
+
+/**
+ * @brief Body timeout of linked sends with io_uring.
+ * @details body_timeout as the timespec of IORING_OP_LINK_TIMEOUT, which is read
+ * when the operation is submitted.
+ */
+static struct __kernel_timespec send_timeout;
+
+/**
+ * @brief Handle a completion of the ring of a worker.
+ * 
+ * @param worker The worker.
+ * @param data User data of the operation.
+ * @param res Result of the operation.
+ * @param flags Flags of the completion.
+ * 
+ * @details Accepted clients are added to the worker (or shed at the connection
+ * limit). Clients accepted while draining, before the cancelled accept completed,
+ * are served as well, as the new server never sees them. Connections whose read or
+ * poll completed are served (via the serve_conn function), linked sends are
+ * completed by the ring_sent function and connections which were closed meanwhile
+ * are freed.
+ * Global variables: conn_limit.
+ */
+static void handle_completion(worker_t *worker, uint64_t data, int res, unsigned int flags);
+
+/**
+ * @brief Submit the multishot poll of the proxy_fd of a worker.
+ * 
+ * @param worker Worker.
+ */
+static void ring_watch_proxy(worker_t *worker);
+
+/**
+ * @brief Complete a response sent by ring_send_file.
+ * 
+ * @param conn Client connection.
+ * @param res Result of the send.
+ * 
+ * @details Releases the slot of the send buffer. Bytes which were not sent are
+ * copied to the arena and sent as with epoll. The response is finished without
+ * keeping the connection if the read of the data was short or failed, or if the
+ * body timeout expired. A connection closed meanwhile is freed.
+ */
+static void ring_sent(conn_t *conn, int res);
+
+void run_ring(worker_t *worker) {
+    ring_accept(worker);
+    worker->accepting = 1;
+    struct io_uring_sqe *sqe = uring_sqe(&worker->ring);
+    if(sqe == NULL) {
+        ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd;
+    sqe->poll32_events = POLLIN;
+    // Every write to wake_fd completes the poll again
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = OP_WAKE;
+    if(worker->proxy_fd >= 0) {
+        ring_watch_proxy(worker);
+    }
+
+    while(!quit && !(worker->drained && worker->conn_cnt == 0 && worker->accepts == 0)) {
+        if(uring_enter(&worker->ring, worker->sched_cnt > 0 ? 0 : 1, wheel_timeout(&worker->timers, stats_now())) != 0
+                && errno != EINTR) {
+            ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        struct io_uring_cqe *cqe;
+        while((cqe = uring_cqe(&worker->ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned int flags = cqe->flags;
+            uring_cqe_seen(&worker->ring);
+            handle_completion(worker, data, res, flags);
+        }
+        finish_batch(worker);
+    }
+}
+
+static void handle_completion(worker_t *worker, uint64_t data, int res, unsigned int flags) {
+    switch(data & OP_MASK) {
+    case OP_ACCEPT:
+        if(res >= 0) {
+            worker->stats.connections++;
+            if(!worker->drained && (!worker->accepting || (conn_limit > 0 && worker->conn_cnt >= conn_limit))) {
+                // Clients accepted before the multishot accept was cancelled
+                shed(worker, res);
+                close(res);
+                pause_accept(worker);
+            } else {
+                add_conn(worker, res);
+            }
+        } else if(res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM) {
+            pause_accept(worker);
+        } else if(res != -ECANCELED && res != -EINTR && res != -ECONNABORTED && res != -EAGAIN) {
+            ERRPRINTF("accept failed: %s\n", strerror(-res));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        if(!(flags & IORING_CQE_F_MORE)) {
+            worker->accepts--;
+        }
+        if(!(flags & IORING_CQE_F_MORE) && worker->accepting && res != -ECANCELED) {
+            // The multishot accept ended, e.g. because the completion queue overflowed
+            ring_accept(worker);
+        }
+        break;
+    case OP_PROXY:
+        resume_proxied(worker);
+        if(!(flags & IORING_CQE_F_MORE)) {
+            ring_watch_proxy(worker);
+        }
+        break;
+    case OP_WAKE:
+    case OP_CANCEL:
+        break;
+    default: {
+        conn_t *conn = (conn_t *)(uintptr_t)(data & ~(uint64_t)OP_MASK);
+        conn->ring_op = 0;
+        if((data & OP_MASK) == OP_SEND) {
+            ring_sent(conn, res);
+            break;
+        }
+        if(conn->fd < 0) {
+            // The connection was closed while the operation was in progress
+            free_conn(conn);
+            break;
+        }
+        if((data & OP_MASK) == OP_PIPE) {
+            resume_pipe(conn);
+            break;
+        }
+        if((data & OP_MASK) == OP_READ) {
+            conn->ring_res = res;
+            conn->ring_done = 1;
+        }
+        serve_conn(conn);
+        break;
+    }
+    }
+}
+
+int ring_supported(void) {
+    static const int ops[] = {IORING_OP_ACCEPT, IORING_OP_READ_FIXED, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL,
+        IORING_OP_SEND, IORING_OP_LINK_TIMEOUT, IORING_OP_SOCKET};
+    uring_t ring;
+    if(uring_init(&ring, 4) != 0) {
+        return 0;
+    }
+    int supported = 1;
+    for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        supported = supported && uring_probe(&ring, ops[i]);
+    }
+    uring_destroy(&ring);
+    return supported;
+}
+
+int init_ring(worker_t *worker) {
+    size_t conns_len = conn_limit * sizeof(conn_t);
+    if((worker->conns = malloc(conns_len)) == NULL
+            || (worker->send_buf = malloc(URING_SEND_SLOTS * URING_SEND_SIZE)) == NULL) {
+        return -1;
+    }
+    if(uring_init(&worker->ring, URING_ENTRIES) != 0) {
+        return -1;
+    }
+    // Request heads are read into buffer 0, file data into buffer 1
+    struct iovec bufs[] = {{worker->conns, conns_len}, {worker->send_buf, URING_SEND_SLOTS * URING_SEND_SIZE}};
+    if(uring_register_buffers(&worker->ring, bufs, 2) != 0) {
+        return -1;
+    }
+    worker->send_free = (1u << URING_SEND_SLOTS) - 1;
+    send_timeout.tv_sec = body_timeout;
+    for(unsigned int i = conn_limit; i-- > 0;) {
+        worker->conns[i].worker = worker;
+        worker->conns[i].next = worker->free_conns;
+        worker->free_conns = &worker->conns[i];
+    }
+    return 0;
+}
+
+void ring_accept(worker_t *worker) {
+    struct io_uring_sqe *sqe = uring_sqe(&worker->ring);
+    if(sqe == NULL) {
+        ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+    sqe->user_data = OP_ACCEPT;
+    worker->accepts++;
+}
+
+static void ring_watch_proxy(worker_t *worker) {
+    struct io_uring_sqe *sqe = uring_sqe(&worker->ring);
+    if(sqe == NULL) {
+        ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = worker->proxy_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = OP_PROXY;
+}
+
+int ring_read(conn_t *conn) {
+    struct io_uring_sqe *sqe = uring_sqe(&conn->worker->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t)(conn->buf + conn->len);
+    sqe->len = sizeof(conn->buf) - conn->len;
+    // Sockets have no file position
+    sqe->off = -1;
+    sqe->buf_index = 0;
+    sqe->user_data = conn->ring_op = (uintptr_t)conn | OP_READ;
+    return 0;
+}
+
+int ring_poll(conn_t *conn, int events) {
+    struct io_uring_sqe *sqe = uring_sqe(&conn->worker->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->fd;
+    sqe->poll32_events = events;
+    sqe->user_data = conn->ring_op = (uintptr_t)conn | OP_POLL;
+    return 0;
+}
+
+void ring_cancel(worker_t *worker, uint64_t data) {
+    struct io_uring_sqe *sqe = uring_sqe(&worker->ring);
+    if(sqe == NULL) {
+        ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = data;
+    sqe->user_data = OP_CANCEL;
+}
+
+ssize_t ring_recv(conn_t *conn) {
+    if(conn->ring_done) {
+        conn->ring_done = 0;
+        if(conn->ring_res == -EAGAIN) {
+            // Kernels which don't wait for non-blocking sockets themselves
+            if(ring_poll(conn, POLLIN) != 0) {
+                return -1;
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        if(conn->ring_res < 0) {
+            errno = -conn->ring_res;
+            return -1;
+        }
+        return conn->ring_res;
+    }
+    if(conn->ring_op == 0 && ring_read(conn) != 0) {
+        return -1;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+int ring_send_file(conn_t *conn, res_type_t type, int keep_alive, const struct iovec *extra,
+        int extra_cnt, int fd, int64_t offset, int64_t len) {
+    worker_t *worker = conn->worker;
+    if(worker->send_free == 0 || conn->ring_op != 0 || len > URING_SEND_SIZE) {
+        return 1;
+    }
+    struct iovec iov[4 + MAX_EXTRA_IOV];
+    int cnt = format_res(conn, type, keep_alive, extra, extra_cnt, iov);
+    size_t head_len = 0;
+    for(int i = 0; i < cnt; i++) {
+        head_len += iov[i].iov_len;
+    }
+    // The linked operations must not be split by a submission
+    if(head_len > URING_SEND_SIZE - len || uring_reserve(&worker->ring, 3) != 0) {
+        return 1;
+    }
+    int slot = __builtin_ctz(worker->send_free);
+    char *buf = worker->send_buf + (size_t)slot * URING_SEND_SIZE;
+    size_t pos = 0;
+    for(int i = 0; i < cnt; i++) {
+        memcpy(buf + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    // A short read breaks the link, so the send is cancelled instead of sending a partial body
+    struct io_uring_sqe *read = uring_sqe(&worker->ring);
+    read->opcode = IORING_OP_READ_FIXED;
+    read->flags = IOSQE_IO_LINK;
+    read->fd = fd;
+    read->addr = (uintptr_t)(buf + head_len);
+    read->len = len;
+    read->off = offset;
+    read->buf_index = 1;
+    read->user_data = OP_CANCEL;
+    struct io_uring_sqe *send = uring_sqe(&worker->ring);
+    send->opcode = IORING_OP_SEND;
+    send->fd = conn->fd;
+    send->addr = (uintptr_t)buf;
+    send->len = head_len + len;
+    send->msg_flags = MSG_NOSIGNAL;
+    send->user_data = conn->ring_op = (uintptr_t)conn | OP_SEND;
+    if(body_timeout > 0) {
+        // A client which stops reading must not keep the slot forever
+        send->flags = IOSQE_IO_LINK;
+        struct io_uring_sqe *timeout = uring_sqe(&worker->ring);
+        timeout->opcode = IORING_OP_LINK_TIMEOUT;
+        timeout->addr = (uintptr_t)&send_timeout;
+        timeout->len = 1;
+        timeout->user_data = OP_CANCEL;
+    }
+    worker->send_free &= ~(1u << slot);
+    conn->ring_buf = buf;
+    conn->out_left = head_len + len;
+    return 0;
+}
+
+static void ring_sent(conn_t *conn, int res) {
+    worker_t *worker = conn->worker;
+    char *buf = conn->ring_buf;
+    conn->ring_buf = NULL;
+    worker->send_free |= 1u << ((buf - worker->send_buf) / URING_SEND_SIZE);
+    if(conn->fd < 0) {
+        // The connection was closed while the send was in flight
+        close(conn->ring_res);
+        free_conn(conn);
+        return;
+    }
+    if(res == -ECANCELED) {
+        // The read of the data was short or failed, or the body timeout expired
+        finish_req(conn, 0);
+        return;
+    }
+    // Kernels which don't wait for non-blocking sockets themselves report EAGAIN
+    if(res < 0 && res != -EAGAIN) {
+        ERRPRINTF("error while sending response: %s\n", strerror(-res));
+        finish_req(conn, 0);
+        return;
+    }
+    size_t sent = res < 0 ? 0 : res;
+    size_t left = conn->out_left - sent;
+    conn->sent_bytes += sent;
+    worker->sched_clock += sent;
+    conn->out_left = 0;
+    if(left == 0) {
+        finish_send(conn);
+        return;
+    }
+    // The slot is reused by the next response
+    char *rest = arena_alloc(conn->arena, left);
+    if(rest == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        finish_req(conn, 0);
+        return;
+    }
+    memcpy(rest, buf + sent, left);
+    if(queue_mem(conn, rest, left) != 0) {
+        finish_req(conn, 0);
+        return;
+    }
+    if(send_out(conn, conn->out_keep_alive) == 1) {
+        finish_send(conn);
+    }
+}
@@ -0,0 +1,130 @@
+/**
+ * @file ring.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief io_uring backend of the http server.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details With -U, a worker waits for its connections with a ring instead of
+ * epoll. Clients are accepted by a multishot accept, request heads are read into
+ * the connection buffers registered with the ring and whole files and single ranges
+ * are sent with linked operations from a registered send buffer. Everything else
+ * is handled as with epoll once the ring reported the socket to be ready.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "server.h"
+
+/**
+ * @brief Contains the main loop of a worker using io_uring.
+ * 
+ * @param worker The worker.
+ * 
+ * @details Clients are accepted by a multishot accept and request heads are read
+ * into the registered connection buffers; the operations prepared while handling
+ * a batch of completions are submitted along with waiting for the next batch or
+ * the earliest timeout of the timer wheel in a single system call. Each batch is
+ * finished by the finish_batch function. After a reload, the loop ends once the
+ * connections are drained and the cancelled accept completed, so no client
+ * accepted in the meantime is lost.
+ * Global variables: wake_fd, quit.
+ */
+void run_ring(worker_t *worker);
+
+/**
+ * @brief Check whether the kernel supports the io_uring backend.
+ * 
+ * @return int 1 if all required operations are supported, 0 otherwise.
+ * 
+ * @details Multishot accept has no probe flag; IORING_OP_SOCKET was added in the
+ * same kernel release and stands in for it.
+ */
+int ring_supported(void);
+
+/**
+ * @brief Set up the rings of a worker.
+ * 
+ * @param worker Worker.
+ * @return int 0 on success, -1 on errors (errno is set).
+ * 
+ * @details Allocates conn_limit connections and the buffer responses are sent from,
+ * whose memory is registered with the ring of the worker.
+ * Global variables: conn_limit, body_timeout, send_timeout.
+ */
+int init_ring(worker_t *worker);
+
+/**
+ * @brief Submit the multishot accept on the listen socket.
+ * 
+ * @param worker Worker.
+ * 
+ * @details Global variables: sockfd.
+ */
+void ring_accept(worker_t *worker);
+
+/**
+ * @brief Submit a read of the next part of a request head.
+ * 
+ * @param conn Client connection without operation in progress.
+ * @return int 0 on success, -1 if the queue is full (errno is set).
+ */
+int ring_read(conn_t *conn);
+
+/**
+ * @brief Submit a poll for the next part of an upload body or for room to send.
+ * 
+ * @param conn Client connection without operation in progress.
+ * @param events Events to poll for (POLLIN or POLLOUT).
+ * @return int 0 on success, -1 if the queue is full (errno is set).
+ */
+int ring_poll(conn_t *conn, int events);
+
+/**
+ * @brief Submit the cancellation of an operation.
+ * 
+ * @param worker Worker.
+ * @param data User data of the operation.
+ */
+void ring_cancel(worker_t *worker, uint64_t data);
+
+/**
+ * @brief Receive the next part of a request head with io_uring.
+ * 
+ * @param conn Client connection.
+ * @return ssize_t Result of the completed read, which wrote to the buffer of the
+ * connection behind its len bytes, as for recv. Otherwise a read is submitted and
+ * -1 is returned with errno EAGAIN. A read which failed with EAGAIN is submitted
+ * again once the socket is readable.
+ */
+ssize_t ring_recv(conn_t *conn);
+
+/**
+ * @brief Send a response head and file data with linked operations.
+ * 
+ * @param conn Client connection without operation in progress.
+ * @param type Type of the response.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @param extra Additional header lines.
+ * @param extra_cnt Number of elements of extra.
+ * @param fd File descriptor of the file.
+ * @param offset Offset of the data in the file.
+ * @param len Length of the data.
+ * @return int 0 if the operations were submitted, 1 if the response does not fit into
+ * a slot of the send buffer or no slot is free and nothing was sent.
+ * 
+ * @details The head is assembled in a free slot of the send buffer of the worker and
+ * linked operations on the ring of the worker read the data behind it and send both,
+ * so no copy of the data passes through user space code. The send waits for the
+ * socket up to the body timeout (as a linked timeout) and is completed by the
+ * ring_sent function; the connection stays in CONN_SEND meanwhile.
+ * Global variables: body_timeout, send_timeout.
+ */
+int ring_send_file(conn_t *conn, res_type_t type, int keep_alive, const struct iovec *extra,
+        int extra_cnt, int fd, int64_t offset, int64_t len);
+
+#endif
@@ -0,0 +1,429 @@
+/**
+ * @file sched.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the send path defined in sched.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The send scheduler of a worker is a binary heap of the connections
+ * whose socket is writable, ordered by the number of bytes the worker had sent when
+ * the connection was scheduled plus its remaining bytes divided by SEND_AGING.
+ * Connections waiting for their socket or pipe are not scheduled but watched with
+ * epoll or polled with io_uring.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#include "sched.h"
+#include "ring.h"
+#include "relay.h"
+#include "utils.h"
+
+/**
+ * @brief Maximum number of bytes sent to a connection at once.
+ * @details Responses up to this size are sent right away, larger ones in slices
+ * of this size by the send scheduler of the worker.
+ */
+#define SEND_QUANTUM (256 * 1024)
+
+/**
+ * @brief Maximum number of bytes the send scheduler of a worker sends before the
+ * worker checks for new events again.
+ */
+#define SEND_BUDGET SEND_QUANTUM
+
+/**
+ * @brief Aging divisor of the send scheduler.
+ * @details A response with n bytes remaining goes before new responses once
+ * n / SEND_AGING bytes were sent to other connections, so large responses are
+ * delayed by small ones but never starve.
+ */
+#define SEND_AGING 8
+
+/**
+ * @brief Queue the next chunk of the pipe streamed to a connection.
+ * 
+ * @param conn Client connection whose queued parts were sent completely.
+ * @return int 1 if a chunk was queued (the last one at the end of the stream), 0
+ * if the pipe was not readable, -1 if reading failed.
+ */
+static int read_pipe(conn_t *conn);
+
+/**
+ * @brief Wait until the pipe streamed to a connection becomes readable.
+ * 
+ * @param conn Client connection.
+ * @return int 0 on success, -1 on errors (errno is set).
+ * 
+ * @details With epoll, the pipe is watched one-shot with the address of the
+ * connection tagged with OP_PIPE; with io_uring, a poll is submitted.
+ * Global variables: use_uring.
+ */
+static int watch_pipe(conn_t *conn);
+
+/**
+ * @brief Send the next part of the response queued for a connection.
+ * 
+ * @param conn Client connection.
+ * @param quantum Maximum number of bytes to send.
+ * @return int 0 if the response was sent completely, 1 if bytes remain (out_wait
+ * is set if the socket was not writable, pipe->waiting if the pipe streamed was
+ * not readable), -1 if sending failed.
+ * 
+ * @details Consecutive parts in memory are sent with a single sendmsg, file data
+ * with sendfile. Once the queued parts were sent, the next chunk of a streamed
+ * pipe is queued (via the read_pipe function).
+ */
+static int flush_out(conn_t *conn, int64_t quantum);
+
+/**
+ * @brief Schedule a connection whose socket is writable.
+ * 
+ * @param worker Worker.
+ * @param conn Client connection, which is not scheduled.
+ * 
+ * @details The key is the number of bytes sent by the worker so far plus the
+ * bytes remaining for the connection divided by SEND_AGING.
+ */
+static void sched_push(worker_t *worker, conn_t *conn);
+
+/**
+ * @brief Move a scheduled connection to its place in the heap.
+ * 
+ * @param worker Worker.
+ * @param idx Position of the connection.
+ */
+static void sched_sift(worker_t *worker, int idx);
+
+int send_out(conn_t *conn, int keep_alive) {
+    if(conn->ring_buf != NULL) {
+        // The linked send in flight completes the response
+        conn->out_keep_alive = keep_alive;
+        conn->state = CONN_SEND;
+        return 0;
+    }
+    if(conn->out_left <= SEND_QUANTUM) {
+        int ret = flush_out(conn, SEND_QUANTUM);
+        if(ret == 0) {
+            return 1;
+        }
+        if(ret < 0) {
+            finish_req(conn, 0);
+            return 0;
+        }
+    }
+    conn->out_keep_alive = keep_alive;
+    conn->state = CONN_SEND;
+    wait_out(conn);
+    return 0;
+}
+
+void wait_out(conn_t *conn) {
+    if(conn->pipe != NULL && conn->pipe->waiting) {
+        // A writer which stalls must not keep the connection forever either
+        set_timeout(conn, body_timeout);
+        if(watch_conn(conn, 0) != 0 || watch_pipe(conn) != 0) {
+            ERRPRINTF("waiting for pipe failed: %s\n", strerror(errno));
+            finish_req(conn, 0);
+        }
+        return;
+    }
+    if(!conn->out_wait) {
+        // Other events of the connection are ignored until the response was sent
+        if(watch_conn(conn, 0) != 0) {
+            ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+        }
+        wheel_cancel(&conn->worker->timers, &conn->timer);
+        sched_push(conn->worker, conn);
+        return;
+    }
+    // A client which stops reading must not keep the connection forever
+    set_timeout(conn, body_timeout);
+    if(use_uring ? ring_poll(conn, POLLOUT) != 0 : watch_conn(conn, EPOLLOUT) != 0) {
+        ERRPRINTF("waiting for connection failed: %s\n", strerror(errno));
+        finish_req(conn, 0);
+    }
+}
+
+void finish_send(conn_t *conn) {
+    if(finish_req(conn, conn->out_keep_alive) == 0) {
+        return;
+    }
+    if(watch_conn(conn, EPOLLIN) != 0) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+        close_conn(conn);
+        return;
+    }
+    // With io_uring, a read for the next request is submitted
+    if(conn->len > 0 || use_uring) {
+        serve_conn(conn);
+    }
+}
+
+static int flush_out(conn_t *conn, int64_t quantum) {
+    conn->out_wait = 0;
+    while(quantum > 0) {
+        if(conn->seg_idx == conn->seg_cnt) {
+            if(conn->pipe == NULL || conn->pipe->eof) {
+                break;
+            }
+            int ret = read_pipe(conn);
+            if(ret <= 0) {
+                conn->pipe->waiting = ret == 0;
+                return ret == 0 ? 1 : -1;
+            }
+            continue;
+        }
+        send_seg_t *seg = &conn->segs[conn->seg_idx];
+        ssize_t n;
+        if(seg->data != NULL) {
+            struct iovec iov[SEND_MAX_SEGS];
+            int cnt = 0;
+            int64_t len = 0;
+            for(int i = conn->seg_idx; i < conn->seg_cnt && conn->segs[i].data != NULL && len < quantum; i++) {
+                iov[cnt].iov_base = (void *)conn->segs[i].data;
+                iov[cnt].iov_len = conn->segs[i].len;
+                len += iov[cnt++].iov_len;
+            }
+            if(len > quantum) {
+                iov[cnt - 1].iov_len -= len - quantum;
+            }
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = cnt};
+            n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        } else {
+            n = sendfile(conn->fd, seg->fd, &seg->offset, seg->len < quantum ? seg->len : quantum);
+            if(n == 0) {
+                // The file is shorter than announced
+                n = -1;
+                errno = EPIPE;
+            }
+        }
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->out_wait = 1;
+                return 1;
+            }
+            ERRPRINTF("error while sending response: %s\n", strerror(errno));
+            return -1;
+        }
+        quantum -= n;
+        conn->out_left -= n;
+        conn->sent_bytes += n;
+        conn->worker->sched_clock += n;
+        if(seg->data == NULL) {
+            // sendfile advanced the offset
+            seg->len -= n;
+            conn->seg_idx += seg->len == 0;
+            continue;
+        }
+        while(n > 0) {
+            seg = &conn->segs[conn->seg_idx];
+            if(n < seg->len) {
+                seg->data += n;
+                seg->len -= n;
+                break;
+            }
+            n -= seg->len;
+            conn->seg_idx++;
+        }
+    }
+    return conn->seg_idx < conn->seg_cnt || (conn->pipe != NULL && !conn->pipe->eof) ? 1 : 0;
+}
+
+static int read_pipe(conn_t *conn) {
+    pipe_out_t *pipe = conn->pipe;
+    // Room for the size line of up to 4 hexadecimal digits in front of the data
+    char *data = pipe->buf + 8;
+    ssize_t n;
+    do {
+        n = read(pipe->fd, data, PIPE_CHUNK_SIZE);
+    } while(n < 0 && errno == EINTR);
+    if(n < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        ERRPRINTF("error while streaming pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    // The buffer is only reused once the previous chunk was sent
+    conn->seg_cnt = conn->seg_idx = 0;
+    if(n == 0) {
+        // The writer closed the pipe, the last chunk is followed by an empty trailer section
+        pipe->eof = 1;
+        return queue_mem(conn, "0\r\n\r\n", 5) == 0 ? 1 : -1;
+    }
+    char size_line[8];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t)n);
+    memcpy(data - size_len, size_line, size_len);
+    memcpy(data + n, "\r\n", 2);
+    return queue_mem(conn, data - size_len, size_len + n + 2) == 0 ? 1 : -1;
+}
+
+static int watch_pipe(conn_t *conn) {
+    pipe_out_t *pipe = conn->pipe;
+    if(use_uring) {
+        struct io_uring_sqe *sqe = uring_sqe(&conn->worker->ring);
+        if(sqe == NULL) {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = pipe->fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = conn->ring_op = (uintptr_t)conn | OP_PIPE;
+        return 0;
+    }
+    struct epoll_event ev = {EPOLLIN | EPOLLONESHOT, {.ptr = (void *)((uintptr_t)conn | OP_PIPE)}};
+    if(epoll_ctl(conn->worker->epfd, pipe->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, pipe->fd, &ev) != 0) {
+        return -1;
+    }
+    pipe->watched = 1;
+    return 0;
+}
+
+void resume_pipe(conn_t *conn) {
+    conn->pipe->waiting = 0;
+    wait_out(conn);
+}
+
+int queue_mem(conn_t *conn, const void *data, size_t len) {
+    if(len == 0) {
+        return 0;
+    }
+    if(conn->seg_cnt == SEND_MAX_SEGS) {
+        ERRPUTS("response has too many parts\n");
+        return -1;
+    }
+    if(conn->segs == NULL && (conn->segs = arena_alloc(conn->arena, SEND_MAX_SEGS * sizeof(send_seg_t))) == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    send_seg_t *seg = &conn->segs[conn->seg_cnt++];
+    seg->data = data;
+    seg->len = len;
+    conn->out_left += len;
+    return 0;
+}
+
+int queue_file(conn_t *conn, int fd, int64_t offset, int64_t len) {
+    if(len == 0) {
+        return 0;
+    }
+    if(conn->seg_cnt == SEND_MAX_SEGS) {
+        ERRPUTS("response has too many parts\n");
+        return -1;
+    }
+    if(conn->segs == NULL && (conn->segs = arena_alloc(conn->arena, SEND_MAX_SEGS * sizeof(send_seg_t))) == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    send_seg_t *seg = &conn->segs[conn->seg_cnt++];
+    seg->data = NULL;
+    seg->fd = fd;
+    seg->offset = offset;
+    seg->len = len;
+    conn->out_left += len;
+    return 0;
+}
+
+void reset_out(conn_t *conn) {
+    // The pipe leaves the epoll instance before its file is released
+    if(conn->pipe != NULL && conn->pipe->watched
+            && epoll_ctl(conn->worker->epfd, EPOLL_CTL_DEL, conn->pipe->fd, NULL) != 0) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+    }
+    conn->pipe = NULL;
+    compress_cache_release(&conn->worker->compress, conn->out_entry);
+    lookup_release(&conn->worker->lookup, conn->out_file);
+    conn->out_entry = NULL;
+    conn->out_file = NULL;
+    if(conn->proxy != NULL) {
+        proxy_release(&proxy, conn->proxy->entry);
+        conn->proxy = NULL;
+    }
+    conn->segs = NULL;
+    conn->seg_cnt = conn->seg_idx = 0;
+    conn->out_left = 0;
+}
+
+void run_sends(worker_t *worker) {
+    int64_t budget = SEND_BUDGET;
+    while(worker->sched_cnt > 0 && budget > 0) {
+        conn_t *conn = worker->sched[0];
+        sched_remove(worker, conn);
+        int64_t left = conn->out_left;
+        int ret = flush_out(conn, SEND_QUANTUM);
+        budget -= left - conn->out_left;
+        if(ret < 0) {
+            finish_req(conn, 0);
+        } else if(ret == 0) {
+            finish_send(conn);
+        } else {
+            wait_out(conn);
+        }
+    }
+}
+
+static void sched_push(worker_t *worker, conn_t *conn) {
+    if(worker->sched_cnt == worker->sched_cap) {
+        int cap = worker->sched_cap > 0 ? 2 * worker->sched_cap : 64;
+        conn_t **sched = realloc(worker->sched, cap * sizeof(conn_t *));
+        if(sched == NULL) {
+            ERRPRINTF("realloc failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        worker->sched = sched;
+        worker->sched_cap = cap;
+    }
+    conn->sched_key = worker->sched_clock + conn->out_left / SEND_AGING;
+    conn->sched_idx = worker->sched_cnt++;
+    worker->sched[conn->sched_idx] = conn;
+    sched_sift(worker, conn->sched_idx);
+}
+
+void sched_remove(worker_t *worker, conn_t *conn) {
+    int idx = conn->sched_idx;
+    conn_t *last = worker->sched[--worker->sched_cnt];
+    conn->sched_idx = -1;
+    if(last != conn) {
+        worker->sched[idx] = last;
+        last->sched_idx = idx;
+        sched_sift(worker, idx);
+    }
+}
+
+static void sched_sift(worker_t *worker, int idx) {
+    conn_t **heap = worker->sched;
+    conn_t *conn = heap[idx];
+    while(idx > 0 && heap[(idx - 1) / 2]->sched_key > conn->sched_key) {
+        heap[idx] = heap[(idx - 1) / 2];
+        heap[idx]->sched_idx = idx;
+        idx = (idx - 1) / 2;
+    }
+    for(;;) {
+        int child = 2 * idx + 1;
+        if(child >= worker->sched_cnt) {
+            break;
+        }
+        if(child + 1 < worker->sched_cnt && heap[child + 1]->sched_key < heap[child]->sched_key) {
+            child++;
+        }
+        if(heap[child]->sched_key >= conn->sched_key) {
+            break;
+        }
+        heap[idx] = heap[child];
+        heap[idx]->sched_idx = idx;
+        idx = child;
+    }
+    heap[idx] = conn;
+    conn->sched_idx = idx;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file sched.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Send path of the http server.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Responses are queued as parts in memory or of files and sent without
+ * blocking. Those which don't fit into a single send quantum are sent in slices by
+ * the send scheduler of the worker, which prefers the connections with the least
+ * bytes remaining, so large downloads don't hold up small responses. Named pipes
+ * are streamed as chunked bodies.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+/**
+ * @brief Maximum number of bytes of a named pipe sent in a single chunk.
+ */
+#define PIPE_CHUNK_SIZE (16 * 1024)
+
+/**
+ * @brief Maximum number of parts of a response: the head, a part head and the
+ * data of each range and the closing delimiter.
+ */
+#define SEND_MAX_SEGS (2 * HTTP_MAX_RANGES + 2)
+
+/**
+ * @brief State of a named pipe streamed as a response body.
+ * @details fd is the pipe, which is read without blocking. buf holds the chunk
+ * being sent; its size line is written into the room in front of the data read.
+ * waiting is set while the worker waits for the pipe to become readable, watched
+ * while fd is in the epoll instance of the worker and eof once the last chunk was
+ * queued.
+ */
+typedef struct pipe_out {
+    int fd;
+    int waiting;
+    int watched;
+    int eof;
+    char buf[8 + PIPE_CHUNK_SIZE + 2];
+} pipe_out_t;
+
+/**
+ * @brief Send the response queued for a connection, or schedule it.
+ * 
+ * @param conn Client connection.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 1 if the response was sent completely, 0 if it is sent later by the
+ * send scheduler or sending failed (the request was finished and the connection
+ * closed then).
+ * 
+ * @details Responses which fit into a send quantum are sent right away; the
+ * connection is left in CONN_SEND otherwise, or if the socket was not writable.
+ */
+int send_out(conn_t *conn, int keep_alive);
+
+/**
+ * @brief Wait until more of the response of a connection can be sent.
+ * 
+ * @param conn Client connection in CONN_SEND.
+ * 
+ * @details If the socket was writable, the connection is scheduled. Otherwise the
+ * worker waits for the socket to become writable (the connection is closed after
+ * the body timeout if the client does not read), or for the streamed pipe to
+ * become readable (likewise if the writer stalls).
+ * Global variables: body_timeout, use_uring.
+ */
+void wait_out(conn_t *conn);
+
+/**
+ * @brief Continue the response of a connection once its pipe became readable.
+ * 
+ * @param conn Client connection waiting for its pipe.
+ */
+void resume_pipe(conn_t *conn);
+
+/**
+ * @brief Finish a request whose response was sent by the send scheduler.
+ * 
+ * @param conn Client connection, which may be freed.
+ * 
+ * @details Requests pipelined behind the response are served afterwards.
+ * Global variables: use_uring.
+ */
+void finish_send(conn_t *conn);
+
+/**
+ * @brief Append a part in memory to the response queued for a connection.
+ * 
+ * @param conn Client connection.
+ * @param data Data, which must stay valid until the request is finished.
+ * @param len Length of data.
+ * @return int 0 on success, -1 if the allocation failed or the response has
+ * SEND_MAX_SEGS parts already.
+ */
+int queue_mem(conn_t *conn, const void *data, size_t len);
+
+/**
+ * @brief Append a part of a file to the response queued for a connection.
+ * 
+ * @param conn Client connection.
+ * @param fd File descriptor, which must stay open until the request is finished.
+ * @param offset Offset of the part.
+ * @param len Length of the part.
+ * @return int 0 on success, -1 if the allocation failed or the response has
+ * SEND_MAX_SEGS parts already.
+ */
+int queue_file(conn_t *conn, int fd, int64_t offset, int64_t len);
+
+/**
+ * @brief Drop the response queued for a connection.
+ * 
+ * @param conn Client connection.
+ * 
+ * @details Releases the file and the compressed variant referenced by it.
+ */
+void reset_out(conn_t *conn);
+
+/**
+ * @brief Send the responses of the scheduled connections of a worker.
+ * 
+ * @param worker Worker.
+ * 
+ * @details Sends a quantum to the scheduled connection with the lowest key at a
+ * time, until SEND_BUDGET bytes were sent or no connection is left. Connections
+ * which still have bytes remaining are scheduled again with a new key.
+ */
+void run_sends(worker_t *worker);
+
+/**
+ * @brief Remove a connection from the send scheduler.
+ * 
+ * @param worker Worker.
+ * @param conn Scheduled client connection.
+ */
+void sched_remove(worker_t *worker, conn_t *conn);
+
+#endif
@@ -5,14 +5,30 @@
  * @version 1.0
  * @date 2018-11-07
  * @details This module contains the implementation of a simple http that is able to
- * server static file from a directory using http GET requests. The code in this module 
+ * server static file from a directory using http GET and HEAD requests. The code in this module 
  * consists mostly of setup code resource management while the specifics on the http
- * protocol are provided by the http module. 
+ * protocol are provided by the http module. Connections are served by a number of
+ * worker threads accepting from the same socket; each worker owns its resources and
+ * counters, which are exported on the optional metrics endpoint. A worker waits for
+ * all of its connections with epoll, so idle connections and clients sending slowly
+ * do not block it; with -U, it uses the io_uring backend of the ring module instead.
+ * The header, body and keep-alive timeouts of its connections are kept in a timer
+ * wheel, which yields the expired connections without scanning all of them. Responses are sent without blocking; those which don't fit into a single
+ * send quantum are sent in slices, preferring the connections with the least bytes
+ * remaining, so large downloads don't hold up small responses; the send path is
+ * implemented in the sched module. With -a, the files are served from an archive
+ * created by the pack program instead of a directory.
+ * With -P, requests for files which do not exist are answered by an upstream server
+ * through the caching reverse proxy of the proxy module (see the relay module).
  */
 
+// splice
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <assert.h>
 #include <netdb.h>
 #include <errno.h>
 #include <signal.h>
@@ -20,9 +36,37 @@
 #include <time.h>
 #include <libgen.h>
 #include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "http.h"
+#include "parser.h"
+#include "arena.h"
+#include "compress.h"
+#include "lookup.h"
+#include "stats.h"
+#include "accesslog.h"
+#include "wheel.h"
+#include "uring.h"
+#include "archive.h"
+#include "proxy.h"
 #include "utils.h"
+#include "server.h"
+#include "sched.h"
+#include "ring.h"
+#include "upload.h"
+#include "relay.h"
 
 /**
  * @brief Client backlog.
@@ -32,30 +76,238 @@
 #define LISTEN_BACKLOG 50
 
 /**
- * @brief Macro for replying an error message.
- * @details Replies an http response with the given status number and status text.
- * Assumes that the http frame called "res", the client connection stream "conn" and the 
- * and the request frame "req" exists in the context where this macro is used. 
+ * @brief Size of the first chunk of a connection arena.
+ */
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+/**
+ * @brief Maximum capacity of a connection arena.
+ * @details Requests which need more request scoped memory are answered with an
+ * internal server error.
+ */
+#define ARENA_LIMIT (1024 * 1024)
+
+/**
+ * @brief Number of released connection arenas kept for reuse.
+ */
+#define ARENA_POOL_SIZE 64
+
+/**
+ * @brief Maximum total size of the compressed variants cached by a worker.
+ */
+#define COMPRESS_CACHE_SIZE (16 * 1024 * 1024)
+
+/**
+ * @brief Size range of files which are compressed on the fly.
+ * @details Smaller files do not benefit from compression, larger ones would take
+ * too long to compress while the client waits.
+ */
+#define COMPRESS_MIN_SIZE 256
+#define COMPRESS_MAX_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief Maximum total size of the responses kept by the reverse proxy.
+ */
+#define PROXY_CACHE_SIZE (64 * 1024 * 1024)
+
+/**
+ * @brief Maximum size of a document of the metrics endpoint.
+ */
+#define STATS_BUF_SIZE (64 * 1024)
+
+/**
+ * @brief Size of the access log ring buffer of each worker.
+ */
+#define ACCESS_LOG_RING_SIZE (1024 * 1024)
+
+/**
+ * @brief Time in nanoseconds resolved paths are cached by a worker.
+ */
+#define LOOKUP_TTL (1000 * 1000 * 1000)
+
+/**
+ * @brief Length of a tick of the timer wheels in nanoseconds.
+ */
+#define TIMER_TICK (10 * 1000 * 1000)
+
+/**
+ * @brief Maximum number of events a worker takes from epoll at once.
+ */
+#define MAX_EVENTS 64
+
+/**
+ * @brief Interval in nanoseconds in which a worker at its connection limit sheds pending clients.
+ */
+#define SHED_INTERVAL (50 * 1000 * 1000)
+
+/**
+ * @brief Maximum number of pending clients shed per interval.
+ */
+#define SHED_BATCH 16
+
+/**
+ * @brief Seconds after which shed clients are asked to retry.
+ */
+#define SHED_RETRY_AFTER "1"
+
+/**
+ * @brief Environment variable passing the listen socket to the server started by a reload.
+ */
+#define LISTEN_FD_ENV "OSUE_LISTEN_FD"
+
+/**
+ * @brief Environment variable passing the pipe the server started by a reload reports its readiness to.
+ */
+#define READY_FD_ENV "OSUE_READY_FD"
+
+/**
+ * @brief Time in milliseconds the server started by a reload has to become ready.
+ */
+#define RELOAD_TIMEOUT 5000
+
+/**
+ * @brief Maximum number of connections of a worker with io_uring if no limit is set.
+ * @details The connections of a worker are allocated in advance, as their buffers
+ * are registered with the ring.
+ */
+#define URING_MAX_CONNS 512
+
+/**
+ * @brief Query selecting the JSON document of the metrics endpoint.
+ */
+#define STATS_JSON_QUERY "?format=json"
+
+/**
+ * @brief Initializer of a pre-serialized response.
+ * @details Contains the status line and all fixed header lines of the response.
+ */
+#define STATIC_RES(status, text, headers) \
+    {status, text, HTTP_SLICE_LIT(HTTP_VERSION " " #status " " text "\r\n" headers)}
+
+/**
+ * @brief Pre-serialized response prefix.
+ * @details head contains the status line and the header lines which are the same
+ * for every response of the type. Error responses have no body.
+ */
+typedef struct static_res {
+    int status;
+    const char *status_text;
+    http_slice_t head;
+} static_res_t;
+
+/**
+ * @brief Pre-serialized response prefixes, indexed by res_type_t.
  */
-#define SEND_ERR_RES(s, st) \
-    res.status = s; \
-    res.status_text = st; \
-    send_res(&res, conn); \
-    http_free_frame(req);
+static const static_res_t static_res[] = {
+    [RES_OK] = STATIC_RES(200, "OK", "Accept-Ranges: bytes\r\nVary: Accept-Encoding\r\n"),
+    [RES_OK_CHUNKED] = STATIC_RES(200, "OK", "Transfer-Encoding: chunked\r\n"),
+    [RES_PARTIAL_CONTENT] = STATIC_RES(206, "Partial Content", "Accept-Ranges: bytes\r\nVary: Accept-Encoding\r\n"),
+    [RES_CREATED] = STATIC_RES(201, "Created", "Content-Length: 0\r\n"),
+    [RES_NO_CONTENT] = STATIC_RES(204, "No Content", ""),
+    [RES_NOT_MODIFIED] = STATIC_RES(304, "Not Modified", "Vary: Accept-Encoding\r\n"),
+    [RES_BAD_REQUEST] = STATIC_RES(400, "Bad Request", "Content-Length: 0\r\n"),
+    [RES_NOT_FOUND] = STATIC_RES(404, "Not Found", "Content-Length: 0\r\n"),
+    [RES_PAYLOAD_TOO_LARGE] = STATIC_RES(413, "Payload Too Large", "Content-Length: 0\r\n"),
+    [RES_RANGE_NOT_SATISFIABLE] = STATIC_RES(416, "Range Not Satisfiable", "Content-Length: 0\r\n"),
+    [RES_HEADERS_TOO_LARGE] = STATIC_RES(431, "Request Header Fields Too Large", "Content-Length: 0\r\n"),
+    [RES_INTERNAL_ERROR] = STATIC_RES(500, "Internal Server Error", "Content-Length: 0\r\n"),
+    [RES_NOT_IMPLEMENTED] = STATIC_RES(501, "Not Implemented", "Content-Length: 0\r\n"),
+    [RES_BAD_GATEWAY] = STATIC_RES(502, "Bad Gateway", "Content-Length: 0\r\n"),
+    [RES_GATEWAY_TIMEOUT] = STATIC_RES(504, "Gateway Timeout", "Content-Length: 0\r\n")
+};
 
 /**
- * @brief Program name.
- * @details Name of the executable used for usage and error messages.
+ * @brief Response sent to clients which are shed because the server is overloaded.
+ * @details Serialized completely in advance, a Date header is optional for 5xx
+ * responses. The connection is closed afterwards.
  */
-static char *progname;
+static const http_slice_t shed_res = HTTP_SLICE_LIT(HTTP_VERSION " 503 Service Unavailable\r\n"
+    "Retry-After: " SHED_RETRY_AFTER "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+/**
+ * @brief Connection header lines, indexed by the keep-alive flag.
+ */
+static const http_slice_t conn_lines[] = {
+    HTTP_SLICE_LIT("Connection: close\r\n"),
+    HTTP_SLICE_LIT("Connection: keep-alive\r\n")
+};
+
+/**
+ * @brief Representation of a file selected for a response.
+ * @details encoding is the content coding of the representation and file the
+ * opened file with its status st. For precompressed sibling files, path and file
+ * refer to the sibling; for variants compressed by the server, entry holds the
+ * compressed data.
+ */
+typedef struct variant {
+    int encoding;
+    const char *path;
+    struct stat st;
+    lookup_entry_t *file;
+    compress_entry_t *entry;
+} variant_t;
+
+/**
+ * @brief Body and validators of a response for a file.
+ * @details etag is the entity tag of the file (the suffix of the content coding
+ * is added when sending) and mtime its modification time. encoding is the content
+ * coding of the body, which is either len bytes at data (variants compressed by
+ * the server, ranges are not supported) or len bytes at offset of the file fd.
+ */
+typedef struct entity {
+    const char *mime;
+    http_slice_t etag;
+    time_t mtime;
+    int encoding;
+    const void *data;
+    int fd;
+    int64_t offset;
+    int64_t len;
+} entity_t;
+
+// Settings shared with the other modules of the server, documented in server.h
+char *progname;
+int body_timeout = 30;
+int use_uring = 0;
+proxy_t proxy;
+unsigned int conn_limit = 0;
+volatile sig_atomic_t quit = 0;
+int sockfd = -1;
+int wake_fd = -1;
+int docroot_fd = -1;
+int64_t upload_limit = 0;
 
 /**
  * @brief Path to document root.
- * @details Path to the document root of the webserver, this path will be prepended
- * to request file path's.
+ * @details Path to the document root of the webserver, request paths are resolved
+ * beneath it.
  */
 static char *docroot;
 
+/**
+ * @brief Whether the document root is an archive created by pack (-a cli argument).
+ */
+static int use_archive = 0;
+
+/**
+ * @brief The archive served with -a.
+ */
+static archive_t archive;
+
+/**
+ * @brief URL of the upstream server.
+ * @details If != NULL, requests for files which do not exist are forwarded to this
+ * server and its responses are cached (the -P cli argument).
+ */
+static char *upstream = NULL;
+
+/**
+ * @brief Directory the responses of the upstream server are stored in.
+ * @details If != NULL, cached responses survive restarts and reloads (the -C cli
+ * argument). Otherwise they are only kept while the server runs.
+ */
+static char *cache_dir = NULL;
+
 /**
  * @brief Index file name.
  * @details If the client requests a directory (request path ends with "/"), the
@@ -64,18 +316,111 @@ static char *docroot;
 static char *index_file = "index.html";
 
 /**
- * @brief Flag denoting whether the program should be terminated.
- * @details This variable is used by the signal handlers to indicated that a signal
- * was caught and the program should be terminated after the current request
- * has been handled. 
+ * @brief Keep-alive timeout in seconds.
+ * @details If > 0, connections are kept open after a response for further requests
+ * and closed if no request arrives within this time (the -k cli argument). 0 disables
+ * persistent connections.
+ */
+static int keepalive_timeout = 0;
+
+/**
+ * @brief Header timeout in seconds.
+ * @details Connections are closed if a request head is not complete within this
+ * time after its first byte (or after the connection was accepted) (the -t cli
+ * argument). 0 disables the timeout.
+ */
+static int header_timeout = 10;
+
+/**
+ * @brief Maximum number of requests each worker handles at the same time.
+ * @details The -r cli argument divided among the workers. Requests beyond the
+ * limit are answered with 503. 0 disables the limit.
+ */
+static unsigned int inflight_limit = 0;
+
+/**
+ * @brief Path of the metrics endpoint.
+ * @details If != NULL, GET requests for this path are answered with the counters
+ * of all workers instead of a file (the -m cli argument).
+ */
+static char *stats_path = NULL;
+
+/**
+ * @brief Access log file.
+ * @details If != NULL, every request is written to this file ("-" for stdout) by
+ * the access log (the -l cli argument).
+ */
+static char *access_log_path = NULL;
+
+/**
+ * @brief Behavior of the access log if the ring buffer of a worker is full.
+ * @details Records are dropped by default, the -B cli argument makes the worker wait.
+ */
+static access_log_policy_t access_log_policy = ACCESS_LOG_DROP;
+
+/**
+ * @brief The access log, only initialized if access_log_path != NULL.
+ */
+static access_log_t access_log;
+
+/**
+ * @brief Number of workers (the -w cli argument).
+ */
+static int worker_cnt = 1;
+
+/**
+ * @brief The workers serving connections.
+ */
+static worker_t *workers;
+
+/**
+ * @brief Time the server was started (monotonic clock, in nanoseconds).
+ */
+static uint64_t start_time;
+
+/**
+ * @brief Flag denoting whether the server should be reloaded.
+ * @details Set by the signal handler on SIGHUP and handled by the first worker.
+ * Accessed with the __atomic builtins of GCC.
+ */
+static int reload = 0;
+
+/**
+ * @brief Flag denoting whether the server drains its connections.
+ * @details Set once a server started by a reload took over the listen socket. The
+ * workers stop accepting, close their idle connections and terminate when the
+ * remaining requests are finished. Accessed with the __atomic builtins of GCC.
+ */
+static int draining = 0;
+
+/**
+ * @brief Read end of the pipe the server started by a reload reports its readiness to.
+ * @details -1 if no reload is in progress. Watched by the first worker along with
+ * its connections.
+ */
+static int reload_fd = -1;
+
+/**
+ * @brief Process id of the server started by the reload in progress.
+ */
+static pid_t reload_pid;
+
+/**
+ * @brief Timer of the reload in progress, armed in the wheel of the first worker.
  */
-static volatile sig_atomic_t quit = 0;
+static wheel_timer_t reload_timer;
 
 /**
- * @brief File descriptor for the server socket.
- * @details -1 if not open
+ * @brief Command line of the server, which is executed again on reload.
  */
-static int sockfd = -1;
+static char **saved_argv;
+
+/**
+ * @brief Arguments file.
+ * @details If != NULL, further arguments are read from this file on every start
+ * (the -f cli argument), so settings can be changed by a reload.
+ */
+static char *args_path = NULL;
 
 /**
  * Print usage. 
@@ -99,75 +444,328 @@ static void usage(void);
 static void open_socket(char *port);
 
 /**
- * Cleanup and terminate.
- * @brief Free allocated memory, close open streams and terminate program with the
- * given status code.
+ * @brief Parse command line arguments.
  * 
- * @param status Returns status of the program.
+ * @param argc Argument counter.
+ * @param argv Argument vector.
+ * @param port Port, set by the -p option.
+ * @param max_conns Connection limit, set by the -c option.
+ * @param max_inflight Request limit, set by the -r option.
+ * @return char* The document root, NULL if it was not given.
  * 
- * @details Closes open file streams (pointers != NULL) and exits the program using 
- * exit(), returning the given status.
- * Global variables: sockfd.
+ * @details Sets the global variables of the options; prints the usage if an option
+ * is invalid or more than one argument remains.
+ */
+static char *parse_args(int argc, char **argv, char **port, long *max_conns, long *max_inflight);
+
+/**
+ * @brief Read the arguments of an arguments file.
+ * 
+ * @param path Path of the file.
+ * @param argc Number of arguments, set including the program name.
+ * @return char** Argument vector starting with the program name.
+ * 
+ * @details Arguments are separated by whitespace; lines starting with '#' are
+ * ignored. Terminates the program if the file cannot be read.
  */
-static void cleanup_exit(int status);
+static char **read_args(const char *path, int *argc);
 
 /**
- * @brief Signal handler for SIGINT and SIGTERM.
+ * @brief Signal handler for SIGINT, SIGTERM and SIGHUP.
  * 
  * @param signal Caught signal.
  * 
- * @details Signal handler. Initiates the termination of the program by setting
- * the quit flag. The server will finish handling the current request (if there is any)
- * and terminate afterwards.
- * Global variables: quit.
+ * @details Signal handler. SIGINT and SIGTERM initiate the termination of the 
+ * program by setting the quit flag. The server will finish handling the current
+ * request (if there is any) and terminate afterwards. SIGHUP sets the reload flag.
+ * Global variables: quit, reload.
  */
 static void handle_signal(int signal);
 
 /**
- * @brief Contains the main loop for the server.
- * @details Continuously accept client and handle their requests (via the 
- * handle_request function). 
- * Global variables: sockfd, quit.
+ * @brief Hand the listen socket over to a new server process.
+ * 
+ * @param worker The first worker.
+ * 
+ * @details Executes the server again with its command line, passing the listen
+ * socket and a pipe for reporting its readiness in environment variables, so the
+ * new process neither binds the port again nor loses the clients in the backlog.
+ * The read end of the pipe is watched by the worker and a timer of RELOAD_TIMEOUT
+ * is armed; the worker keeps serving its connections meanwhile and completes the
+ * reload with the check_reload function.
+ * Global variables: saved_argv, sockfd, draining, reload_fd, reload_pid, reload_timer, use_uring.
+ */
+static void start_reload(worker_t *worker);
+
+/**
+ * @brief Complete a reload once the new server is ready or failed to start.
+ * 
+ * @param worker The first worker.
+ * @param timed_out Whether the timer of the reload expired.
+ * 
+ * @details If the new server reported its readiness, the workers are woken up to
+ * drain their connections. If it exited before or did not become ready in time,
+ * it is terminated and the server continues. Nothing happens if the new server is
+ * still starting.
+ * Global variables: wake_fd, draining, reload_fd, reload_pid, reload_timer.
+ */
+static void check_reload(worker_t *worker, int timed_out);
+
+/**
+ * @brief Start draining the connections of a worker.
+ * 
+ * @param worker Worker.
+ * 
+ * @details The worker stops accepting and closes its idle connections; the other
+ * connections are closed after their current request.
+ */
+static void drain_worker(worker_t *worker);
+
+/**
+ * @brief Start the workers and wait until they terminated.
+ * @details The calling thread serves as the first worker. Once it stopped, the
+ * other workers are woken up via wake_fd, so they notice the quit flag as well.
+ * After a reload, the workers stop once their connections are drained.
+ * Afterwards the remaining records of the access log are written.
+ * Global variables: wake_fd, workers, worker_cnt, quit, draining, access_log.
  */
 static void run_server(void);
 
+/**
+ * @brief Contains the main loop of a worker.
+ * 
+ * @param arg The worker.
+ * @return void* NULL.
+ * 
+ * @details Waits for the server socket, the connections of the worker and the 
+ * earliest timeout of its timer wheel with epoll. New clients are accepted, 
+ * readable connections are served (via the serve_conn function) and connections
+ * whose timeout expired are closed (via the finish_batch function). wake_fd is
+ * watched edge-triggered and never read, so every write wakes up all workers. With
+ * io_uring, the loop of run_ring is used instead.
+ * Global variables: sockfd, wake_fd, quit, use_uring.
+ */
+static void *run_worker(void *arg);
+
+/**
+ * @brief Close the connections whose timeout expired in one batch.
+ * 
+ * @param worker The worker.
+ */
+static void expire_timers(worker_t *worker);
+
+/**
+ * @brief Accept all pending clients.
+ * 
+ * @param worker Worker the connections are added to.
+ * 
+ * @details Each connection is added via the add_conn function. At the connection
+ * limit of the worker, or if no file descriptor is left, the worker stops accepting
+ * (via the pause_accept function).
+ * Global variables: sockfd, conn_limit, keepalive_timeout, body_timeout.
+ */
+static void accept_conns(worker_t *worker);
+
+/**
+ * @brief Allocate a connection.
+ * 
+ * @param worker Worker the connection belongs to.
+ * @return conn_t* The connection, NULL if none is left.
+ * 
+ * @details With io_uring, connections are taken from the registered connections
+ * of the worker, otherwise they are allocated with malloc.
+ * Global variables: use_uring.
+ */
+static conn_t *alloc_conn(worker_t *worker);
+
+/**
+ * @brief Accept clients again after pause_accept.
+ * 
+ * @param worker Worker.
+ * 
+ * @details Global variables: sockfd.
+ */
+static void resume_accept(worker_t *worker);
+
+/**
+ * @brief Reject pending clients while a worker does not accept.
+ * 
+ * @param worker Worker whose pace timer expired.
+ * 
+ * @details Resumes accepting if the worker is below its connection limit again.
+ * Otherwise up to SHED_BATCH pending clients are accepted and shed, so clients
+ * get a quick answer instead of waiting in the backlog, and the pace timer is
+ * armed again.
+ * Global variables: sockfd, conn_limit.
+ */
+static void shed_pending(worker_t *worker);
+
+/**
+ * @brief Receive a request head from a client.
+ * 
+ * @param conn Client connection.
+ * @return int A value of http_parse_res_t (HTTP_PARSE_AGAIN if the head is not
+ * complete yet), or -1 if the connection was closed or reading from the socket failed.
+ * 
+ * @details Feeds bytes already in the connection buffer to the request parser and
+ * reads from the client socket without blocking until the head is complete or 
+ * invalid, or no more data is available.
+ * Global variables: quit.
+ */
+static int recv_req(conn_t *conn);
+
 /**
  * @brief Handle a single client request.
  * 
- * @param conn Client connection stream.
+ * @param conn Client connection.
+ * @param parse_res Result of receiving the request head (see recv_req).
+ * @return int 1 if the connection should be kept open for further requests, 0 if
+ * it should be closed. Not meaningful if the connection is left in CONN_BODY.
  * 
- * @details Receives a request from a client and tries to reply the requested file.
+ * @details Answers a request from a client and tries to reply the requested file.
+ * GET and HEAD requests are supported; the response carries the ETag and 
+ * Last-Modified validators of the file and conditional requests are answered with
+ * 304 without opening the file. Range requests are answered with 206 (a 
+ * multipart/byteranges body for several ranges) or 416. If the client accepts a
+ * content coding, a precompressed sibling file or a compressed variant from the
+ * cache of the worker is sent instead of the file. Named pipes are streamed with
+ * chunked transfer coding. With -a, files are looked up in the archive instead
+ * (see send_packed). With -P, requests for files which do not exist are answered
+ * by the reverse proxy (see handle_proxy).
  * In addition to the error behavior defined in the exercise description (404 if file 
  * not found, 501 if method not supported) this function implements the following error
  * handling procedures:
  * - Close the socket without sending a reply if a stream error on the client connection occurs.
  * - Terminate the server if a memory allocation error (or a different unexpected error) occurs.
  * - Reply with an 500 internal server error otherwise (e.g. request file failed to open).
- * Global variables: docroot, index_file.
+ * Global variables: docroot_fd, index_file, use_archive, upstream.
+ */
+static int handle_request(conn_t *conn, int parse_res);
+
+/**
+ * @brief Answer a request for a file of the archive.
+ * 
+ * @param conn Client connection.
+ * @param entry Entry of the requested file in the index of the archive, NULL if
+ * there is none.
+ * @param head_only Whether only the head should be sent.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 0 if the response was queued, -1 if sending failed and the connection
+ * should be closed.
+ * 
+ * @details Sends the stored variant of the most preferred content coding
+ * acceptable for the client (br, zstd, gzip, identity in that order) with
+ * sendfile from the archive, so neither the file system nor the compression cache
+ * is involved. Replies 404 if there is no entry.
+ * Global variables: archive.
+ */
+static int send_packed(conn_t *conn, const archive_entry_t *entry, int head_only, int keep_alive);
+
+/**
+ * @brief Answer a request for the metrics endpoint.
+ * 
+ * @param conn Client connection.
+ * @param json Whether the JSON document was requested.
+ * @param head_only Whether only the head should be sent.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 0 if the response was sent, -1 if sending failed and the connection
+ * should be closed.
+ * 
+ * @details Merges the counters of all workers into a snapshot allocated from the
+ * arena of the connection and sends it with Cache-Control: no-store.
+ * Global variables: workers, worker_cnt, start_time.
+ */
+static int send_stats(conn_t *conn, int json, int head_only, int keep_alive);
+
+/**
+ * @brief Check the conditional request headers.
+ * 
+ * @param req Parsed request.
+ * @param etag Entity tag of the requested file.
+ * @param mtime Modification time of the requested file.
+ * @return int 1 if the client's copy is up to date and 304 should be replied, 0 otherwise.
+ * 
+ * @details Evaluates If-None-Match and, only if that header is absent, 
+ * If-Modified-Since as defined in RFC 7232. Invalid dates and dates in the future
+ * are ignored.
+ */
+static int not_modified(http_parser_t *req, http_slice_t etag, time_t mtime);
+
+/**
+ * @brief Check the If-Range request header.
+ * 
+ * @param req Parsed request.
+ * @param etag Entity tag of the requested file.
+ * @param mtime Modification time of the requested file.
+ * @return int 1 if the Range header should be evaluated, 0 if it should be ignored.
+ * 
+ * @details Returns 1 if there is no If-Range header or if it contains the (strong)
+ * entity tag or the modification date of the file.
+ */
+static int if_range(http_parser_t *req, http_slice_t etag, time_t mtime);
+
+/**
+ * @brief Select the representation of a file for a response.
+ * 
+ * @param conn Client connection.
+ * @param mime Media type of the file.
+ * @param accepted Set of http_encoding_t flags acceptable for the client.
+ * @param var Representation, initialized with the uncompressed file.
+ * 
+ * @details Prefers a sibling file with the extension of an acceptable coding 
+ * (br, zstd, gzip in that order) which was modified after the file. Otherwise 
+ * files of compressible media types are compressed with gzip, using the cache 
+ * of the worker. var is left unchanged if no compressed representation exists.
  */
-static void handle_request(FILE *conn);
+static void select_variant(conn_t *conn, const char *mime, int accepted, variant_t *var);
 
 /**
- * @brief Get the file path for a given requested file
+ * @brief Send a representation of a file.
  * 
- * @param req_path Request path from the http request (must start with a slash)
- * @return char* File path to the requested file.
+ * @param conn Client connection with the parsed request.
+ * @param ent Representation.
+ * @param head_only Whether only the head should be sent.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 0 if the response was queued, -1 if sending failed and the connection
+ * should be closed.
  * 
- * @details Contains the document root with the requests file path and appends the 
- * index file name if the requested file ends with a slash. The returns values is a
- * pointer to a dynamically allocated memory space and therefore needs to be freed.
+ * @details Adds the ETag and Last-Modified validators and the Content-Encoding of
+ * the representation and replies 304 to conditional requests for an up to date
+ * copy. Otherwise the body is sent by send_data or, evaluating the Range header,
+ * by send_file (416 if no range is satisfiable). The data and the file of the
+ * representation must stay valid until the request is finished.
  */
-static char *get_file_path(char *req_path);
+static int send_entity(conn_t *conn, const entity_t *ent, int head_only, int keep_alive);
 
 /**
- * @brief Helper function for sending a reponse to the client.
+ * @brief Send the contents of a named pipe.
+ * 
+ * @param conn Client connection.
+ * @param fd File descriptor of the pipe, opened non-blocking.
+ * @param mime Media type of the stream.
+ * @param head_only Whether only the head should be sent (the pipe is not read).
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 0 if the response was queued, -1 if the allocation failed and the
+ * connection should be closed.
  * 
- * @param res Response http frame which should be sent.
- * @param conn Client connection stream.
+ * @details The length of the stream is unknown, so the body is sent with chunked 
+ * transfer coding, forwarding data as soon as it is read from the pipe. Opening
+ * the pipe does not wait for a writer; without a writer the body is empty. The
+ * chunks are sent like any other response by the send scheduler, which waits for
+ * the pipe without blocking the worker; fd must stay open until the request is
+ * finished.
+ */
+static int send_pipe(conn_t *conn, int fd, const char *mime, int head_only, int keep_alive);
+
+/**
+ * @brief Format a Content-Range header line.
  * 
- * @details Wraps http_send_res and implementes error handling for the function.
+ * @param buf Buffer of at least 96 characters.
+ * @param range Range which should be formatted, or NULL for an unsatisfied range.
+ * @param size Size of the file.
+ * @return size_t Length of the line including the line break.
  */
-static void send_res(http_frame_t *res, FILE *conn);
+static size_t format_content_range(char *buf, const http_range_t *range, int64_t size);
 
 /**
  * @brief Main method for the http server. Parses the command line arguments,
@@ -187,28 +785,61 @@ int main(int argc, char **argv) {
     char *port = "8080";
     progname = argv[0];
 
-    int c;
-    while((c = getopt(argc, argv, "p:i:")) != -1) {
-        switch(c) {
-        case 'p':
-            port = optarg;
-            break;
-        case 'i':
-            index_file = optarg;
-            break;
-        case '?':
-        default:
+    long max_conns = 0, max_inflight = 0;
+    saved_argv = argv;
+    docroot = parse_args(argc, argv, &port, &max_conns, &max_inflight);
+    if(args_path != NULL) {
+        // Options of the file take precedence, so they can be changed by a reload
+        int file_argc;
+        char **file_argv = read_args(args_path, &file_argc);
+        char *file_docroot = parse_args(file_argc, file_argv, &port, &max_conns, &max_inflight);
+        if(file_docroot != NULL && docroot != NULL) {
             usage();
         }
+        if(file_docroot != NULL) {
+            docroot = file_docroot;
+        }
     }
-    argc -= optind;
-    argv += optind;
-
-    if(argc != 1) { 
+    if(docroot == NULL) {
         usage();
     }
 
-    docroot = argv[0];
+    // Each worker gets an equal share of the limits, at least one
+    if(max_conns > 0) {
+        conn_limit = max_conns > worker_cnt ? (max_conns + worker_cnt - 1) / worker_cnt : 1;
+    }
+    if(max_inflight > 0) {
+        inflight_limit = max_inflight > worker_cnt ? (max_inflight + worker_cnt - 1) / worker_cnt : 1;
+    }
+    if(use_uring && !ring_supported()) {
+        ERRPUTS("io_uring is not supported, using epoll\n");
+        use_uring = 0;
+    }
+    if(use_uring && conn_limit == 0) {
+        conn_limit = URING_MAX_CONNS;
+    }
+    if(use_archive && upload_limit > 0) {
+        // Uploads cannot be stored in an archive
+        usage();
+    }
+    if(cache_dir != NULL && upstream == NULL) {
+        usage();
+    }
+    if(use_archive && archive_open(&archive, docroot) != 0) {
+        ERRPRINTF("opening archive %s failed: %s\n", docroot, errno == EINVAL ? "not a valid archive" : strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    if(!use_archive && (docroot_fd = open(docroot, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        ERRPRINTF("open on %s failed: %s\n", docroot, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    // Upstream requests which make no progress are bounded like client bodies
+    if(upstream != NULL && proxy_init(&proxy, upstream, cache_dir, PROXY_CACHE_SIZE,
+            body_timeout > 0 ? body_timeout * 1000 : -1, wake_proxy) != 0) {
+        ERRPRINTF("setting up proxy for %s failed: %s\n", upstream,
+            errno == EINVAL ? "invalid url" : strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
 
     // Setup shutdown handler
     struct sigaction sa;
@@ -216,22 +847,216 @@ int main(int argc, char **argv) {
     sa.sa_handler = handle_signal;
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
 
-    open_socket(port);
-    printf("Server listening on port %s...\n", port);
-
-    run_server();
-
-    cleanup_exit(EXIT_SUCCESS);
-}
-
-static void usage(void) {
-    fprintf(stderr, "Usage: %s [-p PORT] [-i INDEX] DOC_ROOT\n", progname);
-    exit(EXIT_FAILURE);
-}
+    // Write errors on closed connections are handled via the return values
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
 
-static void handle_signal(int signal) {
-    quit = 1;
+    // The counters of the workers must not share cache lines
+    if(posix_memalign((void **)&workers, STATS_CACHE_LINE, worker_cnt * sizeof(worker_t)) != 0) {
+        ERRPUTS("posix_memalign failed\n");
+        cleanup_exit(EXIT_FAILURE);
+    }
+    wheel_timer_init(&reload_timer);
+    for(int i = 0; i < worker_cnt; i++) {
+        worker_t *worker = &workers[i];
+        memset(worker, 0, sizeof(*worker));
+        worker->id = i;
+        wheel_timer_init(&worker->pace_timer);
+        stats_init(&worker->stats);
+        arena_pool_init(&worker->arenas, ARENA_CHUNK_SIZE, ARENA_LIMIT, ARENA_POOL_SIZE);
+        compress_cache_init(&worker->compress, COMPRESS_CACHE_SIZE);
+        if(lookup_cache_init(&worker->lookup, docroot_fd, LOOKUP_TTL) != 0) {
+            ERRPRINTF("calloc failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        if(pipe2(worker->pipe, O_CLOEXEC) != 0) {
+            ERRPRINTF("pipe failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        worker->proxy_fd = -1;
+        if(upstream != NULL && (worker->proxy_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+            ERRPRINTF("eventfd failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        if(use_uring && init_ring(worker) != 0) {
+            ERRPRINTF("setting up io_uring failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+    }
+    if(access_log_path != NULL 
+            && access_log_open(&access_log, access_log_path, worker_cnt, ACCESS_LOG_RING_SIZE, access_log_policy) != 0) {
+        ERRPRINTF("opening access log %s failed: %s\n", access_log_path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    start_time = stats_now();
+    open_socket(port);
+    printf("Server listening on port %s...\n", port);
+    fflush(stdout);
+
+    // Let the process which started this one by a reload drain its connections
+    char *ready = getenv(READY_FD_ENV);
+    if(ready != NULL) {
+        int ready_fd = strtol(ready, NULL, 10);
+        unsetenv(READY_FD_ENV);
+        if(write(ready_fd, "1", 1) != 1) {
+            ERRPRINTF("write on ready pipe failed: %s\n", strerror(errno));
+        }
+        close(ready_fd);
+    }
+
+    run_server();
+
+    cleanup_exit(EXIT_SUCCESS);
+}
+
+static char *parse_args(int argc, char **argv, char **port, long *max_conns, long *max_inflight) {
+    int c;
+    optind = 1;
+    while((c = getopt(argc, argv, "p:i:k:t:b:c:r:u:w:m:l:BUf:aP:C:")) != -1) {
+        switch(c) {
+        case 'p':
+            *port = optarg;
+            break;
+        case 'i':
+            index_file = optarg;
+            break;
+        case 'k':
+            keepalive_timeout = strtol(optarg, NULL, 10);
+            if(keepalive_timeout < 0) {
+                usage();
+            }
+            break;
+        case 't':
+            header_timeout = strtol(optarg, NULL, 10);
+            if(header_timeout < 0) {
+                usage();
+            }
+            break;
+        case 'b':
+            body_timeout = strtol(optarg, NULL, 10);
+            if(body_timeout < 0) {
+                usage();
+            }
+            break;
+        case 'c':
+            *max_conns = strtol(optarg, NULL, 10);
+            if(*max_conns < 0) {
+                usage();
+            }
+            break;
+        case 'r':
+            *max_inflight = strtol(optarg, NULL, 10);
+            if(*max_inflight < 0) {
+                usage();
+            }
+            break;
+        case 'u':
+            upload_limit = strtoll(optarg, NULL, 10);
+            if(upload_limit < 0) {
+                usage();
+            }
+            break;
+        case 'w':
+            worker_cnt = strtol(optarg, NULL, 10);
+            if(worker_cnt <= 0) {
+                usage();
+            }
+            break;
+        case 'm':
+            stats_path = optarg;
+            if(stats_path[0] != '/') {
+                usage();
+            }
+            break;
+        case 'l':
+            access_log_path = optarg;
+            break;
+        case 'B':
+            access_log_policy = ACCESS_LOG_BLOCK;
+            break;
+        case 'U':
+            use_uring = 1;
+            break;
+        case 'f':
+            args_path = optarg;
+            break;
+        case 'a':
+            use_archive = 1;
+            break;
+        case 'P':
+            upstream = optarg;
+            break;
+        case 'C':
+            cache_dir = optarg;
+            break;
+        case '?':
+        default:
+            usage();
+        }
+    }
+    if(argc - optind > 1) {
+        usage();
+    }
+    return optind < argc ? argv[optind] : NULL;
+}
+
+static char **read_args(const char *path, int *argc) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        ERRPRINTF("fopen on %s failed: %s\n", path, strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    size_t cap = 16;
+    char **args = malloc(cap * sizeof(char *));
+    char *line = NULL;
+    size_t line_cap = 0;
+    *argc = 0;
+    if(args == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    args[(*argc)++] = progname;
+    while(getline(&line, &line_cap, file) != -1) {
+        if(line[0] == '#') {
+            continue;
+        }
+        for(char *arg = strtok(line, " \t\r\n"); arg != NULL; arg = strtok(NULL, " \t\r\n")) {
+            if((size_t)*argc + 1 >= cap) {
+                cap *= 2;
+                char **grown = realloc(args, cap * sizeof(char *));
+                if(grown == NULL) {
+                    ERRPRINTF("realloc failed: %s\n", strerror(errno));
+                    cleanup_exit(EXIT_FAILURE);
+                }
+                args = grown;
+            }
+            if((args[(*argc)++] = strdup(arg)) == NULL) {
+                ERRPRINTF("strdup failed: %s\n", strerror(errno));
+                cleanup_exit(EXIT_FAILURE);
+            }
+        }
+    }
+    args[*argc] = NULL;
+    free(line);
+    fclose(file);
+    return args;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [-p PORT] [-i INDEX] [-k KEEPALIVE_SECONDS] [-t HEADER_SECONDS] [-b BODY_SECONDS] "
+        "[-c MAX_CONNECTIONS] [-r MAX_REQUESTS] [-u MAX_UPLOAD_BYTES] [-w WORKERS] "
+        "[-m STATS_PATH] [-l ACCESS_LOG [-B]] [-U] [-f ARGS_FILE] [-a] [-P UPSTREAM_URL [-C CACHE_DIR]] DOC_ROOT\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+static void handle_signal(int signal) {
+    if(signal == SIGHUP) {
+        __atomic_store_n(&reload, 1, __ATOMIC_RELAXED);
+    } else {
+        quit = 1;
+    }
 }
 
 static void open_socket(char *port) {
@@ -247,7 +1072,26 @@ static void open_socket(char *port) {
         cleanup_exit(EXIT_FAILURE);
     }
 
-    sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    char *inherited = getenv(LISTEN_FD_ENV);
+    if(inherited != NULL) {
+        int fd = strtol(inherited, NULL, 10);
+        unsetenv(LISTEN_FD_ENV);
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        if(getsockname(fd, (struct sockaddr *)&addr, &addr_len) == 0 && addr.sin_family == AF_INET
+                && addr.sin_port == ((struct sockaddr_in *)ai->ai_addr)->sin_port) {
+            // Keep the socket of the previous process along with its backlog
+            freeaddrinfo(ai);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            sockfd = fd;
+            return;
+        }
+        // The port was changed, the previous process closes the socket once it drained
+        close(fd);
+    }
+
+    // Workers accept until no client is pending
+    sockfd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
     if(sockfd < 0) {
         freeaddrinfo(ai);
         ERRPRINTF("socket failed: %s\n", strerror(errno));
@@ -270,203 +1114,1220 @@ static void open_socket(char *port) {
     }
 }
 
+static void start_reload(worker_t *worker) {
+    if(__atomic_load_n(&draining, __ATOMIC_RELAXED) || reload_fd >= 0) {
+        return;
+    }
+    int ready[2];
+    if(pipe2(ready, O_CLOEXEC) != 0) {
+        ERRPRINTF("pipe failed: %s\n", strerror(errno));
+        return;
+    }
+
+    // The child of a multithreaded process may only call async-signal-safe
+    // functions, so its environment is prepared in advance
+    extern char **environ;
+    size_t env_cnt = 0;
+    while(environ[env_cnt] != NULL) {
+        env_cnt++;
+    }
+    char **env = malloc((env_cnt + 3) * sizeof(char *));
+    char listen_var[32], ready_var[32];
+    if(env == NULL) {
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    snprintf(listen_var, sizeof(listen_var), LISTEN_FD_ENV "=%d", sockfd);
+    snprintf(ready_var, sizeof(ready_var), READY_FD_ENV "=%d", ready[1]);
+    size_t cnt = 0;
+    for(size_t i = 0; i < env_cnt; i++) {
+        if(strncmp(environ[i], LISTEN_FD_ENV "=", sizeof(LISTEN_FD_ENV)) != 0 
+                && strncmp(environ[i], READY_FD_ENV "=", sizeof(READY_FD_ENV)) != 0) {
+            env[cnt++] = environ[i];
+        }
+    }
+    env[cnt++] = listen_var;
+    env[cnt++] = ready_var;
+    env[cnt] = NULL;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0) {
+        // The listen socket and the ready pipe are inherited by the new server
+        fcntl(sockfd, F_SETFD, 0);
+        fcntl(ready[1], F_SETFD, 0);
+        execvpe(saved_argv[0], saved_argv, env);
+        _exit(127);
+    }
+    free(env);
+    close(ready[1]);
+    if(pid < 0) {
+        ERRPRINTF("fork failed: %s\n", strerror(errno));
+        close(ready[0]);
+        return;
+    }
+
+    // The connections of this process are served while the new server starts
+    fcntl(ready[0], F_SETFL, O_NONBLOCK);
+    reload_fd = ready[0];
+    reload_pid = pid;
+    wheel_arm(&worker->timers, &reload_timer, stats_now() + (uint64_t)RELOAD_TIMEOUT * 1000 * 1000);
+    // The event only ends the wait, the pipe is read by finish_batch
+    if(use_uring) {
+        struct io_uring_sqe *sqe = uring_sqe(&worker->ring);
+        if(sqe == NULL) {
+            ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = reload_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = OP_WAKE;
+        return;
+    }
+    struct epoll_event ev = {EPOLLIN, {.ptr = &wake_fd}};
+    if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, reload_fd, &ev) != 0) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+}
+
+static void check_reload(worker_t *worker, int timed_out) {
+    char c;
+    ssize_t ret = read(reload_fd, &c, 1);
+    if(ret < 0 && (errno == EAGAIN || errno == EINTR) && !timed_out) {
+        return;
+    }
+    // Closing the pipe also removes it from the epoll instance
+    wheel_cancel(&worker->timers, &reload_timer);
+    close(reload_fd);
+    reload_fd = -1;
+    if(ret != 1) {
+        ERRPUTS("reload failed, the new server did not start\n");
+        kill(reload_pid, SIGKILL);
+        waitpid(reload_pid, NULL, 0);
+        return;
+    }
+    printf("Reloaded, draining connections...\n");
+    fflush(stdout);
+
+    __atomic_store_n(&draining, 1, __ATOMIC_RELAXED);
+    uint64_t one = 1;
+    if(write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        ERRPRINTF("write on eventfd failed: %s\n", strerror(errno));
+    }
+}
+
+static void drain_worker(worker_t *worker) {
+    worker->drained = 1;
+    pause_accept(worker);
+    wheel_cancel(&worker->timers, &worker->pace_timer);
+    // Clients reconnect to the new server, requests in progress are finished first
+    conn_t *conn = worker->open_conns;
+    while(conn != NULL) {
+        conn_t *next = conn->next;
+        char c;
+        // A request which already arrived is answered, the connection is closed afterwards
+        if(conn->state == CONN_IDLE && recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+            close_conn(conn);
+        }
+        conn = next;
+    }
+}
+
 static void run_server(void) {
-    FILE *conn;
-    int connfd;
-    while(!quit) {
-        connfd = accept(sockfd, NULL, NULL);
+    // Signals are handled by the first worker, the others keep running their requests
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    if((wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        ERRPRINTF("eventfd failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    for(int i = 1; i < worker_cnt; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+        if(err != 0) {
+            ERRPRINTF("pthread_create failed: %s\n", strerror(err));
+            cleanup_exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    run_worker(&workers[0]);
+
+    // Wake up the other workers, each write is a new edge for them
+    uint64_t one = 1;
+    if(write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        ERRPRINTF("write on eventfd failed: %s\n", strerror(errno));
+    }
+    for(int i = 1; i < worker_cnt; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    if(access_log_path != NULL) {
+        access_log_close(&access_log);
+    }
+    printf(__atomic_load_n(&draining, __ATOMIC_RELAXED) ? "Connections drained, exiting.\n" : "Signal caught, exiting.\n");
+}
+
+static void *run_worker(void *arg) {
+    worker_t *worker = arg;
+    wheel_init(&worker->timers, stats_now(), TIMER_TICK);
+    if(use_uring) {
+        run_ring(worker);
+        return NULL;
+    }
+    if((worker->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        ERRPRINTF("epoll_create1 failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    // A new client only wakes up one of the workers, termination all of them
+    struct epoll_event listen_ev = {EPOLLIN | EPOLLEXCLUSIVE, {.ptr = NULL}};
+    struct epoll_event wake_ev = {EPOLLIN | EPOLLET, {.ptr = &wake_fd}};
+    struct epoll_event proxy_ev = {EPOLLIN, {.ptr = &worker->proxy_fd}};
+    if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, sockfd, &listen_ev) != 0 
+            || epoll_ctl(worker->epfd, EPOLL_CTL_ADD, wake_fd, &wake_ev) != 0
+            || (worker->proxy_fd >= 0 && epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->proxy_fd, &proxy_ev) != 0)) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    worker->accepting = 1;
+
+    struct epoll_event events[MAX_EVENTS];
+    while(!quit && !(worker->drained && worker->conn_cnt == 0)) {
+        // Scheduled responses are continued as soon as the new events were handled
+        int n = epoll_wait(worker->epfd, events, MAX_EVENTS,
+            worker->sched_cnt > 0 ? 0 : wheel_timeout(&worker->timers, stats_now()));
+        if(n < 0 && errno != EINTR) {
+            ERRPRINTF("epoll_wait failed: %s\n", strerror(errno));
+            cleanup_exit(EXIT_FAILURE);
+        }
+        for(int i = 0; i < n; i++) {
+            if(events[i].data.ptr == NULL) {
+                accept_conns(worker);
+            } else if(events[i].data.ptr == &worker->proxy_fd) {
+                resume_proxied(worker);
+            } else if(((uintptr_t)events[i].data.ptr & OP_MASK) == OP_PIPE) {
+                resume_pipe((conn_t *)((uintptr_t)events[i].data.ptr & ~(uintptr_t)OP_MASK));
+            } else if(events[i].data.ptr != &wake_fd) {
+                serve_conn(events[i].data.ptr);
+            }
+        }
+
+        finish_batch(worker);
+    }
+    return NULL;
+}
+
+void finish_batch(worker_t *worker) {
+    expire_timers(worker);
+    run_sends(worker);
+    if(worker->id == 0 && reload_fd >= 0) {
+        check_reload(worker, 0);
+    }
+    if(worker->id == 0 && __atomic_exchange_n(&reload, 0, __ATOMIC_RELAXED)) {
+        start_reload(worker);
+    }
+    if(__atomic_load_n(&draining, __ATOMIC_RELAXED) && !worker->drained) {
+        drain_worker(worker);
+    }
+}
+
+static void expire_timers(worker_t *worker) {
+    wheel_timer_t *expired = wheel_advance(&worker->timers, stats_now());
+    while(expired != NULL) {
+        wheel_timer_t *timer = expired;
+        expired = expired->next;
+        if(timer == &worker->pace_timer) {
+            shed_pending(worker);
+            continue;
+        }
+        if(timer == &reload_timer) {
+            check_reload(worker, 1);
+            continue;
+        }
+        conn_t *conn = (conn_t *)((char *)timer - offsetof(conn_t, timer));
+        worker->stats.timeouts++;
+        if(conn->state == CONN_SEND) {
+            // The response is logged as far as it was sent
+            finish_req(conn, 0);
+        } else {
+            close_conn(conn);
+        }
+    }
+}
+
+static void accept_conns(worker_t *worker) {
+    for(;;) {
+        if(conn_limit > 0 && worker->conn_cnt >= conn_limit) {
+            pause_accept(worker);
+            return;
+        }
+        int connfd = accept4(sockfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
         if(connfd < 0) {
-            if(errno == EINTR) {
-                continue;    
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // The client stays pending until a connection was closed
+                pause_accept(worker);
+                return;
             }
             ERRPRINTF("accept failed: %s\n", strerror(errno));
             cleanup_exit(EXIT_FAILURE);
         }
-        if((conn = fdopen(connfd, "w+")) == NULL) {
-            ERRPRINTF("fdopen connfd failed: %s\n", strerror(errno));
-            if(close(connfd) != 0) {
-                ERRPRINTF("close connfd failed: %s\n", strerror(errno));
-            }
-            continue;
+        worker->stats.connections++;
+        add_conn(worker, connfd);
+    }
+}
+
+void add_conn(worker_t *worker, int connfd) {
+    conn_t *conn = alloc_conn(worker);
+    if(conn == NULL) {
+        if(use_uring) {
+            // Connections closed recently may still wait for their reads to be cancelled
+            shed(worker, connfd);
+            close(connfd);
+            return;
         }
+        ERRPRINTF("malloc failed: %s\n", strerror(errno));
+        close(connfd);
+        cleanup_exit(EXIT_FAILURE);
+    }
+    conn->worker = worker;
+    conn->fd = connfd;
+    conn->len = 0;
+    conn->arena = NULL;
+    conn->upload = NULL;
+    conn->proxy = NULL;
+    conn->pipe = NULL;
+    conn->ring_op = 0;
+    conn->ring_done = 0;
+    conn->ring_buf = NULL;
+    conn->events = EPOLLIN;
+    conn->segs = NULL;
+    conn->seg_cnt = conn->seg_idx = 0;
+    conn->out_left = 0;
+    conn->out_file = NULL;
+    conn->out_entry = NULL;
+    conn->sched_idx = -1;
+    wheel_timer_init(&conn->timer);
+
+    if(keepalive_timeout > 0) {
+        // The head and the body are separate writes, don't let Nagle's algorithm
+        // delay the body until the client's delayed ACK on persistent connections
+        int optval = 1;
+        if(setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) != 0) {
+            ERRPRINTF("setsockopt TCP_NODELAY failed: %s\n", strerror(errno));
+        }
+    }
+
+    struct epoll_event ev = {conn->events, {.ptr = conn}};
+    if(!use_uring && epoll_ctl(worker->epfd, EPOLL_CTL_ADD, connfd, &ev) != 0) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+        close(connfd);
+        free_conn(conn);
+        return;
+    }
+    worker->conn_cnt++;
+    conn->prev = NULL;
+    conn->next = worker->open_conns;
+    if(conn->next != NULL) {
+        conn->next->prev = conn;
+    }
+    worker->open_conns = conn;
+    http_parser_init(&conn->parser, HTTP_PARSE_REQUEST);
+    conn->state = CONN_HEAD;
+    conn->start = conn->head = conn->handled = 0;
+    conn->status = 0;
+    conn->sent_bytes = 0;
+    conn->log_method_len = conn->log_path_len = 0;
+    set_timeout(conn, header_timeout);
+    if(use_uring && ring_read(conn) != 0) {
+        ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+        close_conn(conn);
+    }
+}
 
-        handle_request(conn);
+static conn_t *alloc_conn(worker_t *worker) {
+    if(!use_uring) {
+        return malloc(sizeof(conn_t));
+    }
+    conn_t *conn = worker->free_conns;
+    if(conn != NULL) {
+        worker->free_conns = conn->next;
+    }
+    return conn;
+}
 
-        if(fclose(conn) != 0) {
-            ERRPRINTF("fclose conn failed: %s\n", strerror(errno));
+void free_conn(conn_t *conn) {
+    if(!use_uring) {
+        free(conn);
+        return;
+    }
+    conn->next = conn->worker->free_conns;
+    conn->worker->free_conns = conn;
+}
+
+void pause_accept(worker_t *worker) {
+    if(worker->accepting && use_uring) {
+        ring_cancel(worker, OP_ACCEPT);
+        worker->accepting = 0;
+    } else if(worker->accepting) {
+        if(epoll_ctl(worker->epfd, EPOLL_CTL_DEL, sockfd, NULL) != 0) {
+            ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
         }
-        conn = NULL;
+        worker->accepting = 0;
     }
-    printf("Signal caught, exiting.\n");
+    wheel_arm(&worker->timers, &worker->pace_timer, stats_now() + SHED_INTERVAL);
 }
 
-static void handle_request(FILE *conn) {
-    http_frame_t res, *req;
-    memset(&res, 0, sizeof(res));
+static void resume_accept(worker_t *worker) {
+    wheel_cancel(&worker->timers, &worker->pace_timer);
+    if(use_uring) {
+        ring_accept(worker);
+        worker->accepting = 1;
+        return;
+    }
+    // Exclusive wakeups can't be modified, the socket is added again
+    struct epoll_event ev = {EPOLLIN | EPOLLEXCLUSIVE, {.ptr = NULL}};
+    if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, sockfd, &ev) != 0) {
+        ERRPRINTF("epoll_ctl failed: %s\n", strerror(errno));
+        cleanup_exit(EXIT_FAILURE);
+    }
+    worker->accepting = 1;
+}
 
-    http_header_t conn_header = {"Connection", "close", NULL};
-    res.header_first = &conn_header;
+static void shed_pending(worker_t *worker) {
+    if(worker->accepting || __atomic_load_n(&draining, __ATOMIC_RELAXED)) {
+        // A connection was closed in the same batch of expired timers
+        return;
+    }
+    if(conn_limit == 0 || worker->conn_cnt < conn_limit) {
+        // Only the file limit was reached, retry accepting
+        resume_accept(worker);
+        return;
+    }
+    for(int i = 0; i < SHED_BATCH; i++) {
+        int connfd = accept4(sockfd, NULL, NULL, SOCK_CLOEXEC);
+        if(connfd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        worker->stats.connections++;
+        shed(worker, connfd);
+        close(connfd);
+    }
+    wheel_arm(&worker->timers, &worker->pace_timer, stats_now() + SHED_INTERVAL);
+}
 
-    int ret = http_recv_req(conn, &req);
-    if(ret != HTTP_SUCCESS) {
-        switch(ret) {
-        case HTTP_ERR_INTERNAL:
-            ERRPRINTF("error while receiving request: %s\n", strerror(errno));
-            if(fclose(conn) != 0) {
-                ERRPRINTF("fclose conn failed: %s\n", strerror(errno));
+void shed(worker_t *worker, int fd) {
+    worker->stats.shed++;
+    if(send(fd, shed_res.ptr, shed_res.len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        return;
+    }
+    shutdown(fd, SHUT_WR);
+    char discard[4096];
+    while(recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+    }
+}
+
+void serve_conn(conn_t *conn) {
+    worker_t *worker = conn->worker;
+    int keep_alive;
+    if(conn->state == CONN_SEND) {
+        if(conn->pipe != NULL && conn->pipe->waiting) {
+            // Only errors and hangups of the socket are reported while the pipe is awaited
+            finish_req(conn, 0);
+            return;
+        }
+        if(conn->sched_idx < 0) {
+            // The socket became writable, the scheduler continues the response
+            conn->out_wait = 0;
+            wait_out(conn);
+        }
+        return;
+    }
+    if(conn->state == CONN_PROXY) {
+        // Only errors and hangups are reported while the response is fetched
+        close_conn(conn);
+        return;
+    }
+    if(conn->state == CONN_BODY) {
+        int ret = recv_body(conn);
+        if(ret == 1) {
+            // The body timeout restarts whenever a part of the body arrived
+            set_timeout(conn, body_timeout);
+            if(use_uring && ring_poll(conn, POLLIN) != 0) {
+                ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+                close_conn(conn);
             }
-            http_free_frame(req);
-            cleanup_exit(EXIT_FAILURE);
-        case HTTP_ERR_STREAM:
-            ERRPRINTF("error while receiving request: %s\n", strerror(ferror(http_errvar)));
-            http_free_frame(req);
             return;
-        case HTTP_ERR_PROTOCOL:
-            ERRPUTS("malformed request received\n");
-            SEND_ERR_RES(400, "Bad Request");
+        }
+        keep_alive = finish_upload(conn, ret);
+        // With io_uring, receiving the next request only submits a read
+        if(send_out(conn, keep_alive) == 0 || finish_req(conn, keep_alive) == 0 
+                || (conn->len == 0 && !use_uring)) {
             return;
-        default:
-            ERRPRINTF("error while receiving request: unknown error: %u\n", ret);
-            if(fclose(conn) != 0) {
-                ERRPRINTF("fclose conn failed: %s\n", strerror(errno));
+        }
+    }
+
+    for(;;) {
+        int ret = recv_req(conn);
+        if(ret == HTTP_PARSE_AGAIN) {
+            if(conn->state == CONN_IDLE && conn->len > 0) {
+                // The header timeout starts with the first byte of the request
+                conn->state = CONN_HEAD;
+                set_timeout(conn, header_timeout);
             }
-            http_free_frame(req);
+            return;
+        }
+        if(ret < 0) {
+            close_conn(conn);
+            return;
+        }
+
+        if(inflight_limit > 0 && worker->inflight >= inflight_limit) {
+            shed(worker, conn->fd);
+            close_conn(conn);
+            return;
+        }
+        wheel_cancel(&worker->timers, &conn->timer);
+        if((conn->arena = arena_get(&worker->arenas)) == NULL) {
+            ERRPRINTF("arena_get failed: %s\n", strerror(errno));
             cleanup_exit(EXIT_FAILURE);
         }
+        worker->inflight++;
+        keep_alive = handle_request(conn, ret);
+        if(conn->state == CONN_PROXY) {
+            return;
+        }
+        if(conn->state == CONN_BODY) {
+            set_timeout(conn, body_timeout);
+            if(use_uring && ring_poll(conn, POLLIN) != 0) {
+                ERRPRINTF("io_uring_enter failed: %s\n", strerror(errno));
+                close_conn(conn);
+            }
+            return;
+        }
+        // Pipelined requests which were received already are handled right away
+        if(send_out(conn, keep_alive) == 0 || finish_req(conn, keep_alive) == 0
+                || (conn->len == 0 && !use_uring)) {
+            return;
+        }
+    }
+}
+
+int watch_conn(conn_t *conn, uint32_t events) {
+    if(use_uring || conn->events == events) {
+        return 0;
+    }
+    struct epoll_event ev = {events, {.ptr = conn}};
+    if(epoll_ctl(conn->worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) {
+        return -1;
+    }
+    conn->events = events;
+    return 0;
+}
+
+int finish_req(conn_t *conn, int keep_alive) {
+    worker_t *worker = conn->worker;
+    worker->stats.sent_bytes += conn->sent_bytes;
+    if(conn->status != 0) {
+        uint64_t end = stats_now();
+        // Requests rejected before their head was complete have no handle phase
+        uint64_t head = conn->head != 0 ? conn->head : conn->handled;
+        uint64_t start = conn->start != 0 ? conn->start : head;
+        stats_record(&worker->stats, conn->status, start, head, conn->handled, end);
+        STATS_PROBE4(send_done, conn->fd, conn->status, conn->sent_bytes, end);
+        if(access_log_path != NULL) {
+            access_log_write(&access_log, worker->id, conn->log_req, conn->log_method_len,
+                conn->log_req + conn->log_method_len, conn->log_path_len, conn->status, conn->sent_bytes,
+                end - start);
+        }
     }
+    reset_out(conn);
+    arena_reset(conn->arena);
+    arena_put(&worker->arenas, conn->arena);
+    conn->arena = NULL;
+    worker->inflight--;
 
-    printf("> %s %s\n", req->method, req->file_path);
+    if(keep_alive != 1 || quit || __atomic_load_n(&draining, __ATOMIC_RELAXED)) {
+        close_conn(conn);
+        return 0;
+    }
+    http_parser_init(&conn->parser, HTTP_PARSE_REQUEST);
+    conn->state = conn->len > 0 ? CONN_HEAD : CONN_IDLE;
+    conn->start = conn->head = conn->handled = 0;
+    conn->status = 0;
+    conn->sent_bytes = 0;
+    conn->log_method_len = conn->log_path_len = 0;
+    set_timeout(conn, conn->state == CONN_IDLE ? keepalive_timeout : header_timeout);
+    return 1;
+}
 
-    if(strcasecmp(req->method, "GET") != 0) {
-        SEND_ERR_RES(501, "Not Implemented");
+void set_timeout(conn_t *conn, int seconds) {
+    if(seconds == 0) {
+        wheel_cancel(&conn->worker->timers, &conn->timer);
         return;
     }
+    wheel_arm(&conn->worker->timers, &conn->timer, stats_now() + seconds * (uint64_t)1000000000);
+}
+
+void close_conn(conn_t *conn) {
+    worker_t *worker = conn->worker;
+    wheel_cancel(&worker->timers, &conn->timer);
+    if(conn->upload != NULL) {
+        finish_upload(conn, -1);
+    }
+    if(conn->sched_idx >= 0) {
+        sched_remove(worker, conn);
+    }
+    if(conn->state == CONN_PROXY) {
+        proxy_cancel(&proxy, conn->proxy->entry, &conn->proxy->waiter);
+        stop_waiting(conn);
+    }
+    reset_out(conn);
+    if(conn->arena != NULL) {
+        arena_reset(conn->arena);
+        arena_put(&worker->arenas, conn->arena);
+        worker->inflight--;
+    }
+    if(conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        worker->open_conns = conn->next;
+    }
+    if(conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    // Closing the socket removes it from the epoll instance. A linked send only looks
+    // up its socket once the read completed, so the number must not be reused before;
+    // the socket is shut down and closed once the send completed.
+    if(conn->ring_buf != NULL) {
+        shutdown(conn->fd, SHUT_RDWR);
+        conn->ring_res = conn->fd;
+    } else if(close(conn->fd) != 0) {
+        ERRPRINTF("close conn failed: %s\n", strerror(errno));
+    }
+    if(conn->ring_op != 0) {
+        // The kernel may still write to the buffer, the connection is freed on completion
+        ring_cancel(worker, conn->ring_op);
+        conn->fd = -1;
+    } else {
+        free_conn(conn);
+    }
+    worker->conn_cnt--;
+    if(!worker->accepting && !__atomic_load_n(&draining, __ATOMIC_RELAXED) && (conn_limit == 0 || worker->conn_cnt < conn_limit)) {
+        resume_accept(worker);
+    }
+}
+
+static int recv_req(conn_t *conn) {
+    // Bytes of a pipelined request may already be buffered
+    int ret = HTTP_PARSE_AGAIN;
+    if(conn->len > 0) {
+        if(conn->start == 0) {
+            conn->start = stats_now();
+            STATS_PROBE2(parse_start, conn->fd, conn->start);
+        }
+        ret = http_parse(&conn->parser, conn->buf, conn->len);
+    }
+    while(ret == HTTP_PARSE_AGAIN) {
+        if(conn->len == sizeof(conn->buf)) {
+            return HTTP_PARSE_TOO_LARGE;
+        }
+        ssize_t n = use_uring ? ring_recv(conn)
+            : recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, MSG_DONTWAIT);
+        if(n < 0) {
+            if(errno == EINTR && !quit) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return HTTP_PARSE_AGAIN;
+            }
+            if(errno == ECONNRESET && conn->len == 0) {
+                // Clients may abort persistent connections between requests
+                return -1;
+            }
+            ERRPRINTF("error while receiving request: %s\n", strerror(errno));
+            return -1;
+        }
+        if(n == 0) {
+            if(conn->len > 0) {
+                ERRPUTS("connection closed before request was complete\n");
+            }
+            return -1;
+        }
+        if(conn->len == 0) {
+            conn->start = stats_now();
+            STATS_PROBE2(parse_start, conn->fd, conn->start);
+        }
+        conn->len += n;
+        ret = http_parse(&conn->parser, conn->buf, conn->len);
+    }
+    if(ret == HTTP_PARSE_DONE) {
+        conn->head = stats_now();
+        conn->worker->stats.requests++;
+    }
+    return ret;
+}
+
+static int handle_request(conn_t *conn, int parse_res) {
+    int keep_alive = 0;
+
+    // The head stays in the buffer until the request is handled
+    size_t head_len = conn->parser.head_len;
+    switch(parse_res) {
+    case HTTP_PARSE_DONE:
+        break;
+    case HTTP_PARSE_ERROR:
+        ERRPUTS("malformed request received\n");
+        SEND_ERR_RES(RES_BAD_REQUEST);
+        return 0;
+    case HTTP_PARSE_TOO_LARGE:
+        ERRPUTS("request head too large\n");
+        SEND_ERR_RES(RES_HEADERS_TOO_LARGE);
+        return 0;
+    default:
+        return 0;
+    }
+    http_parser_t *req = &conn->parser;
+
+    if(!http_slice_eq(req->version, HTTP_VERSION)) {
+        ERRPUTS("malformed request received\n");
+        SEND_ERR_RES(RES_BAD_REQUEST);
+        return 0;
+    }
+
+    // Request bodies are only read by the upload handler, otherwise the connection 
+    // cannot be reused if one is present
+    http_slice_t conn_hdr = req->headers.known[HTTP_HDR_CONNECTION];
+    http_slice_t content_len = req->headers.known[HTTP_HDR_CONTENT_LENGTH];
+    int upload = upload_limit > 0 && http_slice_eq(req->method, "PUT");
+    if(keepalive_timeout > 0 && !__atomic_load_n(&draining, __ATOMIC_RELAXED) && !(conn_hdr.ptr != NULL && http_slice_eq(conn_hdr, "close"))
+            && (upload || ((content_len.ptr == NULL || http_slice_eq(content_len, "0"))
+            && req->headers.known[HTTP_HDR_TRANSFER_ENCODING].ptr == NULL))) {
+        keep_alive = 1;
+    }
+
+    if(access_log_path != NULL) {
+        conn->log_method_len = req->method.len < ACCESS_LOG_MAX_METHOD ? req->method.len : ACCESS_LOG_MAX_METHOD;
+        conn->log_path_len = req->path.len < ACCESS_LOG_MAX_PATH ? req->path.len : ACCESS_LOG_MAX_PATH;
+        memcpy(conn->log_req, req->method.ptr, conn->log_method_len);
+        memcpy(conn->log_req + conn->log_method_len, req->path.ptr, conn->log_path_len);
+    }
+
+    if(upload) {
+        return handle_upload(conn, head_len, keep_alive);
+    }
+
+    int head_only = http_slice_eq(req->method, "HEAD");
+    if(!head_only && !http_slice_eq(req->method, "GET")) {
+        SEND_ERR_RES(RES_NOT_IMPLEMENTED);
+        return consume_req(conn, head_len, keep_alive);
+    }
+
+    if(stats_path != NULL && http_slice_eq(req->path, stats_path)) {
+        if(send_stats(conn, 0, head_only, keep_alive) != 0) {
+            keep_alive = 0;
+        }
+        return consume_req(conn, head_len, keep_alive);
+    }
+    size_t stats_path_len = stats_path != NULL ? strlen(stats_path) : 0;
+    if(stats_path != NULL && req->path.len == stats_path_len + strlen(STATS_JSON_QUERY)
+            && memcmp(req->path.ptr, stats_path, stats_path_len) == 0
+            && memcmp(req->path.ptr + stats_path_len, STATS_JSON_QUERY, strlen(STATS_JSON_QUERY)) == 0) {
+        if(send_stats(conn, 1, head_only, keep_alive) != 0) {
+            keep_alive = 0;
+        }
+        return consume_req(conn, head_len, keep_alive);
+    }
+
+    char *file_path = get_file_path(conn->arena, req->path);
+    if(file_path == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return 0;
+    }
+    if(use_archive) {
+        const archive_entry_t *entry = archive_find(&archive, file_path, strlen(file_path));
+        if(entry == NULL && upstream != NULL) {
+            return handle_proxy(conn, head_len, head_only, keep_alive);
+        }
+        if(send_packed(conn, entry, head_only, keep_alive) != 0) {
+            keep_alive = 0;
+        }
+        return consume_req(conn, head_len, keep_alive);
+    }
 
-    FILE *body = NULL;
-    char *file_path = get_file_path(req->file_path);
-    // Add one character for null byte
-    if((body = fopen(file_path, "r")) == NULL) {
+    lookup_entry_t *file = lookup_get(&conn->worker->lookup, file_path, conn->head);
+    if(file == NULL) {
+        if(errno == ENOENT && upstream != NULL) {
+            return handle_proxy(conn, head_len, head_only, keep_alive);
+        }
         if(errno == ENOENT) {
-            free(file_path);
+            SEND_ERR_RES(RES_NOT_FOUND);
+            return consume_req(conn, head_len, keep_alive);
+        }
 
-            SEND_ERR_RES(404, "Not Found");
-            return;
+        ERRPRINTF("open on %s failed: %s\n", file_path, strerror(errno));
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return consume_req(conn, head_len, keep_alive);
+    }
+
+    const char *mime = http_mime_type(file_path);
+    if(S_ISFIFO(file->st.st_mode)) {
+        // Pipes have neither a length nor validators
+        if(send_pipe(conn, file->fd, mime, head_only, keep_alive) != 0) {
+            keep_alive = 0;
         }
+        conn->out_file = file;
+        return consume_req(conn, head_len, keep_alive);
+    }
 
-        ERRPRINTF("fopen on %s failed: %s\n", file_path, strerror(errno));
-        free(file_path);
-        SEND_ERR_RES(500, "Internal Server Error");
-        return;
-    } 
+    // The validators refer to the file even if a sibling is sent
+    struct stat st = file->st;
+    variant_t var = {HTTP_ENC_IDENTITY, file_path, st, file, NULL};
+    http_slice_t accept_encoding = req->headers.known[HTTP_HDR_ACCEPT_ENCODING];
+    if(accept_encoding.ptr != NULL) {
+        select_variant(conn, mime, http_accept_encoding(accept_encoding), &var);
+    }
 
-    if(fseek(body, 0L, SEEK_END) != 0) {
-        ERRPRINTF("fseek on %s failed: %s\n", file_path, strerror(errno));
-        if(fclose(body) != 0) {
-            ERRPRINTF("fclose on %s failed: %s\n", file_path, strerror(errno));
+    // The variant is released once the response was sent
+    conn->out_file = var.file;
+    conn->out_entry = var.entry;
+    char etag[HTTP_ETAG_MAX + 1];
+    entity_t ent = {mime, {etag, http_format_etag(etag, &st)}, st.st_mtime, var.encoding, NULL, var.file->fd, 0,
+        var.st.st_size};
+    if(var.entry != NULL) {
+        ent.data = var.entry->data;
+        ent.len = var.entry->len;
+    }
+    if(send_entity(conn, &ent, head_only, keep_alive) != 0) {
+        keep_alive = 0;
+    }
+    return consume_req(conn, head_len, keep_alive);
+}
+
+static int send_packed(conn_t *conn, const archive_entry_t *entry, int head_only, int keep_alive) {
+    static const int preference[] = {ARCHIVE_BR, ARCHIVE_ZSTD, ARCHIVE_GZIP};
+    static const int encodings[ARCHIVE_VARIANTS] = {HTTP_ENC_IDENTITY, HTTP_ENC_GZIP, HTTP_ENC_BR, HTTP_ENC_ZSTD};
+
+    if(entry == NULL) {
+        return send_res(conn, RES_NOT_FOUND, keep_alive, NULL, 0);
+    }
+    int variant = ARCHIVE_IDENTITY;
+    http_slice_t accept_encoding = conn->parser.headers.known[HTTP_HDR_ACCEPT_ENCODING];
+    if(accept_encoding.ptr != NULL) {
+        int accepted = http_accept_encoding(accept_encoding);
+        for(size_t i = 0; i < sizeof(preference) / sizeof(preference[0]) && variant == ARCHIVE_IDENTITY; i++) {
+            if((accepted & encodings[preference[i]]) && (entry->variant_mask & (1 << preference[i]))) {
+                variant = preference[i];
+            }
+        }
+    }
+
+    // The strings of the archive are not terminated
+    char mime[ARCHIVE_FIELD_MAX + 1];
+    memcpy(mime, archive.data + entry->mime.offset, entry->mime.len);
+    mime[entry->mime.len] = '\0';
+    entity_t ent = {mime, {archive.data + entry->etag.offset, entry->etag.len}, entry->mtime, encodings[variant],
+        NULL, archive.fd, entry->variants[variant].offset, entry->variants[variant].len};
+    return send_entity(conn, &ent, head_only, keep_alive);
+}
+
+static int send_entity(conn_t *conn, const entity_t *ent, int head_only, int keep_alive) {
+    http_parser_t *req = &conn->parser;
+
+    // Validators: ETag and Last-Modified header lines
+    char validators[48 + HTTP_ETAG_MAX + HTTP_DATE_LEN];
+    char etag[HTTP_ETAG_MAX + 16], last_modified[HTTP_DATE_LEN + 1];
+    http_slice_t etag_slice = {etag, ent->etag.len};
+    memcpy(etag, ent->etag.ptr, ent->etag.len);
+    if(ent->encoding != HTTP_ENC_IDENTITY) {
+        // Each coding is a representation of its own, replace the closing quote
+        etag_slice.len += snprintf(etag + etag_slice.len - 1, 16, "-%s\"", http_encoding_name(ent->encoding)) - 1;
+    }
+    size_t validators_len = append_header(validators, 0, "ETag: ", etag, etag_slice.len);
+    if(http_format_date(last_modified, ent->mtime) != 0) {
+        validators_len = append_header(validators, validators_len, "Last-Modified: ", last_modified, HTTP_DATE_LEN);
+    }
+
+    if(not_modified(req, etag_slice, ent->mtime)) {
+        struct iovec extra[] = {{validators, validators_len}};
+        return send_res(conn, RES_NOT_MODIFIED, keep_alive, extra, 1);
+    }
+
+    char encoding_line[32];
+    struct iovec extra[] = {{validators, validators_len}, {encoding_line, 0}};
+    if(ent->encoding != HTTP_ENC_IDENTITY) {
+        const char *name = http_encoding_name(ent->encoding);
+        extra[1].iov_len = append_header(encoding_line, 0, "Content-Encoding: ", name, strlen(name));
+    }
+
+    if(ent->data != NULL) {
+        // Ranges of variants compressed on the fly are not supported, send the whole variant
+        struct iovec hdrs[] = {extra[0], extra[1], {NULL, 0}};
+        if(format_type(conn, ent->mime, &hdrs[2]) != 0) {
+            return -1;
+        }
+        return send_data(conn, head_only ? NULL : ent->data, ent->len, hdrs, 3, keep_alive);
+    }
+
+    http_range_t ranges[HTTP_MAX_RANGES];
+    int range_cnt = -1;
+    http_slice_t range = req->headers.known[HTTP_HDR_RANGE];
+    if(range.ptr != NULL && if_range(req, etag_slice, ent->mtime)) {
+        range_cnt = http_parse_range(range, ent->len, ranges);
+    }
+    if(range_cnt == 0) {
+        char content_range[96];
+        struct iovec extra[] = {{content_range, format_content_range(content_range, NULL, ent->len)}};
+        return send_res(conn, RES_RANGE_NOT_SATISFIABLE, keep_alive, extra, 1);
+    }
+    return send_file(conn, head_only ? -1 : ent->fd, ent->offset, ent->len, ent->mime, ranges, range_cnt, extra, 2,
+        keep_alive);
+}
+
+static void select_variant(conn_t *conn, const char *mime, int accepted, variant_t *var) {
+    static const int preference[] = {HTTP_ENC_BR, HTTP_ENC_ZSTD, HTTP_ENC_GZIP};
+
+    size_t path_len = strlen(var->path);
+    for(size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        if((accepted & preference[i]) == 0) {
+            continue;
+        }
+        const char *ext = http_encoding_ext(preference[i]);
+        char *path = arena_alloc(conn->arena, path_len + strlen(ext) + 1);
+        if(path == NULL) {
+            return;
         }
-        free(file_path);
-        SEND_ERR_RES(500, "Internal Server Error");
+        memcpy(path, var->path, path_len);
+        strcpy(path + path_len, ext);
+
+        // Precompressed files older than the file are stale
+        lookup_entry_t *sibling = lookup_get(&conn->worker->lookup, path, conn->head);
+        if(sibling != NULL && S_ISREG(sibling->st.st_mode) && (sibling->st.st_mtim.tv_sec > var->st.st_mtim.tv_sec
+                || (sibling->st.st_mtim.tv_sec == var->st.st_mtim.tv_sec
+                    && sibling->st.st_mtim.tv_nsec >= var->st.st_mtim.tv_nsec))) {
+            lookup_release(&conn->worker->lookup, var->file);
+            var->encoding = preference[i];
+            var->path = path;
+            var->st = sibling->st;
+            var->file = sibling;
+            return;
+        }
+        lookup_release(&conn->worker->lookup, sibling);
+    }
+
+    if((accepted & HTTP_ENC_GZIP) == 0 || !http_mime_compressible(mime) 
+            || var->st.st_size < COMPRESS_MIN_SIZE || var->st.st_size > COMPRESS_MAX_SIZE) {
         return;
     }
-    int file_len = ftell(body);
-    // With a 64 bit integer, 21 characters are needed at most
-    char file_len_str[21];
-    snprintf(file_len_str, sizeof(file_len_str), "%u", file_len);
-    if(file_len < 0) {
-        ERRPRINTF("ftell on %s failed: %s\n", file_path, strerror(errno));
-        if(fclose(body) != 0) {
-            ERRPRINTF("fclose on %s failed: %s\n", file_path, strerror(errno));
-        }
-        free(file_path);
-        SEND_ERR_RES(500, "Internal Server Error");
+    compress_entry_t *entry = compress_cache_get(&conn->worker->compress, var->path, var->file->fd, &var->st,
+        HTTP_ENC_GZIP);
+    if(entry == NULL) {
+        ERRPRINTF("compressing %s failed: %s\n", var->path, strerror(errno));
         return;
     }
-    if(fseek(body, 0, SEEK_SET) != 0) {
-        ERRPRINTF("rewind on %s failed: %s\n", file_path, strerror(errno));
-        if(fclose(body) != 0) {
-            ERRPRINTF("fclose on %s failed: %s\n", file_path, strerror(errno));
-        }
-        free(file_path);
-        SEND_ERR_RES(500, "Internal Server Error");
+    if(entry->data == NULL) {
+        // Compression does not reduce the size of this file
+        compress_cache_release(&conn->worker->compress, entry);
         return;
     }
+    var->encoding = HTTP_ENC_GZIP;
+    var->entry = entry;
+}
+
+static int send_pipe(conn_t *conn, int fd, const char *mime, int head_only, int keep_alive) {
+    struct iovec extra[1];
+    if(format_type(conn, mime, &extra[0]) != 0) {
+        return -1;
+    }
+    int ret = send_res(conn, RES_OK_CHUNKED, keep_alive, extra, 1);
+    if(ret != 0 || head_only) {
+        return ret;
+    }
 
-    time_t t = time(NULL);
-    struct tm *tm = gmtime(&t);
-    // We assume that 100 characters will be sufficient for the date
-    char timestr[100];
-    if(tm == NULL) {
-        ERRPUTS("gmtime failed\n");
-        free(file_path);
-        if(fclose(conn) != 0) {
-            ERRPRINTF("fclose conn failed: %s\n", strerror(errno));
+    // The chunks are read once the head was sent
+    if((conn->pipe = arena_alloc(conn->arena, sizeof(pipe_out_t))) == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    conn->pipe->fd = fd;
+    conn->pipe->waiting = conn->pipe->watched = conn->pipe->eof = 0;
+    return 0;
+}
+
+int send_data(conn_t *conn, const void *data, size_t len, const struct iovec *hdrs, int hdr_cnt,
+        int keep_alive) {
+    char len_line[40];
+    char num[21];
+    struct iovec extra[MAX_EXTRA_IOV];
+    for(int i = 0; i < hdr_cnt; i++) {
+        extra[i] = hdrs[i];
+    }
+    extra[hdr_cnt].iov_base = len_line;
+    extra[hdr_cnt].iov_len = append_header(len_line, 0, "Content-Length: ", num, http_format_u64(num, len));
+    if(send_res(conn, RES_OK, keep_alive, extra, hdr_cnt + 1) != 0) {
+        return -1;
+    }
+    return data != NULL ? queue_mem(conn, data, len) : 0;
+}
+
+int send_file(conn_t *conn, int fd, int64_t offset, int64_t size, const char *mime,
+        const http_range_t *ranges, int range_cnt, const struct iovec *hdrs, int hdr_cnt, int keep_alive) {
+    // "Content-Length: " + 20 digits + "\r\n"
+    char len_line[40];
+    char content_range[96];
+    // "Content-Type: multipart/byteranges; boundary=" + boundary + "\r\n"
+    char type_line[80];
+    struct iovec extra[MAX_EXTRA_IOV];
+    int extra_cnt = 0;
+    for(int i = 0; i < hdr_cnt; i++) {
+        extra[extra_cnt++] = hdrs[i];
+    }
+
+    if(range_cnt <= 1) {
+        int64_t first = range_cnt < 0 ? 0 : ranges[0].first;
+        int64_t len = range_cnt < 0 ? size : ranges[0].last - ranges[0].first + 1;
+        char num[21];
+        extra[extra_cnt].iov_base = len_line;
+        extra[extra_cnt++].iov_len = append_header(len_line, 0, "Content-Length: ", num, http_format_u64(num, len));
+        if(format_type(conn, mime, &extra[extra_cnt++]) != 0) {
+            return -1;
         }
-        cleanup_exit(EXIT_FAILURE);
+        if(range_cnt == 1) {
+            extra[extra_cnt].iov_base = content_range;
+            extra[extra_cnt++].iov_len = format_content_range(content_range, &ranges[0], size);
+        }
+        int ret = 1;
+        if(use_uring && fd >= 0 && len > 0) {
+            ret = ring_send_file(conn, range_cnt < 0 ? RES_OK : RES_PARTIAL_CONTENT, keep_alive, extra, extra_cnt,
+                fd, offset + first, len);
+        }
+        if(ret != 1) {
+            return ret;
+        }
+        if(send_res(conn, range_cnt < 0 ? RES_OK : RES_PARTIAL_CONTENT, keep_alive, extra, extra_cnt) != 0) {
+            return -1;
+        }
+        return fd >= 0 ? queue_file(conn, fd, offset + first, len) : 0;
     }
-    if(strftime(timestr, sizeof(timestr), "%a, %d %b %y %T %Z", tm) == 0) {
-        ERRPUTS("strftime failed\n");
-        free(file_path);
-        if(fclose(conn) != 0) {
-            ERRPRINTF("fclose conn failed: %s\n", strerror(errno));
+
+    // Multipart body: the boundary is derived from the validators of the file
+    uint64_t hash = 14695981039346656037ULL;
+    for(int i = 0; i < hdr_cnt; i++) {
+        for(size_t j = 0; j < hdrs[i].iov_len; j++) {
+            hash = (hash ^ ((unsigned char *)hdrs[i].iov_base)[j]) * 1099511628211ULL;
         }
-        cleanup_exit(EXIT_FAILURE);
     }
-    http_header_t c_len_header = {"Content-Length", file_len_str, &conn_header};
-    http_header_t date_header = {"Date", timestr, &c_len_header};
-    res.status = 200;
-    res.status_text = "OK";
-    res.header_first = &date_header;
-    res.body = body;
-    res.body_len = -1;
-    send_res(&res, conn);
-    if(fclose(body) != 0) {
-        ERRPRINTF("fclose on %s failed: %s\n", file_path, strerror(errno));
-    }
-    http_free_frame(req);
-    free(file_path);
-}
-
-static void send_res(http_frame_t *res, FILE *conn) {
-    printf("< %lu %s\n", res->status, res->status_text);
-    int ret = http_send_res(conn, res);
-    if(ret != HTTP_SUCCESS) {
-        switch(ret) {
-        case HTTP_ERR_STREAM:
-            ERRPRINTF("error while sending response: %s\n", strerror(ferror(http_errvar)));
-            break;
-        default:
-            ERRPRINTF("error while sending response: unknown error: %u\n", ret);
-            if(fclose(conn) != 0) {
-                ERRPRINTF("fclose conn failed: %s\n", strerror(errno));
-            }
-            cleanup_exit(EXIT_FAILURE);
+    char boundary[32];
+    int boundary_len = snprintf(boundary, sizeof(boundary), "osue-%016llx", (unsigned long long)hash);
+
+    // Part heads "\r\n--<boundary>\r\n<Content-Type line><Content-Range line>\r\n" and the closing delimiter
+    // The media type may come from the upstream, the part heads are sized for it
+    size_t mime_len = strlen(mime);
+    size_t part_cap = 4 + boundary_len + 2 + strlen("Content-Type: ") + mime_len + 2 + 96 + 2;
+    char *parts[HTTP_MAX_RANGES];
+    size_t part_lens[HTTP_MAX_RANGES];
+    int64_t total = 0;
+    for(int i = 0; i < range_cnt; i++) {
+        if((parts[i] = arena_alloc(conn->arena, part_cap)) == NULL) {
+            ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+            return -1;
+        }
+        size_t len = snprintf(parts[i], part_cap, "\r\n--%s\r\n", boundary);
+        len = append_header(parts[i], len, "Content-Type: ", mime, mime_len);
+        len += format_content_range(parts[i] + len, &ranges[i], size);
+        memcpy(parts[i] + len, "\r\n", 2);
+        part_lens[i] = len + 2;
+        total += part_lens[i] + (ranges[i].last - ranges[i].first + 1);
+    }
+    char *closing = arena_alloc(conn->arena, 48);
+    if(closing == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    size_t closing_len = snprintf(closing, 48, "\r\n--%s--\r\n", boundary);
+    total += closing_len;
+
+    char num[21];
+    size_t type_len = snprintf(type_line, sizeof(type_line), "Content-Type: multipart/byteranges; boundary=%.*s\r\n",
+        boundary_len, boundary);
+    extra[extra_cnt].iov_base = type_line;
+    extra[extra_cnt++].iov_len = type_len;
+    extra[extra_cnt].iov_base = len_line;
+    extra[extra_cnt++].iov_len = append_header(len_line, 0, "Content-Length: ", num, http_format_u64(num, total));
+    if(send_res(conn, RES_PARTIAL_CONTENT, keep_alive, extra, extra_cnt) != 0) {
+        return -1;
+    }
+    if(fd < 0) {
+        return 0;
+    }
+    for(int i = 0; i < range_cnt; i++) {
+        if(queue_mem(conn, parts[i], part_lens[i]) != 0
+                || queue_file(conn, fd, offset + ranges[i].first, ranges[i].last - ranges[i].first + 1) != 0) {
+            return -1;
         }
     }
+    return queue_mem(conn, closing, closing_len);
 }
 
-static char *get_file_path(char *req_path) {
-    int docroot_trailing_slash = docroot[strlen(docroot)-1] == '/';
-            
-    int path_len = strlen(req_path) + strlen(docroot) + 1;
-    int add_index = req_path[strlen(req_path)-1] == '/';
-    if(add_index == 1) {
-        path_len += strlen(index_file);
+static size_t format_content_range(char *buf, const http_range_t *range, int64_t size) {
+    if(range == NULL) {
+        return snprintf(buf, 96, "Content-Range: bytes */%lld\r\n", (long long)size);
     }
-    if(docroot_trailing_slash == 1) {
-        path_len++;
+    return snprintf(buf, 96, "Content-Range: bytes %lld-%lld/%lld\r\n", (long long)range->first,
+        (long long)range->last, (long long)size);
+}
+
+static int if_range(http_parser_t *req, http_slice_t etag, time_t mtime) {
+    http_slice_t value = http_header_find(&req->headers, "If-Range");
+    if(value.ptr == NULL) {
+        return 1;
     }
+    if(value.len > 0 && value.ptr[0] == '"') {
+        // Strong comparison, weak entity tags never match
+        return value.len == etag.len && memcmp(value.ptr, etag.ptr, etag.len) == 0;
+    }
+    time_t date;
+    return http_parse_date(value, &date) == 0 && date == mtime;
+}
 
-    char *file_path = malloc(path_len);
-    if(file_path == NULL) {
-        ERRPRINTF("malloc failed: %s\n", strerror(errno));
-        cleanup_exit(EXIT_FAILURE);
+static int not_modified(http_parser_t *req, http_slice_t etag, time_t mtime) {
+    http_slice_t if_none_match = req->headers.known[HTTP_HDR_IF_NONE_MATCH];
+    if(if_none_match.ptr != NULL) {
+        return http_etag_match(if_none_match, etag);
     }
 
-    if(docroot_trailing_slash == 1) {
-        snprintf(file_path, path_len, "%s/%s", docroot, req_path);
-    } else {
-        snprintf(file_path, path_len, "%s%s", docroot, req_path);
+    http_slice_t if_modified_since = req->headers.known[HTTP_HDR_IF_MODIFIED_SINCE];
+    time_t since;
+    if(if_modified_since.ptr != NULL && http_parse_date(if_modified_since, &since) == 0
+            && since <= time(NULL)) {
+        return mtime <= since;
+    }
+    return 0;
+}
+
+int format_type(conn_t *conn, const char *mime, struct iovec *line) {
+    size_t mime_len = strlen(mime);
+    char *buf = arena_alloc(conn->arena, strlen("Content-Type: ") + mime_len + 2);
+    if(buf == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return -1;
     }
+    line->iov_base = buf;
+    line->iov_len = append_header(buf, 0, "Content-Type: ", mime, mime_len);
+    return 0;
+}
+
+size_t append_header(char *buf, size_t len, const char *name, const char *value, size_t value_len) {
+    size_t name_len = strlen(name);
+    memcpy(buf + len, name, name_len);
+    memcpy(buf + len + name_len, value, value_len);
+    memcpy(buf + len + name_len + value_len, "\r\n", 2);
+    return len + name_len + value_len + 2;
+}
+
+static int send_stats(conn_t *conn, int json, int head_only, int keep_alive) {
+    stats_t *total = arena_alloc(conn->arena, sizeof(stats_t));
+    char *buf = arena_alloc(conn->arena, STATS_BUF_SIZE);
+    if(total == NULL || buf == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return send_res(conn, RES_INTERNAL_ERROR, keep_alive, NULL, 0);
+    }
+    stats_init(total);
+    for(int i = 0; i < worker_cnt; i++) {
+        stats_merge(total, &workers[i].stats);
+    }
+    size_t len = stats_format(total, worker_cnt, stats_now() - start_time, json, buf, STATS_BUF_SIZE);
+    if(len == 0) {
+        ERRPUTS("metrics do not fit into the buffer\n");
+        return send_res(conn, RES_INTERNAL_ERROR, keep_alive, NULL, 0);
+    }
+
+    static const char type_json[] = "Content-Type: application/json\r\nCache-Control: no-store\r\n";
+    static const char type_text[] = "Content-Type: text/plain; version=0.0.4\r\nCache-Control: no-store\r\n";
+    struct iovec hdrs[] = {{json ? (void *)type_json : (void *)type_text, json ? sizeof(type_json) - 1 : sizeof(type_text) - 1}};
+    return send_data(conn, head_only ? NULL : buf, len, hdrs, 1, keep_alive);
+}
+
+int consume_req(conn_t *conn, size_t head_len, int keep_alive) {
+    if(keep_alive == 0) {
+        return 0;
+    }
+    conn->len -= head_len;
+    memmove(conn->buf, conn->buf + head_len, conn->len);
+    return 1;
+}
+
+int format_res(conn_t *conn, res_type_t type, int keep_alive, const struct iovec *extra, int extra_cnt,
+        struct iovec *iov) {
+    const static_res_t *res = &static_res[type];
+    http_slice_t date = http_date(&conn->worker->date);
+    iov[0].iov_base = (void *)res->head.ptr;
+    iov[0].iov_len = res->head.len;
+    // Requests read before a reload are answered while draining
+    keep_alive = keep_alive && !__atomic_load_n(&draining, __ATOMIC_RELAXED);
+    iov[1].iov_base = (void *)conn_lines[keep_alive].ptr;
+    iov[1].iov_len = conn_lines[keep_alive].len;
+    iov[2].iov_base = (void *)date.ptr;
+    iov[2].iov_len = date.len;
+    for(int i = 0; i < extra_cnt; i++) {
+        iov[3 + i] = extra[i];
+    }
+    iov[3 + extra_cnt].iov_base = "\r\n";
+    iov[3 + extra_cnt].iov_len = 2;
+    conn->status = res->status;
+    // A response formatted again after a failed attempt was ready already
+    if(conn->handled == 0) {
+        conn->handled = stats_now();
+        STATS_PROBE3(open_done, conn->fd, conn->status, conn->handled);
+    }
+    return 4 + extra_cnt;
+}
+
+int send_res(conn_t *conn, res_type_t type, int keep_alive, const struct iovec *extra, int extra_cnt) {
+    struct iovec iov[4 + MAX_EXTRA_IOV];
+    int cnt = format_res(conn, type, keep_alive, extra, extra_cnt, iov);
+    size_t len = 0;
+    for(int i = 0; i < cnt; i++) {
+        len += iov[i].iov_len;
+    }
+    char *head = arena_alloc(conn->arena, len);
+    if(head == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    len = 0;
+    for(int i = 0; i < cnt; i++) {
+        memcpy(head + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    return queue_mem(conn, head, len);
+}
+
+char *get_file_path(arena_t *arena, http_slice_t req_path) {
+    // The parser only accepts origin-form targets
+    assert(req_path.len > 0 && req_path.ptr[0] == '/');
+    size_t path_len = req_path.len - 1;
+    int add_index = req_path.ptr[req_path.len-1] == '/';
+    char *file_path = arena_alloc(arena, path_len + (add_index ? strlen(index_file) : 0) + 1);
+    if(file_path == NULL) {
+        return NULL;
+    }
+
+    memcpy(file_path, req_path.ptr + 1, path_len);
+    file_path[path_len] = '\0';
     if(add_index == 1) {
         strcat(file_path, index_file);
     }
@@ -474,7 +2335,7 @@ static char *get_file_path(char *req_path) {
     return file_path;
 }
 
-static void cleanup_exit(int status) {
+void cleanup_exit(int status) {
     if(sockfd >= 0 ) {
         close(sockfd);
     }
@@ -0,0 +1,615 @@
+/**
+ * @file server.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Workers, connections and settings shared by the modules of the http server.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The server consists of server.c, which contains the setup, the epoll
+ * event loop and the handling of requests, and of the modules it delegates parts of
+ * the work of a connection to: sched.c sends the responses, ring.c contains the
+ * io_uring backend used with -U, upload.c receives the bodies of PUT requests and
+ * relay.c answers requests through the reverse proxy with -P. The modules work on
+ * the worker_t and conn_t declared here; the settings are defined in server.c.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "http.h"
+#include "parser.h"
+#include "arena.h"
+#include "compress.h"
+#include "lookup.h"
+#include "stats.h"
+#include "accesslog.h"
+#include "wheel.h"
+#include "uring.h"
+#include "proxy.h"
+
+/**
+ * @brief Maximum number of additional header vectors of a response.
+ */
+#define MAX_EXTRA_IOV 16
+
+/**
+ * @brief Responses sent by the server.
+ */
+typedef enum res_type {
+    RES_OK = 0,
+    RES_OK_CHUNKED,
+    RES_PARTIAL_CONTENT,
+    RES_CREATED,
+    RES_NO_CONTENT,
+    RES_NOT_MODIFIED,
+    RES_BAD_REQUEST,
+    RES_NOT_FOUND,
+    RES_PAYLOAD_TOO_LARGE,
+    RES_RANGE_NOT_SATISFIABLE,
+    RES_HEADERS_TOO_LARGE,
+    RES_INTERNAL_ERROR,
+    RES_NOT_IMPLEMENTED,
+    RES_BAD_GATEWAY,
+    RES_GATEWAY_TIMEOUT
+} res_type_t;
+
+/**
+ * @brief Macro for replying an error message.
+ * @details Replies the pre-serialized response of the given res_type_t (without
+ * body). Assumes that the client connection "conn" and the keep-alive flag 
+ * "keep_alive" exist in the context where this macro is used. 
+ */
+#define SEND_ERR_RES(r) \
+    if(send_res(conn, r, keep_alive, NULL, 0) != 0) { \
+        keep_alive = 0; \
+    }
+
+/**
+ * @brief Mask of the operation kind in the user data of ring operations.
+ */
+#define OP_MASK 7
+
+/**
+ * @brief Kinds of operations submitted to the ring of a worker.
+ * @details Stored in the low bits of the user data; operations of a connection
+ * carry the address of its conn_t in the other bits.
+ */
+typedef enum ring_op {
+    // Multishot accept on the listen socket
+    OP_ACCEPT = 0,
+
+    // Poll of wake_fd
+    OP_WAKE,
+
+    // Cancellation of another operation or an operation linked to a send, the result is ignored
+    OP_CANCEL,
+
+    // Read of a request head into the buffer of a connection
+    OP_READ,
+
+    // Poll for a part of an upload body or for room to send a response
+    OP_POLL,
+
+    // Poll of proxy_fd of the worker
+    OP_PROXY,
+
+    // Poll of the named pipe streamed to a connection (also tags its epoll events)
+    OP_PIPE,
+
+    // Send of a response assembled in a slot of the send buffer, linked to the read of its body
+    OP_SEND
+} ring_op_t;
+
+/**
+ * @brief State of a thread serving connections.
+ * @details Only the counters are read by other workers; they are aligned to cache
+ * lines, so each worker writes its own lines.
+ */
+typedef struct worker {
+    /** Counters of the worker, read by the metrics endpoint */
+    stats_t stats;
+    /** Index of the worker, 0 for the first one */
+    int id;
+    pthread_t thread;
+    /** Pool of the arenas of the requests being handled */
+    arena_pool_t arenas;
+    /** Cached Date header shared by all responses of the worker */
+    http_date_t date;
+    /** Cache of compressed file variants */
+    compress_cache_t compress;
+    /** Cache of resolved paths */
+    lookup_cache_t lookup;
+    /** Pipe used for splicing request bodies to files */
+    int pipe[2];
+    /** Number of the next temporary file of an upload */
+    unsigned int upload_seq;
+
+    /** Epoll instance the worker waits for its connections with */
+    int epfd;
+    /** Timer wheel holding the timeouts of the connections */
+    wheel_t timers;
+    /** Number of open connections */
+    unsigned int conn_cnt;
+    /** Number of requests being handled */
+    unsigned int inflight;
+    /** Cleared while the worker does not accept because of the connection or file limit */
+    int accepting;
+    /** Timer shedding pending clients periodically while the worker does not accept */
+    wheel_timer_t pace_timer;
+
+    /** With io_uring, ring replacing epfd */
+    uring_t ring;
+    /** With io_uring, URING_SEND_SLOTS slots responses sent with linked operations are assembled in */
+    char *send_buf;
+    /** Bitmask of the unused slots of send_buf */
+    unsigned int send_free;
+    /** With io_uring, connections of the worker, whose memory is registered with ring */
+    struct conn *conns;
+    /** List of the unused elements of conns */
+    struct conn *free_conns;
+    /** List of the open connections */
+    struct conn *open_conns;
+    /** Set once the worker stopped accepting to drain its connections after a reload */
+    int drained;
+    /** Number of multishot accepts submitted to ring whose last completion did not arrive yet */
+    int accepts;
+
+    /** Binary heap of the connections whose responses are sent in slices, ordered by sched_key */
+    struct conn **sched;
+    /** Number of elements of sched */
+    int sched_cnt;
+    /** Capacity of sched */
+    int sched_cap;
+    /** Number of bytes sent by the worker */
+    uint64_t sched_clock;
+
+    /** With -P, event file descriptor the fetcher threads of the reverse proxy wake the worker with (-1 otherwise) */
+    int proxy_fd;
+    /** List of the requests waiting for the reverse proxy */
+    struct proxy_req *proxy_waits;
+} worker_t;
+
+/**
+ * @brief State of a connection in the event loop of its worker.
+ */
+typedef enum conn_state {
+    // Waiting for the next request on a persistent connection (keep-alive timeout)
+    CONN_IDLE = 0,
+
+    // Receiving a request head (header timeout)
+    CONN_HEAD,
+
+    // Receiving the body of an upload (body timeout)
+    CONN_BODY,
+
+    // Sending a response in slices (body timeout while the socket is not writable)
+    CONN_SEND,
+
+    // Waiting for the reverse proxy to fetch the response (no timeout, the fetch is bounded)
+    CONN_PROXY
+} conn_state_t;
+
+/**
+ * @brief A part of a response which is still to be sent.
+ * @details Either len bytes of memory at data, or, if data is NULL, len bytes of
+ * the file fd starting at offset.
+ */
+typedef struct send_seg {
+    const char *data;
+    int fd;
+    off_t offset;
+    int64_t len;
+} send_seg_t;
+
+/**
+ * @brief State of a client connection.
+ * @details The parse results are slices into buf and remain valid until the next
+ * request is received. All request scoped memory is allocated from arena, which is
+ * only taken from the pool of the worker while a request is handled.
+ */
+typedef struct conn {
+    worker_t *worker;
+    /** Connection socket */
+    int fd;
+    /** State of the connection in the event loop */
+    conn_state_t state;
+    /** Timer of the current timeout */
+    wheel_timer_t timer;
+    /** Receive buffer for request heads */
+    char buf[HTTP_MAX_HEAD];
+    /** Number of bytes in buf */
+    size_t len;
+    /** Parser state of the request head */
+    http_parser_t parser;
+    /** Arena of the request being handled, NULL between requests */
+    arena_t *arena;
+    /** State of an upload whose body is received, NULL otherwise */
+    struct upload *upload;
+    /** State of a request answered by the reverse proxy, NULL otherwise */
+    struct proxy_req *proxy;
+    /** State of a named pipe streamed as the response body, NULL otherwise */
+    struct pipe_out *pipe;
+
+    /** Time the first byte of the current request was received */
+    uint64_t start;
+    /** Time the head of the current request was parsed */
+    uint64_t head;
+    /** Time the head of the response was produced */
+    uint64_t handled;
+    /** Status of the response, 0 if none was sent */
+    int status;
+    /** Number of bytes sent for the response */
+    uint64_t sent_bytes;
+    /** Copy of the method followed by the path of the request for the access log, as buf may be reused before */
+    char log_req[ACCESS_LOG_MAX_METHOD + ACCESS_LOG_MAX_PATH];
+    /** Length of the method in log_req */
+    size_t log_method_len;
+    /** Length of the path in log_req */
+    size_t log_path_len;
+
+    /** With io_uring, user data of the operation in progress (0 if none) */
+    uint64_t ring_op;
+    /** Result of a completed read not consumed yet, or the socket of a closed connection while ring_buf is set */
+    int ring_res;
+    /** Set if ring_res holds the result of a read */
+    int ring_done;
+    /** Slot of the send buffer of the worker reserved by a linked send in flight, NULL if none */
+    char *ring_buf;
+    /** Previous open connection of the worker */
+    struct conn *prev;
+    /** Next open connection of the worker; with io_uring, also links the unused connections */
+    struct conn *next;
+    /** Events epoll reports for the connection */
+    uint32_t events;
+
+    /** Parts of the response still to be sent, allocated from arena */
+    send_seg_t *segs;
+    /** Number of elements of segs */
+    int seg_cnt;
+    /** Index of the first unsent part */
+    int seg_idx;
+    /** Number of bytes of the response still to be sent */
+    int64_t out_left;
+    /** Set if the socket was not writable */
+    int out_wait;
+    /** File referenced by the queued parts */
+    lookup_entry_t *out_file;
+    /** Compressed variant referenced by the queued parts */
+    compress_entry_t *out_entry;
+    /** Keep-alive flag of the response */
+    int out_keep_alive;
+    /** Position of the connection in the send scheduler of the worker, -1 if not scheduled */
+    int sched_idx;
+    /** Priority of the connection in the send scheduler */
+    uint64_t sched_key;
+} conn_t;
+
+/**
+ * @brief Program name.
+ * @details Name of the executable used for usage and error messages.
+ */
+extern char *progname;
+
+/**
+ * @brief Body timeout in seconds.
+ * @details Connections are closed if no part of an upload body arrives or no part
+ * of a response can be sent within this time (the -b cli argument). 0 disables the
+ * timeout.
+ */
+extern int body_timeout;
+
+/**
+ * @brief Whether the workers use io_uring instead of epoll.
+ * @details Set by the -U cli argument and cleared if the kernel does not support
+ * the required operations.
+ */
+extern int use_uring;
+
+/**
+ * @brief The reverse proxy, only initialized if upstream != NULL.
+ */
+extern proxy_t proxy;
+
+/**
+ * @brief Maximum number of open connections of each worker.
+ * @details The -c cli argument divided among the workers, so the limits are checked
+ * without sharing a counter. 0 disables the limit.
+ */
+extern unsigned int conn_limit;
+
+/**
+ * @brief Flag denoting whether the program should be terminated.
+ * @details This variable is used by the signal handlers to indicated that a signal
+ * was caught and the program should be terminated after the current request
+ * has been handled. 
+ */
+extern volatile sig_atomic_t quit;
+
+/**
+ * @brief File descriptor for the server socket.
+ * @details -1 if not open
+ */
+extern int sockfd;
+
+/**
+ * @brief Event file descriptor waking up all workers when the server terminates.
+ */
+extern int wake_fd;
+
+/**
+ * @brief Directory file descriptor of the document root.
+ */
+extern int docroot_fd;
+
+/**
+ * @brief Maximum size of uploaded files in bytes.
+ * @details If > 0, PUT requests store their body to the requested file (the -u cli
+ * argument). 0 disables uploads.
+ */
+extern int64_t upload_limit;
+
+/**
+ * Cleanup and terminate.
+ * @brief Free allocated memory, close open streams and terminate program with the
+ * given status code.
+ * 
+ * @param status Returns status of the program.
+ * 
+ * @details Closes open file streams (pointers != NULL) and exits the program using 
+ * exit(), returning the given status.
+ * Global variables: sockfd.
+ */
+void cleanup_exit(int status);
+
+/**
+ * @brief Serve a readable connection.
+ * 
+ * @param conn Client connection, which may be freed.
+ * 
+ * @details Continues receiving the current upload body or request head. Complete
+ * requests are handled (via the handle_request function) and finished, including
+ * pipelined requests which were received along with them, until more data has to
+ * be awaited; the timeout of the state the connection is left in is armed.
+ * Requests beyond the in-flight limit of the worker are shed and the connection
+ * is closed. The response of each request is sent via the send_out function;
+ * further requests are only handled once it was sent completely. A connection
+ * whose response waited for the socket to become writable is handed to the send
+ * scheduler instead.
+ * Global variables: inflight_limit, header_timeout, body_timeout.
+ */
+void serve_conn(conn_t *conn);
+
+/**
+ * @brief Change the events epoll reports for a connection.
+ * 
+ * @param conn Client connection.
+ * @param events Events.
+ * @return int 0 on success, -1 on errors (errno is set). Does nothing with io_uring.
+ * 
+ * @details Global variables: use_uring.
+ */
+int watch_conn(conn_t *conn, uint32_t events);
+
+/**
+ * @brief Finish a handled request.
+ * 
+ * @param conn Client connection.
+ * @param keep_alive Whether the connection should be kept open.
+ * @return int 1 if the connection is kept open, 0 if it was closed and freed.
+ * 
+ * @details Counts the response, writes it to the access log, drops the queued
+ * response and returns the arena to the pool. Persistent connections wait for the
+ * next request with the keep-alive timeout, or with the header timeout if a part of
+ * it was already received.
+ * Global variables: quit, access_log, keepalive_timeout, header_timeout.
+ */
+int finish_req(conn_t *conn, int keep_alive);
+
+/**
+ * @brief Arm the timer of a connection.
+ * 
+ * @param conn Client connection.
+ * @param seconds Timeout in seconds from now, 0 cancels the timer.
+ */
+void set_timeout(conn_t *conn, int seconds);
+
+/**
+ * @brief Close a connection and free it.
+ * 
+ * @param conn Client connection.
+ * 
+ * @details An incomplete upload and an unsent response are discarded.
+ */
+void close_conn(conn_t *conn);
+
+/**
+ * @brief Add an accepted client to a worker.
+ * 
+ * @param worker Worker the connection is added to.
+ * @param connfd Socket of the client.
+ * 
+ * @details The connection gets its own conn_t, is added to the epoll instance of
+ * the worker (or a read is submitted to its ring) and has to send its first
+ * request head within the header timeout.
+ * Global variables: keepalive_timeout, body_timeout, header_timeout, use_uring.
+ */
+void add_conn(worker_t *worker, int connfd);
+
+/**
+ * @brief Free a connection allocated with alloc_conn.
+ * 
+ * @param conn Client connection.
+ */
+void free_conn(conn_t *conn);
+
+/**
+ * @brief Stop accepting clients.
+ * 
+ * @param worker Worker which reached its connection limit or the file limit.
+ * 
+ * @details Removes the listen socket from the epoll instance of the worker (or
+ * cancels its multishot accept), so pending clients are left to the other workers
+ * or wait in the backlog, and arms the pace timer.
+ * Global variables: sockfd.
+ */
+void pause_accept(worker_t *worker);
+
+/**
+ * @brief Answer a client with the pre-serialized 503 response.
+ * 
+ * @param worker Worker counting the shed client.
+ * @param fd Socket of the client, which has to be closed afterwards.
+ * 
+ * @details The response is sent without blocking. Unread request bytes are
+ * discarded, so closing the socket does not reset the connection before the
+ * client read the response.
+ */
+void shed(worker_t *worker, int fd);
+
+/**
+ * @brief Assemble a response head.
+ * 
+ * @param conn Client connection.
+ * @param type Type of the response.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @param extra Additional header lines (each including the line break), may be NULL.
+ * @param extra_cnt Number of elements of extra, at most MAX_EXTRA_IOV.
+ * @param iov Array of at least 4 + extra_cnt elements the head is stored in.
+ * @return int Number of elements of iov used.
+ * 
+ * @details The head consists of the pre-serialized prefix of the response, the
+ * Connection header, the cached Date header of the worker, the additional header
+ * lines and the empty line terminating the head. Sets the status of the connection
+ * and, for the first head of a request, the time it was produced (the end of the
+ * handle phase, probe open_done).
+ */
+int format_res(conn_t *conn, res_type_t type, int keep_alive, const struct iovec *extra, int extra_cnt,
+        struct iovec *iov);
+
+/**
+ * @brief Finish a batch of events of a worker.
+ * 
+ * @param worker Worker.
+ * 
+ * @details Closes the connections whose timeout expired and continues the scheduled
+ * responses. The first worker starts a reload requested by SIGHUP and completes it
+ * once the new server reported its readiness. After a reload, the worker starts
+ * draining its connections.
+ * Global variables: reload, reload_fd, draining.
+ */
+void finish_batch(worker_t *worker);
+
+/**
+ * @brief Finish a request on a persistent connection.
+ * 
+ * @param conn Client connection.
+ * @param head_len Length of the head of the handled request.
+ * @param keep_alive Whether the connection should be kept open.
+ * @return int keep_alive.
+ * 
+ * @details Removes the head of the handled request from the connection buffer, so
+ * that bytes of a pipelined request which were already received are parsed next.
+ */
+int consume_req(conn_t *conn, size_t head_len, int keep_alive);
+
+/**
+ * @brief Get the file path for a given requested file
+ * 
+ * @param arena Arena the path should be allocated from.
+ * @param req_path Request path slice from the http request (must start with a slash)
+ * @return char* File path to the requested file relative to the document root, or
+ * NULL if the allocation failed.
+ * 
+ * @details Strips the leading slash of the request path and appends the index file
+ * name if the requested file ends with a slash. The returned path is allocated from
+ * arena.
+ */
+char *get_file_path(arena_t *arena, http_slice_t req_path);
+
+/**
+ * @brief Helper function for queueing a reponse head for the client.
+ * 
+ * @param conn Client connection.
+ * @param type Type of the response.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @param extra Additional header lines (each including the line break), may be NULL.
+ * @param extra_cnt Number of elements of extra, at most MAX_EXTRA_IOV.
+ * @return int 0 if the head was queued, -1 if the allocation failed and the
+ * connection should be closed.
+ * 
+ * @details The head assembled by the format_res function is copied to the arena,
+ * as the header lines may be on the stack of the caller.
+ */
+int send_res(conn_t *conn, res_type_t type, int keep_alive, const struct iovec *extra, int extra_cnt);
+
+/**
+ * @brief Append a header line to a buffer.
+ * 
+ * @param buf Buffer the line should be written to, must be large enough.
+ * @param len Number of bytes already in buf.
+ * @param name Header name including the ": " separator.
+ * @param value Header value.
+ * @param value_len Length of value.
+ * @return size_t New number of bytes in buf.
+ */
+size_t append_header(char *buf, size_t len, const char *name, const char *value, size_t value_len);
+
+/**
+ * @brief Format the Content-Type header line of a response.
+ * 
+ * @param conn Client connection, the line is allocated from its arena.
+ * @param mime Media type, which may be of any length.
+ * @param line Vector the line (including the line break) is stored to.
+ * @return int 0 on success, -1 if the allocation failed.
+ */
+int format_type(conn_t *conn, const char *mime, struct iovec *line);
+
+/**
+ * @brief Send a response with a body from memory.
+ * 
+ * @param conn Client connection.
+ * @param data Body, or NULL if only the head should be sent.
+ * @param len Length of the body.
+ * @param hdrs Additional header lines.
+ * @param hdr_cnt Number of elements of hdrs.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 0 if the response was queued, -1 if the allocation failed and the
+ * connection should be closed.
+ * 
+ * @details The body must stay valid until the request is finished.
+ */
+int send_data(conn_t *conn, const void *data, size_t len, const struct iovec *hdrs, int hdr_cnt,
+        int keep_alive);
+
+/**
+ * @brief Send a file response.
+ * 
+ * @param conn Client connection.
+ * @param fd File descriptor of the file, or -1 if only the head should be sent.
+ * @param offset Offset of the file within fd (non-zero for files of an archive).
+ * @param size Size of the file.
+ * @param mime Media type of the file.
+ * @param ranges Requested ranges.
+ * @param range_cnt Number of requested ranges, or -1 for sending the whole file.
+ * @param hdrs Additional header lines (e.g. validators).
+ * @param hdr_cnt Number of elements of hdrs.
+ * @param keep_alive Whether the connection is kept open after the response.
+ * @return int 0 if the response was queued, -1 if sending failed and the connection
+ * should be closed.
+ * 
+ * @details Queues 200 with the whole file, 206 with a Content-Range header for a
+ * single range or 206 with a multipart/byteranges body for several ranges. The 
+ * file data is transmitted with sendfile at the offset of each range, so fd must
+ * stay open until the request is finished. With
+ * io_uring, the whole file or a single range is sent by the ring_send_file function
+ * if it fits into a slot of the send buffer.
+ * Global variables: use_uring.
+ */
+int send_file(conn_t *conn, int fd, int64_t offset, int64_t size, const char *mime,
+        const http_range_t *ranges, int range_cnt, const struct iovec *hdrs, int hdr_cnt, int keep_alive);
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file stats.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the server counters defined in stats.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details The text format follows the Prometheus exposition format, latencies
+ * are exported as summaries in seconds. The JSON document contains the same values
+ * with latencies in nanoseconds.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/**
+ * @brief Names of the phases, indexed by stats_phase_t.
+ */
+static const char *const phase_names[] = {"recv", "handle", "send", "total"};
+
+/**
+ * @brief Percentiles reported for each histogram.
+ */
+static const double percentiles[] = {50.0, 99.0, 99.9};
+
+/**
+ * @brief Names of the percentiles in the JSON document.
+ */
+static const char *const percentile_names[] = {"p50", "p99", "p99.9"};
+
+/**
+ * @brief Quantiles of the percentiles in the text format.
+ */
+static const char *const quantile_names[] = {"0.5", "0.99", "0.999"};
+
+/**
+ * @brief Append formatted text to a buffer.
+ *
+ * @param buf Buffer.
+ * @param size Size of buf.
+ * @param len Pointer to the number of bytes in buf, set to size if the text does not fit.
+ * @param format Format string of printf.
+ */
+static void append(char *buf, size_t size, size_t *len, const char *format, ...);
+
+void stats_init(stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+void stats_record(stats_t *stats, int status, uint64_t start, uint64_t head, uint64_t handled, uint64_t end) {
+    int class = status / 100 - 1;
+    if(class < 0 || class >= STATS_CLASS_COUNT) {
+        return;
+    }
+    stats->responses[class]++;
+    hist_record(&stats->latency[STATS_PHASE_RECV][class], head - start);
+    hist_record(&stats->latency[STATS_PHASE_HANDLE][class], handled - head);
+    hist_record(&stats->latency[STATS_PHASE_SEND][class], end - handled);
+    hist_record(&stats->latency[STATS_PHASE_TOTAL][class], end - start);
+}
+
+void stats_merge(stats_t *dst, const stats_t *src) {
+    dst->connections += src->connections;
+    dst->requests += src->requests;
+    for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+        dst->responses[i] += src->responses[i];
+    }
+    dst->sent_bytes += src->sent_bytes;
+    dst->timeouts += src->timeouts;
+    dst->shed += src->shed;
+    for(int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+        for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+            hist_merge(&dst->latency[phase][i], &src->latency[phase][i]);
+        }
+    }
+}
+
+size_t stats_format(const stats_t *stats, int workers, uint64_t uptime, int json, char *buf, size_t size) {
+    size_t len = 0;
+    if(json) {
+        append(buf, size, &len, "{\"uptime_ns\":%llu,\"workers\":%d,\"connections\":%llu,\"requests\":%llu,"
+            "\"sent_bytes\":%llu,\"timeouts\":%llu,\"shed\":%llu,\"responses\":{", (unsigned long long)uptime, workers,
+            (unsigned long long)stats->connections, (unsigned long long)stats->requests,
+            (unsigned long long)stats->sent_bytes, (unsigned long long)stats->timeouts,
+            (unsigned long long)stats->shed);
+        for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+            append(buf, size, &len, "%s\"%dxx\":%llu", i > 0 ? "," : "", i + 1, (unsigned long long)stats->responses[i]);
+        }
+        append(buf, size, &len, "},\"latency_ns\":{");
+        for(int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+            append(buf, size, &len, "%s\"%s\":{", phase > 0 ? "," : "", phase_names[phase]);
+            int first = 1;
+            for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+                const hist_t *hist = &stats->latency[phase][i];
+                if(hist->count == 0) {
+                    continue;
+                }
+                append(buf, size, &len, "%s\"%dxx\":{\"count\":%llu,\"mean\":%llu", first ? "" : ",", i + 1,
+                    (unsigned long long)hist->count, (unsigned long long)(hist->sum / hist->count));
+                for(size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+                    append(buf, size, &len, ",\"%s\":%llu", percentile_names[p],
+                        (unsigned long long)hist_percentile(hist, percentiles[p]));
+                }
+                append(buf, size, &len, ",\"max\":%llu}", (unsigned long long)hist->max);
+                first = 0;
+            }
+            append(buf, size, &len, "}");
+        }
+        append(buf, size, &len, "}}\n");
+        return len < size ? len : 0;
+    }
+
+    append(buf, size, &len, "# TYPE osue_uptime_seconds gauge\nosue_uptime_seconds %.3f\n", uptime / 1e9);
+    append(buf, size, &len, "# TYPE osue_workers gauge\nosue_workers %d\n", workers);
+    append(buf, size, &len, "# TYPE osue_connections_total counter\nosue_connections_total %llu\n",
+        (unsigned long long)stats->connections);
+    append(buf, size, &len, "# TYPE osue_requests_total counter\nosue_requests_total %llu\n",
+        (unsigned long long)stats->requests);
+    append(buf, size, &len, "# TYPE osue_sent_bytes_total counter\nosue_sent_bytes_total %llu\n",
+        (unsigned long long)stats->sent_bytes);
+    append(buf, size, &len, "# TYPE osue_timeouts_total counter\nosue_timeouts_total %llu\n",
+        (unsigned long long)stats->timeouts);
+    append(buf, size, &len, "# TYPE osue_shed_total counter\nosue_shed_total %llu\n",
+        (unsigned long long)stats->shed);
+    append(buf, size, &len, "# TYPE osue_responses_total counter\n");
+    for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+        append(buf, size, &len, "osue_responses_total{class=\"%dxx\"} %llu\n", i + 1,
+            (unsigned long long)stats->responses[i]);
+    }
+    append(buf, size, &len, "# TYPE osue_latency_seconds summary\n");
+    for(int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+        for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+            const hist_t *hist = &stats->latency[phase][i];
+            if(hist->count == 0) {
+                continue;
+            }
+            for(size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+                append(buf, size, &len, "osue_latency_seconds{phase=\"%s\",class=\"%dxx\",quantile=\"%s\"} %.9f\n",
+                    phase_names[phase], i + 1, quantile_names[p], hist_percentile(hist, percentiles[p]) / 1e9);
+            }
+            append(buf, size, &len, "osue_latency_seconds_sum{phase=\"%s\",class=\"%dxx\"} %.9f\n",
+                phase_names[phase], i + 1, hist->sum / 1e9);
+            append(buf, size, &len, "osue_latency_seconds_count{phase=\"%s\",class=\"%dxx\"} %llu\n",
+                phase_names[phase], i + 1, (unsigned long long)hist->count);
+        }
+    }
+    append(buf, size, &len, "# TYPE osue_latency_max_seconds gauge\n");
+    for(int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+        for(int i = 0; i < STATS_CLASS_COUNT; i++) {
+            const hist_t *hist = &stats->latency[phase][i];
+            if(hist->count > 0) {
+                append(buf, size, &len, "osue_latency_max_seconds{phase=\"%s\",class=\"%dxx\"} %.9f\n",
+                    phase_names[phase], i + 1, hist->max / 1e9);
+            }
+        }
+    }
+    return len < size ? len : 0;
+}
+
+static void append(char *buf, size_t size, size_t *len, const char *format, ...) {
+    if(*len >= size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+    *len = n < 0 || (size_t)n >= size - *len ? size : *len + n;
+}
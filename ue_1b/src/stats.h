@@ -0,0 +1,149 @@
+/**
+ * @file stats.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Request counters and latency histograms of the server.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Every worker owns a stats_t and is its only writer, so recording a
+ * request is a few plain increments without locks or atomic operations. The
+ * structure is aligned to cache lines, so the counters of different workers never
+ * share a line. Readers merge the stats of all workers on demand; they may see a
+ * request partially recorded, which is acceptable for monitoring. Timestamps are
+ * read from the monotonic clock through the vDSO, which does not enter the kernel.
+ * If compiled with HAVE_SDT, the phase boundaries are also exposed as USDT probes
+ * of the provider osue (see STATS_PROBE2), which cost a single nop while no
+ * tracer is attached.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hist.h"
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+/**
+ * @brief Fire a USDT probe with two arguments.
+ */
+#define STATS_PROBE2(name, a, b) DTRACE_PROBE2(osue, name, a, b)
+
+/**
+ * @brief Fire a USDT probe with three arguments.
+ */
+#define STATS_PROBE3(name, a, b, c) DTRACE_PROBE3(osue, name, a, b, c)
+
+/**
+ * @brief Fire a USDT probe with four arguments.
+ */
+#define STATS_PROBE4(name, a, b, c, d) DTRACE_PROBE4(osue, name, a, b, c, d)
+#else
+#define STATS_PROBE2(name, a, b) ((void)0)
+#define STATS_PROBE3(name, a, b, c) ((void)0)
+#define STATS_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
+/**
+ * @brief Size of a cache line.
+ */
+#define STATS_CACHE_LINE 64
+
+/**
+ * @brief Number of status classes (1xx to 5xx).
+ */
+#define STATS_CLASS_COUNT 5
+
+/**
+ * @brief Phases of a request.
+ */
+typedef enum stats_phase {
+    // From the first byte of the request until its head was parsed
+    STATS_PHASE_RECV = 0,
+
+    // From the parsed head until the response head was produced (path
+    // resolution, opening the file, waiting for the upstream)
+    STATS_PHASE_HANDLE,
+
+    // From the produced response head until the response was sent
+    STATS_PHASE_SEND,
+
+    // From the first byte of the request until the response was sent
+    STATS_PHASE_TOTAL,
+
+    // Number of phases, not a valid phase
+    STATS_PHASE_COUNT
+} stats_phase_t;
+
+/**
+ * @brief Counters of a worker.
+ * @details connections counts accepted connections, requests parsed request heads
+ * and responses the responses by status class (index status / 100 - 1). sent_bytes
+ * is the number of sent bytes of all response heads and bodies,
+ * timeouts the number of connections closed because a timeout expired and shed the
+ * number of connections and requests rejected because the server was overloaded.
+ * latency holds the duration of each phase in nanoseconds by status class.
+ */
+typedef struct stats {
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t responses[STATS_CLASS_COUNT];
+    uint64_t sent_bytes;
+    uint64_t timeouts;
+    uint64_t shed;
+    hist_t latency[STATS_PHASE_COUNT][STATS_CLASS_COUNT];
+} __attribute__((aligned(STATS_CACHE_LINE))) stats_t;
+
+/**
+ * @brief Reset counters.
+ *
+ * @param stats Counters.
+ */
+void stats_init(stats_t *stats);
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return uint64_t Current time in nanoseconds.
+ */
+uint64_t stats_now(void);
+
+/**
+ * @brief Count a response.
+ *
+ * @param stats Counters of the calling worker.
+ * @param status Status of the response.
+ * @param start Time the first byte of the request was received.
+ * @param head Time the request head was parsed.
+ * @param handled Time the response head was produced.
+ * @param end Time the response was sent.
+ */
+void stats_record(stats_t *stats, int status, uint64_t start, uint64_t head, uint64_t handled, uint64_t end);
+
+/**
+ * @brief Add counters to others.
+ *
+ * @param dst Counters the values are added to.
+ * @param src Counters whose values are added, may be written concurrently.
+ */
+void stats_merge(stats_t *dst, const stats_t *src);
+
+/**
+ * @brief Format counters for the metrics endpoint.
+ *
+ * @param stats Counters (usually the merged counters of all workers).
+ * @param workers Number of workers.
+ * @param uptime Time since the server was started in nanoseconds.
+ * @param json Whether JSON (1) or the Prometheus text format (0) should be produced.
+ * @param buf Buffer the document is written to.
+ * @param size Size of buf.
+ * @return size_t Length of the document, or 0 if it does not fit into buf.
+ *
+ * @details Latencies are reported as count, mean, p50, p99, p99.9 and max of each
+ * phase and status class with at least one request.
+ */
+size_t stats_format(const stats_t *stats, int workers, uint64_t uptime, int json, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * @file upload.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the uploads defined in upload.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Bodies with a length are spliced from the socket to the file through
+ * the pipe of the worker, chunked bodies are decoded in the receive buffer of the
+ * connection and written. The temporary file is created in the directory of the
+ * requested file, so it can be renamed in place.
+ */
+
+// splice
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "upload.h"
+#include "utils.h"
+
+/**
+ * @brief Maximum number of bytes moved by a single splice of a request body.
+ * @details Bounds the data in flight in the pipe of the worker (the default pipe
+ * capacity of Linux).
+ */
+#define UPLOAD_SPLICE_SIZE (64 * 1024)
+
+/**
+ * @brief Interim response sent to clients which expect 100-continue.
+ */
+static const http_slice_t continue_res = HTTP_SLICE_LIT(HTTP_VERSION " 100 Continue\r\n\r\n");
+
+int handle_upload(conn_t *conn, size_t head_len, int keep_alive) {
+    http_parser_t *req = &conn->parser;
+    http_slice_t content_len = req->headers.known[HTTP_HDR_CONTENT_LENGTH];
+    http_slice_t transfer_encoding = req->headers.known[HTTP_HDR_TRANSFER_ENCODING];
+
+    // Requests without Content-Length and Transfer-Encoding have an empty body
+    int64_t len = 0;
+    if(transfer_encoding.ptr != NULL) {
+        if(!http_is_chunked(transfer_encoding)) {
+            keep_alive = 0;
+            SEND_ERR_RES(RES_NOT_IMPLEMENTED);
+            return 0;
+        }
+        len = -1;
+    } else if(content_len.ptr != NULL) {
+        if(http_parse_num(content_len, &len) != 0) {
+            keep_alive = 0;
+            SEND_ERR_RES(RES_BAD_REQUEST);
+            return 0;
+        }
+    }
+    if(len > upload_limit) {
+        // The body is not read, so the connection cannot be reused
+        keep_alive = 0;
+        SEND_ERR_RES(RES_PAYLOAD_TOO_LARGE);
+        return 0;
+    }
+
+    upload_t *up = arena_alloc(conn->arena, sizeof(upload_t));
+    if(up == NULL) {
+        ERRPRINTF("arena_alloc failed: %s\n", strerror(errno));
+        keep_alive = 0;
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return 0;
+    }
+    char *file_path = NULL;
+    if(req->path.ptr[req->path.len - 1] != '/' && !lookup_has_dot_dot(req->path.ptr, req->path.len)) {
+        file_path = get_file_path(conn->arena, req->path);
+    }
+    if(file_path == NULL) {
+        keep_alive = 0;
+        SEND_ERR_RES(RES_BAD_REQUEST);
+        return 0;
+    }
+
+    // The file is created in its directory, which is resolved beneath the document root
+    int dir_fd = docroot_fd;
+    char *name = strrchr(file_path, '/');
+    if(name != NULL) {
+        *name = '\0';
+        dir_fd = lookup_open(docroot_fd, file_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        *name++ = '/';
+    } else {
+        name = file_path;
+    }
+    if(dir_fd < 0) {
+        keep_alive = 0;
+        if(errno == ENOENT || errno == ENOTDIR || errno == EXDEV || errno == ELOOP) {
+            SEND_ERR_RES(RES_NOT_FOUND);
+            return 0;
+        }
+        ERRPRINTF("open on directory of %s failed: %s\n", file_path, strerror(errno));
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return 0;
+    }
+
+    struct stat st;
+    int exists = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    if(exists && !S_ISREG(st.st_mode)) {
+        if(dir_fd != docroot_fd) {
+            close(dir_fd);
+        }
+        keep_alive = 0;
+        SEND_ERR_RES(RES_BAD_REQUEST);
+        return 0;
+    }
+
+    // The temporary file must be in the same directory for rename to be atomic
+    int fd;
+    do {
+        snprintf(up->tmp_name, sizeof(up->tmp_name), ".upload-%ld-%d-%u", (long)getpid(), conn->worker->id,
+            conn->worker->upload_seq++);
+        fd = openat(dir_fd, up->tmp_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    } while(fd < 0 && errno == EEXIST);
+    if(fd < 0) {
+        ERRPRINTF("creating %s in directory of %s failed: %s\n", up->tmp_name, file_path, strerror(errno));
+        if(dir_fd != docroot_fd) {
+            close(dir_fd);
+        }
+        keep_alive = 0;
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        return 0;
+    }
+    if(fchmod(fd, 0644) != 0) {
+        ERRPRINTF("fchmod on %s failed: %s\n", up->tmp_name, strerror(errno));
+    }
+    up->fd = fd;
+    up->dir_fd = dir_fd;
+    up->name = name;
+    up->file_path = file_path;
+    up->exists = exists;
+    up->keep_alive = keep_alive;
+    up->remaining = len;
+    http_chunked_init(&up->dec);
+    conn->upload = up;
+
+    http_slice_t expect = http_header_find(&req->headers, "Expect");
+    if(expect.ptr != NULL && http_slice_eq(expect, "100-continue") && conn->len == head_len) {
+        struct iovec iov = {(void *)continue_res.ptr, continue_res.len};
+        if(http_writev(conn->fd, &iov, 1) != HTTP_SUCCESS) {
+            ERRPRINTF("error while sending response: %s\n", strerror(errno));
+            return finish_upload(conn, -1);
+        }
+    }
+
+    conn->len -= head_len;
+    memmove(conn->buf, conn->buf + head_len, conn->len);
+    int ret = 1;
+    if(len < 0) {
+        ret = recv_body(conn);
+    } else {
+        // Body bytes received along with the head
+        size_t buffered = (int64_t)conn->len < len ? conn->len : (size_t)len;
+        struct iovec iov = {conn->buf, buffered};
+        if(buffered > 0 && http_writev(fd, &iov, 1) != HTTP_SUCCESS) {
+            ERRPRINTF("error while writing request body: %s\n", strerror(errno));
+            ret = -4;
+        }
+        conn->len -= buffered;
+        memmove(conn->buf, conn->buf + buffered, conn->len);
+        up->remaining -= buffered;
+        if(ret == 1 && up->remaining == 0) {
+            ret = 0;
+        }
+    }
+    if(ret == 1) {
+        // The rest of the body is received once the socket is readable
+        conn->state = CONN_BODY;
+        return keep_alive;
+    }
+    return finish_upload(conn, ret);
+}
+
+int recv_body(conn_t *conn) {
+    upload_t *up = conn->upload;
+    if(up->remaining >= 0) {
+        int *pipefd = conn->worker->pipe;
+        ssize_t n = splice(conn->fd, NULL, pipefd[1], NULL,
+            up->remaining < UPLOAD_SPLICE_SIZE ? up->remaining : UPLOAD_SPLICE_SIZE, SPLICE_F_MOVE);
+        if(n < 0) {
+            if(errno == EINTR || errno == EAGAIN) {
+                return 1;
+            }
+            ERRPRINTF("error while receiving request body: %s\n", strerror(errno));
+            return -1;
+        }
+        if(n == 0) {
+            ERRPUTS("connection closed before request body was complete\n");
+            return -1;
+        }
+        up->remaining -= n;
+        // Empty the pipe completely, so it can be used by the next request
+        while(n > 0) {
+            ssize_t moved = splice(pipefd[0], NULL, up->fd, NULL, n, SPLICE_F_MOVE);
+            if(moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if(moved <= 0) {
+                ERRPRINTF("error while writing request body: %s\n", strerror(errno));
+                char discard[4096];
+                while(n > 0 && (moved = read(pipefd[0], discard, n < (ssize_t)sizeof(discard) ? n : (ssize_t)sizeof(discard))) > 0) {
+                    n -= moved;
+                }
+                return -4;
+            }
+            n -= moved;
+        }
+        return up->remaining > 0 ? 1 : 0;
+    }
+
+    for(;;) {
+        size_t out_len, used;
+        int ret = http_chunked_decode(&up->dec, conn->buf, conn->len, &out_len, &used);
+        if(ret == HTTP_PARSE_ERROR) {
+            return -3;
+        }
+        if(up->dec.total > (uint64_t)upload_limit) {
+            return -2;
+        }
+        struct iovec iov = {conn->buf, out_len};
+        if(out_len > 0 && http_writev(up->fd, &iov, 1) != HTTP_SUCCESS) {
+            ERRPRINTF("error while writing request body: %s\n", strerror(errno));
+            return -4;
+        }
+        conn->len -= used;
+        memmove(conn->buf, conn->buf + used, conn->len);
+        if(ret == HTTP_PARSE_DONE) {
+            return 0;
+        }
+
+        ssize_t n = recv(conn->fd, conn->buf, sizeof(conn->buf), MSG_DONTWAIT);
+        if(n < 0) {
+            if(errno == EINTR && !quit) {
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            ERRPRINTF("error while receiving request body: %s\n", strerror(errno));
+            return -1;
+        }
+        if(n == 0) {
+            ERRPUTS("connection closed before request body was complete\n");
+            return -1;
+        }
+        conn->len = n;
+    }
+}
+
+int finish_upload(conn_t *conn, int ret) {
+    upload_t *up = conn->upload;
+    int keep_alive = up->keep_alive;
+    conn->upload = NULL;
+    conn->state = CONN_HEAD;
+
+    if(close(up->fd) != 0 && ret == 0) {
+        ERRPRINTF("close on %s failed: %s\n", up->tmp_name, strerror(errno));
+        ret = -4;
+    }
+    if(ret == 0 && renameat(up->dir_fd, up->tmp_name, up->dir_fd, up->name) != 0) {
+        ERRPRINTF("rename to %s failed: %s\n", up->file_path, strerror(errno));
+        ret = -4;
+    }
+    if(ret != 0) {
+        unlinkat(up->dir_fd, up->tmp_name, 0);
+    } else {
+        lookup_invalidate(&conn->worker->lookup, up->file_path);
+    }
+    if(up->dir_fd != docroot_fd) {
+        close(up->dir_fd);
+    }
+    switch(ret) {
+    case 0:
+        if(send_res(conn, up->exists ? RES_NO_CONTENT : RES_CREATED, keep_alive, NULL, 0) != 0) {
+            keep_alive = 0;
+        }
+        break;
+    case -2:
+        keep_alive = 0;
+        SEND_ERR_RES(RES_PAYLOAD_TOO_LARGE);
+        break;
+    case -3:
+        keep_alive = 0;
+        SEND_ERR_RES(RES_BAD_REQUEST);
+        break;
+    case -4:
+        keep_alive = 0;
+        SEND_ERR_RES(RES_INTERNAL_ERROR);
+        break;
+    default:
+        keep_alive = 0;
+    }
+    // The head was already removed from the buffer
+    return consume_req(conn, 0, keep_alive);
+}
@@ -0,0 +1,94 @@
+/**
+ * @file upload.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Uploads of the http server.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details With -u, PUT requests store their body to the requested file beneath
+ * the document root. The body is received without blocking the worker, as the other
+ * events of its connections, and written to a temporary file which replaces the
+ * requested file once the body is complete.
+ */
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+/**
+ * @brief State of an upload whose body is received.
+ * @details fd is the temporary file tmp_name in the directory dir_fd, which is
+ * renamed to name once the body is complete. file_path is the path of the file
+ * relative to the document root, exists whether it existed before. remaining is
+ * the number of body bytes still to be received, -1 for chunked bodies, which are
+ * decoded by dec. keep_alive is the keep-alive flag of the request.
+ */
+typedef struct upload {
+    int fd;
+    int dir_fd;
+    char tmp_name[64];
+    const char *name;
+    const char *file_path;
+    int exists;
+    int keep_alive;
+    int64_t remaining;
+    http_chunked_t dec;
+} upload_t;
+
+/**
+ * @brief Handle a PUT request.
+ * 
+ * @param conn Client connection.
+ * @param head_len Length of the head of the request.
+ * @param keep_alive Whether the connection may be kept open.
+ * @return int 1 if the connection should be kept open for further requests, 0 if
+ * it should be closed.
+ * 
+ * @details Streams the request body into a temporary file in the directory of the
+ * requested file and renames it to the requested file once the body is complete,
+ * so readers see either the old or the new file. Replies 201 if the file was 
+ * created and 204 if it was replaced. Bodies larger than upload_limit are rejected
+ * with 413 before they are read (if the length is announced) or as soon as the 
+ * limit is exceeded; clients expecting 100-continue only receive the interim 
+ * response if the upload is accepted. Removes the request head from the connection
+ * buffer; its parse results are invalid afterwards. If the body was not received 
+ * along with the head, the connection is left in CONN_BODY and the upload is
+ * continued by recv_body and finish_upload once the socket is readable.
+ * Global variables: upload_limit.
+ */
+int handle_upload(conn_t *conn, size_t head_len, int keep_alive);
+
+/**
+ * @brief Continue receiving the body of an upload.
+ * 
+ * @param conn Client connection with an upload, whose socket is readable.
+ * @return int 0 if the body was received, 1 if more of it has to be awaited, -1 if
+ * receiving from the client failed, -2 if the body exceeds upload_limit, -3 if the
+ * chunk framing is invalid and -4 if writing to the file failed.
+ * 
+ * @details A body with known length is moved from the socket to the file with a 
+ * single splice through the pipe of the worker, which does not block on a readable
+ * socket. Chunked bodies are decoded in the connection buffer, reading without
+ * blocking until no more data is available. Bytes of a pipelined request following
+ * the body are left in the buffer.
+ * Global variables: upload_limit, quit.
+ */
+int recv_body(conn_t *conn);
+
+/**
+ * @brief Complete an upload and reply to it.
+ * 
+ * @param conn Client connection with an upload.
+ * @param ret Result of receiving the body (see recv_body).
+ * @return int 1 if the connection should be kept open for further requests, 0 if
+ * it should be closed.
+ * 
+ * @details Renames the temporary file to the requested file if the body was
+ * received and removes it otherwise.
+ */
+int finish_upload(conn_t *conn, int ret);
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * @file uring.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the io_uring interface defined in uring.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details glibc has no wrappers for the io_uring system calls, they are invoked
+ * through syscall. The submission and completion queues are mapped together
+ * (IORING_FEAT_SINGLE_MMAP) and the positions shared with the kernel are accessed
+ * with the __atomic builtins of GCC. Waiting with a timeout uses
+ * IORING_ENTER_EXT_ARG, so no timeout operation has to be submitted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/**
+ * @brief Enter the kernel.
+ *
+ * @param ring Ring.
+ * @param submit Number of entries to submit.
+ * @param wait Minimum number of completions to wait for.
+ * @param timeout Maximum time to wait in milliseconds, -1 to wait without limit.
+ * @return int Number of submitted entries, or -1 on errors (errno is set).
+ */
+static int enter(uring_t *ring, unsigned int submit, unsigned int wait, int timeout);
+
+int uring_init(uring_t *ring, unsigned int entries) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    long fd = syscall(SYS_io_uring_setup, entries, &params);
+    if(fd < 0) {
+        return -1;
+    }
+    ring->fd = fd;
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        close(ring->fd);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->mem_len = sq_len > cq_len ? sq_len : cq_len;
+    ring->mem = mmap(NULL, ring->mem_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQ_RING);
+    if(ring->mem == MAP_FAILED) {
+        int err = errno;
+        close(ring->fd);
+        errno = err;
+        return -1;
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) {
+        int err = errno;
+        munmap(ring->mem, ring->mem_len);
+        close(ring->fd);
+        errno = err;
+        return -1;
+    }
+
+    char *mem = ring->mem;
+    ring->sq_head = (unsigned int *)(mem + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(mem + params.sq_off.tail);
+    ring->sq_array = (unsigned int *)(mem + params.sq_off.array);
+    ring->sq_mask = *(unsigned int *)(mem + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_tail_local = *ring->sq_tail;
+    ring->cq_head = (unsigned int *)(mem + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(mem + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(mem + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(mem + params.cq_off.cqes);
+    return 0;
+}
+
+void uring_destroy(uring_t *ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->mem, ring->mem_len);
+    close(ring->fd);
+}
+
+int uring_probe(uring_t *ring, int op) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if(probe == NULL) {
+        return 0;
+    }
+    int supported = 0;
+    if(syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 && op <= probe->last_op) {
+        supported = (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+    free(probe);
+    return supported;
+}
+
+int uring_register_buffers(uring_t *ring, const struct iovec *iov, unsigned int cnt) {
+    return syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, cnt) == 0 ? 0 : -1;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *ring) {
+    if(ring->sq_tail_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        // Make room by submitting the prepared entries
+        if(uring_enter(ring, 0, 0) != 0) {
+            return NULL;
+        }
+        if(ring->sq_tail_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    unsigned int idx = ring->sq_tail_local & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_tail_local++;
+    return sqe;
+}
+
+int uring_reserve(uring_t *ring, unsigned int cnt) {
+    if(ring->sq_tail_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) + cnt <= ring->sq_entries) {
+        return 0;
+    }
+    if(uring_enter(ring, 0, 0) != 0) {
+        return -1;
+    }
+    if(ring->sq_tail_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) + cnt > ring->sq_entries) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+int uring_enter(uring_t *ring, unsigned int wait, int timeout) {
+    // Publish the prepared entries to the kernel
+    __atomic_store_n(ring->sq_tail, ring->sq_tail_local, __ATOMIC_RELEASE);
+    unsigned int submit = ring->sq_tail_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if(submit == 0 && wait == 0) {
+        return 0;
+    }
+    return enter(ring, submit, wait, timeout) < 0 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_cqe(uring_t *ring) {
+    unsigned int head = *ring->cq_head;
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring) {
+    // The entry was read, the kernel may overwrite it
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static int enter(uring_t *ring, unsigned int submit, unsigned int wait, int timeout) {
+    struct __kernel_timespec ts = {timeout / 1000, (timeout % 1000) * 1000000LL};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = timeout >= 0 ? (uint64_t)(uintptr_t)&ts : 0;
+    unsigned int flags = IORING_ENTER_EXT_ARG | (wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+    long ret = syscall(SYS_io_uring_enter, ring->fd, submit, wait, flags, &arg, sizeof(arg));
+    if(ret < 0 && errno == ETIME) {
+        return 0;
+    }
+    return ret;
+}
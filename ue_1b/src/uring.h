@@ -0,0 +1,133 @@
+/**
+ * @file uring.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Minimal io_uring interface.
+ * @version 1.0
+ * @date 2026-10-18
+ * @details Sets up a ring with the raw system calls and hands out submission queue
+ * entries to be prepared by the caller with the definitions of linux/io_uring.h.
+ * Prepared entries are only published to the kernel by uring_enter, so all entries
+ * prepared while handling a batch of completions are submitted along with waiting
+ * for the next ones in a single system call. A ring is not thread safe; each thread
+ * should use its own ring.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * @brief A ring.
+ * @details fd is the file descriptor of the ring. The pointers refer to the shared
+ * ring memory mapped at mem (mem_len bytes) and the submission queue entries mapped
+ * at sqes. sq_tail_local is the tail including the prepared entries which are not
+ * published yet.
+ */
+typedef struct uring {
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_tail_local;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    void *mem;
+    size_t mem_len;
+    size_t sqes_len;
+} uring_t;
+
+/**
+ * @brief Set up a ring.
+ *
+ * @param ring Ring which should be initialized.
+ * @param entries Number of submission queue entries, rounded up to a power of 2.
+ * @return int 0 on success, -1 on errors (errno is set, EOPNOTSUPP if the kernel
+ * lacks a required feature).
+ */
+int uring_init(uring_t *ring, unsigned int entries);
+
+/**
+ * @brief Close a ring and unmap its memory.
+ *
+ * @param ring Ring.
+ */
+void uring_destroy(uring_t *ring);
+
+/**
+ * @brief Check whether the kernel supports an operation.
+ *
+ * @param ring Ring.
+ * @param op Operation (IORING_OP_*).
+ * @return int 1 if the operation is supported, 0 otherwise.
+ */
+int uring_probe(uring_t *ring, int op);
+
+/**
+ * @brief Register buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED.
+ *
+ * @param ring Ring.
+ * @param iov Buffers; the memory is pinned until the ring is closed.
+ * @param cnt Number of buffers.
+ * @return int 0 on success, -1 on errors (errno is set).
+ */
+int uring_register_buffers(uring_t *ring, const struct iovec *iov, unsigned int cnt);
+
+/**
+ * @brief Get a submission queue entry.
+ *
+ * @param ring Ring.
+ * @return struct io_uring_sqe* Zeroed entry which is submitted by the next call of
+ * uring_enter, NULL if the queue is full and submitting the prepared entries failed
+ * (errno is set).
+ */
+struct io_uring_sqe *uring_sqe(uring_t *ring);
+
+/**
+ * @brief Make sure a number of entries can be prepared without submitting in between.
+ *
+ * @param ring Ring.
+ * @param cnt Number of entries, at most the size of the submission queue.
+ * @return int 0 on success, -1 if submitting the prepared entries failed (errno is set).
+ *
+ * @details Needed for linked entries, as a chain ends with the last entry submitted
+ * by a call of uring_enter.
+ */
+int uring_reserve(uring_t *ring, unsigned int cnt);
+
+/**
+ * @brief Submit the prepared entries and wait for completions.
+ *
+ * @param ring Ring.
+ * @param wait Minimum number of completions to wait for, 0 to only submit.
+ * @param timeout Maximum time to wait in milliseconds, -1 to wait without limit.
+ * @return int 0 on success (also if the timeout expired), -1 on errors (errno is
+ * set, EINTR if a signal was caught).
+ */
+int uring_enter(uring_t *ring, unsigned int wait, int timeout);
+
+/**
+ * @brief Get the next completion.
+ *
+ * @param ring Ring.
+ * @return struct io_uring_cqe* Completion queue entry, valid until uring_cqe_seen
+ * is called; NULL if there is none.
+ */
+struct io_uring_cqe *uring_cqe(uring_t *ring);
+
+/**
+ * @brief Release the completion returned by uring_cqe.
+ *
+ * @param ring Ring.
+ */
+void uring_cqe_seen(uring_t *ring);
+
+#endif
@@ -0,0 +1,205 @@
+/**
+ * @file wheel.c
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Implementation of the timer wheel defined in wheel.h
+ * @version 1.0
+ * @date 2026-10-18
+ * @details A timer is stored at the lowest level l for which its expiration tick
+ * and the current tick only differ in the digits (of WHEEL_BITS bits each) up to
+ * digit l; its slot is digit l of the expiration tick. The slot of level l > 0 is
+ * therefore reached exactly when the current tick reaches the first tick whose
+ * digits up to l - 1 are zero, at which point its timers are linked again and
+ * end up on a lower level. Timers whose expiration tick differs in higher digits
+ * are kept in the overflow list, which is linked again whenever all digits of the
+ * current tick are zero.
+ */
+
+#include <string.h>
+#include <limits.h>
+
+#include "wheel.h"
+
+/**
+ * @brief Link a timer into the slot matching its expiration tick.
+ *
+ * @param wheel Wheel.
+ * @param timer Timer which is not linked, expires must not be before wheel->now.
+ */
+static void link_timer(wheel_t *wheel, wheel_timer_t *timer);
+
+/**
+ * @brief Link all timers of a list again.
+ *
+ * @param wheel Wheel.
+ * @param timer First timer of the list, which is no longer referenced by the wheel.
+ */
+static void relink_timers(wheel_t *wheel, wheel_timer_t *timer);
+
+/**
+ * @brief Find the first tick at which an occupied slot is reached.
+ *
+ * @param wheel Wheel with at least one armed timer.
+ * @return uint64_t Tick.
+ */
+static uint64_t next_tick(const wheel_t *wheel);
+
+void wheel_init(wheel_t *wheel, uint64_t now, uint64_t tick) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick = tick;
+    wheel->now = now / tick;
+}
+
+void wheel_timer_init(wheel_timer_t *timer) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void wheel_arm(wheel_t *wheel, wheel_timer_t *timer, uint64_t expires) {
+    wheel_cancel(wheel, timer);
+    // Round up, timers must not expire early
+    uint64_t tick = (expires + wheel->tick - 1) / wheel->tick;
+    timer->expires = tick < wheel->now ? wheel->now : tick;
+    link_timer(wheel, timer);
+    wheel->count++;
+}
+
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer) {
+    if(timer->pprev == NULL) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if(timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    if(timer->level < WHEEL_LEVELS && wheel->slots[timer->level][timer->slot] == NULL) {
+        wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel->count--;
+}
+
+wheel_timer_t *wheel_advance(wheel_t *wheel, uint64_t now) {
+    uint64_t target = now / wheel->tick;
+    wheel_timer_t *expired = NULL;
+    while(wheel->count > 0) {
+        uint64_t tick = next_tick(wheel);
+        if(tick > target) {
+            break;
+        }
+        wheel->now = tick;
+
+        // Move the timers of the reached slots of higher levels down, the highest level first
+        if((tick & (((uint64_t)1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1)) == 0) {
+            wheel_timer_t *timer = wheel->overflow;
+            wheel->overflow = NULL;
+            relink_timers(wheel, timer);
+        }
+        int level = 0;
+        while(level < WHEEL_LEVELS - 1 && (tick & (((uint64_t)1 << ((level + 1) * WHEEL_BITS)) - 1)) == 0) {
+            level++;
+        }
+        for(; level > 0; level--) {
+            int slot = (tick >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+            wheel_timer_t *timer = wheel->slots[level][slot];
+            wheel->slots[level][slot] = NULL;
+            wheel->occupied[level] &= ~((uint64_t)1 << slot);
+            relink_timers(wheel, timer);
+        }
+
+        int slot = tick & (WHEEL_SLOTS - 1);
+        wheel_timer_t *timer = wheel->slots[0][slot];
+        wheel->slots[0][slot] = NULL;
+        wheel->occupied[0] &= ~((uint64_t)1 << slot);
+        while(timer != NULL) {
+            wheel_timer_t *next = timer->next;
+            timer->pprev = NULL;
+            timer->next = expired;
+            expired = timer;
+            wheel->count--;
+            timer = next;
+        }
+        wheel->now = tick + 1;
+    }
+    // No slot is reached before the target, skip the empty ticks
+    if(wheel->now <= target) {
+        wheel->now = target + 1;
+    }
+    return expired;
+}
+
+int wheel_timeout(const wheel_t *wheel, uint64_t now) {
+    if(wheel->count == 0) {
+        return -1;
+    }
+    uint64_t at = next_tick(wheel) * wheel->tick;
+    if(at <= now) {
+        return 0;
+    }
+    uint64_t ms = (at - now + 999999) / 1000000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+static void link_timer(wheel_t *wheel, wheel_timer_t *timer) {
+    int level = 0;
+    while(level < WHEEL_LEVELS
+            && (timer->expires >> ((level + 1) * WHEEL_BITS)) != (wheel->now >> ((level + 1) * WHEEL_BITS))) {
+        level++;
+    }
+    int slot = 0;
+    wheel_timer_t **head = &wheel->overflow;
+    if(level < WHEEL_LEVELS) {
+        slot = (timer->expires >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+        head = &wheel->slots[level][slot];
+        wheel->occupied[level] |= (uint64_t)1 << slot;
+    }
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = *head;
+    if(*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void relink_timers(wheel_t *wheel, wheel_timer_t *timer) {
+    while(timer != NULL) {
+        wheel_timer_t *next = timer->next;
+        link_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+static uint64_t next_tick(const wheel_t *wheel) {
+    uint64_t best = UINT64_MAX;
+    if(wheel->overflow != NULL) {
+        // The overflow list is linked again when the range of the levels is left
+        int range = WHEEL_LEVELS * WHEEL_BITS;
+        uint64_t mask = ((uint64_t)1 << range) - 1;
+        best = (wheel->now & mask) == 0 ? wheel->now : ((wheel->now >> range) + 1) << range;
+    }
+    for(int level = 0; level < WHEEL_LEVELS; level++) {
+        if(wheel->occupied[level] == 0) {
+            continue;
+        }
+        int shift = level * WHEEL_BITS;
+        int digit = (wheel->now >> shift) & (WHEEL_SLOTS - 1);
+        // The slot of the current digit was already reached unless the lower digits are zero
+        int first = digit + ((wheel->now & (((uint64_t)1 << shift) - 1)) != 0);
+        if(first >= WHEEL_SLOTS) {
+            continue;
+        }
+        uint64_t mask = wheel->occupied[level] >> first << first;
+        if(mask == 0) {
+            continue;
+        }
+        uint64_t tick = (wheel->now >> (shift + WHEEL_BITS) << (shift + WHEEL_BITS))
+            | ((uint64_t)__builtin_ctzll(mask) << shift);
+        if(tick < best) {
+            best = tick;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file wheel.h
+ * @author Markus Klein (e11707252@student.tuwien.ac.at)
+ * @brief Hierarchical timer wheel.
+ * @details Timers are intrusive list nodes embedded in the objects they belong to.
+ * Time is divided into ticks; a timer is stored in a slot of the lowest level
+ * whose range covers its expiration tick, so arming and cancelling a timer only
+ * link and unlink a node. Advancing the wheel moves the timers of the reached
+ * slots of higher levels down to lower levels and returns the timers of the reached
+ * slots of the lowest level as a list, without visiting timers which did not
+ * expire. A bitmap per level records the occupied slots, so the time of the next
+ * expiration is found without scanning empty slots.
+ * The wheel is not thread safe; each thread should use its own wheel.
+ */
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of bits of a tick covered by each level.
+ */
+#define WHEEL_BITS 6
+
+/**
+ * @brief Number of slots of each level.
+ */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+/**
+ * @brief Number of levels.
+ * @details The levels cover 2^(WHEEL_BITS * WHEEL_LEVELS) ticks; timers expiring
+ * beyond the covered range are kept in an overflow list until it is reached.
+ */
+#define WHEEL_LEVELS 4
+
+/**
+ * @brief A timer.
+ * @details expires is the expiration tick. pprev points to the pointer referring
+ * to the timer, NULL if the timer is not armed. level and slot denote the list the
+ * timer is linked into (level WHEEL_LEVELS for the overflow list).
+ */
+typedef struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer **pprev;
+    uint64_t expires;
+    uint8_t level;
+    uint8_t slot;
+} wheel_timer_t;
+
+/**
+ * @brief A timer wheel.
+ * @details now is the next tick to be processed, tick the length of a tick in
+ * nanoseconds. count is the number of armed timers. Bit i of occupied[l] is set if
+ * slots[l][i] is not empty. overflow holds the timers beyond the range of the levels.
+ */
+typedef struct wheel {
+    uint64_t now;
+    uint64_t tick;
+    size_t count;
+    uint64_t occupied[WHEEL_LEVELS];
+    wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    wheel_timer_t *overflow;
+} wheel_t;
+
+/**
+ * @brief Initialize a wheel.
+ *
+ * @param wheel Wheel which should be initialized.
+ * @param now Current time (monotonic clock, in nanoseconds).
+ * @param tick Length of a tick in nanoseconds.
+ */
+void wheel_init(wheel_t *wheel, uint64_t now, uint64_t tick);
+
+/**
+ * @brief Initialize a timer as not armed.
+ *
+ * @param timer Timer.
+ */
+void wheel_timer_init(wheel_timer_t *timer);
+
+/**
+ * @brief Arm a timer, cancelling it first if it is armed.
+ *
+ * @param wheel Wheel.
+ * @param timer Timer.
+ * @param expires Expiration time (monotonic clock, in nanoseconds). Times in the
+ * past expire on the next call of wheel_advance.
+ */
+void wheel_arm(wheel_t *wheel, wheel_timer_t *timer, uint64_t expires);
+
+/**
+ * @brief Cancel a timer.
+ *
+ * @param wheel Wheel the timer was armed in.
+ * @param timer Timer, which may be not armed.
+ */
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer);
+
+/**
+ * @brief Advance the wheel to the current time.
+ *
+ * @param wheel Wheel.
+ * @param now Current time (monotonic clock, in nanoseconds).
+ * @return wheel_timer_t* List of the expired timers linked by next, NULL if none
+ * expired. The timers are not armed anymore and may be armed again.
+ */
+wheel_timer_t *wheel_advance(wheel_t *wheel, uint64_t now);
+
+/**
+ * @brief Compute the time until the wheel has to be advanced next.
+ *
+ * @param wheel Wheel.
+ * @param now Current time (monotonic clock, in nanoseconds).
+ * @return int Timeout in milliseconds for poll or epoll_wait, -1 if no timer is armed.
+ */
+int wheel_timeout(const wheel_t *wheel, uint64_t now);
+
+#endif